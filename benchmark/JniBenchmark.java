@@ -0,0 +1,13 @@
+/*-----------------------------------------------------------------------------
+ * Target object of the wrapper benchmarks (jni_wrapper_benchmark.cpp):
+ * the benchmarks access its fields from native code.
+ *
+ * Compile it with 'javac -d <dir> JniBenchmark.java', and pass <dir> to
+ * the benchmark as its class path.
+ *---------------------------------------------------------------------------*/
+
+public class JniBenchmark {
+   public int intField = 17;		   				// integer field
+   public long longField = 23;						// long field
+   public String stringField = "Hello, world!";	// String field
+}
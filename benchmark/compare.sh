@@ -0,0 +1,35 @@
+#!/bin/sh
+#------------------------------------------------------------------------------
+# Compares two benchmark result files (JSON, as written by jni_benchmark.h
+# with --benchmark_out), benchmark by benchmark:
+#
+#    benchmark/compare.sh baseline.json contender.json
+#
+# prints the real time per iteration of both, and the change (negative:
+# faster). Benchmarks missing from either file are skipped.
+#------------------------------------------------------------------------------
+
+if [ $# -ne 2 ]; then
+   echo "usage: $0 baseline.json contender.json" >&2
+   exit 2
+fi
+
+awk '
+   # The files have one key per line
+   /"name":/ { split($0, q, "\""); name = q[4] }
+   /"real_time":/ {
+      value = $2; sub(",", "", value)
+      if (FILENAME == ARGV[1]) { base[name] = value; order[n++] = name }
+      else new[name] = value
+   }
+   END {
+      printf "%-48s %12s %12s %8s\n", "Benchmark", "Baseline", "Contender", "Change"
+      for (i = 0; i < n; i++) {
+         name = order[i]
+         if (!(name in new) || base[name] == 0)
+            continue
+         printf "%-48s %9.1f ns %9.1f ns %+7.1f%%\n", name, base[name],
+                new[name], (new[name] - base[name]) * 100 / base[name]
+      }
+   }
+' "$1" "$2"
@@ -0,0 +1,457 @@
+/*-----------------------------------------------------------------------------
+ * A small micro-benchmark harness with an embedded Java VM.
+ *
+ * Benchmarks are written and registered in the style of Google Benchmark:
+ *
+ *    static void BM_RawGetIntField(JNIBenchmarkState &state) {
+ *       JNIEnv *env = state.env();
+ *       while (state.KeepRunning())
+ *          JNIDoNotOptimize(env->GetIntField(obj, id));
+ *    }
+ *    JNI_BENCHMARK(BM_RawGetIntField);
+ *    JNI_BENCHMARK(BM_ArrayAcquire)->Arg(16)->Arg(1 << 20);
+ *    JNI_BENCHMARK(BM_MonitorEnterExit)->Threads(1)->Threads(4);
+ *
+ * and run by JNIBenchmarkMain() once the Java VM exists:
+ *
+ *    int main(int argc, char *argv[]) {
+ *       JNIBenchmarkVM vm(argc, argv);
+ *       ...	// set up the objects used by the benchmarks
+ *       return JNIBenchmarkMain(vm.env(), argc, argv);
+ *    }
+ *
+ * Every benchmark runs on threads attached to the Java VM; state.env() is
+ * the JNIEnv of the running thread. The number of iterations is grown
+ * until a run lasts at least --benchmark_min_time seconds. With several
+ * threads, each thread runs all the iterations, and the threads start
+ * together.
+ *
+ * Options (compatible with Google Benchmark's, so that its tools/compare.py
+ * can compare two JSON result files):
+ *    --benchmark_filter=<regex>		run matching benchmarks only
+ *    --benchmark_min_time=<seconds>	(default 0.5)
+ *    --benchmark_format=<console|json>	output on stdout
+ *    --benchmark_out=<file>			also write JSON results to <file>
+ * and, handled by JNIBenchmarkVM:
+ *    --classpath=<path>	the Java class path (default: the value of the
+ *							JNI_BENCHMARK_CLASSPATH environment variable,
+ *							or JNI_BENCHMARK_DEFAULT_CLASSPATH)
+ *    -J<option>			a Java VM option (e.g. -J-Xmx2g)
+ *    --preload=<class>		a class to resolve during startup (e.g.
+ *							--preload=java/util/HashMap)
+ * If JNI_BENCHMARK_DEFAULT_LIBRARY_PATH is defined, it is passed to the Java
+ * VM as java.library.path (a -J-Djava.library.path option overrides it).
+ * The Java VM is a JNIVirtualMachine (jni_vm.h), whose startup() times
+ * are available through JNIBenchmarkVM::jvm().
+ *
+ * Linux only (thread CPU times are read through clock_gettime). Requires
+ * C++11, and the JDK's libjvm at link time.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_BENCHMARK_H_INCLUDED_
+#define _JNI_BENCHMARK_H_INCLUDED_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include <jni.h>
+
+#include "jni_master.h"
+
+#ifndef JNI_BENCHMARK_DEFAULT_CLASSPATH
+#define JNI_BENCHMARK_DEFAULT_CLASSPATH "."
+#endif
+
+// Prevents the compiler from optimizing 'value' away
+template<class T>
+inline void JNIDoNotOptimize(const T &value) {
+   asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class JNIBenchmarkState;
+typedef void (*JNIBenchmarkFunction)(JNIBenchmarkState &);
+
+/*-----------------------------------------------------------------------------
+ * JNIBenchmark: a registered benchmark and its argument and thread lists
+ *---------------------------------------------------------------------------*/
+class JNIBenchmark {
+   std::string _name;
+   JNIBenchmarkFunction _function;
+   std::vector<long> _args;
+   std::vector<int> _threads;
+
+public:
+   JNIBenchmark(const char *name, JNIBenchmarkFunction function) :
+      _name(name), _function(function) {}
+
+   JNIBenchmark *Arg(long arg) { _args.push_back(arg); return this; }
+   JNIBenchmark *Threads(int threads) {
+      _threads.push_back(threads);
+      return this;
+   }
+
+   const std::string &name() const { return _name; }
+   JNIBenchmarkFunction function() const { return _function; }
+   const std::vector<long> &args() const { return _args; }
+   const std::vector<int> &threads() const { return _threads; }
+
+   static std::vector<JNIBenchmark *> &registry() {
+      static std::vector<JNIBenchmark *> benchmarks;
+      return benchmarks;
+   }
+
+   static JNIBenchmark *add(const char *name, JNIBenchmarkFunction function) {
+      registry().push_back(new JNIBenchmark(name, function));
+      return registry().back();
+   }
+};
+
+#define JNI_BENCHMARK_CONCAT_(a, b) a##b
+#define JNI_BENCHMARK_CONCAT(a, b) JNI_BENCHMARK_CONCAT_(a, b)
+
+#define JNI_BENCHMARK(function)											\
+   static JNIBenchmark *JNI_BENCHMARK_CONCAT(_jniBenchmark, __LINE__) =	\
+      JNIBenchmark::add(#function, function)
+
+/*-----------------------------------------------------------------------------
+ * JNIBenchmarkState: the state of one thread running a benchmark
+ *---------------------------------------------------------------------------*/
+class JNIBenchmarkState {
+public:
+   // Start barrier and timing shared by the threads of a run
+   struct Run {
+      std::mutex lock;
+      std::condition_variable ready;
+      int waiting;
+      int threads;
+      std::chrono::steady_clock::time_point start;
+      std::chrono::steady_clock::time_point end;
+      double cpuSeconds;
+      long bytes;
+      long items;
+
+      explicit Run(int n) :
+         waiting(n), threads(n), cpuSeconds(0), bytes(0), items(0) {}
+   };
+
+private:
+   JNIEnv *_env;
+   long _arg;
+   int _threadIndex;
+   long _iterations;
+   long _remaining;
+   bool _started;
+   double _cpuStart;
+   long _bytes;
+   long _items;
+   Run &_run;
+
+public:
+   JNIBenchmarkState(JNIEnv *env, long arg, int threadIndex, long iterations,
+                     Run &run) :
+      _env(env), _arg(arg), _threadIndex(threadIndex),
+      _iterations(iterations), _remaining(iterations), _started(false),
+      _cpuStart(0), _bytes(0), _items(0), _run(run) {}
+
+   // The processed bytes and items may be set after the loop
+   ~JNIBenchmarkState() {
+      std::lock_guard<std::mutex> guard(_run.lock);
+      _run.bytes += _bytes;
+      _run.items += _items;
+   }
+
+   JNIEnv *env() const { return _env; }
+   long range(int = 0) const { return _arg; }
+   int threads() const { return _run.threads; }
+   int thread_index() const { return _threadIndex; }
+   long iterations() const { return _iterations; }
+
+   void SetBytesProcessed(long bytes) { _bytes = bytes; }
+   void SetItemsProcessed(long items) { _items = items; }
+
+   bool KeepRunning() {
+      if (!_started) {
+         start();
+         _started = true;
+      }
+      if (_remaining-- > 0)
+         return true;
+      stop();
+      return false;
+   }
+
+   static double threadCpuSeconds() {
+      struct timespec ts;
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+      return ts.tv_sec + ts.tv_nsec * 1e-9;
+   }
+
+private:
+   // All the threads start timing together
+   void start() {
+      std::unique_lock<std::mutex> guard(_run.lock);
+      if (--_run.waiting == 0) {
+         _run.start = std::chrono::steady_clock::now();
+         _run.ready.notify_all();
+      }
+      else
+         _run.ready.wait(guard, [this] { return _run.waiting == 0; });
+      _cpuStart = threadCpuSeconds();
+   }
+
+   void stop() {
+      double cpu = threadCpuSeconds() - _cpuStart;
+      std::chrono::steady_clock::time_point now =
+         std::chrono::steady_clock::now();
+      std::lock_guard<std::mutex> guard(_run.lock);
+      if (now > _run.end)
+         _run.end = now;
+      _run.cpuSeconds += cpu;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIBenchmarkVM: the embedded Java VM
+ *---------------------------------------------------------------------------*/
+class JNIBenchmarkVM {
+   JNIVirtualMachine _jvm;
+
+   static JNIVirtualMachineOptions options(int argc, char *argv[]) {
+      const char *path = getenv("JNI_BENCHMARK_CLASSPATH");
+      std::string classPath =
+         (path != 0) ? path : JNI_BENCHMARK_DEFAULT_CLASSPATH;
+      JNIVirtualMachineOptions options;
+#ifdef JNI_BENCHMARK_DEFAULT_LIBRARY_PATH
+      options.libraryPath(JNI_BENCHMARK_DEFAULT_LIBRARY_PATH);
+#endif
+      for (int i = 1; i < argc; i++) {
+         if (strncmp(argv[i], "--classpath=", 12) == 0)
+            classPath = argv[i] + 12;
+         else if (strncmp(argv[i], "-J", 2) == 0)
+            options.option(argv[i] + 2);
+         else if (strncmp(argv[i], "--preload=", 10) == 0)
+            options.preload(argv[i] + 10);
+      }
+      return options.classPath(classPath);
+   }
+
+public:
+   JNIBenchmarkVM(int argc, char *argv[]) : _jvm(options(argc, argv)) {}
+
+   JavaVM *vm() const { return _jvm.vm(); }
+   JNIEnv *env() const { return _jvm.env(); }
+   JNIVirtualMachine &jvm() { return _jvm; }
+};
+
+/*-----------------------------------------------------------------------------
+ * Running and reporting
+ *---------------------------------------------------------------------------*/
+struct JNIBenchmarkResult {
+   std::string name;
+   long iterations;
+   int threads;
+   double realNanos;		// per iteration
+   double cpuNanos;		// per iteration, over all threads
+   double bytesPerSecond;
+   double itemsPerSecond;
+};
+
+// Runs 'function' with 'iterations' on 'threads' threads; the first
+// thread is the calling one. Returns the run's wall time in seconds.
+inline double JNIBenchmarkRun(JNIEnv *env, JNIBenchmarkFunction function,
+                              long arg, int threads, long iterations,
+                              JNIBenchmarkState::Run &run) {
+   JavaVM *vm;
+   env->GetJavaVM(&vm);
+   std::vector<std::thread> workers;
+   for (int t = 1; t < threads; t++)
+      workers.push_back(std::thread([=, &run] {
+         JNIEnvironment attached(vm);
+         JNIBenchmarkState state(attached.Get(), arg, t, iterations, run);
+         function(state);
+      }));
+   JNIBenchmarkState state(env, arg, 0, iterations, run);
+   function(state);
+   for (size_t t = 0; t < workers.size(); t++)
+      workers[t].join();
+   return std::chrono::duration<double>(run.end - run.start).count();
+}
+
+inline JNIBenchmarkResult JNIBenchmarkMeasure(JNIEnv *env,
+                                              const std::string &name,
+                                              JNIBenchmarkFunction function,
+                                              long arg, int threads,
+                                              double minTime) {
+   long iterations = 1;
+   for (;;) {
+      JNIBenchmarkState::Run run(threads);
+      double seconds = JNIBenchmarkRun(env, function, arg, threads,
+                                       iterations, run);
+      if (seconds >= minTime || iterations >= 1000000000L) {
+         JNIBenchmarkResult r;
+         r.name = name;
+         r.iterations = iterations;
+         r.threads = threads;
+         r.realNanos = seconds * 1e9 / iterations;
+         r.cpuNanos = run.cpuSeconds * 1e9 / iterations / threads;
+         r.bytesPerSecond = run.bytes / seconds;
+         r.itemsPerSecond = run.items / seconds;
+         return r;
+      }
+      // Aim 40% past the minimum time, growing by 10x at most
+      double scale = (seconds > 0) ? minTime * 1.4 / seconds : 10;
+      long next = static_cast<long>(iterations * std::min(scale, 10.0));
+      iterations = std::max(next, iterations + 1);
+   }
+}
+
+inline std::string JNIBenchmarkEscape(const std::string &s) {
+   std::string out;
+   for (size_t i = 0; i < s.size(); i++) {
+      if (s[i] == '"' || s[i] == '\\')
+         out += '\\';
+      out += s[i];
+   }
+   return out;
+}
+
+inline void JNIBenchmarkWriteJSON(std::ostream &out, JNIEnv *env,
+                                  const std::vector<JNIBenchmarkResult> &rs) {
+   char date[64];
+   time_t now = time(0);
+   strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+   char host[256] = "";
+   gethostname(host, sizeof(host) - 1);
+   std::string java;
+   {
+      JNIClass system(env, "java/lang/System");
+      jmethodID getProperty = env->GetStaticMethodID(system, "getProperty",
+         "(Ljava/lang/String;)Ljava/lang/String;");
+      jstring key = env->NewStringUTF("java.vm.version");
+      jstring value = static_cast<jstring>(
+         env->CallStaticObjectMethod(system, getProperty, key));
+      if (value != 0)
+         java = JNIStringUTFChars(env, value).asString();
+      env->DeleteLocalRef(key);
+      env->DeleteLocalRef(value);
+   }
+
+   out << "{\n  \"context\": {\n"
+       << "    \"date\": \"" << date << "\",\n"
+       << "    \"host_name\": \"" << JNIBenchmarkEscape(host) << "\",\n"
+       << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+       << "    \"java_vm_version\": \"" << JNIBenchmarkEscape(java) << "\",\n"
+#ifdef NDEBUG
+       << "    \"library_build_type\": \"release\"\n"
+#else
+       << "    \"library_build_type\": \"debug\"\n"
+#endif
+       << "  },\n  \"benchmarks\": [";
+   for (size_t i = 0; i < rs.size(); i++) {
+      const JNIBenchmarkResult &r = rs[i];
+      out << (i ? "," : "") << "\n    {\n"
+          << "      \"name\": \"" << JNIBenchmarkEscape(r.name) << "\",\n"
+          << "      \"run_name\": \"" << JNIBenchmarkEscape(r.name) << "\",\n"
+          << "      \"run_type\": \"iteration\",\n"
+          << "      \"iterations\": " << r.iterations << ",\n"
+          << "      \"threads\": " << r.threads << ",\n"
+          << "      \"real_time\": " << r.realNanos << ",\n"
+          << "      \"cpu_time\": " << r.cpuNanos << ",\n";
+      if (r.bytesPerSecond > 0)
+         out << "      \"bytes_per_second\": " << r.bytesPerSecond << ",\n";
+      if (r.itemsPerSecond > 0)
+         out << "      \"items_per_second\": " << r.itemsPerSecond << ",\n";
+      out << "      \"time_unit\": \"ns\"\n    }";
+   }
+   out << "\n  ]\n}\n";
+}
+
+inline void JNIBenchmarkWriteConsole(const JNIBenchmarkResult &r) {
+   printf("%-48s %12.1f ns %12.1f ns %12ld", r.name.c_str(), r.realNanos,
+          r.cpuNanos, r.iterations);
+   if (r.bytesPerSecond > 0)
+      printf(" %10.1f MB/s", r.bytesPerSecond / 1e6);
+   printf("\n");
+   fflush(stdout);
+}
+
+// Runs the registered benchmarks selected by the command line
+inline int JNIBenchmarkMain(JNIEnv *env, int argc, char *argv[]) {
+   std::string filter = ".";
+   std::string format = "console";
+   std::string outFile;
+   double minTime = 0.5;
+   for (int i = 1; i < argc; i++) {
+      std::string a = argv[i];
+      if (a.compare(0, 19, "--benchmark_filter=") == 0)
+         filter = a.substr(19);
+      else if (a.compare(0, 21, "--benchmark_min_time=") == 0)
+         minTime = atof(a.c_str() + 21);
+      else if (a.compare(0, 19, "--benchmark_format=") == 0)
+         format = a.substr(19);
+      else if (a.compare(0, 16, "--benchmark_out=") == 0)
+         outFile = a.substr(16);
+   }
+   std::regex selected(filter);
+   bool console = (format != "json");
+
+   if (console)
+      printf("%-48s %15s %15s %12s\n", "Benchmark", "Time", "CPU",
+             "Iterations");
+   std::vector<JNIBenchmarkResult> results;
+   std::vector<JNIBenchmark *> &benchmarks = JNIBenchmark::registry();
+   for (size_t b = 0; b < benchmarks.size(); b++) {
+      const JNIBenchmark &bm = *benchmarks[b];
+      std::vector<long> args = bm.args();
+      std::vector<int> threads = bm.threads();
+      if (args.empty())
+         args.push_back(0);
+      if (threads.empty())
+         threads.push_back(1);
+      for (size_t a = 0; a < args.size(); a++)
+         for (size_t t = 0; t < threads.size(); t++) {
+            std::ostringstream name;
+            name << bm.name();
+            if (!bm.args().empty())
+               name << '/' << args[a];
+            if (!bm.threads().empty())
+               name << "/threads:" << threads[t];
+            if (!std::regex_search(name.str(), selected))
+               continue;
+            results.push_back(JNIBenchmarkMeasure(env, name.str(),
+               bm.function(), args[a], threads[t], minTime));
+            if (console)
+               JNIBenchmarkWriteConsole(results.back());
+         }
+   }
+
+   if (!console)
+      JNIBenchmarkWriteJSON(std::cout, env, results);
+   if (!outFile.empty()) {
+      std::ofstream out(outFile.c_str());
+      JNIBenchmarkWriteJSON(out, env, results);
+      if (!out) {
+         fprintf(stderr, "Failed to write %s\n", outFile.c_str());
+         return 1;
+      }
+   }
+   return 0;
+}
+
+#endif /* _JNI_BENCHMARK_H_INCLUDED_ */
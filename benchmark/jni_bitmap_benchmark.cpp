@@ -0,0 +1,360 @@
+/*-----------------------------------------------------------------------------
+ * Benchmark: the Bitmap kernels (jni_bitmap.h) against raw pixel loops.
+ *
+ * Bitmaps are host mocks (mock/android/bitmap.h), locked through
+ * JNIAndroidBitmap in an embedded Java VM, as a native method would:
+ * - JNIAndroidBitmap lock/unlock
+ * - premultiply and RGBA_8888 -> RGB_565 conversion, paired with the
+ *   loops a native method typically writes over the raw 'void *'
+ * - box blur and bilinear resize (to half size)
+ * The kernels are also timed with their rows split across a JNIThreadPool
+ * (..._Pool). The argument is the width and height of the bitmaps.
+ *
+ * Frames of several 64x64 Bitmaps (the argument is their number) are
+ * locked and unlocked with one JNIAndroidBitmap each, and with a
+ * JNIBitmapBatch, without and with a JNIBitmapInfoCache. These bitmaps
+ * are backed by Java objects, which the cache hashes by identity.
+ * Staging buffers of a frame's size are allocated with malloc, and taken
+ * from a JNIBitmapBufferPool.
+ *
+ * Before the benchmarks run, the vectorized kernels are checked against
+ * the scalar ones at every instruction set level supported by the
+ * processor; a mismatch fails the run.
+ *
+ * See jni_benchmark.h for the options (no class path is needed).
+ *---------------------------------------------------------------------------*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <jni.h>
+
+#include "jni_benchmark.h"
+#include "jni_bitmap.h"
+#include "jni_bitmap_batch.h"
+
+using namespace std;
+
+typedef JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_8888> RGBA8888View;
+typedef JNIBitmapView<ANDROID_BITMAP_FORMAT_RGB_565> RGB565View;
+
+/*-----------------------------------------------------------------------------
+ * Bitmaps of each benchmarked size (created on first use), and the pool
+ *---------------------------------------------------------------------------*/
+struct Images {
+   JNIMockBitmap rgba;
+   JNIMockBitmap rgb565;
+   JNIMockBitmap blurred;
+   JNIMockBitmap half;
+
+   explicit Images(uint32_t side) :
+      rgba(side, side, ANDROID_BITMAP_FORMAT_RGBA_8888),
+      rgb565(side, side, ANDROID_BITMAP_FORMAT_RGB_565),
+      blurred(side, side, ANDROID_BITMAP_FORMAT_RGBA_8888),
+      half(side / 2, side / 2, ANDROID_BITMAP_FORMAT_RGBA_8888) {
+      unsigned char *p = static_cast<unsigned char *>(rgba.pixels());
+      for (size_t i = 0; i < size_t(rgba.info().stride) * side; i++)
+         p[i] = static_cast<unsigned char>(rand());
+   }
+};
+
+struct Fixture {
+   enum { frameBitmaps = 32 };
+
+   JNIThreadPool pool;
+   map<long, unique_ptr<Images> > images;
+   vector<unique_ptr<JNIMockBitmap> > frame;	// backed by Java objects
+   JNIBitmapInfoCache infos;
+   JNIBitmapBufferPool buffers;
+
+   explicit Fixture(JNIEnv *env) : pool(static_cast<JavaVM *>(0)) {
+      for (int i = 0; i < frameBitmaps; i++)
+         frame.push_back(unique_ptr<JNIMockBitmap>(new JNIMockBitmap(env,
+            64, 64, ANDROID_BITMAP_FORMAT_RGBA_8888)));
+   }
+
+   Images &at(long side) {
+      unique_ptr<Images> &i = images[side];
+      if (!i)
+         i.reset(new Images(static_cast<uint32_t>(side)));
+      return *i;
+   }
+};
+
+static Fixture *fixture;
+
+#define SIDES ->Arg(256)->Arg(1024)
+
+/*-----------------------------------------------------------------------------
+ * Locking
+ *---------------------------------------------------------------------------*/
+static void BM_JNIAndroidBitmap_Lock(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jobject bitmap = fixture->at(256).rgba.object();
+   while (state.KeepRunning()) {
+      JNIAndroidBitmap pixels(env, bitmap);
+      JNIDoNotOptimize(pixels.data());
+   }
+}
+JNI_BENCHMARK(BM_JNIAndroidBitmap_Lock);
+
+/*-----------------------------------------------------------------------------
+ * Premultiply (in place: the timing does not depend on the pixel values)
+ *---------------------------------------------------------------------------*/
+static void BM_RawPremultiply(JNIBenchmarkState &state) {
+   Images &images = fixture->at(state.range(0));
+   JNIAndroidBitmap bitmap(state.env(), images.rgba.object());
+   while (state.KeepRunning()) {
+      for (uint32_t y = 0; y < bitmap.height(); y++) {
+         uint8_t *p = static_cast<uint8_t *>(bitmap.data()) +
+                      size_t(y) * bitmap.stride();
+         for (uint32_t x = 0; x < bitmap.width(); x++, p += 4)
+            for (int c = 0; c < 3; c++)
+               p[c] = static_cast<uint8_t>((p[c] * p[3] + 127) / 255);
+      }
+      JNIDoNotOptimize(bitmap.data());
+   }
+   state.SetBytesProcessed(state.iterations() * state.range(0) *
+                           state.range(0) * 4);
+}
+JNI_BENCHMARK(BM_RawPremultiply) SIDES;
+
+static void BM_JNIBitmapPremultiply(JNIBenchmarkState &state) {
+   Images &images = fixture->at(state.range(0));
+   JNIAndroidBitmap bitmap(state.env(), images.rgba.object());
+   RGBA8888View pixels(bitmap);
+   while (state.KeepRunning()) {
+      JNIBitmapKernels::premultiply(pixels);
+      JNIDoNotOptimize(bitmap.data());
+   }
+   state.SetBytesProcessed(state.iterations() * state.range(0) *
+                           state.range(0) * 4);
+}
+JNI_BENCHMARK(BM_JNIBitmapPremultiply) SIDES;
+
+static void BM_JNIBitmapPremultiply_Pool(JNIBenchmarkState &state) {
+   Images &images = fixture->at(state.range(0));
+   JNIAndroidBitmap bitmap(state.env(), images.rgba.object());
+   RGBA8888View pixels(bitmap);
+   while (state.KeepRunning())
+      JNIBitmapKernels::premultiply(pixels, &fixture->pool);
+   state.SetBytesProcessed(state.iterations() * state.range(0) *
+                           state.range(0) * 4);
+}
+JNI_BENCHMARK(BM_JNIBitmapPremultiply_Pool) SIDES;
+
+/*-----------------------------------------------------------------------------
+ * RGBA_8888 -> RGB_565
+ *---------------------------------------------------------------------------*/
+static void BM_RawConvert565(JNIBenchmarkState &state) {
+   Images &images = fixture->at(state.range(0));
+   JNIAndroidBitmap src(state.env(), images.rgba.object());
+   JNIAndroidBitmap dst(state.env(), images.rgb565.object());
+   while (state.KeepRunning()) {
+      for (uint32_t y = 0; y < src.height(); y++) {
+         const uint8_t *s = static_cast<uint8_t *>(src.data()) +
+                            size_t(y) * src.stride();
+         uint16_t *d = reinterpret_cast<uint16_t *>(
+            static_cast<uint8_t *>(dst.data()) + size_t(y) * dst.stride());
+         for (uint32_t x = 0; x < src.width(); x++, s += 4)
+            d[x] = static_cast<uint16_t>((s[0] * 31 + 127) / 255 << 11 |
+                                         (s[1] * 63 + 127) / 255 << 5 |
+                                         (s[2] * 31 + 127) / 255);
+      }
+      JNIDoNotOptimize(dst.data());
+   }
+   state.SetBytesProcessed(state.iterations() * state.range(0) *
+                           state.range(0) * 4);
+}
+JNI_BENCHMARK(BM_RawConvert565) SIDES;
+
+static void BM_JNIBitmapConvert565(JNIBenchmarkState &state) {
+   Images &images = fixture->at(state.range(0));
+   JNIAndroidBitmap src(state.env(), images.rgba.object());
+   JNIAndroidBitmap dst(state.env(), images.rgb565.object());
+   RGBA8888View from(src);
+   RGB565View to(dst);
+   while (state.KeepRunning()) {
+      JNIBitmapKernels::convert(from, to);
+      JNIDoNotOptimize(dst.data());
+   }
+   state.SetBytesProcessed(state.iterations() * state.range(0) *
+                           state.range(0) * 4);
+}
+JNI_BENCHMARK(BM_JNIBitmapConvert565) SIDES;
+
+/*-----------------------------------------------------------------------------
+ * Blur (radius 4) and resize
+ *---------------------------------------------------------------------------*/
+static void blur(JNIBenchmarkState &state, JNIThreadPool *pool) {
+   Images &images = fixture->at(state.range(0));
+   JNIAndroidBitmap src(state.env(), images.rgba.object());
+   JNIAndroidBitmap dst(state.env(), images.blurred.object());
+   RGBA8888View from(src), to(dst);
+   while (state.KeepRunning())
+      JNIBitmapKernels::blur(from, to, 4, pool);
+   state.SetItemsProcessed(state.iterations() * state.range(0) *
+                           state.range(0));
+}
+
+static void BM_JNIBitmapBlur(JNIBenchmarkState &state) {
+   blur(state, 0);
+}
+JNI_BENCHMARK(BM_JNIBitmapBlur) SIDES;
+
+static void BM_JNIBitmapBlur_Pool(JNIBenchmarkState &state) {
+   blur(state, &fixture->pool);
+}
+JNI_BENCHMARK(BM_JNIBitmapBlur_Pool) SIDES;
+
+static void resize(JNIBenchmarkState &state, JNIThreadPool *pool) {
+   Images &images = fixture->at(state.range(0));
+   JNIAndroidBitmap src(state.env(), images.rgba.object());
+   JNIAndroidBitmap dst(state.env(), images.half.object());
+   RGBA8888View from(src), to(dst);
+   while (state.KeepRunning())
+      JNIBitmapKernels::resize(from, to, JNI_BITMAP_BILINEAR, pool);
+   state.SetItemsProcessed(state.iterations() * state.range(0) *
+                           state.range(0) / 4);
+}
+
+static void BM_JNIBitmapResize(JNIBenchmarkState &state) {
+   resize(state, 0);
+}
+JNI_BENCHMARK(BM_JNIBitmapResize) SIDES;
+
+static void BM_JNIBitmapResize_Pool(JNIBenchmarkState &state) {
+   resize(state, &fixture->pool);
+}
+JNI_BENCHMARK(BM_JNIBitmapResize_Pool) SIDES;
+
+/*-----------------------------------------------------------------------------
+ * Frames: locking several Bitmaps, and staging buffers
+ *---------------------------------------------------------------------------*/
+#define FRAME_BITMAPS ->Arg(8)->Arg(Fixture::frameBitmaps)
+
+static void BM_JNIAndroidBitmap_LockFrame(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   vector<unique_ptr<JNIAndroidBitmap> > locked(state.range(0));
+   while (state.KeepRunning()) {
+      for (long i = 0; i < state.range(0); i++)
+         locked[i].reset(
+            new JNIAndroidBitmap(env, fixture->frame[i]->object()));
+      for (long i = state.range(0) - 1; i >= 0; i--)
+         locked[i].reset();
+   }
+   state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+JNI_BENCHMARK(BM_JNIAndroidBitmap_LockFrame) FRAME_BITMAPS;
+
+static void lockFrame(JNIBenchmarkState &state, JNIBitmapInfoCache *cache) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      JNIBitmapBatch batch(env, cache);
+      for (long i = 0; i < state.range(0); i++)
+         batch.lock(fixture->frame[i]->object());
+      JNIDoNotOptimize(batch.pixels(0));
+   }
+   state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_JNIBitmapBatch_LockFrame(JNIBenchmarkState &state) {
+   lockFrame(state, 0);
+}
+JNI_BENCHMARK(BM_JNIBitmapBatch_LockFrame) FRAME_BITMAPS;
+
+static void BM_JNIBitmapBatch_LockFrame_Cached(JNIBenchmarkState &state) {
+   lockFrame(state, &fixture->infos);
+}
+JNI_BENCHMARK(BM_JNIBitmapBatch_LockFrame_Cached) FRAME_BITMAPS;
+
+static void BM_RawStagingBuffer(JNIBenchmarkState &state) {
+   const AndroidBitmapInfo &info = fixture->at(state.range(0)).rgba.info();
+   while (state.KeepRunning()) {
+      void *buffer = malloc(size_t(info.stride) * info.height);
+      JNIDoNotOptimize(buffer);
+      free(buffer);
+   }
+}
+JNI_BENCHMARK(BM_RawStagingBuffer) SIDES;
+
+static void BM_JNIBitmapBufferPool(JNIBenchmarkState &state) {
+   const AndroidBitmapInfo &info = fixture->at(state.range(0)).rgba.info();
+   while (state.KeepRunning()) {
+      JNIBitmapBuffer buffer = fixture->buffers.acquire(info);
+      JNIDoNotOptimize(buffer.data());
+   }
+}
+JNI_BENCHMARK(BM_JNIBitmapBufferPool) SIDES;
+
+/*-----------------------------------------------------------------------------
+ * Vectorized kernels against the scalar ones, at every supported level
+ *---------------------------------------------------------------------------*/
+static bool verify() {
+   const uint32_t w = 333, h = 17;	// rows are not multiples of the lanes
+   vector<JNIRGBA8888> rgba(w * h), expected(w * h), actual(w * h);
+   vector<uint16_t> rgb565(w * h), packed(w * h);
+   vector<uint8_t> alpha(w * h);
+   for (size_t i = 0; i < rgba.size(); i++) {
+      uint32_t r = static_cast<uint32_t>(rand());
+      memcpy(&rgba[i], &r, sizeof(r));
+      rgb565[i] = static_cast<uint16_t>(rand());
+   }
+   RGBA8888View rgbaView(&rgba[0], w, h, w * 4);
+   RGBA8888View actualView(&actual[0], w, h, w * 4);
+
+   JNIKernelLevel supported = JNIKernels::level();
+   bool ok = true;
+   for (int level = JNI_KERNELS_SCALAR; level <= supported; level++) {
+      JNIKernels::setLevel(static_cast<JNIKernelLevel>(level));
+
+      expected = rgba;
+      JNIBitmapScalar::premultiply(&expected[0], expected.size());
+      actual = rgba;
+      JNIBitmapKernels::premultiply(actualView, &fixture->pool, 1);
+      bool premultiply = memcmp(&expected[0], &actual[0], w * h * 4) == 0;
+
+      JNIBitmapScalar::unpack565(&rgb565[0], &expected[0], expected.size());
+      JNIBitmapKernels::convert(RGB565View(&rgb565[0], w, h, w * 2),
+                                actualView);
+      bool unpack = memcmp(&expected[0], &actual[0], w * h * 4) == 0;
+
+      JNIBitmapKernels::convert(rgbaView, RGB565View(&packed[0], w, h, w * 2));
+      JNIBitmapScalar::pack565(&rgba[0], &rgb565[0], rgb565.size());
+      bool pack = packed == rgb565;
+
+      JNIBitmapKernels::convert(rgbaView,
+         JNIBitmapView<ANDROID_BITMAP_FORMAT_A_8>(&alpha[0], w, h, w));
+      bool extract = true;
+      for (size_t i = 0; i < alpha.size(); i++)
+         extract = extract && alpha[i] == rgba[i].a;
+
+      if (!(premultiply && unpack && pack && extract)) {
+         fprintf(stderr, "Bitmap kernels differ from the scalar ones at "
+                 "level %s\n",
+                 JNIKernels::levelName(static_cast<JNIKernelLevel>(level)));
+         ok = false;
+      }
+   }
+   JNIKernels::setLevel(supported);
+   return ok;
+}
+
+int main(int argc, char *argv[]) {
+   try {
+      JNIBenchmarkVM vm(argc, argv);
+      Fixture shared(vm.env());
+      fixture = &shared;
+      if (!verify())
+         return 1;
+      return JNIBenchmarkMain(vm.env(), argc, argv);
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
@@ -0,0 +1,165 @@
+/*-----------------------------------------------------------------------------
+ * Benchmark: the native methods of the example libraries.
+ *
+ * The example classes (JniExample, JniComplexExample) are loaded in an
+ * embedded Java VM, and their native methods are called through JNI, as
+ * Java code would call them:
+ * - JniExample.native_call: field lookups and access, a static String
+ *   field, and a JNIArray (its console output is discarded while timed)
+ * - JniComplexExample.register_object: SampleContainer::insert, i.e. a
+ *   JNIMonitor, a JNIStringUTFChars and a JNIGlobalRef per object, on one
+ *   and several threads
+ *
+ * These are representative workloads of libraries built on the templates,
+ * and serve as the training run of the profile-guided optimization
+ * workflow (see pgo.sh).
+ *
+ * The class path must contain the compiled example classes, and
+ * java.library.path the example libraries:
+ *
+ *    jni_example_benchmark --classpath=<classes> \
+ *       -J-Djava.library.path=<libraries> --benchmark_out=results.json
+ *
+ * (the CMake build sets both by default). See jni_benchmark.h for the
+ * other options.
+ *---------------------------------------------------------------------------*/
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <jni.h>
+
+#include "jni_benchmark.h"
+
+using namespace std;
+
+/*-----------------------------------------------------------------------------
+ * Objects shared by the benchmarks (global references, created once)
+ *---------------------------------------------------------------------------*/
+struct Fixture {
+   enum { objects = 1024 };
+
+   JNIEnv *env;
+   jclass example;
+   jmethodID nativeCall;
+   jobject exampleObject;
+   jclass complexExample;
+   jmethodID registerObject;
+   vector<jobject> namesWithInfo;
+
+   explicit Fixture(JNIEnv *env) : env(env) {
+      example = static_cast<jclass>(global(findClass("JniExample")));
+      nativeCall = env->GetStaticMethodID(example, "native_call",
+                                          "(LJniExample;)V");
+      exampleObject = global(env->NewObject(example,
+         env->GetMethodID(example, "<init>", "()V")));
+
+      complexExample =
+         static_cast<jclass>(global(findClass("JniComplexExample")));
+      registerObject = env->GetStaticMethodID(complexExample,
+         "register_object", "(LNameWithInfo;)V");
+      jmethodID init = env->GetStaticMethodID(complexExample,
+         "init_native_resources", "()V");
+      if (nativeCall == 0 || registerObject == 0 || init == 0)
+         throw JNIException("Native methods of the examples not found");
+      env->CallStaticVoidMethod(complexExample, init);
+      check();
+
+      // Objects to insert, with random names
+      jclass nameWithInfo = findClass("NameWithInfo");
+      jmethodID ctor = env->GetMethodID(nameWithInfo, "<init>",
+         "(Ljava/lang/String;Ljava/lang/String;I)V");
+      for (int i = 0; i < objects; i++) {
+         char name[16];
+         snprintf(name, sizeof(name), "%08x", rand());
+         jstring jname = env->NewStringUTF(name);
+         namesWithInfo.push_back(
+            global(env->NewObject(nameWithInfo, ctor, jname, jname, 0)));
+         env->DeleteLocalRef(jname);
+      }
+      env->DeleteLocalRef(nameWithInfo);
+   }
+
+   ~Fixture() {
+      env->DeleteGlobalRef(example);
+      env->DeleteGlobalRef(exampleObject);
+      env->DeleteGlobalRef(complexExample);
+      for (size_t i = 0; i < namesWithInfo.size(); i++)
+         env->DeleteGlobalRef(namesWithInfo[i]);
+   }
+
+   // Java exceptions thrown by the native methods
+   void check() {
+      if (env->ExceptionCheck()) {
+         env->ExceptionDescribe();
+         env->ExceptionClear();
+         throw JNIException("Java exception in a native method");
+      }
+   }
+
+private:
+   jclass findClass(const char *name) {
+      jclass clazz = env->FindClass(name);
+      if (clazz == 0) {
+         env->ExceptionClear();
+         throw JNIException(string(name) +
+                            " class not found (see --classpath)");
+      }
+      return clazz;
+   }
+
+   jobject global(jobject local) {
+      jobject ref = env->NewGlobalRef(local);
+      env->DeleteLocalRef(local);
+      return ref;
+   }
+};
+
+static Fixture *fixture;
+
+/*-----------------------------------------------------------------------------
+ * JniExample
+ *---------------------------------------------------------------------------*/
+static void BM_JniExample_NativeCall(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   streambuf *console = cout.rdbuf(0);	// output is discarded
+   while (state.KeepRunning())
+      env->CallStaticVoidMethod(fixture->example, fixture->nativeCall,
+                                fixture->exampleObject);
+   cout.rdbuf(console);
+   cout.clear();
+}
+JNI_BENCHMARK(BM_JniExample_NativeCall);
+
+/*-----------------------------------------------------------------------------
+ * JniComplexExample (the container is never cleared: objects registered
+ * by every run accumulate)
+ *---------------------------------------------------------------------------*/
+static void BM_SampleContainer_Insert(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   size_t i = state.thread_index();
+   while (state.KeepRunning())
+      env->CallStaticVoidMethod(fixture->complexExample,
+         fixture->registerObject, fixture->namesWithInfo[i++ % Fixture::objects]);
+}
+JNI_BENCHMARK(BM_SampleContainer_Insert)->Threads(1)->Threads(4);
+
+int main(int argc, char *argv[]) {
+   try {
+      JNIBenchmarkVM vm(argc, argv);
+      int result;
+      {
+         Fixture shared(vm.env());
+         fixture = &shared;
+         result = JNIBenchmarkMain(vm.env(), argc, argv);
+         shared.check();
+      }
+      return result;
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
@@ -0,0 +1,142 @@
+/*-----------------------------------------------------------------------------
+ * Benchmark: JNIGlobalRef keyed hash maps.
+ *
+ * A registry (an unordered_map keyed by JNIGlobalRef<jobject>, hashed with
+ * the cached identity hash code and compared with JNIIdentityEqual) holds
+ * one entry per Java object. The objects are looked up through distinct
+ * global references to them, as a native method given the object holds:
+ * - BM_Registry_Find: a hashed probe; the hash code selects the bucket,
+ *   and IsSameObject confirms the match
+ * - BM_LinearScan: the list the registry replaces, of the first Arg
+ *   objects, scanned with JNIGlobalRef::operator== for an unhashed probe:
+ *   IsSameObject is called for every entry until the match
+ * - BM_IdentityHash: System.identityHashCode, computed once per reference
+ * - BM_Raw_IsSameObject: one IsSameObject call, the unit of both lookups
+ *
+ * Options: --entries=<n> (default 100000), and those of jni_benchmark.h.
+ *---------------------------------------------------------------------------*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <jni.h>
+
+#include "jni_benchmark.h"
+
+typedef std::unordered_map<JNIGlobalRef<jobject>, std::size_t,
+                           std::hash<JNIGlobalRef<jobject> >,
+                           JNIIdentityEqual<jobject> > Registry;
+typedef std::vector<std::unique_ptr<JNIGlobalRef<jobject> > > RefList;
+
+static const std::size_t maxScan = 2048;
+
+static Registry *registry;
+static RefList hashedProbes;	// distinct from the keys, hashed
+static RefList probes;			// distinct from the keys, never hashed
+static RefList scanList;		// the first objects, never hashed
+
+static void BM_Registry_Find(JNIBenchmarkState &state) {
+   std::size_t i = 0, found = 0;
+   while (state.KeepRunning()) {
+      found += (registry->find(*hashedProbes[i]) != registry->end());
+      if (++i == hashedProbes.size())
+         i = 0;
+   }
+   JNIDoNotOptimize(found);
+}
+JNI_BENCHMARK(BM_Registry_Find);
+
+static void BM_LinearScan(JNIBenchmarkState &state) {
+   std::size_t m = static_cast<std::size_t>(state.range(0));
+   if (m > scanList.size())
+      m = scanList.size();
+   std::size_t i = 0, found = 0;
+   while (state.KeepRunning()) {
+      const JNIGlobalRef<jobject> &probe = *probes[i];
+      for (std::size_t j = 0; j < m; j++)
+         if (*scanList[j] == probe) {
+            found++;
+            break;
+         }
+      if (++i == m)
+         i = 0;
+   }
+   JNIDoNotOptimize(found);
+}
+JNI_BENCHMARK(BM_LinearScan)->Arg(16)->Arg(256)->Arg(maxScan);
+
+static void BM_IdentityHash(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   std::size_t i = 0;
+   while (state.KeepRunning()) {
+      JNIDoNotOptimize(JNIIdentityHashCode(env, probes[i]->get()));
+      if (++i == probes.size())
+         i = 0;
+   }
+}
+JNI_BENCHMARK(BM_IdentityHash);
+
+static void BM_Raw_IsSameObject(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   std::size_t i = 0;
+   while (state.KeepRunning()) {
+      JNIDoNotOptimize(env->IsSameObject(scanList[i]->get(),
+                                         probes[i]->get()));
+      if (++i == scanList.size())
+         i = 0;
+   }
+}
+JNI_BENCHMARK(BM_Raw_IsSameObject);
+
+int main(int argc, char *argv[]) {
+   std::size_t n = 100000;
+   for (int i = 1; i < argc; i++)
+      if (strncmp(argv[i], "--entries=", 10) == 0)
+         n = static_cast<std::size_t>(atol(argv[i] + 10));
+   if (n == 0)
+      n = 1;
+
+   try {
+      JNIBenchmarkVM vm(argc, argv);
+      JNIEnv *env = vm.env();
+      int result;
+      {
+         JNIClass objectClass(env, "java/lang/Object");
+         jmethodID ctor = env->GetMethodID(objectClass, "<init>", "()V");
+         Registry entries(n, std::hash<JNIGlobalRef<jobject> >(),
+                          JNIIdentityEqual<jobject>(env));
+         for (std::size_t i = 0; i < n; i++) {
+            jobject obj = env->NewObject(objectClass, ctor);
+            entries.emplace(std::piecewise_construct,
+                            std::forward_as_tuple(env, obj),
+                            std::forward_as_tuple(i));
+            hashedProbes.push_back(std::unique_ptr<JNIGlobalRef<jobject> >(
+               new JNIGlobalRef<jobject>(env, obj)));
+            hashedProbes.back()->identityHash(env);
+            probes.push_back(std::unique_ptr<JNIGlobalRef<jobject> >(
+               new JNIGlobalRef<jobject>(env, obj)));
+            if (i < maxScan)
+               scanList.push_back(std::unique_ptr<JNIGlobalRef<jobject> >(
+                  new JNIGlobalRef<jobject>(env, obj)));
+            env->DeleteLocalRef(obj);
+         }
+         registry = &entries;
+         result = JNIBenchmarkMain(env, argc, argv);
+
+         hashedProbes.clear();
+         probes.clear();
+         scanList.clear();
+      }
+      return result;
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
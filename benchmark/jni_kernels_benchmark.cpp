@@ -0,0 +1,118 @@
+/*-----------------------------------------------------------------------------
+ * Benchmark: JNIKernels versus naive operator[] loops.
+ *
+ * The loops below are written the way native methods typically process a
+ * JNIArray (element by element through operator[]). Since the kernels
+ * make no JNI calls, the comparison is made on native buffers, and needs
+ * no Java VM. Every kernel is timed at each instruction set level
+ * supported by the processor.
+ *
+ * Usage: jni_kernels_benchmark [elements] [repetitions]
+ *---------------------------------------------------------------------------*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <jni.h>
+
+#include "jni_kernels.h"
+
+using namespace std;
+
+static volatile double sink;	// keeps results alive
+
+// Time 'reps' invocations of 'f', returning nanoseconds per element
+template<class F>
+static double measure(F f, size_t n, int reps) {
+   f();	// warm-up
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   for (int r = 0; r < reps; r++)
+      f();
+   chrono::steady_clock::duration elapsed =
+      chrono::steady_clock::now() - start;
+   return chrono::duration<double, nano>(elapsed).count() / reps / n;
+}
+
+template<class T>
+static void run(const char *type, size_t n, int reps) {
+   vector<T> a(n), b(n), work(n);
+   vector<jfloat> out(n);
+   for (size_t i = 0; i < n; i++) {
+      a[i] = static_cast<T>(rand() % 100);
+      b[i] = static_cast<T>(rand() % 100);
+   }
+   JNIArrayView<T> va(&a[0], n), vb(&b[0], n), vw(&work[0], n);
+   JNIArrayView<jfloat> vo(&out[0], n);
+
+   // Naive loops
+   double naive[6];
+   naive[0] = measure([&] {
+      typename JNIKernelTraits<T>::Accumulator s = 0;
+      for (size_t i = 0; i < n; i++)
+         s += va[i];
+      sink = s;
+   }, n, reps);
+   naive[1] = measure([&] {
+      T m = va[0];
+      for (size_t i = 1; i < n; i++)
+         if (va[i] > m)
+            m = va[i];
+      sink = m;
+   }, n, reps);
+   naive[2] = measure([&] {
+      typename JNIKernelTraits<T>::Accumulator s = 0;
+      for (size_t i = 0; i < n; i++)
+         s += va[i] * vb[i];
+      sink = s;
+   }, n, reps);
+   naive[3] = measure([&] {
+      for (size_t i = 0; i < n; i++)
+         vw[i] = static_cast<T>(vw[i] * 3);
+   }, n, reps);
+   naive[4] = measure([&] {
+      for (size_t i = 0; i < n; i++)
+         vw[i] = (vw[i] < 10) ? 10 : (vw[i] > 90) ? 90 : vw[i];
+   }, n, reps);
+   naive[5] = measure([&] {
+      for (size_t i = 0; i < n; i++)
+         vo[i] = static_cast<jfloat>(va[i]);
+   }, n, reps);
+
+   printf("%-8s %-8s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", type, "naive",
+          naive[0], naive[1], naive[2], naive[3], naive[4], naive[5]);
+
+   // Kernels, at every supported level
+   JNIKernelLevel best = JNIKernels::level();
+   for (int level = JNI_KERNELS_SCALAR; level <= best; level++) {
+      JNIKernels::setLevel(static_cast<JNIKernelLevel>(level));
+      double t[6];
+      t[0] = measure([&] { sink = JNIKernels::sum(va); }, n, reps);
+      t[1] = measure([&] { sink = JNIKernels::max(va); }, n, reps);
+      t[2] = measure([&] { sink = JNIKernels::dot(va, vb); }, n, reps);
+      t[3] = measure([&] { JNIKernels::scale(vw, 3); }, n, reps);
+      t[4] = measure([&] { JNIKernels::clamp(vw, 10, 90); }, n, reps);
+      t[5] = measure([&] { JNIKernels::convert(va, vo); }, n, reps);
+      printf("%-8s %-8s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", type,
+             JNIKernels::levelName(static_cast<JNIKernelLevel>(level)),
+             t[0], t[1], t[2], t[3], t[4], t[5]);
+   }
+   JNIKernels::setLevel(best);
+}
+
+int main(int argc, char *argv[]) {
+   size_t n = (argc > 1) ? atol(argv[1]) : 1 << 20;
+   int reps = (argc > 2) ? atoi(argv[2]) : 50;
+
+   printf("%zu elements, %d repetitions, ns/element\n", n, reps);
+   printf("%-8s %-8s %8s %8s %8s %8s %8s %8s\n", "type", "variant",
+          "sum", "max", "dot", "scale", "clamp", "convert");
+   run<jbyte>("jbyte", n, reps);
+   run<jshort>("jshort", n, reps);
+   run<jint>("jint", n, reps);
+   run<jlong>("jlong", n, reps);
+   run<jfloat>("jfloat", n, reps);
+   run<jdouble>("jdouble", n, reps);
+   return 0;
+}
@@ -0,0 +1,144 @@
+/*-----------------------------------------------------------------------------
+ * Benchmark: JNIMonitor against the native locks (jni_native_lock.h).
+ *
+ * Every benchmark protects the same short critical section (incrementing a
+ * shared counter) with one lock, which all its threads contend for:
+ * - JNIMonitor, on a java.lang.Object (the only choice when Java code also
+ *   synchronizes on the object)
+ * - JNISpinLock, JNINativeMutex and std::mutex
+ * - JNINativeRWLock, locked exclusively, and shared (reading the counter)
+ * - JNIProfiledMonitor, without and with spinning (jni_monitor_stats.h);
+ *   its statistics are written to stderr at the end
+ * Object.notify through JNIMonitor (with its cached method id) is compared
+ * with the raw calls, looking the method up on each call.
+ *
+ * See jni_benchmark.h for the options.
+ *---------------------------------------------------------------------------*/
+
+#include <iostream>
+#include <mutex>
+
+#include <jni.h>
+
+#include "jni_benchmark.h"
+
+static jobject monitor;		// global reference
+static long counter;
+
+static JNISpinLock spinLock;
+static JNINativeMutex nativeMutex;
+static JNINativeRWLock rwLock;
+static std::mutex stdMutex;
+
+static JNIMonitorStats monitorStats("BM_JNIProfiledMonitor");
+static JNIMonitorStats spinningStats("BM_JNIProfiledMonitor_Spin", 256);
+
+static void BM_JNIMonitor(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      JNIMonitor lock(env, monitor);
+      counter++;
+   }
+}
+JNI_BENCHMARK(BM_JNIMonitor)->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_JNIProfiledMonitor(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      JNIProfiledMonitor lock(env, monitor, monitorStats);
+      counter++;
+   }
+}
+JNI_BENCHMARK(BM_JNIProfiledMonitor)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_JNIProfiledMonitor_Spin(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      JNIProfiledMonitor lock(env, monitor, spinningStats);
+      counter++;
+   }
+}
+JNI_BENCHMARK(BM_JNIProfiledMonitor_Spin)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_JNIMonitor_Notify(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   JNIMonitor lock(env, monitor);
+   while (state.KeepRunning())
+      lock.notify(env);
+}
+JNI_BENCHMARK(BM_JNIMonitor_Notify);
+
+static void BM_Raw_MonitorNotify(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   env->MonitorEnter(monitor);
+   while (state.KeepRunning()) {
+      jclass clazz = env->GetObjectClass(monitor);
+      env->CallVoidMethod(monitor, env->GetMethodID(clazz, "notify", "()V"));
+      env->DeleteLocalRef(clazz);
+   }
+   env->MonitorExit(monitor);
+}
+JNI_BENCHMARK(BM_Raw_MonitorNotify);
+
+template<class Lockable>
+static void nativeLockBenchmark(JNIBenchmarkState &state, Lockable &lock) {
+   while (state.KeepRunning()) {
+      JNINativeLock<Lockable> guard(lock);
+      counter++;
+   }
+}
+
+static void BM_JNISpinLock(JNIBenchmarkState &state) {
+   nativeLockBenchmark(state, spinLock);
+}
+JNI_BENCHMARK(BM_JNISpinLock)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_JNINativeMutex(JNIBenchmarkState &state) {
+   nativeLockBenchmark(state, nativeMutex);
+}
+JNI_BENCHMARK(BM_JNINativeMutex)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_StdMutex(JNIBenchmarkState &state) {
+   nativeLockBenchmark(state, stdMutex);
+}
+JNI_BENCHMARK(BM_StdMutex)->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_JNINativeRWLock_Write(JNIBenchmarkState &state) {
+   nativeLockBenchmark(state, rwLock);
+}
+JNI_BENCHMARK(BM_JNINativeRWLock_Write)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_JNINativeRWLock_Read(JNIBenchmarkState &state) {
+   while (state.KeepRunning()) {
+      JNINativeSharedLock<JNINativeRWLock> guard(rwLock);
+      JNIDoNotOptimize(counter);
+   }
+}
+JNI_BENCHMARK(BM_JNINativeRWLock_Read)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+int main(int argc, char *argv[]) {
+   try {
+      JNIBenchmarkVM vm(argc, argv);
+      JNIEnv *env = vm.env();
+      int result;
+      {
+         JNIClass objectClass(env, "java/lang/Object");
+         JNIGlobalRef<jobject> object(env, env->NewObject(objectClass,
+            env->GetMethodID(objectClass, "<init>", "()V")));
+         monitor = object;
+         result = JNIBenchmarkMain(env, argc, argv);
+         JNIMonitorStats::dump(std::cerr);
+      }
+      return result;
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
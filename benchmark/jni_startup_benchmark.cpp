@@ -0,0 +1,58 @@
+/*-----------------------------------------------------------------------------
+ * Benchmark: Java VM startup, and class lookups on attached threads.
+ *
+ * Reports (on stderr) the startup times of its JNIVirtualMachine: the time
+ * spent in JNI_CreateJavaVM, and in resolving the --preload classes. A
+ * process can only create one Java VM, so VM options are compared by
+ * running the benchmark once per option set, e.g.
+ *
+ *    jni_startup_benchmark --benchmark_filter=^$ -J-Xshare:off
+ *    jni_startup_benchmark --benchmark_filter=^$ -J-XX:+UseSerialGC
+ *
+ * (the filter matching no benchmark). The benchmarks compare FindClass
+ * with JNIVirtualMachine::findClass, which resolves each class once.
+ *
+ * See jni_benchmark.h for the other options.
+ *---------------------------------------------------------------------------*/
+
+#include <cstdio>
+
+#include <jni.h>
+
+#include "jni_master.h"
+#include "jni_benchmark.h"
+
+static JNIVirtualMachine *jvm;
+
+static void BM_Raw_FindClass(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      jclass clazz = env->FindClass("java/util/HashMap");
+      JNIDoNotOptimize(clazz);
+      env->DeleteLocalRef(clazz);
+   }
+}
+JNI_BENCHMARK(BM_Raw_FindClass)->Threads(1)->Threads(4);
+
+static void BM_JNIVirtualMachine_findClass(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning())
+      JNIDoNotOptimize(jvm->findClass(env, "java/util/HashMap"));
+}
+JNI_BENCHMARK(BM_JNIVirtualMachine_findClass)->Threads(1)->Threads(4);
+
+int main(int argc, char *argv[]) {
+   try {
+      JNIBenchmarkVM vm(argc, argv);
+      const JNIVirtualMachineStartup &startup = vm.jvm().startup();
+      fprintf(stderr, "JNI_CreateJavaVM: %.3f ms, preload (%zu classes): "
+              "%.3f ms\n", startup.createNanoseconds / 1e6,
+              startup.preloadedClasses, startup.preloadNanoseconds / 1e6);
+      jvm = &vm.jvm();
+      return JNIBenchmarkMain(vm.env(), argc, argv);
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
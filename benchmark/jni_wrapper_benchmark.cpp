@@ -0,0 +1,512 @@
+/*-----------------------------------------------------------------------------
+ * Benchmark: the cost of the wrappers against raw JNI.
+ *
+ * Each wrapper benchmark (BM_JNI...) is paired with a raw JNI baseline
+ * (BM_Raw...) doing the same work:
+ * - JNIField / JNIFieldAccess get and set, and field lookup
+ * - JNIArray and JNICriticalArray acquire/release, at several sizes
+ * - JNINewArray, from a vector and from a generator, against NewIntArray
+ *   filled by one region copy, and element by element
+ * - JNIStringUTFChars and JNIStringChars, against the raw calls and
+ *   GetStringUTFRegion into a native buffer
+ * - JNIEnvironment on an attached thread, and attach/detach
+ * - JNIGlobalRef create/delete, on one and several threads
+ * - JNIMonitor enter/exit, uncontended and contended
+ * - JNIMappedFile windows over a temporary file, against reading the file
+ *   into a Java array through JNIArray
+ *
+ * The fields accessed belong to a JniBenchmark object (JniBenchmark.java),
+ * so the class path must contain the compiled JniBenchmark class:
+ *
+ *    javac -d classes JniBenchmark.java
+ *    jni_wrapper_benchmark --classpath=classes --benchmark_out=results.json
+ *
+ * See jni_benchmark.h for the other options. The JSON results use Google
+ * Benchmark's format, so releases can be compared with its compare.py.
+ *---------------------------------------------------------------------------*/
+
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <jni.h>
+
+#include "jni_benchmark.h"
+
+using namespace std;
+
+/*-----------------------------------------------------------------------------
+ * Objects shared by the benchmarks (global references, created once)
+ *---------------------------------------------------------------------------*/
+struct Fixture {
+   JNIEnv *env;
+   jclass targetClass;
+   jobject target;
+   jfieldID intId;
+   jobject lock;
+   map<long, jintArray> arrays;		// by length
+   map<long, jstring> strings;		// by length
+   string mappedPath;				// temporary file of 'mappedSize' bytes
+   static const long mappedSize = 16 * 1024 * 1024;
+
+   explicit Fixture(JNIEnv *env) : env(env) {
+      jclass local = env->FindClass("JniBenchmark");
+      if (local == 0)
+         throw JNIException("JniBenchmark class not found (see --classpath)");
+      targetClass = static_cast<jclass>(global(local));
+      target = global(env->AllocObject(targetClass));
+      intId = env->GetFieldID(targetClass, "intField", "I");
+      lock = global(env->AllocObject(JNIClass(env, "java/lang/Object")));
+
+      const long sizes[] = { 16, 1024, 64 * 1024, 1024 * 1024 };
+      for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+         arrays[sizes[i]] = static_cast<jintArray>(
+            global(env->NewIntArray(static_cast<jsize>(sizes[i]))));
+
+      const long lengths[] = { 16, 1024 };
+      for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+         string s(lengths[i], 'x');
+         strings[lengths[i]] =
+            static_cast<jstring>(global(env->NewStringUTF(s.c_str())));
+      }
+
+      char path[] = "/tmp/jni_wrapper_benchmark.XXXXXX";
+      int fd = mkstemp(path);
+      if (fd < 0 || ftruncate(fd, mappedSize) != 0)
+         throw JNIException("Failed to create the mapped file");
+      close(fd);
+      mappedPath = path;
+   }
+
+   ~Fixture() {
+      env->DeleteGlobalRef(targetClass);
+      env->DeleteGlobalRef(target);
+      env->DeleteGlobalRef(lock);
+      for (map<long, jintArray>::iterator p = arrays.begin();
+           p != arrays.end(); p++)
+         env->DeleteGlobalRef(p->second);
+      for (map<long, jstring>::iterator p = strings.begin();
+           p != strings.end(); p++)
+         env->DeleteGlobalRef(p->second);
+      unlink(mappedPath.c_str());
+   }
+
+private:
+   jobject global(jobject local) {
+      jobject ref = env->NewGlobalRef(local);
+      env->DeleteLocalRef(local);
+      return ref;
+   }
+};
+
+static Fixture *fixture;
+
+#define ARRAY_SIZES ->Arg(16)->Arg(1024)->Arg(64 * 1024)->Arg(1024 * 1024)
+#define STRING_LENGTHS ->Arg(16)->Arg(1024)
+#define MAPPED_SIZES \
+   ->Arg(64 * 1024)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024)
+
+/*-----------------------------------------------------------------------------
+ * Fields
+ *---------------------------------------------------------------------------*/
+static void BM_JNIField_GetInt(JNIBenchmarkState &state) {
+   JNIField<jint> field(state.env(), fixture->target, "intField");
+   while (state.KeepRunning()) {
+      jint value = field;
+      JNIDoNotOptimize(value);
+   }
+}
+JNI_BENCHMARK(BM_JNIField_GetInt);
+
+static void BM_JNIField_SetInt(JNIBenchmarkState &state) {
+   JNIField<jint> field(state.env(), fixture->target, "intField");
+   jint value = 0;
+   while (state.KeepRunning())
+      field = value++;
+}
+JNI_BENCHMARK(BM_JNIField_SetInt);
+
+static void BM_JNIFieldAccess_GetInt(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning())
+      JNIDoNotOptimize(
+         JNIFieldAccess<jint>::Get(env, fixture->target, fixture->intId));
+}
+JNI_BENCHMARK(BM_JNIFieldAccess_GetInt);
+
+static void BM_Raw_GetIntField(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning())
+      JNIDoNotOptimize(env->GetIntField(fixture->target, fixture->intId));
+}
+JNI_BENCHMARK(BM_Raw_GetIntField);
+
+static void BM_Raw_SetIntField(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jint value = 0;
+   while (state.KeepRunning())
+      env->SetIntField(fixture->target, fixture->intId, value++);
+}
+JNI_BENCHMARK(BM_Raw_SetIntField);
+
+// Constructing the proxy looks up the class and the field id
+static void BM_JNIField_Lookup(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      JNIField<jint> field(env, fixture->target, "intField");
+      JNIDoNotOptimize(field);
+   }
+}
+JNI_BENCHMARK(BM_JNIField_Lookup);
+
+static void BM_Raw_FieldLookup(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      jclass clazz = env->GetObjectClass(fixture->target);
+      JNIDoNotOptimize(env->GetFieldID(clazz, "intField", "I"));
+      env->DeleteLocalRef(clazz);
+   }
+}
+JNI_BENCHMARK(BM_Raw_FieldLookup);
+
+/*-----------------------------------------------------------------------------
+ * Arrays
+ *---------------------------------------------------------------------------*/
+static void arrayBytes(JNIBenchmarkState &state) {
+   state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(jint));
+}
+
+static void BM_JNIArray_AcquireRelease(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jintArray array = fixture->arrays[state.range(0)];
+   while (state.KeepRunning()) {
+      JNIArray<jint> a(env, array);
+      JNIDoNotOptimize(a[0]);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_JNIArray_AcquireRelease) ARRAY_SIZES;
+
+static void BM_JNIArray_AcquireAbort(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jintArray array = fixture->arrays[state.range(0)];
+   while (state.KeepRunning()) {
+      JNIArray<jint> a(env, array);
+      JNIDoNotOptimize(a[0]);
+      a.CustomRelease(env, JNI_ABORT);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_JNIArray_AcquireAbort) ARRAY_SIZES;
+
+static void BM_Raw_ArrayElements(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jintArray array = fixture->arrays[state.range(0)];
+   while (state.KeepRunning()) {
+      jint *a = env->GetIntArrayElements(array, 0);
+      JNIDoNotOptimize(a[0]);
+      env->ReleaseIntArrayElements(array, a, 0);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_Raw_ArrayElements) ARRAY_SIZES;
+
+static void BM_JNICriticalArray_AcquireRelease(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jintArray array = fixture->arrays[state.range(0)];
+   while (state.KeepRunning()) {
+      JNICriticalArray<jint> a(env, array);
+      JNIDoNotOptimize(a[0]);
+      a.CustomRelease(env);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_JNICriticalArray_AcquireRelease) ARRAY_SIZES;
+
+static void BM_Raw_ArrayCritical(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jintArray array = fixture->arrays[state.range(0)];
+   while (state.KeepRunning()) {
+      jint *a = static_cast<jint *>(env->GetPrimitiveArrayCritical(array, 0));
+      JNIDoNotOptimize(a[0]);
+      env->ReleasePrimitiveArrayCritical(array, a, 0);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_Raw_ArrayCritical) ARRAY_SIZES;
+
+static void BM_Raw_ArrayRegion(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jintArray array = fixture->arrays[state.range(0)];
+   vector<jint> buffer(state.range(0));
+   while (state.KeepRunning()) {
+      env->GetIntArrayRegion(array, 0, static_cast<jsize>(buffer.size()),
+                             &buffer[0]);
+      JNIDoNotOptimize(buffer[0]);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_Raw_ArrayRegion) ARRAY_SIZES;
+
+static void BM_JNINewArray(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   vector<jint> values(state.range(0), 1);
+   while (state.KeepRunning())
+      env->DeleteLocalRef(JNINewArray(env, values));
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_JNINewArray) ARRAY_SIZES;
+
+static void BM_JNINewArray_Generator(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jsize len = static_cast<jsize>(state.range(0));
+   while (state.KeepRunning())
+      env->DeleteLocalRef(JNINewArray<jint>(env, len,
+                                            [](jsize i) { return i; }));
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_JNINewArray_Generator) ARRAY_SIZES;
+
+static void BM_Raw_NewArrayRegion(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   vector<jint> values(state.range(0), 1);
+   jsize len = static_cast<jsize>(values.size());
+   while (state.KeepRunning()) {
+      jintArray array = env->NewIntArray(len);
+      env->SetIntArrayRegion(array, 0, len, &values[0]);
+      env->DeleteLocalRef(array);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_Raw_NewArrayRegion) ARRAY_SIZES;
+
+// Writing element by element, as generated
+static void BM_Raw_NewArrayElementwise(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jsize len = static_cast<jsize>(state.range(0));
+   while (state.KeepRunning()) {
+      jintArray array = env->NewIntArray(len);
+      for (jsize i = 0; i < len; i++)
+         env->SetIntArrayRegion(array, i, 1, &i);
+      env->DeleteLocalRef(array);
+   }
+   arrayBytes(state);
+}
+JNI_BENCHMARK(BM_Raw_NewArrayElementwise) ARRAY_SIZES;
+
+/*-----------------------------------------------------------------------------
+ * Strings
+ *---------------------------------------------------------------------------*/
+static void BM_JNIStringUTFChars(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jstring str = fixture->strings[state.range(0)];
+   while (state.KeepRunning()) {
+      JNIStringUTFChars chars(env, str);
+      JNIDoNotOptimize(chars[0]);
+   }
+}
+JNI_BENCHMARK(BM_JNIStringUTFChars) STRING_LENGTHS;
+
+static void BM_JNIStringUTFChars_AsString(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jstring str = fixture->strings[state.range(0)];
+   while (state.KeepRunning()) {
+      string s = JNIStringUTFChars(env, str).asString();
+      JNIDoNotOptimize(s[0]);
+   }
+}
+JNI_BENCHMARK(BM_JNIStringUTFChars_AsString) STRING_LENGTHS;
+
+static void BM_Raw_GetStringUTFChars(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jstring str = fixture->strings[state.range(0)];
+   while (state.KeepRunning()) {
+      const char *chars = env->GetStringUTFChars(str, 0);
+      JNIDoNotOptimize(chars[0]);
+      env->ReleaseStringUTFChars(str, chars);
+   }
+}
+JNI_BENCHMARK(BM_Raw_GetStringUTFChars) STRING_LENGTHS;
+
+static void BM_Raw_GetStringUTFRegion(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jstring str = fixture->strings[state.range(0)];
+   vector<char> buffer(4 * state.range(0) + 1);
+   while (state.KeepRunning()) {
+      jsize length = env->GetStringLength(str);
+      env->GetStringUTFRegion(str, 0, length, &buffer[0]);
+      JNIDoNotOptimize(buffer[0]);
+   }
+}
+JNI_BENCHMARK(BM_Raw_GetStringUTFRegion) STRING_LENGTHS;
+
+static void BM_JNIStringChars(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jstring str = fixture->strings[state.range(0)];
+   while (state.KeepRunning()) {
+      JNIStringChars chars(env, str);
+      JNIDoNotOptimize(chars[0]);
+   }
+}
+JNI_BENCHMARK(BM_JNIStringChars) STRING_LENGTHS;
+
+static void BM_Raw_GetStringCritical(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   jstring str = fixture->strings[state.range(0)];
+   while (state.KeepRunning()) {
+      const jchar *chars = env->GetStringCritical(str, 0);
+      JNIDoNotOptimize(chars[0]);
+      env->ReleaseStringCritical(str, chars);
+   }
+}
+JNI_BENCHMARK(BM_Raw_GetStringCritical) STRING_LENGTHS;
+
+/*-----------------------------------------------------------------------------
+ * Environment
+ *---------------------------------------------------------------------------*/
+static void BM_JNIEnvironment_Attached(JNIBenchmarkState &state) {
+   JavaVM *vm;
+   state.env()->GetJavaVM(&vm);
+   while (state.KeepRunning()) {
+      JNIEnvironment env(vm);
+      JNIDoNotOptimize(env.Get());
+   }
+}
+JNI_BENCHMARK(BM_JNIEnvironment_Attached);
+
+static void BM_Raw_GetEnv(JNIBenchmarkState &state) {
+   JavaVM *vm;
+   state.env()->GetJavaVM(&vm);
+   while (state.KeepRunning()) {
+      JNIEnv *env;
+      vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION);
+      JNIDoNotOptimize(env);
+   }
+}
+JNI_BENCHMARK(BM_Raw_GetEnv);
+
+// Run on a thread of its own, which is not attached to the Java VM
+static void BM_JNIEnvironment_AttachDetach(JNIBenchmarkState &state) {
+   JavaVM *vm;
+   state.env()->GetJavaVM(&vm);
+   thread detached([&] {
+      while (state.KeepRunning()) {
+         JNIEnvironment env(vm);
+         JNIDoNotOptimize(env.Get());
+      }
+   });
+   detached.join();
+}
+JNI_BENCHMARK(BM_JNIEnvironment_AttachDetach);
+
+static void BM_Raw_AttachDetach(JNIBenchmarkState &state) {
+   JavaVM *vm;
+   state.env()->GetJavaVM(&vm);
+   thread detached([&] {
+      while (state.KeepRunning()) {
+         JNIEnv *env;
+         vm->AttachCurrentThread(reinterpret_cast<void **>(&env), 0);
+         JNIDoNotOptimize(env);
+         vm->DetachCurrentThread();
+      }
+   });
+   detached.join();
+}
+JNI_BENCHMARK(BM_Raw_AttachDetach);
+
+/*-----------------------------------------------------------------------------
+ * Global references
+ *---------------------------------------------------------------------------*/
+static void BM_JNIGlobalRef_CreateDelete(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      JNIGlobalRef<jobject> ref(env, fixture->target);
+      JNIDoNotOptimize(ref.get());
+   }
+}
+JNI_BENCHMARK(BM_JNIGlobalRef_CreateDelete)->Threads(1)->Threads(4);
+
+static void BM_Raw_GlobalRef(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      jobject ref = env->NewGlobalRef(fixture->target);
+      JNIDoNotOptimize(ref);
+      env->DeleteGlobalRef(ref);
+   }
+}
+JNI_BENCHMARK(BM_Raw_GlobalRef)->Threads(1)->Threads(4);
+
+/*-----------------------------------------------------------------------------
+ * Monitors: all the threads contend for the same monitor
+ *---------------------------------------------------------------------------*/
+static void BM_JNIMonitor_EnterExit(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      JNIMonitor monitor(env, fixture->lock);
+      JNIDoNotOptimize(monitor.get());
+   }
+}
+JNI_BENCHMARK(BM_JNIMonitor_EnterExit)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+static void BM_Raw_MonitorEnterExit(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   while (state.KeepRunning()) {
+      env->MonitorEnter(fixture->lock);
+      env->MonitorExit(fixture->lock);
+   }
+}
+JNI_BENCHMARK(BM_Raw_MonitorEnterExit)
+   ->Threads(1)->Threads(2)->Threads(4)->Threads(8);
+
+/*-----------------------------------------------------------------------------
+ * Mapped files
+ *---------------------------------------------------------------------------*/
+static void BM_JNIMappedFile_Window(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   JNIMappedFile file(fixture->mappedPath);
+   while (state.KeepRunning())
+      env->DeleteLocalRef(file.window(env, 0, state.range(0)));
+   state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+JNI_BENCHMARK(BM_JNIMappedFile_Window) MAPPED_SIZES;
+
+static void BM_JNIArray_ReadFile(JNIBenchmarkState &state) {
+   JNIEnv *env = state.env();
+   int fd = open(fixture->mappedPath.c_str(), O_RDONLY);
+   jsize len = static_cast<jsize>(state.range(0));
+   while (state.KeepRunning()) {
+      jbyteArray array = env->NewByteArray(len);
+      {
+         JNIArray<jbyte> a(env, array);
+         JNIDoNotOptimize(pread(fd, &a[0], len, 0));
+      }
+      env->DeleteLocalRef(array);
+   }
+   close(fd);
+   state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+JNI_BENCHMARK(BM_JNIArray_ReadFile) MAPPED_SIZES;
+
+int main(int argc, char *argv[]) {
+   try {
+      JNIBenchmarkVM vm(argc, argv);
+      int result;
+      {
+         Fixture shared(vm.env());
+         fixture = &shared;
+         result = JNIBenchmarkMain(vm.env(), argc, argv);
+      }
+      return result;
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
@@ -0,0 +1,214 @@
+/*-----------------------------------------------------------------------------
+ * A host stand-in for the NDK's <android/bitmap.h>, so that code built on
+ * jni_android.h and jni_bitmap.h can be compiled and run off-device.
+ *
+ * Bitmaps are JNIMockBitmap objects, passed to the AndroidBitmap_*
+ * functions (and to JNIAndroidBitmap) as their 'jobject':
+ *
+ *    JNIMockBitmap bitmap(640, 480, ANDROID_BITMAP_FORMAT_RGBA_8888);
+ *    JNIAndroidBitmap pixels(env, bitmap.object());
+ *
+ * By default, that 'jobject' is the address of the JNIMockBitmap, which
+ * is enough for the AndroidBitmap_* functions (JNIAndroidBitmap needs a
+ * real JNIEnv, to find the Java VM for its destructor). Code which also
+ * passes the Bitmaps to JNI functions (e.g. JNIBitmapInfoCache, which
+ * hashes them by identity) needs Java objects: a JNIMockBitmap
+ * constructed with a JNIEnv is represented by a new java.lang.Object,
+ * and any reference to that object designates the bitmap.
+ *
+ * Each bitmap counts the calls made on it, and its current locks, and
+ * records when it was last unlocked (unlockOrder, numbered across all
+ * bitmaps); unlocking a bitmap that is not locked fails with
+ * ANDROID_BITMAP_RESULT_BAD_PARAMETER. The counters are not atomic.
+ *
+ * Add the directory containing 'android/' to the include path of host
+ * builds only.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_MOCK_ANDROID_BITMAP_H_INCLUDED_
+#define _JNI_MOCK_ANDROID_BITMAP_H_INCLUDED_
+
+#include <stdint.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include <jni.h>
+
+enum AndroidBitmapFormat {
+   ANDROID_BITMAP_FORMAT_NONE = 0,
+   ANDROID_BITMAP_FORMAT_RGBA_8888 = 1,
+   ANDROID_BITMAP_FORMAT_RGB_565 = 4,
+   ANDROID_BITMAP_FORMAT_RGBA_4444 = 7,
+   ANDROID_BITMAP_FORMAT_A_8 = 8,
+   ANDROID_BITMAP_FORMAT_RGBA_F16 = 9
+};
+
+enum {
+   ANDROID_BITMAP_RESULT_SUCCESS = 0,
+   ANDROID_BITMAP_RESULT_BAD_PARAMETER = -1,
+   ANDROID_BITMAP_RESULT_JNI_EXCEPTION = -2,
+   ANDROID_BITMAP_RESULT_ALLOCATION_FAILED = -3
+};
+
+enum {
+   ANDROID_BITMAP_FLAGS_ALPHA_PREMUL = 0,
+   ANDROID_BITMAP_FLAGS_ALPHA_OPAQUE = 1,
+   ANDROID_BITMAP_FLAGS_ALPHA_UNPREMUL = 2,
+   ANDROID_BITMAP_FLAGS_ALPHA_MASK = 3
+};
+
+typedef struct {
+   uint32_t width;
+   uint32_t height;
+   uint32_t stride;
+   int32_t format;
+   uint32_t flags;
+} AndroidBitmapInfo;
+
+/*-----------------------------------------------------------------------------
+ * JNIMockBitmap: zero-filled pixels, with rows of 'padding' extra bytes
+ *---------------------------------------------------------------------------*/
+class JNIMockBitmap {
+   AndroidBitmapInfo _info;
+   std::vector<unsigned char> _pixels;
+   JavaVM *_vm;
+   jobject _object;		// global reference to the Java object, or 0
+
+   JNIMockBitmap(const JNIMockBitmap &);
+   JNIMockBitmap &operator= (const JNIMockBitmap &);
+
+public:
+   int locks;				// currently held locks
+   long infoCalls;			// calls to AndroidBitmap_getInfo
+   long lockCalls;			// calls to AndroidBitmap_lockPixels
+   long unlockCalls;		// calls to AndroidBitmap_unlockPixels
+   long unlockOrder;		// number of the last unlock, 0 if none
+
+   JNIMockBitmap(uint32_t width, uint32_t height, int32_t format,
+                 uint32_t padding = 0) : _vm(0), _object(0) {
+      init(width, height, format, padding);
+   }
+
+   JNIMockBitmap(JNIEnv *env, uint32_t width, uint32_t height,
+                 int32_t format, uint32_t padding = 0) : _vm(0), _object(0) {
+      init(width, height, format, padding);
+      env->GetJavaVM(&_vm);
+      jclass clazz = env->FindClass("java/lang/Object");
+      jobject object = env->NewObject(clazz,
+         env->GetMethodID(clazz, "<init>", "()V"));
+      _object = env->NewGlobalRef(object);
+      env->DeleteLocalRef(object);
+      env->DeleteLocalRef(clazz);
+   }
+
+   ~JNIMockBitmap() {
+      {
+         std::lock_guard<std::mutex> guard(registryLock());
+         std::vector<JNIMockBitmap *> &r = registry();
+         r.erase(std::find(r.begin(), r.end(), this));
+      }
+      void *env;
+      if (_object != 0 && _vm->GetEnv(&env, JNI_VERSION_1_2) == JNI_OK)
+         static_cast<JNIEnv *>(env)->DeleteGlobalRef(_object);
+   }
+
+   jobject object() {
+      return (_object != 0) ? _object : reinterpret_cast<jobject>(this);
+   }
+
+   // The bitmap designated by 'jbitmap' (0 if none): addresses of plain
+   // bitmaps are recognized first, so that no JNI function sees them
+   static JNIMockBitmap *from(JNIEnv *env, jobject jbitmap) {
+      std::lock_guard<std::mutex> guard(registryLock());
+      std::vector<JNIMockBitmap *> &r = registry();
+      for (size_t i = 0; i < r.size(); i++)
+         if (r[i]->_object == 0 && reinterpret_cast<jobject>(r[i]) == jbitmap)
+            return r[i];
+      for (size_t i = 0; i < r.size(); i++)
+         if (r[i]->_object != 0 && env->IsSameObject(r[i]->_object, jbitmap))
+            return r[i];
+      return 0;
+   }
+
+   const AndroidBitmapInfo &info() const { return _info; }
+   void *pixels() { return _pixels.empty() ? 0 : &_pixels[0]; }
+
+private:
+   void init(uint32_t width, uint32_t height, int32_t format,
+             uint32_t padding) {
+      locks = 0;
+      infoCalls = lockCalls = unlockCalls = unlockOrder = 0;
+      _info.width = width;
+      _info.height = height;
+      _info.stride = width * bytesPerPixel(format) + padding;
+      _info.format = format;
+      _info.flags = ANDROID_BITMAP_FLAGS_ALPHA_PREMUL;
+      _pixels.resize(static_cast<size_t>(_info.stride) * height);
+      std::lock_guard<std::mutex> guard(registryLock());
+      registry().push_back(this);
+   }
+
+   static std::vector<JNIMockBitmap *> &registry() {
+      static std::vector<JNIMockBitmap *> bitmaps;
+      return bitmaps;
+   }
+   static std::mutex &registryLock() {
+      static std::mutex lock;
+      return lock;
+   }
+
+public:
+   // Unlocks of all bitmaps so far
+   static long &unlocks() {
+      static long count = 0;
+      return count;
+   }
+
+   static uint32_t bytesPerPixel(int32_t format) {
+      switch (format) {
+      case ANDROID_BITMAP_FORMAT_RGBA_8888:	return 4;
+      case ANDROID_BITMAP_FORMAT_RGB_565:	return 2;
+      case ANDROID_BITMAP_FORMAT_RGBA_4444:	return 2;
+      case ANDROID_BITMAP_FORMAT_A_8:		return 1;
+      case ANDROID_BITMAP_FORMAT_RGBA_F16:	return 8;
+      default:								return 0;
+      }
+   }
+};
+
+inline int AndroidBitmap_getInfo(JNIEnv *env, jobject jbitmap,
+                                 AndroidBitmapInfo *info) {
+   JNIMockBitmap *bitmap = JNIMockBitmap::from(env, jbitmap);
+   if (bitmap == 0 || info == 0)
+      return ANDROID_BITMAP_RESULT_BAD_PARAMETER;
+   bitmap->infoCalls++;
+   *info = bitmap->info();
+   return ANDROID_BITMAP_RESULT_SUCCESS;
+}
+
+inline int AndroidBitmap_lockPixels(JNIEnv *env, jobject jbitmap,
+                                    void **addrPtr) {
+   JNIMockBitmap *bitmap = JNIMockBitmap::from(env, jbitmap);
+   if (bitmap == 0)
+      return ANDROID_BITMAP_RESULT_BAD_PARAMETER;
+   bitmap->lockCalls++;
+   bitmap->locks++;
+   if (addrPtr != 0)
+      *addrPtr = bitmap->pixels();
+   return ANDROID_BITMAP_RESULT_SUCCESS;
+}
+
+inline int AndroidBitmap_unlockPixels(JNIEnv *env, jobject jbitmap) {
+   JNIMockBitmap *bitmap = JNIMockBitmap::from(env, jbitmap);
+   if (bitmap == 0)
+      return ANDROID_BITMAP_RESULT_BAD_PARAMETER;
+   bitmap->unlockCalls++;
+   if (bitmap->locks == 0)
+      return ANDROID_BITMAP_RESULT_BAD_PARAMETER;
+   bitmap->locks--;
+   bitmap->unlockOrder = ++JNIMockBitmap::unlocks();
+   return ANDROID_BITMAP_RESULT_SUCCESS;
+}
+
+#endif /* _JNI_MOCK_ANDROID_BITMAP_H_INCLUDED_ */
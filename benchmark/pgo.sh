@@ -0,0 +1,61 @@
+#!/bin/sh
+#------------------------------------------------------------------------------
+# Profile-guided optimization workflow.
+#
+#    benchmark/pgo.sh [work directory]	(default: _pgo in the source tree)
+#
+# 1. baseline: a Release build (with LTO), whose benchmarks are timed
+# 2. instrumented build (JNI_TEMPLATES_PGO=GENERATE) of the example
+#    libraries and the benchmarks
+# 3. training: the benchmark drivers run representative workloads in an
+#    embedded Java VM (field access, array processing, string conversion,
+#    SampleContainer inserts through the example libraries), writing the
+#    profiles
+# 4. optimized build (JNI_TEMPLATES_PGO=USE, in the same build directory,
+#    as GCC requires), whose benchmarks are timed again
+# 5. the before-and-after numbers are printed (benchmark/compare.sh), and
+#    kept in the work directory as JSON
+#
+# Extra arguments for CMake may be given in CMAKE_ARGS, and for the timed
+# runs in BENCHMARK_ARGS (e.g. BENCHMARK_ARGS=--benchmark_min_time=1).
+#------------------------------------------------------------------------------
+
+set -e
+
+src=$(cd "$(dirname "$0")/.." && pwd)
+work=${1:-$src/_pgo}
+profiles=$work/profiles
+drivers="jni_wrapper_benchmark jni_example_benchmark"
+mkdir -p "$work"
+
+build() {
+   cmake -S "$src" -B "$1" -DCMAKE_BUILD_TYPE=Release -DJNI_TEMPLATES_LTO=ON \
+      $CMAKE_ARGS $2 >/dev/null
+   cmake --build "$1" --clean-first -j "$(nproc)"
+}
+
+run() {
+   for driver in $drivers; do
+      "$1/benchmark/$driver" $2 --benchmark_out="$work/$3-$driver.json"
+   done
+}
+
+echo "=== Baseline build"
+build "$work/baseline"
+run "$work/baseline" "$BENCHMARK_ARGS" baseline
+
+echo "=== Instrumented build and training run"
+rm -rf "$profiles"
+build "$work/pgo" "-DJNI_TEMPLATES_PGO=GENERATE -DJNI_TEMPLATES_PGO_DIR=$profiles"
+run "$work/pgo" --benchmark_min_time=0.05 training
+
+echo "=== Optimized build"
+build "$work/pgo" "-DJNI_TEMPLATES_PGO=USE -DJNI_TEMPLATES_PGO_DIR=$profiles"
+run "$work/pgo" "$BENCHMARK_ARGS" pgo
+
+for driver in $drivers; do
+   echo
+   echo "=== $driver: baseline vs. PGO"
+   "$src/benchmark/compare.sh" "$work/baseline-$driver.json" \
+      "$work/pgo-$driver.json"
+done
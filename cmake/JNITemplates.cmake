@@ -0,0 +1,92 @@
+#------------------------------------------------------------------------------
+# Helpers for native libraries built on the JNI C++ Template Library
+#------------------------------------------------------------------------------
+
+include_guard(GLOBAL)
+
+# Precompiles jni_master.h for 'target'. Every translation unit of the
+# target then skips parsing the headers and their macro-expanded
+# specializations.
+function(jni_templates_precompile_headers target)
+   target_precompile_headers(${target} PRIVATE <jni.h> <jni_master.h>)
+endfunction()
+
+# Builds 'target' with link-time optimization, if the toolchain supports it
+function(jni_templates_enable_lto target)
+   include(CheckIPOSupported)
+   check_ipo_supported(RESULT supported OUTPUT output LANGUAGES CXX)
+   if(supported)
+      set_property(TARGET ${target} PROPERTY INTERPROCEDURAL_OPTIMIZATION ON)
+   else()
+      message(WARNING "LTO is not supported for ${target}: ${output}")
+   endif()
+endfunction()
+
+# Profile-guided optimization of 'target' (GCC or Clang). 'mode' is
+#   GENERATE   instrumented build: running it writes profiles into 'dir'
+#   USE        optimized build from the profiles in 'dir'
+# GCC names its profiles after the object files, so both builds must use
+# the same build directory. Clang's raw profiles are merged into
+# 'dir'/default.profdata by jni_templates_merge_profiles().
+function(jni_templates_enable_pgo target mode dir)
+   if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+      if(mode STREQUAL "GENERATE")
+         set(flags -fprofile-generate=${dir} -fprofile-update=atomic)
+      else()
+         # Code not covered by the training run is optimized as usual
+         set(flags -fprofile-use=${dir} -fprofile-partial-training
+                   -Wno-missing-profile)
+      endif()
+   elseif(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+      if(mode STREQUAL "GENERATE")
+         set(flags -fprofile-instr-generate=${dir}/%m-%p.profraw)
+      else()
+         set(flags -fprofile-instr-use=${dir}/default.profdata
+                   -Wno-profile-instr-unprofiled)
+      endif()
+   else()
+      message(WARNING "PGO is not supported with ${CMAKE_CXX_COMPILER_ID}")
+      return()
+   endif()
+   target_compile_options(${target} PRIVATE ${flags})
+   target_link_options(${target} PRIVATE ${flags})
+endfunction()
+
+# Merges Clang's raw profiles in 'dir' (a no-op for GCC)
+function(jni_templates_merge_profiles dir)
+   if(NOT CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+      return()
+   endif()
+   file(GLOB raw ${dir}/*.profraw)
+   if(NOT raw)
+      message(FATAL_ERROR "No profiles in ${dir}: run the instrumented build")
+   endif()
+   get_filename_component(bin ${CMAKE_CXX_COMPILER} DIRECTORY)
+   find_program(LLVM_PROFDATA llvm-profdata HINTS ${bin})
+   if(NOT LLVM_PROFDATA)
+      message(FATAL_ERROR "llvm-profdata not found: set LLVM_PROFDATA")
+   endif()
+   execute_process(
+      COMMAND ${LLVM_PROFDATA} merge -o ${dir}/default.profdata ${raw}
+      RESULT_VARIABLE result)
+   if(NOT result EQUAL 0)
+      message(FATAL_ERROR "llvm-profdata could not merge the profiles in ${dir}")
+   endif()
+endfunction()
+
+# Applies the project options (JNI_TEMPLATES_PRECOMPILE_HEADERS,
+# JNI_TEMPLATES_LTO and JNI_TEMPLATES_PGO) to a target built with the
+# library
+function(jni_templates_configure target)
+   target_link_libraries(${target} PRIVATE jni_cpp_templates::jni_cpp_templates)
+   if(JNI_TEMPLATES_PRECOMPILE_HEADERS)
+      jni_templates_precompile_headers(${target})
+   endif()
+   if(JNI_TEMPLATES_LTO)
+      jni_templates_enable_lto(${target})
+   endif()
+   if(JNI_TEMPLATES_PGO)
+      jni_templates_enable_pgo(${target} ${JNI_TEMPLATES_PGO}
+                               ${JNI_TEMPLATES_PGO_DIR})
+   endif()
+endfunction()
@@ -4,4 +4,5 @@ APP_PLATFORM := android-8
 NDK_TOOLCHAIN_VERSION := clang
 APP_STL := gnustl_static
 APP_GNUSTL_FORCE_CPP_FEATURES := exceptions rtti
+APP_CPPFLAGS := -std=c++11
 APP_ABI := x86 armeabi armeabi-v7a mips
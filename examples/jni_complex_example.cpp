@@ -36,7 +36,9 @@ using namespace std;
  * object to the container, and function 'exportAllObjects' returns an array
  * of all the objects stored.
  *
- * To ensure code portability, thread-safety is realized by using JNI monitors.
+ * Thread-safety is realized by a native lock (JNINativeMutex). The map is
+ * only accessed from native code, so a JNI monitor, which costs a JNI call
+ * per lock, is not needed (see jni_native_lock.h).
  ----------------------------------------------------------------------------*/
 class SampleContainer {
    static SampleContainer *instance;
@@ -44,31 +46,18 @@ class SampleContainer {
 
 private:
    MapOfObjects mapOfObjects;		// the container implementation
-   JNIGlobalRef<jobject> monitor;	// monitor (for critical sections)
+   JNINativeMutex lock;			// lock (for critical sections)
 
-   // Constructor: environment and monitor initialization
-   SampleContainer(JNIEnv *env) :
-	  monitor(env, getMonitorObject(env))
-   {}
+   SampleContainer() {}
 
    // Destructor: purging the map elements. 
    // All the global references are deleted explicitly.
-   // The monitor object is released automatically through
-   // the resource management mechanism.
    ~SampleContainer() {
 	  MapOfObjects::iterator p;
 	  for (p = mapOfObjects.begin(); p != mapOfObjects.end(); p++)
 		 delete (*p).second;
    }
 
-private:
-   // allocating the monitor object
-   static jobject getMonitorObject(JNIEnv *env) {
-	  JNIClass objectClass(env, "java/lang/Object");
-	  jmethodID constructorId = env->GetMethodID(objectClass, "<init>", "()V");
-	  return env->NewObject(objectClass, constructorId);
-   }
-   
 public:
    // Function 'getInstance()'.
    // The environment parameter facilitates the initialization mode.
@@ -89,12 +78,12 @@ public:
 			throw
 			   new JNIException("SampleContainer not initialized properly.");
 		 }
-		 static JNIGlobalRef<jobject> initMonitor(env, getMonitorObject(env));
+		 static JNINativeMutex initLock;
 
 		 // Double-checked locking is used to provide correct initialization
-		 JNIMonitor startCriticalSection(env, initMonitor);
+		 JNINativeLock<JNINativeMutex> startCriticalSection(env, initLock);
 		 if (instance == 0)
-			instance = new SampleContainer(env);
+			instance = new SampleContainer();
 	  }
 	  return instance;
    }
@@ -108,9 +97,9 @@ public:
 
    // inserting an object
    void insert(JNIEnv *env, jobject obj) {
-	  // JNIMonitor is used to ensure integrity of the critical section.
+	  // JNINativeLock is used to ensure integrity of the critical section.
 	  // It is destroyed automatically as it goes out of scope.
-	  JNIMonitor startCriticalSection(env, monitor);
+	  JNINativeLock<JNINativeMutex> startCriticalSection(env, lock);
 
 	  // Retrieve the "name" field of the object, create a global reference to
 	  // it, then insert a pointer to this reference into the container.
@@ -121,19 +110,21 @@ public:
 	  mapOfObjects.insert(make_pair(str.asString(), ref));
    }
 
-   // Exporting all the collected objects as a vector (this vector is
+   // Exporting all the collected objects into a vector (this vector is
    // inherently sorted, as the objects are extracted from a map).
+   // The vector is allocated from the per-thread arena, so the caller
+   // must hold a JNICallScope for as long as it uses the result.
    // Observe that it's impossible to use the STL 'copy()' here, since 'vector'
    // and 'multimap' iterators have a different structure.
-   vector<JNIGlobalRef<jobject> *> exportAllObjects(JNIEnv *env) {
-	  JNIMonitor startCriticalSection(env, monitor);
-	  vector<JNIGlobalRef<jobject> *> result(mapOfObjects.size(), 0);
+   void exportAllObjects(JNIEnv *env,
+						 JNIArenaVector<JNIGlobalRef<jobject> *> &result) {
+	  JNINativeLock<JNINativeMutex> startCriticalSection(env, lock);
+	  result.assign(mapOfObjects.size(), 0);
 	  MapOfObjects::iterator p;
-	  vector<JNIGlobalRef<jobject> *>::iterator q;
+	  JNIArenaVector<JNIGlobalRef<jobject> *>::iterator q;
 	  for (p = mapOfObjects.begin(), q = result.begin();
 		   p != mapOfObjects.end(); p++, q++)
 		 *q = (*p).second;
-	  return result;
    }	  
 };
 
@@ -171,9 +162,12 @@ JNIEXPORT void JNICALL Java_JniComplexExample_register_1object
 JNIEXPORT jobjectArray JNICALL Java_JniComplexExample_recall_1objects
   (JNIEnv *env, jclass clazz)
 {
+   // Temporaries of this call are allocated from the per-thread arena
+   JNICallScope scope;
+
    // Obtain the vector of global references
-   vector<JNIGlobalRef<jobject> *> allObjects =
-	  SampleContainer::getInstance()->exportAllObjects(env);
+   JNIArenaVector<JNIGlobalRef<jobject> *> allObjects;
+   SampleContainer::getInstance()->exportAllObjects(env, allObjects);
    // Create an output array of type 'NameWithInfo[]'
    JNIClass objectClass(env, "NameWithInfo");
    jobjectArray result =
@@ -0,0 +1,318 @@
+/*-----------------------------------------------------------------------------
+ * Opt-in telemetry of array and string access: copied or pinned?
+ *
+ * Get<PrimitiveType>ArrayElements, GetPrimitiveArrayCritical and
+ * GetString[UTF]Chars may either pin the Java data or copy it, and report
+ * which through their 'isCopy' parameter. When JNI_ACCESS_TELEMETRY is
+ * defined (before including any header of this library), JNIResource
+ * records, per kind of access (element type and access mode):
+ * - the number of acquisitions that copied, and that pinned, the data
+ * - the bytes copied in on acquisition, and copied back on release (i.e.
+ *   released copies, unless released with JNI_ABORT)
+ * - the time each acquisition was held, from acquisition to release
+ *
+ * 'isCopy' is always requested from the JVM; an 'isCopy' pointer given by
+ * the application still receives the result. Measuring the size costs one
+ * GetArrayLength/GetString[UTF]Length call per acquisition.
+ *
+ * The statistics are read natively:
+ *
+ *    std::vector<JNIAccessStats> stats = JNIAccessTelemetry::snapshot();
+ *    JNIAccessTelemetry::dump(std::cerr);
+ *
+ * or from Java, through a static native method registered (e.g. in
+ * JNI_OnLoad) with:
+ *
+ *    JNIAccessTelemetry::registerNative(env, "com/example/Stats");
+ *
+ *    // Java: static native long[] accessTelemetry();
+ *
+ * which returns JNIAccessTelemetry::columns values per kind, in kind order
+ * (see JNIAccessTelemetry::name()): acquired, copied, pinned, bytes copied
+ * in, bytes copied out, releases, total hold time (ns), max hold time (ns).
+ *
+ * Without JNI_ACCESS_TELEMETRY, JNI_ACCESS_IS_COPY() passes the 'isCopy'
+ * pointer through, and this file declares nothing else.
+ *
+ * Telemetry requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_ACCESS_TELEMETRY_H_INCLUDED_
+#define _JNI_ACCESS_TELEMETRY_H_INCLUDED_
+
+#ifndef JNI_ACCESS_TELEMETRY
+
+#define JNI_ACCESS_IS_COPY(isCopy) (isCopy)
+
+#else /* JNI_ACCESS_TELEMETRY */
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "jni_declarations.h"
+
+#define JNI_ACCESS_IS_COPY(isCopy) (JNIAccessTelemetry::isCopyFlag(isCopy))
+
+/*-----------------------------------------------------------------------------
+ * Kinds of access: one per element type for Get<PrimitiveType>ArrayElements
+ * and for GetPrimitiveArrayCritical, then the two string accesses.
+ *---------------------------------------------------------------------------*/
+enum JNIAccessMode {
+   JNI_ACCESS_ELEMENTS,
+   JNI_ACCESS_CRITICAL,
+   JNI_ACCESS_STRING
+};
+
+template<class NativeType> struct JNIAccessElement;
+template<> struct JNIAccessElement<jboolean> { enum { index = 0 }; };
+template<> struct JNIAccessElement<jbyte>    { enum { index = 1 }; };
+template<> struct JNIAccessElement<jchar>    { enum { index = 2 }; };
+template<> struct JNIAccessElement<jshort>   { enum { index = 3 }; };
+template<> struct JNIAccessElement<jint>     { enum { index = 4 }; };
+template<> struct JNIAccessElement<jlong>    { enum { index = 5 }; };
+template<> struct JNIAccessElement<jfloat>   { enum { index = 6 }; };
+template<> struct JNIAccessElement<jdouble>  { enum { index = 7 }; };
+
+/*-----------------------------------------------------------------------------
+ * JNIAccessTraits<Settings> tells JNIResource which kind of access its
+ * settings perform (-1: not recorded), how many bytes the acquisition
+ * covers, and whether a release copies the data back. The settings of
+ * jni_resource.h specialize it.
+ *---------------------------------------------------------------------------*/
+template<class JNIResourceSettings>
+struct JNIAccessTraits {
+   enum { kind = -1 };
+
+   static std::uint64_t bytes(JNIEnv *,
+                              typename JNIResourceSettings::JResource) {
+      return 0;
+   }
+
+   template<class ReleaseF>
+   static bool writesBack(const ReleaseF &) { return false; }
+};
+
+/*-----------------------------------------------------------------------------
+ * Statistics of one kind of access
+ *---------------------------------------------------------------------------*/
+struct JNIAccessStats {
+   const char *name;
+   std::uint64_t acquired;
+   std::uint64_t copied;
+   std::uint64_t pinned;
+   std::uint64_t bytesIn;		// copied on acquisition
+   std::uint64_t bytesOut;		// copied back on release
+   std::uint64_t released;
+   std::uint64_t holdNanos;		// total time held
+   std::uint64_t maxHoldNanos;
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIAccessTelemetry: process-wide counters
+ *---------------------------------------------------------------------------*/
+class JNIAccessTelemetry {
+public:
+   enum { elementTypes = 8 };
+   enum { kinds = 2 * elementTypes + 2 };
+   enum { columns = 8 };
+
+   static const char *name(int kind) {
+      static const char *names[kinds] = {
+         "jboolean[]", "jbyte[]", "jchar[]", "jshort[]",
+         "jint[]", "jlong[]", "jfloat[]", "jdouble[]",
+         "jboolean[]/critical", "jbyte[]/critical", "jchar[]/critical",
+         "jshort[]/critical", "jint[]/critical", "jlong[]/critical",
+         "jfloat[]/critical", "jdouble[]/critical",
+         "String/chars", "String/UTF"
+      };
+      return (kind >= 0 && kind < kinds) ? names[kind] : "";
+   }
+
+private:
+   struct Counters {
+      std::atomic<std::uint64_t> value[columns];
+
+      Counters() {
+         for (int c = 0; c < columns; c++)
+            value[c].store(0, std::memory_order_relaxed);
+      }
+   };
+
+   enum { ACQUIRED, COPIED, PINNED, BYTES_IN, BYTES_OUT, RELEASED,
+          HOLD_NANOS, MAX_HOLD_NANOS };
+
+   // 'isCopy' flag of the acquisition in progress on the calling thread
+   struct Probe {
+      jboolean value;
+      jboolean *flag;		// set by isCopyFlag(), or 0
+   };
+
+   static Counters *counters() {
+      static Counters table[kinds];
+      return table;
+   }
+
+   static Probe &probe() {
+      static thread_local Probe p = { JNI_FALSE, 0 };
+      return p;
+   }
+
+   friend class JNIAccessRecord;
+
+public:
+   // Passed as 'isCopy' by the GetF functions: the application's flag if
+   // any, otherwise one owned by the calling thread
+   static jboolean *isCopyFlag(jboolean *isCopy) {
+      Probe &p = probe();
+      p.flag = (isCopy != 0) ? isCopy : &p.value;
+      return p.flag;
+   }
+
+   static std::vector<JNIAccessStats> snapshot() {
+      std::vector<JNIAccessStats> result(kinds);
+      for (int k = 0; k < kinds; k++) {
+         const Counters &c = counters()[k];
+         JNIAccessStats &s = result[k];
+         s.name = name(k);
+         s.acquired = c.value[ACQUIRED].load(std::memory_order_relaxed);
+         s.copied = c.value[COPIED].load(std::memory_order_relaxed);
+         s.pinned = c.value[PINNED].load(std::memory_order_relaxed);
+         s.bytesIn = c.value[BYTES_IN].load(std::memory_order_relaxed);
+         s.bytesOut = c.value[BYTES_OUT].load(std::memory_order_relaxed);
+         s.released = c.value[RELEASED].load(std::memory_order_relaxed);
+         s.holdNanos = c.value[HOLD_NANOS].load(std::memory_order_relaxed);
+         s.maxHoldNanos =
+            c.value[MAX_HOLD_NANOS].load(std::memory_order_relaxed);
+      }
+      return result;
+   }
+
+   // Text export, one line per kind of access that occurred
+   static void dump(std::ostream &out) {
+      std::vector<JNIAccessStats> stats = snapshot();
+      out << "# kind acquired copied pinned bytes_in bytes_out"
+             " mean_hold_ns max_hold_ns\n";
+      for (std::size_t k = 0; k < stats.size(); k++) {
+         const JNIAccessStats &s = stats[k];
+         if (s.acquired == 0)
+            continue;
+         out << s.name << ' ' << s.acquired << ' ' << s.copied << ' '
+             << s.pinned << ' ' << s.bytesIn << ' ' << s.bytesOut << ' '
+             << (s.released ? s.holdNanos / s.released : 0) << ' '
+             << s.maxHoldNanos << '\n';
+      }
+   }
+
+   static void reset() {
+      for (int k = 0; k < kinds; k++)
+         for (int c = 0; c < columns; c++)
+            counters()[k].value[c].store(0, std::memory_order_relaxed);
+   }
+
+   // The statistics as a Java long[] (see the layout above)
+   static jlongArray toJava(JNIEnv *env) {
+      jlong values[kinds * columns];
+      for (int k = 0; k < kinds; k++)
+         for (int c = 0; c < columns; c++)
+            values[k * columns + c] = static_cast<jlong>(
+               counters()[k].value[c].load(std::memory_order_relaxed));
+      jlongArray array = env->NewLongArray(kinds * columns);
+      if (array != 0)
+         env->SetLongArrayRegion(array, 0, kinds * columns, values);
+      return array;
+   }
+
+   // Registers toJava() as the static native method 'method' (with
+   // signature '()[J') of class 'className'
+   static void registerNative(JNIEnv *env, const char *className,
+                              const char *method = "accessTelemetry") {
+      jclass clazz = env->FindClass(className);
+      if (clazz == 0)
+         throw JNIException("Failed to find the access telemetry class");
+      JNINativeMethod native = {
+         const_cast<char *>(method), const_cast<char *>("()[J"),
+         reinterpret_cast<void *>(&accessTelemetry)
+      };
+      jint result = env->RegisterNatives(clazz, &native, 1);
+      env->DeleteLocalRef(clazz);
+      if (result != JNI_OK)
+         throw JNIException("Failed to register the access telemetry method");
+   }
+
+private:
+   static jlongArray JNICALL accessTelemetry(JNIEnv *env, jclass) {
+      return toJava(env);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIAccessRecord: the state of one acquisition, kept by JNIResource
+ *---------------------------------------------------------------------------*/
+class JNIAccessRecord {
+   int _kind;			// -1 if not recorded
+   bool _copy;
+   std::uint64_t _bytes;
+   std::chrono::steady_clock::time_point _start;
+
+   typedef JNIAccessTelemetry _telemetry;
+
+public:
+   JNIAccessRecord() : _kind(-1), _copy(false), _bytes(0) {}
+
+   // Called before the GetF function
+   void begin(int kind, std::uint64_t bytes) {
+      _kind = kind;
+      _bytes = bytes;
+      _telemetry::probe().flag = 0;
+   }
+
+   // Called after the GetF function; acquisitions of null resources (for
+   // which the JVM was not called) and failed ones are not recorded
+   void end(bool acquired) {
+      jboolean *flag = _telemetry::probe().flag;
+      if (_kind < 0 || flag == 0 || !acquired) {
+         _kind = -1;
+         return;
+      }
+      _copy = (*flag != JNI_FALSE);
+      _start = std::chrono::steady_clock::now();
+
+      std::atomic<std::uint64_t> *c = _telemetry::counters()[_kind].value;
+      c[_telemetry::ACQUIRED].fetch_add(1, std::memory_order_relaxed);
+      if (_copy) {
+         c[_telemetry::COPIED].fetch_add(1, std::memory_order_relaxed);
+         c[_telemetry::BYTES_IN].fetch_add(_bytes, std::memory_order_relaxed);
+      }
+      else
+         c[_telemetry::PINNED].fetch_add(1, std::memory_order_relaxed);
+   }
+
+   // Called on release
+   void released(bool writesBack) {
+      if (_kind < 0)
+         return;
+      std::uint64_t nanos = static_cast<std::uint64_t>(
+         std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _start).count());
+
+      std::atomic<std::uint64_t> *c = _telemetry::counters()[_kind].value;
+      if (_copy && writesBack)
+         c[_telemetry::BYTES_OUT].fetch_add(_bytes, std::memory_order_relaxed);
+      c[_telemetry::RELEASED].fetch_add(1, std::memory_order_relaxed);
+      c[_telemetry::HOLD_NANOS].fetch_add(nanos, std::memory_order_relaxed);
+      std::uint64_t max =
+         c[_telemetry::MAX_HOLD_NANOS].load(std::memory_order_relaxed);
+      while (nanos > max && !c[_telemetry::MAX_HOLD_NANOS].compare_exchange_weak(
+                               max, nanos, std::memory_order_relaxed))
+         ;
+      _kind = -1;
+   }
+};
+
+#endif /* JNI_ACCESS_TELEMETRY */
+
+#endif /* _JNI_ACCESS_TELEMETRY_H_INCLUDED_ */
@@ -0,0 +1,257 @@
+/*-----------------------------------------------------------------------------
+ * Per-thread scratch memory for native calls.
+ *
+ * Native methods frequently build short-lived temporaries (strings copied
+ * out of Java, vectors of results) that are freed again before the method
+ * returns. JNIArena is a fixed-capacity bump allocator owned by each
+ * thread, and JNICallScope is a resource object which rewinds the arena
+ * when the native call ends, so that such temporaries cost neither malloc
+ * nor free:
+ *
+ *    JNIEXPORT void JNICALL Java_Foo_bar(JNIEnv *env, jclass, jstring s) {
+ *       JNICallScope scope;
+ *       JNIArenaString name = JNIArenaCopy(JNIStringUTFChars(env, s));
+ *       JNIArenaVector<jint> values;
+ *       ...
+ *    }  // all the arena memory is reclaimed here
+ *
+ * Memory obtained from the arena (directly or through JNIArenaAllocator)
+ * must not outlive the innermost enclosing JNICallScope. Scopes may be
+ * nested. When the arena is exhausted, allocations overflow to the heap
+ * and are freed when the owning scope ends. Allocations made outside any
+ * JNICallScope are never reclaimed (beyond deallocate() of the most recent
+ * one) until the thread exits: their overflow blocks accumulate, so
+ * long-lived threads should only use the arena within scopes.
+ *
+ * The existing helpers do not use the arena: asString() returns a
+ * std::string, and JNIArray accesses the memory the Java VM provides.
+ * Their arena counterparts are the JNIArenaCopy() functions below.
+ *
+ * The capacity of each thread's arena is JNI_ARENA_CAPACITY bytes
+ * (64 KB unless defined otherwise before including this file).
+ *
+ * Requires C++11 (thread_local).
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_ARENA_H_INCLUDED_
+#define _JNI_ARENA_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_utils.h"
+#include "jni_resource.h"
+
+#ifndef JNI_ARENA_CAPACITY
+#define JNI_ARENA_CAPACITY (64 * 1024)
+#endif
+
+/*-----------------------------------------------------------------------------
+ * JNIArena: a bump allocator over a fixed buffer, with heap overflow.
+ *
+ * - allocate(size, align) returns memory from the buffer, or from the heap
+ *   once the buffer is exhausted.
+ * - deallocate(p, size) reclaims the memory only if it was the most recent
+ *   allocation (which is the common case for a growing vector); otherwise
+ *   it is a no-op.
+ * - mark()/rewind(mark) release everything allocated after the mark,
+ *   including heap overflow blocks.
+ * - local() returns the arena of the calling thread.
+ *---------------------------------------------------------------------------*/
+class JNIArena {
+   // Header of a heap overflow block
+   struct Overflow {
+      Overflow *next;
+   };
+
+public:
+   // Position in the arena, as returned by mark()
+   struct Mark {
+      std::size_t top;
+      Overflow *overflow;
+   };
+
+private:
+   char *_buffer;			// fixed buffer (allocated on first use)
+   std::size_t _capacity;	// size of the buffer
+   std::size_t _top;		// first free byte in the buffer
+   Overflow *_overflow;		// overflow blocks, most recent first
+   std::size_t _highWater;	// maximal value of '_top' observed
+
+   JNIArena(const JNIArena &);
+   JNIArena &operator= (const JNIArena &);
+
+public:
+   explicit JNIArena(std::size_t capacity = JNI_ARENA_CAPACITY) :
+      _buffer(0), _capacity(capacity), _top(0), _overflow(0), _highWater(0) {}
+
+   ~JNIArena() {
+      Mark origin = { 0, 0 };
+      rewind(origin);
+      std::free(_buffer);
+   }
+
+   static JNIArena &local() {
+      static thread_local JNIArena arena;
+      return arena;
+   }
+
+   void *allocate(std::size_t size,
+                  std::size_t align = alignof(std::max_align_t)) {
+      if (_buffer == 0 && _capacity > 0) {
+         _buffer = static_cast<char *>(std::malloc(_capacity));
+         if (_buffer == 0)
+            _capacity = 0;
+      }
+      std::size_t base = reinterpret_cast<std::size_t>(_buffer);
+      std::size_t start = ((base + _top + align - 1) & ~(align - 1)) - base;
+      if (_buffer != 0 && start + size <= _capacity) {
+         _top = start + size;
+         if (_top > _highWater)
+            _highWater = _top;
+         return _buffer + start;
+      }
+      return allocateOverflow(size, align);
+   }
+
+   void deallocate(void *p, std::size_t size) {
+      char *block = static_cast<char *>(p);
+      if (_buffer != 0 && block >= _buffer && block + size == _buffer + _top)
+         _top = block - _buffer;
+   }
+
+   Mark mark() const {
+      Mark m = { _top, _overflow };
+      return m;
+   }
+
+   void rewind(const Mark &m) {
+      while (_overflow != m.overflow) {
+         Overflow *next = _overflow->next;
+         std::free(_overflow);
+         _overflow = next;
+      }
+      _top = m.top;
+   }
+
+   // Statistics
+   std::size_t capacity() const { return _capacity; }
+   std::size_t used() const { return _top; }
+   std::size_t highWater() const { return _highWater; }
+   bool overflowed() const { return _overflow != 0; }
+
+private:
+   void *allocateOverflow(std::size_t size, std::size_t align) {
+      std::size_t header = (sizeof(Overflow) + align - 1) & ~(align - 1);
+      if (align > alignof(std::max_align_t))
+         header += align;
+      char *raw = static_cast<char *>(std::malloc(header + size));
+      if (raw == 0)
+         throw std::bad_alloc();
+      Overflow *block = reinterpret_cast<Overflow *>(raw);
+      block->next = _overflow;
+      _overflow = block;
+      std::size_t start =
+         (reinterpret_cast<std::size_t>(raw) + header) & ~(align - 1);
+      return reinterpret_cast<void *>(start);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNICallScope marks the calling thread's arena on construction and rewinds
+ * it on destruction. It is meant to be the first statement of a native
+ * method that uses arena memory.
+ *---------------------------------------------------------------------------*/
+class JNICallScope {
+   JNIArena &_arena;		// arena of the current thread
+   JNIArena::Mark _mark;	// arena position at scope entry
+
+   JNICallScope(const JNICallScope &);
+   JNICallScope &operator= (const JNICallScope &);
+
+public:
+   JNICallScope() : _arena(JNIArena::local()), _mark(_arena.mark()) {}
+   ~JNICallScope() { _arena.rewind(_mark); }
+
+   JNIArena &arena() { return _arena; }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIArenaAllocator: an STL allocator drawing from a JNIArena (by default,
+ * the arena of the constructing thread).
+ *---------------------------------------------------------------------------*/
+template<class T>
+class JNIArenaAllocator {
+   JNIArena *_arena;
+
+public:
+   typedef T value_type;
+
+   template<class U>
+   struct rebind {
+      typedef JNIArenaAllocator<U> other;
+   };
+
+   JNIArenaAllocator() : _arena(&JNIArena::local()) {}
+   explicit JNIArenaAllocator(JNIArena &arena) : _arena(&arena) {}
+
+   template<class U>
+   JNIArenaAllocator(const JNIArenaAllocator<U> &x) : _arena(x.arena()) {}
+
+   T *allocate(std::size_t n) {
+      return static_cast<T *>(_arena->allocate(n * sizeof(T), alignof(T)));
+   }
+   void deallocate(T *p, std::size_t n) {
+      _arena->deallocate(p, n * sizeof(T));
+   }
+
+   JNIArena *arena() const { return _arena; }
+
+   template<class U>
+   bool operator== (const JNIArenaAllocator<U> &x) const {
+      return _arena == x.arena();
+   }
+   template<class U>
+   bool operator!= (const JNIArenaAllocator<U> &x) const {
+      return _arena != x.arena();
+   }
+};
+
+typedef std::basic_string<char, std::char_traits<char>,
+                          JNIArenaAllocator<char> > JNIArenaString;
+
+template<class T>
+using JNIArenaVector = std::vector<T, JNIArenaAllocator<T> >;
+
+/*-----------------------------------------------------------------------------
+ * Arena-backed counterparts of the string and array copying helpers:
+ * - JNIArenaCopy(JNIStringUTFChars) is the arena version of asString()
+ * - JNIArenaCopy(JNIEnv *, ArrayType) copies a primitive Java array into
+ *   an arena vector through a single Get<PrimitiveType>ArrayRegion call.
+ *---------------------------------------------------------------------------*/
+
+inline JNIArenaString JNIArenaCopy(const JNIStringUTFChars &str) {
+   return (str.get() != 0) ? JNIArenaString(str.get()) : JNIArenaString();
+}
+
+#define JNI_ARENA_COPY(Type)												\
+inline JNIArenaVector<NATIVE_TYPE(Type)>									\
+JNIArenaCopy(JNIEnv *env, ARRAY_TYPE(Type) array) {							\
+   jsize len = (array == 0) ? 0 : env->GetArrayLength(array);				\
+   JNIArenaVector<NATIVE_TYPE(Type)> result(len);							\
+   if (len > 0)																\
+      GetArrayRegion(env, array, 0, len, result.data());					\
+   return result;															\
+}
+
+/*-----------------------------------------------------------------------------
+ * Combo instantiation of JNIArenaCopy for all primitive types
+ *---------------------------------------------------------------------------*/
+
+INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_ARENA_COPY)
+
+#endif /* _JNI_ARENA_H_INCLUDED_ */
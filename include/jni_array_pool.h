@@ -0,0 +1,247 @@
+/*-----------------------------------------------------------------------------
+ * Pooled copy mode for native arrays.
+ *
+ * When Get<PrimitiveType>ArrayElements copies, the JVM allocates and frees
+ * a buffer for every JNIArray. JNIPooledArray is a drop-in alternative
+ * which always copies: the elements are read with Get<PrimitiveType>
+ * ArrayRegion into a buffer taken from a per-thread pool of size classes,
+ * and written back with Set<PrimitiveType>ArrayRegion on release.
+ * Repeated calls with arrays of similar sizes therefore allocate nothing.
+ *
+ * Release modes follow Release<PrimitiveType>ArrayElements:
+ * - 0:          copy back the contents and free the buffer (the default)
+ * - JNI_COMMIT: copy back the contents but keep the buffer
+ * - JNI_ABORT:  free the buffer without copying back
+ *
+ * Pool geometry may be adjusted by defining, before including this file:
+ * - JNI_BUFFER_POOL_CLASSES: number of power-of-two size classes, starting
+ *   at 64 bytes (default 20, i.e. buffers of up to 32 MB are pooled)
+ * - JNI_BUFFER_POOL_DEPTH: buffers kept per size class (default 4)
+ *
+ * Requires C++11 (thread_local).
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_ARRAY_POOL_H_INCLUDED_
+#define _JNI_ARRAY_POOL_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "jni_declarations.h"
+#include "jni_utils.h"
+#include "jni_resource.h"
+
+#ifndef JNI_BUFFER_POOL_CLASSES
+#define JNI_BUFFER_POOL_CLASSES 20
+#endif
+
+#ifndef JNI_BUFFER_POOL_DEPTH
+#define JNI_BUFFER_POOL_DEPTH 4
+#endif
+
+/*-----------------------------------------------------------------------------
+ * JNIBufferPool: a per-thread cache of native buffers, by size class.
+ *
+ * Every buffer is preceded by a header recording its size class and a
+ * user-defined 'length' (the element count, for pooled arrays).
+ * Buffers larger than the largest size class are allocated and freed
+ * directly. A buffer may be released on a thread other than the one that
+ * acquired it, in which case it is cached by the releasing thread.
+ *---------------------------------------------------------------------------*/
+class JNIBufferPool {
+public:
+   static const std::size_t classes = JNI_BUFFER_POOL_CLASSES;
+   static const std::size_t depth = JNI_BUFFER_POOL_DEPTH;
+   static const std::size_t unpooled = ~static_cast<std::size_t>(0);
+
+   // Buffer header; the union keeps the data maximally aligned
+   union Header {
+      struct {
+         std::size_t sizeClass;	// size class, or 'unpooled'
+         std::size_t length;		// user-defined length
+      } info;
+      std::max_align_t align;
+   };
+
+private:
+   void *_free[classes][depth];	// cached buffers (headers)
+   std::size_t _count[classes];	// number of cached buffers per class
+   std::size_t _hits;			// acquisitions served from the cache
+   std::size_t _misses;			// acquisitions that allocated
+
+   JNIBufferPool(const JNIBufferPool &);
+   JNIBufferPool &operator= (const JNIBufferPool &);
+
+public:
+   JNIBufferPool() : _hits(0), _misses(0) {
+      for (std::size_t c = 0; c < classes; c++)
+         _count[c] = 0;
+   }
+
+   ~JNIBufferPool() {
+      for (std::size_t c = 0; c < classes; c++)
+         while (_count[c] > 0)
+            std::free(_free[c][--_count[c]]);
+   }
+
+   static JNIBufferPool &local() {
+      static thread_local JNIBufferPool pool;
+      return pool;
+   }
+
+   // Capacity (in bytes) of the buffers of size class 'c'
+   static std::size_t classCapacity(std::size_t c) {
+      return static_cast<std::size_t>(64) << c;
+   }
+
+   // Obtain a buffer of at least 'bytes' bytes
+   void *acquire(std::size_t bytes) {
+      std::size_t c = 0;
+      while (c < classes && classCapacity(c) < bytes)
+         c++;
+
+      Header *header;
+      if (c < classes && _count[c] > 0) {
+         header = static_cast<Header *>(_free[c][--_count[c]]);
+         _hits++;
+      }
+      else {
+         std::size_t capacity = (c < classes) ? classCapacity(c) : bytes;
+         header = static_cast<Header *>(
+            std::malloc(sizeof(Header) + capacity));
+         if (header == 0)
+            throw std::bad_alloc();
+         header->info.sizeClass = (c < classes) ? c : unpooled;
+         _misses++;
+      }
+      header->info.length = 0;
+      return header + 1;
+   }
+
+   // Return a buffer obtained from acquire()
+   void release(void *data) {
+      Header *h = header(data);
+      std::size_t c = h->info.sizeClass;
+      if (c != unpooled && _count[c] < depth)
+         _free[c][_count[c]++] = h;
+      else
+         std::free(h);
+   }
+
+   static Header *header(void *data) {
+      return static_cast<Header *>(data) - 1;
+   }
+
+   // Statistics
+   std::size_t hits() const { return _hits; }
+   std::size_t misses() const { return _misses; }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIPooledArraySettings implements JNIResourceSettings for pooled arrays.
+ * JResource type corresponds to the Java array type, and Resource type
+ * corresponds to a pointer to NativeType (as for JNIArraySettings).
+ * The element count is kept in the buffer header, so that release needs
+ * no further JNI calls besides Set<PrimitiveType>ArrayRegion.
+ *---------------------------------------------------------------------------*/
+template<class NativeType>
+struct JNIPooledArraySettings {
+   typedef typename ARRAY_TYPE_OF(NativeType) JResource;
+   typedef NativeType *Resource;
+
+   // Copy the array into a pooled buffer with Get<PrimitiveType>ArrayRegion.
+   // The elements are always copied; if 'isCopy' is given, it is set to
+   // JNI_TRUE.
+   struct GetF {
+      jboolean *_isCopy;
+      GetF(jboolean *isCopy = 0) : _isCopy(isCopy) {}
+      Resource operator() (JNIEnv *env, JResource array) const {
+         if (array == 0)
+            return 0;
+         jsize len = env->GetArrayLength(array);
+         Resource buf = static_cast<Resource>(
+            JNIBufferPool::local().acquire(len * sizeof(NativeType)));
+         JNIBufferPool::header(buf)->info.length = len;
+         if (len > 0)
+            GetArrayRegion(env, array, 0, len, buf);
+         if (_isCopy != 0)
+            *_isCopy = JNI_TRUE;
+         return buf;
+      }
+   };
+
+   // Write back with Set<PrimitiveType>ArrayRegion (unless 'mode' is
+   // JNI_ABORT), then return the buffer to the pool (unless 'mode' is
+   // JNI_COMMIT).
+   struct ReleaseF {
+      jint _mode;
+      ReleaseF(jint mode = 0) : _mode(mode) {}
+      void operator() (JNIEnv *env, JResource array, Resource buf) const {
+         if (buf == 0)
+            return;
+         jsize len = static_cast<jsize>(length(buf));
+         if (_mode != JNI_ABORT && array != 0 && len > 0)
+            SetArrayRegion(env, array, 0, len, buf);
+         if (_mode != JNI_COMMIT)
+            JNIBufferPool::local().release(buf);
+      }
+   };
+
+   static std::size_t length(Resource buf) {
+      return (buf == 0) ? 0 : JNIBufferPool::header(buf)->info.length;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIPooledArray offers the same interface as JNIArray.
+ * Since JNIResource gives up ownership on any release, a JNI_COMMIT
+ * release is performed without going through ReleaseResource, so that the
+ * array remains usable (and is written back again on destruction).
+ *---------------------------------------------------------------------------*/
+template<class NativeType>
+class JNIPooledArray : public JNIResource<JNIPooledArraySettings<NativeType> >
+{
+   typedef JNIPooledArraySettings<NativeType> _settings;
+   typedef JNIResource<_settings> _super;
+   typedef typename ARRAY_TYPE_OF(NativeType) ArrayType;
+
+public:
+   JNIPooledArray() {}
+   JNIPooledArray(JNIEnv *env, ArrayType array) : _super(env, array) {}
+   JNIPooledArray(JNIEnv *env, ArrayType array, jboolean *isCopy) :
+      _super(env, array, typename _settings::GetF(isCopy)) {}
+
+   // The following two constructors access the requested Java
+   // resource field by calling GetJResource<ArrayType>(...)
+   template<class T>
+   JNIPooledArray(JNIEnv *env, T arg, const char *name) :
+      _super(env, GetJResource<ArrayType>()(env, arg, name)) {}
+
+   template<class T>
+   JNIPooledArray(JNIEnv *env, T arg, const char *name, bool isStatic) :
+      _super(env, GetJResource<ArrayType>()(env, arg, name, isStatic)) {}
+
+   // Release the array with the given mode (0, JNI_COMMIT or JNI_ABORT)
+   void CustomRelease(JNIEnv *env, int mode = 0) {
+      typename _settings::ReleaseF releaseF(mode);
+      if (mode == JNI_COMMIT)
+         releaseF(env, this->_jresource, this->_resource);
+      else
+         this->ReleaseResource(env, releaseF);
+   }
+   void CustomRelease(int mode = 0) {
+      JNIEnvironment env(this->_vm);
+      CustomRelease(env, mode);
+   }
+
+   NativeType &operator[] (int i) { return this->_resource[i]; }
+   const NativeType &operator[] (int i) const { return this->_resource[i]; }
+
+   // The length is known from the copy, no JNI call is needed
+   int size() const {
+      return static_cast<int>(_settings::length(this->_resource));
+   }
+};
+
+#endif /* _JNI_ARRAY_POOL_H_INCLUDED_ */
@@ -0,0 +1,395 @@
+/*-----------------------------------------------------------------------------
+ * Asynchronous native calls, completed through java.util.concurrent.
+ * CompletableFuture.
+ *
+ * A native method which would block its Java caller can instead hand its
+ * work to a JNIExecutor, and return a CompletableFuture at once:
+ *
+ *    static JNIExecutor *executor;	// created in JNI_OnLoad
+ *
+ *    JNIEXPORT jobject JNICALL
+ *    Java_Foo_compressAsync(JNIEnv *env, jobject self, jbyteArray data) {
+ *       return JNIAsync(*executor, env, [](JNIEnv *env, jbyteArray data) {
+ *          JNIArray<jbyte> bytes(env, data);
+ *          ...
+ *          return result;				// local reference, or void
+ *       }, data);
+ *    }
+ *
+ * - Reference arguments (anything convertible to 'jobject') are promoted to
+ *   JNIGlobalRef on the calling thread, and released once the work is done;
+ *   other arguments are copied.
+ * - The work runs on one of the executor's threads, which are attached to
+ *   the Java VM for their whole lifetime (as daemon threads, which do not
+ *   hold up the VM's shutdown), and receives that thread's JNIEnv. Local
+ *   references created by the work are freed after each task.
+ * - The future is completed with the returned object (null for 'void'
+ *   work). If the work throws, or leaves a Java exception pending, the
+ *   future is completed exceptionally instead (C++ exceptions are reported
+ *   as a RuntimeException carrying what()).
+ * - The executor's queue is bounded. When it is full, JNIAsync either
+ *   blocks the caller until there is room (JNI_EXECUTOR_BLOCK), or returns
+ *   a future failed with RejectedExecutionException (JNI_EXECUTOR_REJECT).
+ *
+ * The CompletableFuture class and method ids are looked up once, on the
+ * first call.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_ASYNC_H_INCLUDED_
+#define _JNI_ASYNC_H_INCLUDED_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_env.h"
+#include "jni_instrument.h"
+#include "jni_resource.h"
+#include "jni_object_view.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIExecutor: a fixed set of attached worker threads consuming a bounded
+ * queue of tasks. Each task receives the JNIEnv of the worker running it.
+ *
+ * submit() returns false if the task was not queued: the executor is
+ * shutting down, no worker could attach to the Java VM, or the queue is
+ * full and the policy is JNI_EXECUTOR_REJECT. Workers which cannot attach
+ * exit at once, and submit() waits until every worker has tried. The
+ * destructor runs the tasks still queued, then joins the workers.
+ *---------------------------------------------------------------------------*/
+enum JNIExecutorPolicy {
+   JNI_EXECUTOR_BLOCK,		// wait for room in the queue
+   JNI_EXECUTOR_REJECT		// fail the submission
+};
+
+class JNIExecutor {
+public:
+   typedef std::function<void(JNIEnv *)> Task;
+
+private:
+   JavaVM *_vm;
+   std::size_t _capacity;			// maximal number of queued tasks
+   JNIExecutorPolicy _policy;
+   std::vector<std::thread> _threads;
+
+   mutable std::mutex _lock;			// protects the fields below
+   std::condition_variable _notEmpty;
+   std::condition_variable _notFull;
+   std::deque<Task> _queue;
+   bool _stop;
+   std::size_t _rejected;			// submissions refused so far
+   std::size_t _starting;			// workers not attached yet
+   std::size_t _running;			// attached workers
+
+   JNIExecutor(const JNIExecutor &);
+   JNIExecutor &operator= (const JNIExecutor &);
+
+public:
+   JNIExecutor(JavaVM *vm, unsigned threads = 1, std::size_t capacity = 256,
+               JNIExecutorPolicy policy = JNI_EXECUTOR_BLOCK) :
+      _vm(vm), _capacity(capacity), _policy(policy) {
+      start(threads);
+   }
+   JNIExecutor(JNIEnv *env, unsigned threads = 1, std::size_t capacity = 256,
+               JNIExecutorPolicy policy = JNI_EXECUTOR_BLOCK) :
+      _vm(0), _capacity(capacity), _policy(policy) {
+      env->GetJavaVM(&_vm);
+      start(threads);
+   }
+
+   ~JNIExecutor() {
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         _stop = true;
+      }
+      _notEmpty.notify_all();
+      _notFull.notify_all();
+      for (std::size_t i = 0; i < _threads.size(); i++)
+         _threads[i].join();
+   }
+
+   bool submit(Task task) {
+      std::unique_lock<std::mutex> lock(_lock);
+      _notFull.wait(lock, [this] { return _stop || _starting == 0; });
+      if (_policy == JNI_EXECUTOR_BLOCK)
+         _notFull.wait(lock, [this] {
+            return _stop || _running == 0 || _queue.size() < _capacity;
+         });
+      if (_stop || _running == 0 || _queue.size() >= _capacity) {
+         _rejected++;
+         return false;
+      }
+      _queue.push_back(std::move(task));
+      lock.unlock();
+      _notEmpty.notify_one();
+      return true;
+   }
+
+   // Statistics
+   std::size_t pending() const {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _queue.size();
+   }
+   std::size_t rejected() const {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _rejected;
+   }
+   std::size_t capacity() const { return _capacity; }
+   std::size_t size() const { return _threads.size(); }
+
+private:
+   void start(unsigned threads) {
+      _stop = false;
+      _rejected = 0;
+      if (_capacity == 0)
+         _capacity = 1;
+      if (threads == 0)
+         threads = 1;
+      _starting = threads;
+      _running = 0;
+      for (unsigned i = 0; i < threads; i++)
+         _threads.push_back(std::thread(&JNIExecutor::main, this));
+   }
+
+   void main() {
+      std::unique_ptr<JNIEnvironment> env;
+      try {
+         if (_vm != 0)
+            env.reset(new JNIEnvironment(_vm, true));	// detached on exit
+      }
+      catch(JNIException &e) {
+         // Unable to attach: the worker exits, as tasks need a JNIEnv
+      }
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         _starting--;
+         if (env)
+            _running++;
+      }
+      _notFull.notify_all();
+      if (env)
+         loop(*env);
+   }
+
+   void loop(JNIEnv *env) {
+      for (;;) {
+         Task task;
+         {
+            std::unique_lock<std::mutex> lock(_lock);
+            _notEmpty.wait(lock, [this] { return _stop || !_queue.empty(); });
+            if (_queue.empty())
+               return;
+            task = std::move(_queue.front());
+            _queue.pop_front();
+         }
+         _notFull.notify_one();
+         run(env, task);
+      }
+   }
+
+   // Runs a task in its own local frame, since a worker never returns to
+   // Java to have its local references freed
+   static void run(JNIEnv *env, Task &task) {
+      bool framed = (env->PushLocalFrame(16) == 0);
+      try {
+         task(env);
+      }
+      catch(...) {
+         // Tasks report their own failures
+      }
+      if (env->ExceptionCheck())
+         env->ExceptionClear();
+      if (framed)
+         env->PopLocalFrame(0);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNICompletableFuture caches the class and method ids needed to create and
+ * complete futures (and to build the exceptions that fail them).
+ *---------------------------------------------------------------------------*/
+class JNICompletableFuture {
+   JNIGlobalRef<jclass> _futureClass;
+   JNIGlobalRef<jclass> _runtimeClass;
+   JNIGlobalRef<jclass> _rejectedClass;
+   jmethodID _ctor;					// CompletableFuture()
+   jmethodID _complete;				// complete(Object)
+   jmethodID _completeExceptionally;	// completeExceptionally(Throwable)
+   jmethodID _runtimeCtor;			// RuntimeException(String)
+   jmethodID _rejectedCtor;			// RejectedExecutionException(String)
+
+   JNICompletableFuture(JNIEnv *env) :
+      _futureClass(env, JNIClass(env,
+         "java/util/concurrent/CompletableFuture")),
+      _runtimeClass(env, JNIClass(env, "java/lang/RuntimeException")),
+      _rejectedClass(env, JNIClass(env,
+         "java/util/concurrent/RejectedExecutionException")) {
+      _ctor = method(env, _futureClass, "<init>", "()V");
+      _complete = method(env, _futureClass, "complete",
+                         "(Ljava/lang/Object;)Z");
+      _completeExceptionally = method(env, _futureClass,
+         "completeExceptionally", "(Ljava/lang/Throwable;)Z");
+      _runtimeCtor = method(env, _runtimeClass, "<init>",
+                            "(Ljava/lang/String;)V");
+      _rejectedCtor = method(env, _rejectedClass, "<init>",
+                             "(Ljava/lang/String;)V");
+   }
+
+public:
+   static const JNICompletableFuture &get(JNIEnv *env) {
+      static JNICompletableFuture ids(env);
+      return ids;
+   }
+
+   // Returns a local reference to a new, incomplete future
+   jobject create(JNIEnv *env) const {
+      JNI_INSTRUMENT("CompletableFuture::<init>");
+      jobject future = env->NewObject(_futureClass.get(), _ctor);
+      if (future == 0)
+         throw JNIException("Failed to create a CompletableFuture");
+      return future;
+   }
+
+   void complete(JNIEnv *env, jobject future, jobject value) const {
+      JNI_INSTRUMENT("CompletableFuture::complete");
+      env->CallBooleanMethod(future, _complete, value);
+   }
+
+   void fail(JNIEnv *env, jobject future, jthrowable cause) const {
+      JNI_INSTRUMENT("CompletableFuture::completeExceptionally");
+      env->CallBooleanMethod(future, _completeExceptionally, cause);
+   }
+
+   // Fails the future with a RuntimeException (or, if 'rejected' is set, a
+   // RejectedExecutionException) with the given message
+   void fail(JNIEnv *env, jobject future, const char *message,
+             bool rejected = false) const {
+      jstring text = env->NewStringUTF(message);
+      jobject cause = rejected ?
+         env->NewObject(_rejectedClass.get(), _rejectedCtor, text) :
+         env->NewObject(_runtimeClass.get(), _runtimeCtor, text);
+      if (cause != 0)
+         fail(env, future, static_cast<jthrowable>(cause));
+      env->DeleteLocalRef(cause);
+      env->DeleteLocalRef(text);
+   }
+
+private:
+   static jmethodID method(JNIEnv *env, jclass clazz, const char *name,
+                           const char *sig) {
+      jmethodID id = env->GetMethodID(clazz, name, sig);
+      if (id == 0)
+         throw JNIException("Failed to get a CompletableFuture method id");
+      return id;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIAsyncArg determines how an argument is carried over to the worker:
+ * references are held by a (shared) JNIGlobalRef, other values are copied.
+ *---------------------------------------------------------------------------*/
+template<class T, bool IsReference =
+   std::is_pointer<T>::value && std::is_convertible<T, jobject>::value>
+struct JNIAsyncArg {
+   typedef T Held;
+   static Held hold(JNIEnv *, const T &x) { return x; }
+   static T get(const Held &h) { return h; }
+};
+
+template<class T>
+struct JNIAsyncArg<T, true> {
+   typedef std::shared_ptr<JNIGlobalRef<T> > Held;
+   static Held hold(JNIEnv *env, T x) {
+      return std::make_shared<JNIGlobalRef<T> >(env, x);
+   }
+   static T get(const Held &h) { return h->get(); }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIAsyncTask: the work, its held arguments and the future to complete
+ *---------------------------------------------------------------------------*/
+template<class Work, class... Args>
+class JNIAsyncTask {
+   typedef std::tuple<typename JNIAsyncArg<Args>::Held...> HeldArgs;
+   typedef typename JNIMakeIndexList<sizeof...(Args)>::type _indices;
+   typedef decltype(std::declval<Work &>()(std::declval<JNIEnv *>(),
+                                           std::declval<Args>()...)) Result;
+
+   Work _work;
+   HeldArgs _args;
+   std::shared_ptr<JNIGlobalRef<jobject> > _future;
+
+public:
+   JNIAsyncTask(JNIEnv *env, jobject future, const Work &work,
+                const Args &...args) :
+      _work(work), _args(JNIAsyncArg<Args>::hold(env, args)...),
+      _future(std::make_shared<JNIGlobalRef<jobject> >(env, future)) {}
+
+   void operator() (JNIEnv *env) {
+      const JNICompletableFuture &ids = JNICompletableFuture::get(env);
+      jobject future = _future->get();
+      try {
+         jobject result = invoke(env, _indices(),
+                                 std::is_void<Result>());
+         if (env->ExceptionCheck()) {
+            jthrowable cause = env->ExceptionOccurred();
+            env->ExceptionClear();
+            ids.fail(env, future, cause);
+         }
+         else
+            ids.complete(env, future, result);
+      }
+      catch(std::exception &e) {
+         if (env->ExceptionCheck())
+            env->ExceptionClear();
+         ids.fail(env, future, e.what());
+      }
+      catch(...) {
+         if (env->ExceptionCheck())
+            env->ExceptionClear();
+         ids.fail(env, future, "Native task failed");
+      }
+   }
+
+private:
+   template<std::size_t... I>
+   jobject invoke(JNIEnv *env, JNIIndexList<I...>, std::false_type) {
+      return _work(env, JNIAsyncArg<Args>::get(std::get<I>(_args))...);
+   }
+
+   template<std::size_t... I>
+   jobject invoke(JNIEnv *env, JNIIndexList<I...>, std::true_type) {
+      _work(env, JNIAsyncArg<Args>::get(std::get<I>(_args))...);
+      return 0;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIAsync(executor, env, work, args...) queues work(env', args...) on the
+ * executor, and returns a local reference to the CompletableFuture it will
+ * complete. 'work' returns a local reference (or nothing).
+ *---------------------------------------------------------------------------*/
+template<class Work, class... Args>
+jobject JNIAsync(JNIExecutor &executor, JNIEnv *env, Work work,
+                 Args... args) {
+   const JNICompletableFuture &ids = JNICompletableFuture::get(env);
+   jobject future = ids.create(env);
+   JNIAsyncTask<Work, Args...> task(env, future, work, args...);
+   if (!executor.submit(task))
+      ids.fail(env, future, "Native task rejected by the executor", true);
+   return future;
+}
+
+#endif /* _JNI_ASYNC_H_INCLUDED_ */
@@ -0,0 +1,888 @@
+/*-----------------------------------------------------------------------------
+ * Typed pixel access and image kernels for Android Bitmaps.
+ *
+ * JNIBitmapView<Format> is a typed view of the pixels of a locked Bitmap
+ * (JNIAndroidBitmap) or of any buffer with the same layout. Its rows are
+ * arrays of JNIBitmapFormat<Format>::Pixel:
+ *
+ *    JNIAndroidBitmap bitmap(env, jbitmap);
+ *    JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_8888> pixels(bitmap);
+ *    JNIRGBA8888 *row = pixels.row(y);
+ *
+ * - ANDROID_BITMAP_FORMAT_RGBA_8888: JNIRGBA8888 (bytes R, G, B, A)
+ * - ANDROID_BITMAP_FORMAT_RGB_565:   uint16_t (R in the 5 high bits)
+ * - ANDROID_BITMAP_FORMAT_A_8:       uint8_t
+ * - ANDROID_BITMAP_FORMAT_RGBA_F16:  JNIRGBAF16 (four half floats)
+ *
+ * JNIBitmapKernels transforms whole views:
+ * - convert(src, dst):           between any two formats, same size
+ * - premultiply(view):           color channels multiplied by alpha
+ *                                (RGBA_8888 and RGBA_F16)
+ * - unpremultiply(view):         the inverse: color channels divided by
+ *                                alpha (0 where alpha is 0)
+ * - blur(src, dst, radius):      box blur over (2 * radius + 1)^2 pixels,
+ *                                with clamped edges; 'src' and 'dst' may
+ *                                be the same view
+ * - resize(src, dst, filter):    nearest or bilinear, same format
+ *
+ * Every kernel takes an optional JNIThreadPool, across which the rows are
+ * split in bands of 'grain' rows (by default, eight bands per worker).
+ * Premultiplication of RGBA_8888, and conversions between RGBA_8888 and
+ * RGB_565 or A_8, work on whole pixels in vector registers (at the level
+ * selected by JNIKernels on x86, with NEON on ARM); unpremultiplication
+ * of RGBA_8888 divides a pixel at a time; the other transforms go through
+ * rows of normalized RGBA floats.
+ *
+ * The kernels make no JNI calls. Off-device, <android/bitmap.h> and the
+ * AndroidBitmap_* functions can be supplied by the mock in
+ * benchmark/mock.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_BITMAP_H_INCLUDED_
+#define _JNI_BITMAP_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "jni_android.h"
+#include "jni_kernels.h"
+#include "jni_parallel.h"
+
+#if defined(JNI_KERNELS_X86)
+#define JNI_BITMAP_VECTOR 1
+#define JNI_BITMAP_INLINE JNI_KERNEL_INLINE
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__ARM_NEON)
+#define JNI_BITMAP_VECTOR 1
+#define JNI_BITMAP_INLINE inline __attribute__((always_inline))
+#endif
+
+#ifdef JNI_BITMAP_VECTOR
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Pixel types, and half float conversions (round to nearest even)
+ *---------------------------------------------------------------------------*/
+struct JNIRGBA8888 {
+   uint8_t r, g, b, a;
+};
+
+struct JNIRGBAF16 {
+   uint16_t r, g, b, a;
+};
+
+struct JNIHalf {
+   static float toFloat(uint16_t h) {
+      uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+      uint32_t exponent = (h >> 10) & 0x1fu;
+      uint32_t mantissa = h & 0x3ffu;
+      uint32_t bits;
+      if (exponent == 0x1f)			// infinity or NaN
+         bits = sign | 0x7f800000u | (mantissa << 13);
+      else if (exponent != 0)		// normal
+         bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+      else {						// zero or subnormal: mantissa * 2^-24
+         float f = mantissa * (1.0f / 16777216.0f);
+         return sign ? -f : f;
+      }
+      float f;
+      std::memcpy(&f, &bits, sizeof(f));
+      return f;
+   }
+
+   static uint16_t fromFloat(float f) {
+      uint32_t bits;
+      std::memcpy(&bits, &f, sizeof(bits));
+      uint32_t sign = bits & 0x80000000u;
+      bits ^= sign;
+      uint32_t h;
+      if (bits >= 0x47800000u)			// 2^16 and above, infinity, NaN
+         h = (bits > 0x7f800000u) ? 0x7e00u : 0x7c00u;
+      else if (bits < 0x38800000u) {	// below 2^-14: subnormal or zero
+         // Adding 0.5 aligns the mantissa, rounded, on its low bits
+         const uint32_t magicBits = 126u << 23;
+         float magic, sum;
+         std::memcpy(&magic, &magicBits, sizeof(magic));
+         std::memcpy(&sum, &bits, sizeof(sum));
+         sum += magic;
+         std::memcpy(&h, &sum, sizeof(h));
+         h -= magicBits;
+      }
+      else {							// normal (may round to infinity)
+         uint32_t odd = (bits >> 13) & 1u;
+         bits += 0xc8000fffu + odd;		// rebias the exponent, and round
+         h = bits >> 13;
+      }
+      return static_cast<uint16_t>(h | (sign >> 16));
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapFormat<Format> describes the pixels of a format, and converts
+ * rows of them from/to normalized RGBA floats (4 per pixel): channels
+ * absent from the format decode as 0 (color) or 1 (alpha), and are
+ * ignored when encoding.
+ *---------------------------------------------------------------------------*/
+struct JNIBitmapChannel {
+   static float from8(unsigned c) { return c * (1.0f / 255.0f); }
+   static uint8_t to8(float f) {
+      return static_cast<uint8_t>(unit(f) * 255.0f + 0.5f);
+   }
+   static unsigned toBits(float f, float max) {
+      return static_cast<unsigned>(unit(f) * max + 0.5f);
+   }
+
+   // Clamped to [0, 1] (NaN to 0)
+   static float unit(float f) {
+      f = (f > 0.0f) ? f : 0.0f;
+      return (f < 1.0f) ? f : 1.0f;
+   }
+};
+
+template<int Format>
+struct JNIBitmapFormat;
+
+template<>
+struct JNIBitmapFormat<ANDROID_BITMAP_FORMAT_RGBA_8888> {
+   typedef JNIRGBA8888 Pixel;
+   static const char *name() { return "RGBA_8888"; }
+
+   static void decode(const Pixel *p, float *rgba, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4) {
+         rgba[0] = JNIBitmapChannel::from8(p[i].r);
+         rgba[1] = JNIBitmapChannel::from8(p[i].g);
+         rgba[2] = JNIBitmapChannel::from8(p[i].b);
+         rgba[3] = JNIBitmapChannel::from8(p[i].a);
+      }
+   }
+   static void encode(const float *rgba, Pixel *p, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4) {
+         p[i].r = JNIBitmapChannel::to8(rgba[0]);
+         p[i].g = JNIBitmapChannel::to8(rgba[1]);
+         p[i].b = JNIBitmapChannel::to8(rgba[2]);
+         p[i].a = JNIBitmapChannel::to8(rgba[3]);
+      }
+   }
+};
+
+template<>
+struct JNIBitmapFormat<ANDROID_BITMAP_FORMAT_RGB_565> {
+   typedef uint16_t Pixel;
+   static const char *name() { return "RGB_565"; }
+
+   static void decode(const Pixel *p, float *rgba, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4) {
+         rgba[0] = (p[i] >> 11) * (1.0f / 31.0f);
+         rgba[1] = ((p[i] >> 5) & 0x3f) * (1.0f / 63.0f);
+         rgba[2] = (p[i] & 0x1f) * (1.0f / 31.0f);
+         rgba[3] = 1.0f;
+      }
+   }
+   static void encode(const float *rgba, Pixel *p, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4)
+         p[i] = static_cast<Pixel>(
+            JNIBitmapChannel::toBits(rgba[0], 31.0f) << 11 |
+            JNIBitmapChannel::toBits(rgba[1], 63.0f) << 5 |
+            JNIBitmapChannel::toBits(rgba[2], 31.0f));
+   }
+};
+
+template<>
+struct JNIBitmapFormat<ANDROID_BITMAP_FORMAT_A_8> {
+   typedef uint8_t Pixel;
+   static const char *name() { return "A_8"; }
+
+   static void decode(const Pixel *p, float *rgba, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4) {
+         rgba[0] = rgba[1] = rgba[2] = 0.0f;
+         rgba[3] = JNIBitmapChannel::from8(p[i]);
+      }
+   }
+   static void encode(const float *rgba, Pixel *p, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4)
+         p[i] = JNIBitmapChannel::to8(rgba[3]);
+   }
+};
+
+template<>
+struct JNIBitmapFormat<ANDROID_BITMAP_FORMAT_RGBA_F16> {
+   typedef JNIRGBAF16 Pixel;
+   static const char *name() { return "RGBA_F16"; }
+
+   // Half floats are not clamped: F16 Bitmaps may hold extended ranges
+   static void decode(const Pixel *p, float *rgba, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4) {
+         rgba[0] = JNIHalf::toFloat(p[i].r);
+         rgba[1] = JNIHalf::toFloat(p[i].g);
+         rgba[2] = JNIHalf::toFloat(p[i].b);
+         rgba[3] = JNIHalf::toFloat(p[i].a);
+      }
+   }
+   static void encode(const float *rgba, Pixel *p, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++, rgba += 4) {
+         p[i].r = JNIHalf::fromFloat(rgba[0]);
+         p[i].g = JNIHalf::fromFloat(rgba[1]);
+         p[i].b = JNIHalf::fromFloat(rgba[2]);
+         p[i].a = JNIHalf::fromFloat(rgba[3]);
+      }
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapView<Format>: pixels, dimensions and stride (in bytes) of a
+ * Bitmap. The view does not own the pixels: the Bitmap must stay locked
+ * while the view is in use.
+ *---------------------------------------------------------------------------*/
+template<int Format>
+class JNIBitmapView {
+public:
+   typedef typename JNIBitmapFormat<Format>::Pixel Pixel;
+
+private:
+   unsigned char *_pixels;
+   uint32_t _width;
+   uint32_t _height;
+   uint32_t _stride;
+
+public:
+   JNIBitmapView(void *pixels, uint32_t width, uint32_t height,
+                 uint32_t stride) :
+      _pixels(static_cast<unsigned char *>(pixels)),
+      _width(width), _height(height), _stride(stride) {
+      check();
+   }
+
+   // Throws if the Bitmap is not locked, or not in this format
+   explicit JNIBitmapView(const JNIAndroidBitmap &bitmap) :
+      _pixels(static_cast<unsigned char *>(bitmap.data())),
+      _width(bitmap.width()), _height(bitmap.height()),
+      _stride(bitmap.stride()) {
+      if (bitmap.format() != Format)
+         throw JNIException(std::string("Bitmap format is not ") +
+                            JNIBitmapFormat<Format>::name());
+      if (_pixels == 0)
+         throw JNIException("Bitmap pixels are not locked");
+      check();
+   }
+
+   uint32_t width() const { return _width; }
+   uint32_t height() const { return _height; }
+   uint32_t stride() const { return _stride; }
+   void *data() const { return _pixels; }
+
+   Pixel *row(uint32_t y) const {
+      return reinterpret_cast<Pixel *>(_pixels + std::size_t(y) * _stride);
+   }
+
+   Pixel &operator() (uint32_t x, uint32_t y) const {
+      return row(y)[x];
+   }
+
+private:
+   void check() const {
+      if (_height > 1 && _stride < std::size_t(_width) * sizeof(Pixel))
+         throw JNIException("Bitmap stride shorter than a row");
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * Whole-pixel row kernels on RGBA_8888, exact in integer arithmetic:
+ * - x / 255 is computed as (x * 0x8081) >> 23 (exact for x < 2^16)
+ * - c * a / 255, rounded, as (t + (t >> 8)) >> 8, where t = c * a + 128
+ * - 5 and 6 bit channels widen, rounded, as (c * 527 + 23) >> 6 and
+ *   (c * 259 + 33) >> 6
+ * JNIBitmapScalar processes a pixel at a time; JNIBitmapVector<Bytes>
+ * loads whole pixels as 32 bit lanes of a 'Bytes' bytes vector (x86 and
+ * ARM are little endian: R is the low byte).
+ *---------------------------------------------------------------------------*/
+struct JNIBitmapScalar {
+   static unsigned div255(unsigned x) { return (x * 0x8081u) >> 23; }
+   static unsigned mul255(unsigned c, unsigned a) {
+      unsigned t = c * a + 128;
+      return (t + (t >> 8)) >> 8;
+   }
+
+   static void premultiply(JNIRGBA8888 *p, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++) {
+         unsigned a = p[i].a;
+         p[i].r = static_cast<uint8_t>(mul255(p[i].r, a));
+         p[i].g = static_cast<uint8_t>(mul255(p[i].g, a));
+         p[i].b = static_cast<uint8_t>(mul255(p[i].b, a));
+      }
+   }
+
+   // c * 255 / a, rounded and clamped to 255 (for a > 0)
+   static unsigned unmul255(unsigned c, unsigned a) {
+      unsigned v = (c * 255 + a / 2) / a;
+      return (v < 255) ? v : 255;
+   }
+
+   static void unpremultiply(JNIRGBA8888 *p, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++) {
+         unsigned a = p[i].a;
+         if (a == 255)
+            continue;
+         if (a == 0) {
+            p[i].r = p[i].g = p[i].b = 0;
+            continue;
+         }
+         p[i].r = static_cast<uint8_t>(unmul255(p[i].r, a));
+         p[i].g = static_cast<uint8_t>(unmul255(p[i].g, a));
+         p[i].b = static_cast<uint8_t>(unmul255(p[i].b, a));
+      }
+   }
+
+   static void pack565(const JNIRGBA8888 *src, uint16_t *dst, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++)
+         dst[i] = static_cast<uint16_t>(div255(src[i].r * 31u + 127) << 11 |
+                                        div255(src[i].g * 63u + 127) << 5 |
+                                        div255(src[i].b * 31u + 127));
+   }
+
+   static void unpack565(const uint16_t *src, JNIRGBA8888 *dst, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++) {
+         unsigned v = src[i];
+         dst[i].r = static_cast<uint8_t>(((v >> 11) * 527 + 23) >> 6);
+         dst[i].g = static_cast<uint8_t>((((v >> 5) & 0x3f) * 259 + 33) >> 6);
+         dst[i].b = static_cast<uint8_t>(((v & 0x1f) * 527 + 23) >> 6);
+         dst[i].a = 255;
+      }
+   }
+
+   static void alpha(const JNIRGBA8888 *src, uint8_t *dst, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++)
+         dst[i] = src[i].a;
+   }
+
+   static void fromAlpha(const uint8_t *src, JNIRGBA8888 *dst, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++) {
+         dst[i].r = dst[i].g = dst[i].b = 0;
+         dst[i].a = src[i];
+      }
+   }
+};
+
+#ifdef JNI_BITMAP_VECTOR
+
+template<class E, int Bytes>
+struct JNIBitmapLanes {
+   typedef E type __attribute__((vector_size(Bytes)));
+};
+
+template<int Bytes>
+struct JNIBitmapVector {
+   static const std::size_t lanes = Bytes / 4;
+   typedef typename JNIBitmapLanes<uint32_t, Bytes>::type Vec;
+   typedef typename JNIBitmapLanes<uint16_t, Bytes / 2>::type Vec16;
+   typedef typename JNIBitmapLanes<uint8_t, Bytes / 4>::type Vec8;
+
+   // In place (vectors are not returned by value, see -Wpsabi)
+   static JNI_BITMAP_INLINE void div255(Vec &x) {
+      x = (x * 0x8081u) >> 23;
+   }
+   static JNI_BITMAP_INLINE void mul255(Vec &c, const Vec &a) {
+      c = c * a + 128u;
+      c = (c + (c >> 8)) >> 8;
+   }
+
+   static JNI_BITMAP_INLINE void premultiply(JNIRGBA8888 *p, std::size_t n) {
+      Vec v;
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         std::memcpy(&v, p + i, sizeof(v));
+         Vec r = v & 0xffu, g = (v >> 8) & 0xffu, b = (v >> 16) & 0xffu;
+         Vec a = v >> 24;
+         mul255(r, a);
+         mul255(g, a);
+         mul255(b, a);
+         v = r | g << 8 | b << 16 | a << 24;
+         std::memcpy(p + i, &v, sizeof(v));
+      }
+      JNIBitmapScalar::premultiply(p + i, n - i);
+   }
+
+   static JNI_BITMAP_INLINE void pack565(const JNIRGBA8888 *src, uint16_t *dst,
+                                         std::size_t n) {
+      Vec v;
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         std::memcpy(&v, src + i, sizeof(v));
+         Vec r = (v & 0xffu) * 31u + 127u;
+         Vec g = ((v >> 8) & 0xffu) * 63u + 127u;
+         Vec b = ((v >> 16) & 0xffu) * 31u + 127u;
+         div255(r);
+         div255(g);
+         div255(b);
+         Vec p = r << 11 | g << 5 | b;
+         Vec16 d = __builtin_convertvector(p, Vec16);
+         std::memcpy(dst + i, &d, sizeof(d));
+      }
+      JNIBitmapScalar::pack565(src + i, dst + i, n - i);
+   }
+
+   static JNI_BITMAP_INLINE void unpack565(const uint16_t *src,
+                                           JNIRGBA8888 *dst, std::size_t n) {
+      Vec16 s;
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         std::memcpy(&s, src + i, sizeof(s));
+         Vec v = __builtin_convertvector(s, Vec);
+         Vec p = (((v >> 11) * 527u + 23u) >> 6) |
+                 (((v >> 5) & 0x3fu) * 259u + 33u) >> 6 << 8 |
+                 ((v & 0x1fu) * 527u + 23u) >> 6 << 16 | 0xff000000u;
+         std::memcpy(dst + i, &p, sizeof(p));
+      }
+      JNIBitmapScalar::unpack565(src + i, dst + i, n - i);
+   }
+
+   static JNI_BITMAP_INLINE void alpha(const JNIRGBA8888 *src, uint8_t *dst,
+                                       std::size_t n) {
+      Vec v;
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         std::memcpy(&v, src + i, sizeof(v));
+         Vec8 a = __builtin_convertvector(v >> 24, Vec8);
+         std::memcpy(dst + i, &a, sizeof(a));
+      }
+      JNIBitmapScalar::alpha(src + i, dst + i, n - i);
+   }
+
+   static JNI_BITMAP_INLINE void fromAlpha(const uint8_t *src, JNIRGBA8888 *dst,
+                                           std::size_t n) {
+      Vec8 a;
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         std::memcpy(&a, src + i, sizeof(a));
+         Vec v = __builtin_convertvector(a, Vec) << 24;
+         std::memcpy(dst + i, &v, sizeof(v));
+      }
+      JNIBitmapScalar::fromAlpha(src + i, dst + i, n - i);
+   }
+};
+
+#endif /* JNI_BITMAP_VECTOR */
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapDispatch<Level>: the row kernels compiled for a JNIKernels
+ * instruction set level (on ARM, every level uses NEON)
+ *---------------------------------------------------------------------------*/
+#if defined(JNI_BITMAP_VECTOR) && !defined(JNI_KERNELS_X86)
+template<int Level>
+struct JNIBitmapDispatch : JNIBitmapVector<16> {};
+#else
+template<int Level>
+struct JNIBitmapDispatch : JNIBitmapScalar {};
+#endif
+
+#ifdef JNI_KERNELS_X86
+
+#define JNI_BITMAP_LEVEL(Level, Bytes, Isa)									\
+template<>																	\
+struct JNIBitmapDispatch<Level> {											\
+   JNI_KERNEL_TARGET(Isa)													\
+   static void premultiply(JNIRGBA8888 *p, std::size_t n) {				\
+      JNIBitmapVector<Bytes>::premultiply(p, n);							\
+   }																		\
+   JNI_KERNEL_TARGET(Isa)													\
+   static void pack565(const JNIRGBA8888 *src, uint16_t *dst,				\
+                       std::size_t n) {									\
+      JNIBitmapVector<Bytes>::pack565(src, dst, n);						\
+   }																		\
+   JNI_KERNEL_TARGET(Isa)													\
+   static void unpack565(const uint16_t *src, JNIRGBA8888 *dst,			\
+                         std::size_t n) {									\
+      JNIBitmapVector<Bytes>::unpack565(src, dst, n);						\
+   }																		\
+   JNI_KERNEL_TARGET(Isa)													\
+   static void alpha(const JNIRGBA8888 *src, uint8_t *dst, std::size_t n) {	\
+      JNIBitmapVector<Bytes>::alpha(src, dst, n);							\
+   }																		\
+   JNI_KERNEL_TARGET(Isa)													\
+   static void fromAlpha(const uint8_t *src, JNIRGBA8888 *dst,			\
+                         std::size_t n) {									\
+      JNIBitmapVector<Bytes>::fromAlpha(src, dst, n);						\
+   }																		\
+};
+
+JNI_BITMAP_LEVEL(JNI_KERNELS_SSE2, 16, "sse2")
+JNI_BITMAP_LEVEL(JNI_KERNELS_AVX2, 32, "avx2,fma")
+JNI_BITMAP_LEVEL(JNI_KERNELS_AVX512, 64,
+                 "avx512f,avx512bw,avx512dq,avx512vl,fma")
+
+// Expands to a switch over the level selected by JNIKernels
+#define JNI_BITMAP_DISPATCH(Call)											\
+   switch (JNIKernels::level()) {											\
+   case JNI_KERNELS_AVX512:	JNIBitmapDispatch<JNI_KERNELS_AVX512>::Call; break;	\
+   case JNI_KERNELS_AVX2:	JNIBitmapDispatch<JNI_KERNELS_AVX2>::Call; break;	\
+   case JNI_KERNELS_SSE2:	JNIBitmapDispatch<JNI_KERNELS_SSE2>::Call; break;	\
+   default:					JNIBitmapDispatch<JNI_KERNELS_SCALAR>::Call; break;	\
+   }
+
+#else
+
+#define JNI_BITMAP_DISPATCH(Call)											\
+   JNIBitmapDispatch<JNI_KERNELS_SCALAR>::Call;
+
+#endif /* JNI_KERNELS_X86 */
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapConvertRow<From, To>: conversion of one row, through a line of
+ * 4 floats per pixel, except between identical formats and for the
+ * whole-pixel RGBA_8888 kernels above
+ *---------------------------------------------------------------------------*/
+template<int From, int To>
+struct JNIBitmapConvertRow {
+   static void apply(const typename JNIBitmapFormat<From>::Pixel *src,
+                     typename JNIBitmapFormat<To>::Pixel *dst,
+                     std::size_t n, float *line) {
+      JNIBitmapFormat<From>::decode(src, line, n);
+      JNIBitmapFormat<To>::encode(line, dst, n);
+   }
+};
+
+template<int Format>
+struct JNIBitmapConvertRow<Format, Format> {
+   static void apply(const typename JNIBitmapFormat<Format>::Pixel *src,
+                     typename JNIBitmapFormat<Format>::Pixel *dst,
+                     std::size_t n, float *) {
+      if (src != dst)
+         std::memmove(dst, src, n * sizeof(*src));
+   }
+};
+
+template<>
+struct JNIBitmapConvertRow<ANDROID_BITMAP_FORMAT_RGBA_8888,
+                           ANDROID_BITMAP_FORMAT_RGB_565> {
+   static void apply(const JNIRGBA8888 *src, uint16_t *dst, std::size_t n,
+                     float *) {
+      JNI_BITMAP_DISPATCH(pack565(src, dst, n))
+   }
+};
+
+template<>
+struct JNIBitmapConvertRow<ANDROID_BITMAP_FORMAT_RGB_565,
+                           ANDROID_BITMAP_FORMAT_RGBA_8888> {
+   static void apply(const uint16_t *src, JNIRGBA8888 *dst, std::size_t n,
+                     float *) {
+      JNI_BITMAP_DISPATCH(unpack565(src, dst, n))
+   }
+};
+
+template<>
+struct JNIBitmapConvertRow<ANDROID_BITMAP_FORMAT_RGBA_8888,
+                           ANDROID_BITMAP_FORMAT_A_8> {
+   static void apply(const JNIRGBA8888 *src, uint8_t *dst, std::size_t n,
+                     float *) {
+      JNI_BITMAP_DISPATCH(alpha(src, dst, n))
+   }
+};
+
+template<>
+struct JNIBitmapConvertRow<ANDROID_BITMAP_FORMAT_A_8,
+                           ANDROID_BITMAP_FORMAT_RGBA_8888> {
+   static void apply(const uint8_t *src, JNIRGBA8888 *dst, std::size_t n,
+                     float *) {
+      JNI_BITMAP_DISPATCH(fromAlpha(src, dst, n))
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapForRows calls band(y0, y1) over [0, height) in bands of 'grain'
+ * rows, on the pool if one is given (in the calling thread otherwise)
+ *---------------------------------------------------------------------------*/
+template<class Band>
+inline void JNIBitmapForRows(JNIThreadPool *pool, uint32_t height, Band band,
+                             std::size_t grain = 0) {
+   if (pool == 0 || height == 0) {
+      band(uint32_t(0), height);
+      return;
+   }
+   if (grain == 0)
+      grain = height / (pool->size() * 8);
+   if (grain == 0)
+      grain = 1;
+   std::size_t bands = (height + grain - 1) / grain;
+   JNIThreadPool::ChunkF f = [&](std::size_t c) -> std::size_t {
+      uint32_t y0 = static_cast<uint32_t>(c * grain);
+      uint32_t y1 = (height - y0 > grain) ?
+         static_cast<uint32_t>(y0 + grain) : height;
+      band(y0, y1);
+      return y1 - y0;
+   };
+   pool->run(bands, f);
+}
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapKernels: the image transforms
+ *---------------------------------------------------------------------------*/
+enum JNIBitmapFilter {
+   JNI_BITMAP_NEAREST,
+   JNI_BITMAP_BILINEAR
+};
+
+class JNIBitmapKernels {
+public:
+   template<int From, int To>
+   static void convert(const JNIBitmapView<From> &src,
+                       const JNIBitmapView<To> &dst,
+                       JNIThreadPool *pool = 0, std::size_t grain = 0) {
+      sameSize(src, dst, "convert");
+      const uint32_t w = src.width();
+      JNIBitmapForRows(pool, src.height(), [&](uint32_t y0, uint32_t y1) {
+         std::vector<float> line(std::size_t(w) * 4);
+         for (uint32_t y = y0; y < y1; y++)
+            JNIBitmapConvertRow<From, To>::apply(src.row(y), dst.row(y), w,
+                                                 line.data());
+      }, grain);
+   }
+
+   static void premultiply(
+      const JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_8888> &view,
+      JNIThreadPool *pool = 0, std::size_t grain = 0) {
+      const uint32_t w = view.width();
+      JNIBitmapForRows(pool, view.height(), [&](uint32_t y0, uint32_t y1) {
+         for (uint32_t y = y0; y < y1; y++)
+            JNI_BITMAP_DISPATCH(premultiply(view.row(y), w))
+      }, grain);
+   }
+
+   static void premultiply(
+      const JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_F16> &view,
+      JNIThreadPool *pool = 0, std::size_t grain = 0) {
+      typedef JNIBitmapFormat<ANDROID_BITMAP_FORMAT_RGBA_F16> F16;
+      const uint32_t w = view.width();
+      JNIBitmapForRows(pool, view.height(), [&](uint32_t y0, uint32_t y1) {
+         std::vector<float> line(std::size_t(w) * 4);
+         for (uint32_t y = y0; y < y1; y++) {
+            F16::decode(view.row(y), line.data(), w);
+            for (float *p = line.data(); p < line.data() + line.size();
+                 p += 4) {
+               p[0] *= p[3];
+               p[1] *= p[3];
+               p[2] *= p[3];
+            }
+            F16::encode(line.data(), view.row(y), w);
+         }
+      }, grain);
+   }
+
+   static void unpremultiply(
+      const JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_8888> &view,
+      JNIThreadPool *pool = 0, std::size_t grain = 0) {
+      const uint32_t w = view.width();
+      JNIBitmapForRows(pool, view.height(), [&](uint32_t y0, uint32_t y1) {
+         for (uint32_t y = y0; y < y1; y++)
+            JNIBitmapScalar::unpremultiply(view.row(y), w);
+      }, grain);
+   }
+
+   static void unpremultiply(
+      const JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_F16> &view,
+      JNIThreadPool *pool = 0, std::size_t grain = 0) {
+      typedef JNIBitmapFormat<ANDROID_BITMAP_FORMAT_RGBA_F16> F16;
+      const uint32_t w = view.width();
+      JNIBitmapForRows(pool, view.height(), [&](uint32_t y0, uint32_t y1) {
+         std::vector<float> line(std::size_t(w) * 4);
+         for (uint32_t y = y0; y < y1; y++) {
+            F16::decode(view.row(y), line.data(), w);
+            for (float *p = line.data(); p < line.data() + line.size();
+                 p += 4) {
+               float k = (p[3] != 0.0f) ? 1.0f / p[3] : 0.0f;
+               p[0] *= k;
+               p[1] *= k;
+               p[2] *= k;
+            }
+            F16::encode(line.data(), view.row(y), w);
+         }
+      }, grain);
+   }
+
+   // Two passes: rows are blurred horizontally into a float image, which
+   // is then blurred vertically into 'dst' (with running sums restarted
+   // at every band)
+   template<int Format>
+   static void blur(const JNIBitmapView<Format> &src,
+                    const JNIBitmapView<Format> &dst, unsigned radius,
+                    JNIThreadPool *pool = 0, std::size_t grain = 0) {
+      typedef JNIBitmapFormat<Format> F;
+      sameSize(src, dst, "blur");
+      const std::size_t w = src.width(), h = src.height(), rowSize = w * 4;
+      const long r = radius;
+      const float norm = 1.0f / (2 * r + 1);
+      if (w == 0 || h == 0)
+         return;
+      std::vector<float> image(rowSize * h);
+      float *rows = image.data();
+
+      JNIBitmapForRows(pool, src.height(), [&](uint32_t y0, uint32_t y1) {
+         std::vector<float> line(rowSize);
+         for (uint32_t y = y0; y < y1; y++) {
+            F::decode(src.row(y), line.data(), w);
+            float *out = rows + y * rowSize;
+            float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (long k = -r; k <= r; k++)
+               add(acc, line.data() + clamp(k, w) * 4, 1.0f, 4);
+            for (std::size_t x = 0; x < w; x++) {
+               for (int c = 0; c < 4; c++)
+                  out[x * 4 + c] = acc[c] * norm;
+               add(acc, line.data() + clamp(long(x) + r + 1, w) * 4, 1.0f, 4);
+               add(acc, line.data() + clamp(long(x) - r, w) * 4, -1.0f, 4);
+            }
+         }
+      }, grain);
+
+      JNIBitmapForRows(pool, src.height(), [&](uint32_t y0, uint32_t y1) {
+         std::vector<float> acc(rowSize, 0.0f), line(rowSize);
+         for (long k = -r; k <= r; k++)
+            add(acc.data(), rows + clamp(long(y0) + k, h) * rowSize, 1.0f,
+                rowSize);
+         for (uint32_t y = y0; y < y1; y++) {
+            for (std::size_t i = 0; i < rowSize; i++)
+               line[i] = acc[i] * norm;
+            F::encode(line.data(), dst.row(y), w);
+            add(acc.data(), rows + clamp(long(y) + r + 1, h) * rowSize, 1.0f,
+                rowSize);
+            add(acc.data(), rows + clamp(long(y) - r, h) * rowSize, -1.0f,
+                rowSize);
+         }
+      }, grain);
+   }
+
+   // Pixel centers are aligned: source coordinate (x + 0.5) * sw / dw - 0.5
+   template<int Format>
+   static void resize(const JNIBitmapView<Format> &src,
+                      const JNIBitmapView<Format> &dst,
+                      JNIBitmapFilter filter = JNI_BITMAP_BILINEAR,
+                      JNIThreadPool *pool = 0, std::size_t grain = 0) {
+      if (src.data() == dst.data())
+         throw JNIException("JNIBitmapKernels::resize(): same bitmap");
+      if (dst.width() == 0 || dst.height() == 0)
+         return;
+      if (src.width() == 0 || src.height() == 0)
+         throw JNIException("JNIBitmapKernels::resize(): empty source");
+      if (filter == JNI_BITMAP_NEAREST)
+         nearest(src, dst, pool, grain);
+      else
+         bilinear(src, dst, pool, grain);
+   }
+
+private:
+   template<int From, int To>
+   static void sameSize(const JNIBitmapView<From> &src,
+                        const JNIBitmapView<To> &dst, const char *kernel) {
+      if (src.width() != dst.width() || src.height() != dst.height())
+         throw JNIException(std::string("JNIBitmapKernels::") + kernel +
+                            "(): bitmaps of different sizes");
+   }
+
+   static std::size_t clamp(long i, std::size_t n) {
+      return (i < 0) ? 0 : (std::size_t(i) >= n) ? n - 1 : std::size_t(i);
+   }
+
+   static void add(float *acc, const float *p, float sign, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++)
+         acc[i] += sign * p[i];
+   }
+
+   template<int Format>
+   static void nearest(const JNIBitmapView<Format> &src,
+                       const JNIBitmapView<Format> &dst,
+                       JNIThreadPool *pool, std::size_t grain) {
+      typedef typename JNIBitmapView<Format>::Pixel Pixel;
+      const uint64_t sw = src.width(), sh = src.height();
+      const uint64_t dw = dst.width(), dh = dst.height();
+      std::vector<uint32_t> xs(dw);
+      for (uint64_t x = 0; x < dw; x++)
+         xs[x] = static_cast<uint32_t>((2 * x + 1) * sw / (2 * dw));
+      JNIBitmapForRows(pool, dst.height(), [&](uint32_t y0, uint32_t y1) {
+         for (uint32_t y = y0; y < y1; y++) {
+            const Pixel *s = src.row(
+               static_cast<uint32_t>((2 * uint64_t(y) + 1) * sh / (2 * dh)));
+            Pixel *d = dst.row(y);
+            for (std::size_t x = 0; x < dw; x++)
+               d[x] = s[xs[x]];
+         }
+      }, grain);
+   }
+
+   // Source sample: index 'i0', and weight 'w' of the next index 'i1'
+   struct Sample {
+      uint32_t i0, i1;
+      float w;
+   };
+
+   static Sample sample(uint32_t d, uint32_t dn, uint32_t sn) {
+      float f = (d + 0.5f) * sn / dn - 0.5f;
+      f = (f > 0.0f) ? f : 0.0f;
+      Sample s;
+      s.i0 = static_cast<uint32_t>(f);
+      if (s.i0 >= sn - 1) {
+         s.i0 = s.i1 = sn - 1;
+         s.w = 0.0f;
+      }
+      else {
+         s.i1 = s.i0 + 1;
+         s.w = f - s.i0;
+      }
+      return s;
+   }
+
+   template<int Format>
+   static void bilinear(const JNIBitmapView<Format> &src,
+                        const JNIBitmapView<Format> &dst,
+                        JNIThreadPool *pool, std::size_t grain) {
+      typedef JNIBitmapFormat<Format> F;
+      const uint32_t sw = src.width(), sh = src.height();
+      const uint32_t dw = dst.width(), dh = dst.height();
+      std::vector<Sample> xs(dw);
+      for (uint32_t x = 0; x < dw; x++)
+         xs[x] = sample(x, dw, sw);
+      JNIBitmapForRows(pool, dh, [&](uint32_t y0, uint32_t y1) {
+         // Decoded source rows, reused while consecutive output rows
+         // sample the same ones
+         std::vector<float> a(std::size_t(sw) * 4), b(a.size());
+         std::vector<float> line(std::size_t(dw) * 4);
+         long rowA = -1, rowB = -1;
+         for (uint32_t y = y0; y < y1; y++) {
+            Sample sy = sample(y, dh, sh);
+            if (rowA != sy.i0) {
+               if (rowB == sy.i0) {
+                  a.swap(b);
+                  std::swap(rowA, rowB);
+               }
+               else {
+                  F::decode(src.row(sy.i0), a.data(), sw);
+                  rowA = sy.i0;
+               }
+            }
+            if (rowB != sy.i1) {
+               F::decode(src.row(sy.i1), b.data(), sw);
+               rowB = sy.i1;
+            }
+            for (uint32_t x = 0; x < dw; x++) {
+               const float *a0 = &a[xs[x].i0 * 4], *a1 = &a[xs[x].i1 * 4];
+               const float *b0 = &b[xs[x].i0 * 4], *b1 = &b[xs[x].i1 * 4];
+               for (int c = 0; c < 4; c++) {
+                  float top = a0[c] + (a1[c] - a0[c]) * xs[x].w;
+                  float bottom = b0[c] + (b1[c] - b0[c]) * xs[x].w;
+                  line[x * 4 + c] = top + (bottom - top) * sy.w;
+               }
+            }
+            F::encode(line.data(), dst.row(y), dw);
+         }
+      }, grain);
+   }
+};
+
+#ifdef JNI_BITMAP_VECTOR
+#pragma GCC diagnostic pop
+#endif
+
+#endif /* _JNI_BITMAP_H_INCLUDED_ */
@@ -0,0 +1,458 @@
+/*-----------------------------------------------------------------------------
+ * Locking many Bitmaps at once, and recycled staging buffers.
+ *
+ * JNIBitmapBatch locks a set of Bitmaps through a single JNIEnv, and
+ * unlocks them in reverse order when destroyed (or on unlock()):
+ *
+ *    static JNIBitmapInfoCache infos;	// kept across frames (one thread)
+ *    ...
+ *    JNIBitmapBatch frame(env, jbitmaps, &infos);	// a Bitmap[]
+ *    JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_8888> out =
+ *       frame.view<ANDROID_BITMAP_FORMAT_RGBA_8888>(0);
+ *
+ * Bitmaps may also be added one at a time with lock(). A Bitmap that
+ * fails to lock throws a JNIException; the Bitmaps locked before it stay
+ * in the batch (the array constructor unlocks them before rethrowing).
+ * Unlike JNIAndroidBitmap, which finds its JNIEnv through the Java VM on
+ * release, a batch keeps the JNIEnv it was given: it must be destroyed on
+ * the same thread, within the same native call.
+ *
+ * JNIBitmapInfoCache keeps the AndroidBitmapInfo of Bitmaps by identity,
+ * through weak global references, so that a Bitmap reused from frame to
+ * frame is queried with AndroidBitmap_getInfo only once. A batch first
+ * compares each Bitmap with the one it locked at the same position in
+ * the previous batch (IsSameObject); other Bitmaps are looked up by
+ * System.identityHashCode. The information becomes stale if a Bitmap is
+ * reconfigured (Bitmap.reconfigure()): invalidate() drops it. Entries of
+ * collected Bitmaps are dropped by purge(), which a miss also runs once
+ * the cache has doubled in size since the last purge. The cache is not
+ * thread-safe.
+ *
+ * JNIBitmapBufferPool recycles native staging buffers sized from an
+ * AndroidBitmapInfo (stride * height bytes, aligned on cache lines), so
+ * that per-frame copies allocate nothing once the pool is warm. acquire()
+ * returns a JNIBitmapBuffer, which goes back to the pool when destroyed;
+ * recycled buffers are not cleared. Idle buffers are kept by exact size,
+ * up to a total of 'maxIdleBytes'. The pool is thread-safe (buffers may
+ * be released on any thread), and must outlive its buffers.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_BITMAP_BATCH_H_INCLUDED_
+#define _JNI_BITMAP_BATCH_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_resource.h"
+#include "jni_instrument.h"
+#include "jni_bitmap.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapInfoCache
+ *---------------------------------------------------------------------------*/
+class JNIBitmapInfoCache {
+   struct Entry {
+      std::unique_ptr<JNIWeakGlobalRef<jobject> > ref;
+      AndroidBitmapInfo info;
+   };
+   typedef std::unordered_multimap<jint, Entry> _map;
+
+   _map _entries;
+   std::vector<Entry *> _recent;	// entry found at each batch position
+   std::size_t _hits;				// lookups served from the cache
+   std::size_t _misses;			// lookups that called getInfo
+   std::size_t _purgeAt;		// size from which a miss purges first
+
+   JNIBitmapInfoCache(const JNIBitmapInfoCache &);
+   JNIBitmapInfoCache &operator= (const JNIBitmapInfoCache &);
+
+public:
+   enum { minPurgeAt = 64 };
+
+   JNIBitmapInfoCache() : _hits(0), _misses(0), _purgeAt(minPurgeAt) {}
+
+   // Information of 'bitmap', locked at position 'slot' of a batch (any
+   // value if not in a batch). Returns an ANDROID_BITMAP_RESULT_* code.
+   int get(JNIEnv *env, jobject bitmap, AndroidBitmapInfo &info,
+           std::size_t slot = 0) {
+      if (slot < _recent.size() && _recent[slot] != 0 &&
+          env->IsSameObject(_recent[slot]->ref->get(), bitmap)) {
+         info = _recent[slot]->info;
+         _hits++;
+         return ANDROID_BITMAP_RESULT_SUCCESS;
+      }
+
+      jint hash = JNIIdentityHashCode(env, bitmap);
+      Entry *entry = find(env, hash, bitmap);
+      if (entry != 0)
+         _hits++;
+      else {
+         int result = AndroidBitmap_getInfo(env, bitmap, &info);
+         if (result != ANDROID_BITMAP_RESULT_SUCCESS)
+            return result;
+         if (_entries.size() >= _purgeAt)
+            purge(env);
+         _map::iterator i = _entries.insert(std::make_pair(hash, Entry()));
+         entry = &i->second;
+         entry->ref.reset(new JNIWeakGlobalRef<jobject>(env, bitmap));
+         entry->info = info;
+         _misses++;
+      }
+      if (slot >= _recent.size())
+         _recent.resize(slot + 1, 0);
+      _recent[slot] = entry;
+      info = entry->info;
+      return ANDROID_BITMAP_RESULT_SUCCESS;
+   }
+
+   // Drops the information of 'bitmap' (e.g., after Bitmap.reconfigure())
+   void invalidate(JNIEnv *env, jobject bitmap) {
+      jint hash = JNIIdentityHashCode(env, bitmap);
+      std::pair<_map::iterator, _map::iterator> r = _entries.equal_range(hash);
+      for (_map::iterator i = r.first; i != r.second; ++i)
+         if (env->IsSameObject(i->second.ref->get(), bitmap)) {
+            erase(env, i);
+            return;
+         }
+   }
+
+   // Drops the entries of collected Bitmaps; returns their number
+   std::size_t purge(JNIEnv *env) {
+      std::size_t before = _entries.size();
+      for (_map::iterator i = _entries.begin(); i != _entries.end(); ) {
+         if (i->second.ref->expired(env))
+            i = erase(env, i);
+         else
+            ++i;
+      }
+      _purgeAt = 2 * _entries.size();
+      if (_purgeAt < minPurgeAt)
+         _purgeAt = minPurgeAt;
+      return before - _entries.size();
+   }
+
+   void clear(JNIEnv *env) {
+      while (!_entries.empty())
+         erase(env, _entries.begin());
+   }
+
+   // Statistics
+   std::size_t size() const { return _entries.size(); }
+   std::size_t hits() const { return _hits; }
+   std::size_t misses() const { return _misses; }
+
+private:
+   // The entry of 'bitmap' in its hash bucket; entries of collected
+   // Bitmaps met on the way are dropped
+   Entry *find(JNIEnv *env, jint hash, jobject bitmap) {
+      std::pair<_map::iterator, _map::iterator> r = _entries.equal_range(hash);
+      for (_map::iterator i = r.first; i != r.second; ) {
+         if (env->IsSameObject(i->second.ref->get(), bitmap))
+            return &i->second;
+         if (i->second.ref->expired(env))
+            i = erase(env, i);
+         else
+            ++i;
+      }
+      return 0;
+   }
+
+   _map::iterator erase(JNIEnv *env, _map::iterator i) {
+      for (std::size_t s = 0; s < _recent.size(); s++)
+         if (_recent[s] == &i->second)
+            _recent[s] = 0;
+      i->second.ref->ReleaseResource(env);
+      return _entries.erase(i);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapBatch
+ *---------------------------------------------------------------------------*/
+class JNIBitmapBatch {
+public:
+   struct Entry {
+      jobject bitmap;
+      void *pixels;
+      AndroidBitmapInfo info;
+      bool localRef;		// a local reference created by the batch
+   };
+
+private:
+   JNIEnv *_env;
+   JNIBitmapInfoCache *_cache;
+   std::vector<Entry> _entries;
+
+   JNIBitmapBatch(const JNIBitmapBatch &);
+   JNIBitmapBatch &operator= (const JNIBitmapBatch &);
+
+public:
+   explicit JNIBitmapBatch(JNIEnv *env, JNIBitmapInfoCache *cache = 0) :
+      _env(env), _cache(cache) {}
+
+   // Locks every element of 'bitmaps' (a Bitmap[])
+   JNIBitmapBatch(JNIEnv *env, jobjectArray bitmaps,
+                  JNIBitmapInfoCache *cache = 0) :
+      _env(env), _cache(cache) {
+      jsize n = env->GetArrayLength(bitmaps);
+      _entries.reserve(n);
+      try {
+         for (jsize i = 0; i < n; i++)
+            add(env->GetObjectArrayElement(bitmaps, i), true);
+      }
+      catch(...) {
+         unlock();
+         throw;
+      }
+   }
+
+   ~JNIBitmapBatch() { unlock(); }
+
+   // Locks 'bitmap', and returns its index in the batch
+   std::size_t lock(jobject bitmap) {
+      add(bitmap, false);
+      return _entries.size() - 1;
+   }
+
+   // Unlocks the Bitmaps, last locked first, and empties the batch
+   void unlock() {
+      while (!_entries.empty()) {
+         Entry &e = _entries.back();
+         AndroidBitmap_unlockPixels(_env, e.bitmap);
+         if (e.localRef)
+            _env->DeleteLocalRef(e.bitmap);
+         _entries.pop_back();
+      }
+   }
+
+   std::size_t size() const { return _entries.size(); }
+   const Entry &operator[] (std::size_t i) const { return _entries[i]; }
+   void *pixels(std::size_t i) const { return _entries[i].pixels; }
+   const AndroidBitmapInfo &info(std::size_t i) const {
+      return _entries[i].info;
+   }
+
+   // Throws if Bitmap 'i' is not in this format
+   template<int Format>
+   JNIBitmapView<Format> view(std::size_t i) const {
+      const Entry &e = _entries[i];
+      if (e.info.format != Format)
+         throw JNIException(std::string("Bitmap format is not ") +
+                            JNIBitmapFormat<Format>::name());
+      return JNIBitmapView<Format>(e.pixels, e.info.width, e.info.height,
+                                   e.info.stride);
+   }
+
+private:
+   void add(jobject bitmap, bool localRef) {
+      JNI_INSTRUMENT("JNIBitmapBatch::lock");
+      Entry e;
+      e.bitmap = bitmap;
+      e.localRef = localRef;
+      int result = (_cache != 0) ?
+         _cache->get(_env, bitmap, e.info, _entries.size()) :
+         AndroidBitmap_getInfo(_env, bitmap, &e.info);
+      if (result == ANDROID_BITMAP_RESULT_SUCCESS)
+         result = AndroidBitmap_lockPixels(_env, bitmap, &e.pixels);
+      if (result != ANDROID_BITMAP_RESULT_SUCCESS) {
+         if (localRef)
+            _env->DeleteLocalRef(bitmap);
+         throw JNIException("Failed to lock Bitmap pixels");
+      }
+      _entries.push_back(e);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIBitmapBufferPool and JNIBitmapBuffer
+ *---------------------------------------------------------------------------*/
+class JNIBitmapBufferPool;
+
+class JNIBitmapBuffer {
+   friend class JNIBitmapBufferPool;
+
+   JNIBitmapBufferPool *_pool;
+   void *_block;				// allocated block, 0 if empty
+   unsigned char *_data;		// aligned start of the pixels
+   AndroidBitmapInfo _info;
+
+   JNIBitmapBuffer(const JNIBitmapBuffer &);
+   JNIBitmapBuffer &operator= (const JNIBitmapBuffer &);
+
+   JNIBitmapBuffer(JNIBitmapBufferPool *pool, void *block,
+                   unsigned char *data, const AndroidBitmapInfo &info) :
+      _pool(pool), _block(block), _data(data), _info(info) {}
+
+public:
+   JNIBitmapBuffer() : _pool(0), _block(0), _data(0) {}
+
+   JNIBitmapBuffer(JNIBitmapBuffer &&x) :
+      _pool(x._pool), _block(x._block), _data(x._data), _info(x._info) {
+      x._block = 0;
+      x._data = 0;
+   }
+
+   JNIBitmapBuffer &operator= (JNIBitmapBuffer &&x) {
+      if (&x != this) {
+         release();
+         _pool = x._pool;
+         _block = x._block;
+         _data = x._data;
+         _info = x._info;
+         x._block = 0;
+         x._data = 0;
+      }
+      return *this;
+   }
+
+   ~JNIBitmapBuffer() { release(); }
+
+   // Returns the buffer to its pool now
+   inline void release();
+
+   void *data() const { return _data; }
+   std::size_t size() const {
+      return (_block == 0) ? 0 : std::size_t(_info.stride) * _info.height;
+   }
+   const AndroidBitmapInfo &info() const { return _info; }
+
+   // Throws if the buffer is not in this format
+   template<int Format>
+   JNIBitmapView<Format> view() const {
+      if (_info.format != Format)
+         throw JNIException(std::string("Bitmap buffer format is not ") +
+                            JNIBitmapFormat<Format>::name());
+      return JNIBitmapView<Format>(_data, _info.width, _info.height,
+                                   _info.stride);
+   }
+};
+
+class JNIBitmapBufferPool {
+   friend class JNIBitmapBuffer;
+
+   struct Block {
+      void *block;
+      unsigned char *data;
+   };
+   typedef std::unordered_multimap<std::size_t, Block> _map;
+
+   std::mutex _lock;
+   _map _idle;					// idle blocks, by size
+   std::size_t _idleBytes;
+   std::size_t _maxIdleBytes;
+   std::size_t _hits;			// acquisitions served from idle blocks
+   std::size_t _misses;		// acquisitions that allocated
+
+   JNIBitmapBufferPool(const JNIBitmapBufferPool &);
+   JNIBitmapBufferPool &operator= (const JNIBitmapBufferPool &);
+
+public:
+   explicit JNIBitmapBufferPool(std::size_t maxIdleBytes = 64 << 20) :
+      _idleBytes(0), _maxIdleBytes(maxIdleBytes), _hits(0), _misses(0) {}
+
+   ~JNIBitmapBufferPool() { trim(); }
+
+   // A buffer with the layout of a Bitmap (same stride)
+   JNIBitmapBuffer acquire(const AndroidBitmapInfo &info) {
+      std::size_t bytes = std::size_t(info.stride) * info.height;
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         _map::iterator i = _idle.find(bytes);
+         if (i != _idle.end()) {
+            Block b = i->second;
+            _idle.erase(i);
+            _idleBytes -= bytes;
+            _hits++;
+            return JNIBitmapBuffer(this, b.block, b.data, info);
+         }
+         _misses++;
+      }
+      void *block = std::malloc(bytes + JNI_CACHE_LINE_SIZE - 1);
+      if (block == 0)
+         throw std::bad_alloc();
+      unsigned char *data = reinterpret_cast<unsigned char *>(
+         (reinterpret_cast<std::uintptr_t>(block) + JNI_CACHE_LINE_SIZE - 1) /
+         JNI_CACHE_LINE_SIZE * JNI_CACHE_LINE_SIZE);
+      return JNIBitmapBuffer(this, block, data, info);
+   }
+
+   // A buffer of packed rows
+   JNIBitmapBuffer acquire(uint32_t width, uint32_t height, int32_t format) {
+      AndroidBitmapInfo info;
+      info.width = width;
+      info.height = height;
+      info.stride = width * bytesPerPixel(format);
+      info.format = format;
+      info.flags = 0;
+      return acquire(info);
+   }
+
+   // Frees the idle buffers
+   void trim() {
+      std::lock_guard<std::mutex> guard(_lock);
+      for (_map::iterator i = _idle.begin(); i != _idle.end(); ++i)
+         std::free(i->second.block);
+      _idle.clear();
+      _idleBytes = 0;
+   }
+
+   static uint32_t bytesPerPixel(int32_t format) {
+      switch (format) {
+      case ANDROID_BITMAP_FORMAT_RGBA_8888:	return 4;
+      case ANDROID_BITMAP_FORMAT_RGB_565:	return 2;
+      case ANDROID_BITMAP_FORMAT_RGBA_4444:	return 2;
+      case ANDROID_BITMAP_FORMAT_A_8:		return 1;
+      case ANDROID_BITMAP_FORMAT_RGBA_F16:	return 8;
+      default:
+         throw JNIException("Unsupported Bitmap format");
+      }
+   }
+
+   // Statistics
+   std::size_t hits() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _hits;
+   }
+   std::size_t misses() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _misses;
+   }
+   std::size_t idleBytes() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _idleBytes;
+   }
+
+private:
+   void recycle(void *block, unsigned char *data, std::size_t bytes) {
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         if (_idleBytes + bytes <= _maxIdleBytes) {
+            Block b = { block, data };
+            _idle.insert(std::make_pair(bytes, b));
+            _idleBytes += bytes;
+            return;
+         }
+      }
+      std::free(block);
+   }
+};
+
+inline void JNIBitmapBuffer::release() {
+   if (_block != 0) {
+      _pool->recycle(_block, _data, size());
+      _block = 0;
+      _data = 0;
+   }
+}
+
+#endif /* _JNI_BITMAP_BATCH_H_INCLUDED_ */
@@ -0,0 +1,343 @@
+/*-----------------------------------------------------------------------------
+ * Batched delivery of native events to a Java listener.
+ *
+ * Calling back into Java once per event costs a method call (and, from a
+ * native thread, an attach) per event. JNICallbackBatcher<Event> lets any
+ * number of native threads post events into a lock-free ring; a single
+ * delivery thread, attached to the VM for its whole lifetime (as a daemon
+ * thread, which does not hold up the VM's shutdown), drains the ring and
+ * hands the events to the listener in batches, through one cached method
+ * call per batch:
+ *
+ *    JNICallbackBatcher<jlong> batcher(env, listener);	// onEvents([JI)V
+ *    ...
+ *    batcher.post(timestamp);		// from any native thread
+ *
+ * - Primitive events ('jint', 'jdouble', ...) are delivered as a Java array
+ *   of the corresponding type and the number of valid elements, i.e. the
+ *   listener method has the signature (<PrimitiveType>[], int)void.
+ * - Other events (trivially copyable structures) are delivered as a direct
+ *   ByteBuffer over the native batch, and the number of events, i.e.
+ *   (ByteBuffer, int)void. The buffer is in native byte order.
+ * - The array (or buffer) is allocated once and reused for every batch;
+ *   the listener must copy out what it wants to keep before returning.
+ * - A batch is delivered as soon as 'batchSize' events are pending, or
+ *   'maxDelay' after the previous delivery, whichever comes first; flush()
+ *   requests an immediate delivery.
+ * - post() never blocks: when the ring is full, the event is dropped and
+ *   counted. Java exceptions thrown by the listener are cleared and counted.
+ * - The destructor delivers the events still pending, then stops the
+ *   delivery thread.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_CALLBACK_BATCHER_H_INCLUDED_
+#define _JNI_CALLBACK_BATCHER_H_INCLUDED_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_class.h"
+#include "jni_env.h"
+#include "jni_instrument.h"
+#include "jni_utils.h"
+#include "jni_resource.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIEventRing: a bounded multi-producer single-consumer queue.
+ * Every cell carries a sequence number telling whether it is free for the
+ * producer of a given position, or ready for the consumer; producers claim
+ * positions with a compare-and-swap, so push() and pop() are lock-free.
+ * The capacity is rounded up to a power of two.
+ *---------------------------------------------------------------------------*/
+template<class Event>
+class JNIEventRing {
+   struct Cell {
+      std::atomic<std::size_t> sequence;
+      Event event;
+   };
+
+   std::vector<Cell> _cells;
+   std::size_t _mask;
+   alignas(64) std::atomic<std::size_t> _head;	// next position to push
+   alignas(64) std::size_t _tail;				// next position to pop
+
+   JNIEventRing(const JNIEventRing &);
+   JNIEventRing &operator= (const JNIEventRing &);
+
+public:
+   explicit JNIEventRing(std::size_t capacity) : _head(0), _tail(0) {
+      std::size_t size = 2;
+      while (size < capacity)
+         size *= 2;
+      _cells = std::vector<Cell>(size);
+      _mask = size - 1;
+      for (std::size_t i = 0; i < size; i++)
+         _cells[i].sequence.store(i, std::memory_order_relaxed);
+   }
+
+   // Producers: returns false if the ring is full
+   bool push(const Event &event) {
+      std::size_t pos = _head.load(std::memory_order_relaxed);
+      for (;;) {
+         Cell &cell = _cells[pos & _mask];
+         std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+         if (seq == pos) {
+            if (_head.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+               cell.event = event;
+               cell.sequence.store(pos + 1, std::memory_order_release);
+               return true;
+            }
+         }
+         else if (seq < pos)
+            return false;
+         else
+            pos = _head.load(std::memory_order_relaxed);
+      }
+   }
+
+   // Consumer only: returns false if the ring is empty
+   bool pop(Event &event) {
+      Cell &cell = _cells[_tail & _mask];
+      if (cell.sequence.load(std::memory_order_acquire) != _tail + 1)
+         return false;
+      event = cell.event;
+      cell.sequence.store(_tail + _mask + 1, std::memory_order_release);
+      _tail++;
+      return true;
+   }
+
+   std::size_t capacity() const { return _mask + 1; }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIBatchDelivery<Event> describes how a batch reaches Java:
+ * - signature():             signature of the listener method
+ * - create(env, buf, n):     local reference to the Java container of up
+ *                            to 'n' events, backed by 'buf' if possible
+ * - fill(env, c, buf, n):    copies 'n' events into the container
+ * The generic version uses a direct ByteBuffer; primitive types use arrays.
+ *---------------------------------------------------------------------------*/
+template<class Event>
+struct JNIBatchDelivery {
+   static std::string signature() { return "(Ljava/nio/ByteBuffer;I)V"; }
+
+   static jobject create(JNIEnv *env, Event *buf, jsize n) {
+      jobject buffer = env->NewDirectByteBuffer(buf, n * sizeof(Event));
+      if (buffer == 0)
+         return 0;
+
+      // Direct buffers are big-endian unless told otherwise
+      JNIClass byteOrder(env, "java/nio/ByteOrder");
+      jmethodID nativeOrder = env->GetStaticMethodID(byteOrder,
+         "nativeOrder", "()Ljava/nio/ByteOrder;");
+      jmethodID order = env->GetMethodID(JNIClass(env, buffer), "order",
+         "(Ljava/nio/ByteOrder;)Ljava/nio/ByteBuffer;");
+      if (nativeOrder == 0 || order == 0)
+         throw JNIException("Failed to get ByteBuffer method ids");
+      jobject native = env->CallStaticObjectMethod(byteOrder, nativeOrder);
+      env->DeleteLocalRef(env->CallObjectMethod(buffer, order, native));
+      env->DeleteLocalRef(native);
+      return buffer;
+   }
+
+   static void fill(JNIEnv *, jobject, const Event *, jsize) {}
+};
+
+#define JNI_BATCH_DELIVERY(Type)											\
+template<> struct JNIBatchDelivery<NATIVE_TYPE(Type)> {						\
+   static std::string signature() {											\
+      return std::string("(") + ARRAY_SIGNATURE(Type) + "I)V";				\
+   }																		\
+																			\
+   static jobject create(JNIEnv *env, NATIVE_TYPE(Type) *, jsize n) {		\
+      return env->New##Type##Array(n);										\
+   }																		\
+																			\
+   static void fill(JNIEnv *env, jobject array,								\
+                    NATIVE_TYPE(Type) *buf, jsize n) {						\
+      SetArrayRegion(env, static_cast<ARRAY_TYPE(Type)>(array), 0, n, buf);	\
+   }																		\
+};
+
+/*-----------------------------------------------------------------------------
+ * Combo instantiation of JNIBatchDelivery for all primitive types
+ *---------------------------------------------------------------------------*/
+
+INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_BATCH_DELIVERY)
+
+/*-----------------------------------------------------------------------------
+ * JNICallbackBatcher
+ *---------------------------------------------------------------------------*/
+template<class Event>
+class JNICallbackBatcher {
+   typedef JNIBatchDelivery<Event> _delivery;
+
+   JavaVM *_vm;
+   JNIGlobalRef<jobject> _listener;	// receiver of the batches
+   jmethodID _method;					// listener method
+   JNIEventRing<Event> _ring;
+   std::vector<Event> _batch;			// native side of the Java container
+   std::chrono::milliseconds _maxDelay;
+
+   std::atomic<std::size_t> _pending;	// events posted, not yet drained
+   std::atomic<std::size_t> _delivered;
+   std::atomic<std::size_t> _batches;
+   std::atomic<std::size_t> _dropped;
+   std::atomic<std::size_t> _failures;	// batches the listener threw on
+
+   std::mutex _lock;					// protects the fields below
+   std::condition_variable _wake;
+   bool _flush;
+   bool _stop;
+   std::thread _thread;				// delivery thread (started last)
+
+   JNICallbackBatcher(const JNICallbackBatcher &);
+   JNICallbackBatcher &operator= (const JNICallbackBatcher &);
+
+public:
+   JNICallbackBatcher(JNIEnv *env, jobject listener,
+                      const char *method = "onEvents",
+                      std::size_t capacity = 4096,
+                      std::size_t batchSize = 256,
+                      std::chrono::milliseconds maxDelay =
+                         std::chrono::milliseconds(10)) :
+      _vm(0), _listener(env, listener), _method(0), _ring(capacity),
+      _batch(batchSize > 0 ? batchSize : 1), _maxDelay(maxDelay),
+      _pending(0), _delivered(0), _batches(0), _dropped(0), _failures(0),
+      _flush(false), _stop(false) {
+      env->GetJavaVM(&_vm);
+      _method = env->GetMethodID(JNIClass(env, listener), method,
+                                 _delivery::signature().c_str());
+      if (_method == 0)
+         throw JNIException("Failed to get the listener method id");
+      _thread = std::thread(&JNICallbackBatcher::main, this);
+   }
+
+   ~JNICallbackBatcher() {
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         _stop = true;
+      }
+      _wake.notify_one();
+      _thread.join();
+   }
+
+   // Posts an event; returns false (and counts it) if the ring is full
+   bool post(const Event &event) {
+      // Counted before the push, so that the consumer never sees more
+      // events than are pending
+      std::size_t pending = _pending.fetch_add(1, std::memory_order_acq_rel);
+      if (!_ring.push(event)) {
+         _pending.fetch_sub(1, std::memory_order_acq_rel);
+         _dropped.fetch_add(1, std::memory_order_relaxed);
+         return false;
+      }
+      // Only the event completing a batch wakes the delivery thread
+      if (pending + 1 == _batch.size())
+         flush();
+      return true;
+   }
+
+   // Requests delivery of the pending events without waiting for the
+   // thresholds
+   void flush() {
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         _flush = true;
+      }
+      _wake.notify_one();
+   }
+
+   // Statistics
+   std::size_t delivered() const { return _delivered.load(); }
+   std::size_t batches() const { return _batches.load(); }
+   std::size_t dropped() const { return _dropped.load(); }
+   std::size_t failures() const { return _failures.load(); }
+   std::size_t pending() const { return _pending.load(); }
+
+private:
+   void main() {
+      try {
+         JNIEnvironment env(_vm, true);	// detached on exit
+         JNIGlobalRef<jobject> container(env, _delivery::create(env,
+            &_batch[0], static_cast<jsize>(_batch.size())));
+         if (container.get() == 0)
+            throw JNIException("Failed to create the batch container");
+         loop(env, container.get());
+      }
+      catch(JNIException &e) {
+         // Unable to attach or to set up delivery: events are discarded
+         // (and counted as dropped) until the batcher is destroyed
+         discard();
+      }
+   }
+
+   void loop(JNIEnv *env, jobject container) {
+      for (;;) {
+         bool stop;
+         {
+            std::unique_lock<std::mutex> lock(_lock);
+            _wake.wait_for(lock, _maxDelay, [this] { return _flush || _stop; });
+            stop = _stop;
+            _flush = false;
+         }
+         // Deliver everything available, in batches
+         while (deliver(env, container) == _batch.size())
+            ;
+         if (stop)
+            return;
+      }
+   }
+
+   std::size_t deliver(JNIEnv *env, jobject container) {
+      std::size_t n = 0;
+      while (n < _batch.size() && _ring.pop(_batch[n]))
+         n++;
+      if (n == 0)
+         return 0;
+      _pending.fetch_sub(n, std::memory_order_acq_rel);
+
+      jsize len = static_cast<jsize>(n);
+      JNI_INSTRUMENT("JNICallbackBatcher::deliver");
+      _delivery::fill(env, container, &_batch[0], len);
+      env->CallVoidMethod(_listener.get(), _method, container, len);
+      if (env->ExceptionCheck()) {
+         env->ExceptionClear();
+         _failures.fetch_add(1, std::memory_order_relaxed);
+      }
+      _delivered.fetch_add(n, std::memory_order_relaxed);
+      _batches.fetch_add(1, std::memory_order_relaxed);
+      return n;
+   }
+
+   void discard() {
+      for (;;) {
+         bool stop;
+         {
+            std::unique_lock<std::mutex> lock(_lock);
+            _wake.wait_for(lock, _maxDelay, [this] { return _flush || _stop; });
+            stop = _stop;
+            _flush = false;
+         }
+         Event event;
+         while (_ring.pop(event)) {
+            _pending.fetch_sub(1, std::memory_order_acq_rel);
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+         }
+         if (stop)
+            return;
+      }
+   }
+};
+
+#endif /* _JNI_CALLBACK_BATCHER_H_INCLUDED_ */
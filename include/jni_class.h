@@ -6,6 +6,7 @@
 #define _JNI_CLASS_H_INCLUDED_
 
 #include "jni_declarations.h"
+#include "jni_instrument.h"
 
 /*-----------------------------------------------------------------------------
  * JNIClass encapsulates a 'jclass' object.
@@ -23,11 +24,15 @@ public:
    // Constructors of the form JNIClass(JNIEnv *env, T cls),
    // where T can be 'jclass', 'jobject' or 'const char *'.
    JNIClass(JNIEnv *env, jclass clazz) : _clazz(clazz) {}
-   JNIClass(JNIEnv *env, jobject obj) : _clazz(env->GetObjectClass(obj)) {
+   JNIClass(JNIEnv *env, jobject obj) {
+	  JNI_INSTRUMENT("JNIClass::GetObjectClass");
+	  _clazz = env->GetObjectClass(obj);
 	  if (_clazz == 0)
 		 throw JNIException("Failed to get a class");
    }
-   JNIClass(JNIEnv *env, const char *name) : _clazz(env->FindClass(name)) {
+   JNIClass(JNIEnv *env, const char *name) {
+	  JNI_INSTRUMENT("JNIClass::FindClass");
+	  _clazz = env->FindClass(name);
 	  if (_clazz == 0)
 		 throw JNIException("Failed to get a class");
    }
@@ -0,0 +1,221 @@
+/*-----------------------------------------------------------------------------
+ * Deferred release of JNIResources.
+ *
+ * ~JNIResource releases its resource through a JNIEnvironment, which fails
+ * if the destroying thread cannot be attached to the Java VM (e.g. while
+ * the VM shuts down, or when out of memory). The resource would then be
+ * leaked. For global and weak global references, ~JNIResource instead
+ * queues the release, which is retried explicitly, by
+ * JNIDeferredRelease::drain(env), or at JNI_OnUnload:
+ *
+ *    JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *) {
+ *       JNIEnvironment env(vm);
+ *       JNIDeferredRelease::unload(env);
+ *    }
+ *
+ * Only releases whose handles stay valid on any thread, and after the
+ * native frame returns, can be retried (see JNIReleaseTraits). The other
+ * resources (array elements, string characters, critical arrays and
+ * monitors) are keyed by references which are usually local, and their
+ * releases are counted as leaked instead of being queued.
+ *
+ * Releases are never retried implicitly: drain() runs arbitrary JNI calls,
+ * which must not happen e.g. inside a critical region. Call it where no
+ * critical region is held, such as at the start of a native method, or
+ * from a housekeeping thread.
+ *
+ * Counters make the failures visible: deferred() releases were queued,
+ * released() of them succeeded later, leaked() were given up (dropped by
+ * unload(), not deferrable, or not queued for lack of memory), and
+ * pending() are queued.
+ * drain() costs one atomic load when nothing is pending.
+ *
+ * Only C++11 builds defer releases; C++98 builds keep leaking them.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_DEFERRED_RELEASE_H_INCLUDED_
+#define _JNI_DEFERRED_RELEASE_H_INCLUDED_
+
+#include "jni_declarations.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIReleaseTraits<Settings>: whether the release of a resource may be run
+ * later, on any thread. Specialized for global and weak global references
+ * in jni_resource.h.
+ *---------------------------------------------------------------------------*/
+template<class JNIResourceSettings>
+struct JNIReleaseTraits {
+   enum { deferrable = 0 };
+};
+
+#if __cplusplus >= 201103L
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "jni_instrument.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIDeferredRelease: the process-wide queue of failed releases
+ *---------------------------------------------------------------------------*/
+class JNIDeferredRelease {
+public:
+   // A queued release
+   class Entry {
+      JavaVM *_vm;
+
+   public:
+      explicit Entry(JavaVM *vm) : _vm(vm) {}
+      virtual ~Entry() {}
+
+      virtual void release(JNIEnv *env) = 0;
+
+      JavaVM *vm() const { return _vm; }
+   };
+
+   // Queues the release of 'resource' by 'Settings::ReleaseF', or counts it
+   // as leaked if the release cannot be deferred
+   template<class Settings>
+   static void defer(JavaVM *vm, typename Settings::JResource jresource,
+                     typename Settings::Resource resource) {
+      if (!JNIReleaseTraits<Settings>::deferrable) {
+         state().leaked.fetch_add(1, std::memory_order_relaxed);
+         return;
+      }
+      try {
+         std::unique_ptr<Entry> entry(
+            new EntryOf<Settings>(vm, jresource, resource));
+         std::lock_guard<std::mutex> guard(state().lock);
+         state().queue.push_back(std::move(entry));
+         state().pending.fetch_add(1);
+         state().deferred.fetch_add(1, std::memory_order_relaxed);
+      }
+      catch (...) {
+         state().leaked.fetch_add(1, std::memory_order_relaxed);
+      }
+   }
+
+   // Runs the queued releases for the Java VM of 'env'; returns their
+   // number
+   static std::size_t drain(JNIEnv *env) {
+      JavaVM *vm;
+      if (env->GetJavaVM(&vm) != JNI_OK)
+         return 0;
+      return drain(vm, env);
+   }
+
+   static std::size_t drain(JavaVM *vm, JNIEnv *env) {
+      // Releases queued while draining wait for the next drain
+      bool &draining = drainingThread();
+      if (draining || pending() == 0)
+         return 0;
+      draining = true;
+      JNI_INSTRUMENT("JNIDeferredRelease::drain");
+
+      std::vector<std::unique_ptr<Entry> > ready;
+      {
+         std::lock_guard<std::mutex> guard(state().lock);
+         std::vector<std::unique_ptr<Entry> > &queue = state().queue;
+         std::vector<std::unique_ptr<Entry> >::iterator kept = queue.begin();
+         for (std::size_t i = 0; i < queue.size(); i++) {
+            if (queue[i]->vm() == vm)
+               ready.push_back(std::move(queue[i]));
+            else
+               *kept++ = std::move(queue[i]);
+         }
+         queue.erase(kept, queue.end());
+         state().pending.fetch_sub(ready.size());
+      }
+      for (std::size_t i = 0; i < ready.size(); i++)
+         ready[i]->release(env);
+      state().released.fetch_add(ready.size(), std::memory_order_relaxed);
+
+      draining = false;
+      return ready.size();
+   }
+
+   // At JNI_OnUnload: drains, then drops the releases for the Java VM of
+   // 'env' which are still queued (queued while draining)
+   static void unload(JNIEnv *env) {
+      JavaVM *vm;
+      if (env->GetJavaVM(&vm) != JNI_OK)
+         return;
+      drain(vm, env);
+
+      std::lock_guard<std::mutex> guard(state().lock);
+      std::vector<std::unique_ptr<Entry> > &queue = state().queue;
+      std::vector<std::unique_ptr<Entry> >::iterator kept = queue.begin();
+      std::size_t dropped = 0;
+      for (std::size_t i = 0; i < queue.size(); i++) {
+         if (queue[i]->vm() == vm)
+            dropped++;
+         else
+            *kept++ = std::move(queue[i]);
+      }
+      queue.erase(kept, queue.end());
+      state().pending.fetch_sub(dropped);
+      state().leaked.fetch_add(dropped, std::memory_order_relaxed);
+   }
+
+   static std::uint64_t deferred() {
+      return state().deferred.load(std::memory_order_relaxed);
+   }
+   static std::uint64_t released() {
+      return state().released.load(std::memory_order_relaxed);
+   }
+   static std::uint64_t leaked() {
+      return state().leaked.load(std::memory_order_relaxed);
+   }
+   static std::size_t pending() {
+      return state().pending.load();
+   }
+
+private:
+   template<class Settings>
+   class EntryOf : public Entry {
+      typename Settings::JResource _jresource;
+      typename Settings::Resource _resource;
+
+   public:
+      EntryOf(JavaVM *vm, typename Settings::JResource jresource,
+              typename Settings::Resource resource) :
+         Entry(vm),
+         _jresource(jresource), _resource(resource) {}
+
+      void release(JNIEnv *env) {
+         typename Settings::ReleaseF releaseF;
+         releaseF(env, _jresource, _resource);
+      }
+   };
+
+   struct State {
+      std::mutex lock;					// protects 'queue'
+      std::vector<std::unique_ptr<Entry> > queue;
+      std::atomic<std::size_t> pending;
+      std::atomic<std::uint64_t> deferred;
+      std::atomic<std::uint64_t> released;
+      std::atomic<std::uint64_t> leaked;
+
+      State() : pending(0), deferred(0), released(0), leaked(0) {}
+   };
+
+   // Never destroyed: resources with static storage may still be released
+   // at exit
+   static State &state() {
+      static State *s = new State;
+      return *s;
+   }
+
+   static bool &drainingThread() {
+      static thread_local bool draining = false;
+      return draining;
+   }
+};
+
+#endif /* __cplusplus >= 201103L */
+
+#endif /* _JNI_DEFERRED_RELEASE_H_INCLUDED_ */
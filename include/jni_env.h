@@ -6,6 +6,7 @@
 #define _JNI_ENV_H_INCLUDED_
 
 #include "jni_declarations.h"
+#include "jni_instrument.h"
 
 #define JNI_VERSION JNI_VERSION_1_2
 
@@ -21,14 +22,21 @@ class JNIEnvironment {
    bool _attached; // Attached to the current thread
    
 public:
-   JNIEnvironment(JavaVM *vm) : _vm(vm), _attached(false) {
+   // A 'daemon' thread, once attached, does not keep the Java VM from
+   // shutting down: long-lived native threads should be attached as daemons
+   JNIEnvironment(JavaVM *vm, bool daemon = false) :
+      _vm(vm), _attached(false) {
       int state = vm->GetEnv((void **)&_env, JNI_VERSION);
       if(state == JNI_EDETACHED) {
+         JNI_INSTRUMENT("JNIEnvironment::attach");
 #ifdef __ANDROID__
-         if(vm->AttachCurrentThread(&_env, NULL) != 0) {
+         JNIEnv **env = &_env;
 #else
-         if(vm->AttachCurrentThread((void **)&_env, NULL) != 0) {
+         void **env = (void **)&_env;
 #endif
+         jint result = daemon ? vm->AttachCurrentThreadAsDaemon(env, NULL) :
+                                vm->AttachCurrentThread(env, NULL);
+         if(result != 0) {
             throw JNIException("Failed to attach JNIEnv to Java VM");
          }
          else {
@@ -42,6 +50,7 @@ public:
 
    ~JNIEnvironment() {
       if(_attached) {
+         JNI_INSTRUMENT("JNIEnvironment::detach");
          _vm->DetachCurrentThread();
       }
    }
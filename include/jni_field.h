@@ -20,6 +20,7 @@
 #include "jni_declarations.h"
 #include "jni_class.h"
 #include "jni_env.h"
+#include "jni_instrument.h"
 
 /*-----------------------------------------------------------------------------
  * JNIGenericFieldId represents a structure common for both regular and static
@@ -61,10 +62,12 @@ public:
 
    // Get and Set utilities
    JavaType Get(jobject obj) const {
+     JNI_INSTRUMENT("JNIFieldId<Object>::Get");
      JNIEnvironment env(_vm);
 	  return static_cast<JavaType>(env.Get()->GetObjectField(obj, _id));
    }
    void Set(jobject obj, JavaType val) {
+      JNI_INSTRUMENT("JNIFieldId<Object>::Set");
       JNIEnvironment env(_vm);
 	   env.Get()->SetObjectField(obj, _id, val);
    }
@@ -90,10 +93,12 @@ public:                                                                    \
 											 name, SIGNATURE(Type))) {}               \
                                                                            \
    NATIVE_TYPE(Type) Get(jobject obj) const {                              \
+      JNI_INSTRUMENT("JNIFieldId<" #Type ">::Get");                        \
       JNIEnvironment env(_vm);                                             \
       return env.Get()->Get##Type##Field(obj, _id);                        \
    }                                                                       \
    void Set(jobject obj, NATIVE_TYPE(Type) val) {                          \
+      JNI_INSTRUMENT("JNIFieldId<" #Type ">::Set");                        \
       JNIEnvironment env(_vm);                                             \
       env.Get()->Set##Type##Field(obj, _id, val);                          \
    }                                                                       \
@@ -125,10 +130,12 @@ public:
 
    // Get and Set utilities
    JavaType Get(jclass clazz) const {
+     JNI_INSTRUMENT("JNIStaticFieldId<Object>::Get");
      JNIEnvironment env(_vm);
 	  return static_cast<JavaType>(env.Get()->GetStaticObjectField(clazz, _id));
    }
    void Set(jclass clazz, JavaType val) {
+     JNI_INSTRUMENT("JNIStaticFieldId<Object>::Set");
      JNIEnvironment env(_vm);
 	  env.Get()->SetStaticObjectField(clazz, _id, val);
    }
@@ -155,10 +162,12 @@ public:																		\
 											  name, SIGNATURE(Type))) {}	\
 																			\
    NATIVE_TYPE(Type) Get(jclass clazz) const {								\
+      JNI_INSTRUMENT("JNIStaticFieldId<" #Type ">::Get");					\
       JNIEnvironment env(_vm);                                              \
       return env.Get()->GetStatic##Type##Field(clazz, _id);					\
    }																		\
    void Set(jclass clazz, NATIVE_TYPE(Type) val) {							\
+      JNI_INSTRUMENT("JNIStaticFieldId<" #Type ">::Set");					\
       JNIEnvironment env(_vm);                                              \
       env.Get()->SetStatic##Type##Field(clazz, _id, val);				    \
    }																		\
@@ -171,6 +180,62 @@ public:																		\
 
 INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_STATIC_FIELD_ID_METHODS)
 
+/*-----------------------------------------------------------------------------
+ * JNIFieldAccess provides Get/Set of a field through an explicitly supplied
+ * JNIEnv and a raw 'jfieldID'. Unlike JNIFieldId, it neither resolves the
+ * id nor constructs a JNIEnvironment per access, which makes it suitable
+ * for tight sequences of field accesses on a single thread (see
+ * JNIObjectView in 'jni_object_view.h').
+ * The generic template handles object types, and is specialized for the
+ * primitive types below.
+ *---------------------------------------------------------------------------*/
+template<class JavaType>
+struct JNIFieldAccess {
+   static JavaType Get(JNIEnv *env, jobject obj, jfieldID id) {
+      JNI_INSTRUMENT("JNIFieldAccess<Object>::Get");
+      return static_cast<JavaType>(env->GetObjectField(obj, id));
+   }
+   static void Set(JNIEnv *env, jobject obj, jfieldID id, JavaType val) {
+      JNI_INSTRUMENT("JNIFieldAccess<Object>::Set");
+      env->SetObjectField(obj, id, val);
+   }
+   static JavaType GetStatic(JNIEnv *env, jclass clazz, jfieldID id) {
+      return static_cast<JavaType>(env->GetStaticObjectField(clazz, id));
+   }
+   static void SetStatic(JNIEnv *env, jclass clazz, jfieldID id,
+                         JavaType val) {
+      env->SetStaticObjectField(clazz, id, val);
+   }
+};
+
+#define JNI_FIELD_ACCESS(Type)                                              \
+template<> struct JNIFieldAccess<NATIVE_TYPE(Type)> {                       \
+   static NATIVE_TYPE(Type) Get(JNIEnv *env, jobject obj, jfieldID id) {    \
+      JNI_INSTRUMENT("JNIFieldAccess<" #Type ">::Get");                     \
+      return env->Get##Type##Field(obj, id);                                \
+   }                                                                        \
+   static void Set(JNIEnv *env, jobject obj, jfieldID id,                   \
+                   NATIVE_TYPE(Type) val) {                                 \
+      JNI_INSTRUMENT("JNIFieldAccess<" #Type ">::Set");                     \
+      env->Set##Type##Field(obj, id, val);                                  \
+   }                                                                        \
+   static NATIVE_TYPE(Type) GetStatic(JNIEnv *env, jclass clazz,            \
+                                      jfieldID id) {                        \
+      return env->GetStatic##Type##Field(clazz, id);                        \
+   }                                                                        \
+   static void SetStatic(JNIEnv *env, jclass clazz, jfieldID id,            \
+                         NATIVE_TYPE(Type) val) {                           \
+      env->SetStatic##Type##Field(clazz, id, val);                          \
+   }                                                                        \
+};
+
+/*-----------------------------------------------------------------------------
+ * Combo instantiation of JNIFieldAccess specialization for all primitive
+ * types
+ *---------------------------------------------------------------------------*/
+
+INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_FIELD_ACCESS)
+
 /*-----------------------------------------------------------------------------
  * JNIField is a template parameterized with a native type ('jint',
  * 'jchar' etc.) It has two members: a JNIFieldId and an object itself.
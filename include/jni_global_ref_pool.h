@@ -0,0 +1,257 @@
+/*-----------------------------------------------------------------------------
+ * Pooled global references.
+ *
+ * Every JNIGlobalRef calls NewGlobalRef on construction and DeleteGlobalRef
+ * on destruction, and both take the Java VM's global handle lock. Native
+ * registries holding many objects (such as the SampleContainer example)
+ * contend on that lock. JNIGlobalRefPool keeps the objects reachable from
+ * a few large Java 'Object[]' segments instead, each held by a single
+ * global reference, and hands out slots in these segments:
+ *
+ *    JNIGlobalRefPool pool(env);
+ *    JNIPooledRef ref(pool, env, obj);	// SetObjectArrayElement
+ *    ...
+ *    jobject local = ref.get(env);		// GetObjectArrayElement
+ *
+ * - Releases are batched: a released slot is queued, and the queued slots
+ *   are cleared (and made available again) together, once 'releaseBatch'
+ *   of them accumulate, when a slot is needed, or on flush(). Releasing
+ *   needs no JNIEnv. Until then, the objects remain reachable.
+ * - New segments are allocated on demand (up to 'maxSegments'), and kept
+ *   until the pool is destroyed.
+ * - live() and highWater() count the slots in use; a non-zero live() at
+ *   unload time denotes leaked references.
+ *
+ * All functions are thread-safe.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_GLOBAL_REF_POOL_H_INCLUDED_
+#define _JNI_GLOBAL_REF_POOL_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_class.h"
+#include "jni_env.h"
+#include "jni_resource.h"
+#include "jni_deferred_release.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIGlobalRefPool
+ *---------------------------------------------------------------------------*/
+class JNIGlobalRefPool {
+public:
+   typedef std::uint32_t Handle;
+   static const Handle invalid = 0xffffffffu;
+
+private:
+   JavaVM *_vm;
+   std::size_t _segmentSize;		// slots per segment
+   std::size_t _maxSegments;
+   std::size_t _releaseBatch;		// queued releases triggering a flush
+
+   // Segment table: allocated once, so that slots can be read without
+   // locking while new segments are added
+   std::unique_ptr<jobjectArray[]> _segments;
+
+   std::mutex _lock;				// protects the fields below
+   std::size_t _segmentCount;
+   std::vector<Handle> _free;		// cleared slots
+   std::vector<Handle> _pending;	// released slots, not yet cleared
+   std::size_t _live;
+   std::size_t _highWater;
+
+   JNIGlobalRefPool(const JNIGlobalRefPool &);
+   JNIGlobalRefPool &operator= (const JNIGlobalRefPool &);
+
+public:
+   explicit JNIGlobalRefPool(JNIEnv *env, std::size_t segmentSize = 4096,
+                             std::size_t maxSegments = 1024,
+                             std::size_t releaseBatch = 256) :
+      _vm(0), _segmentSize(segmentSize > 0 ? segmentSize : 1),
+      _maxSegments(maxSegments), _releaseBatch(releaseBatch),
+      _segments(new jobjectArray[maxSegments]), _segmentCount(0),
+      _live(0), _highWater(0) {
+      env->GetJavaVM(&_vm);
+   }
+
+   // Deletes the segments, and with them the last references to the
+   // objects still pooled
+   ~JNIGlobalRefPool() {
+      try {
+         JNIEnvironment env(_vm);
+         for (std::size_t s = 0; s < _segmentCount; s++)
+            env.Get()->DeleteGlobalRef(_segments[s]);
+      }
+      catch(JNIException &e) {
+         // Unable to obtain a JNIEnv: the segments are deleted later
+         for (std::size_t s = 0; s < _segmentCount; s++)
+            JNIDeferredRelease::defer<JNIGlobalRefSettings<jobjectArray> >(
+               _vm, 0, _segments[s]);
+      }
+   }
+
+   // Stores 'obj' in a free slot
+   Handle acquire(JNIEnv *env, jobject obj) {
+      Handle h;
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         if (_pending.size() >= _releaseBatch ||
+             (_free.empty() && !_pending.empty()))
+            clear(env);
+         if (_free.empty())
+            grow(env);
+         h = _free.back();
+         _free.pop_back();
+         if (++_live > _highWater)
+            _highWater = _live;
+      }
+      set(env, h, obj);
+      return h;
+   }
+
+   // Queues the slot for release
+   void release(Handle h) {
+      if (h == invalid)
+         return;
+      std::lock_guard<std::mutex> guard(_lock);
+      _pending.push_back(h);
+      _live--;
+   }
+
+   // Clears the queued slots now
+   void flush(JNIEnv *env) {
+      std::lock_guard<std::mutex> guard(_lock);
+      clear(env);
+   }
+
+   // Returns a new local reference to the object in the slot (0 for an
+   // invalid handle)
+   jobject get(JNIEnv *env, Handle h) const {
+      if (h == invalid)
+         return 0;
+      return env->GetObjectArrayElement(segment(h), offset(h));
+   }
+
+   // Replaces the object in the slot (nothing for an invalid handle)
+   void set(JNIEnv *env, Handle h, jobject obj) {
+      if (h == invalid)
+         return;
+      env->SetObjectArrayElement(segment(h), offset(h), obj);
+   }
+
+   // Statistics
+   std::size_t live() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _live;
+   }
+   std::size_t highWater() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _highWater;
+   }
+   std::size_t pending() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _pending.size();
+   }
+   std::size_t segments() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _segmentCount;
+   }
+   std::size_t capacity() {
+      std::lock_guard<std::mutex> guard(_lock);
+      return _segmentCount * _segmentSize;
+   }
+
+private:
+   jobjectArray segment(Handle h) const { return _segments[h / _segmentSize]; }
+   jsize offset(Handle h) const { return static_cast<jsize>(h % _segmentSize); }
+
+   // Both called with the lock held
+   void clear(JNIEnv *env) {
+      for (std::size_t i = 0; i < _pending.size(); i++) {
+         set(env, _pending[i], 0);
+         _free.push_back(_pending[i]);
+      }
+      _pending.clear();
+   }
+
+   void grow(JNIEnv *env) {
+      if (_segmentCount == _maxSegments ||
+          (_segmentCount + 1) * _segmentSize > invalid)
+         throw JNIException("JNIGlobalRefPool is exhausted");
+      jobjectArray local = env->NewObjectArray(
+         static_cast<jsize>(_segmentSize), JNIClass(env, "java/lang/Object"), 0);
+      if (local == 0)
+         throw JNIException("Failed to allocate a JNIGlobalRefPool segment");
+      _segments[_segmentCount] =
+         static_cast<jobjectArray>(env->NewGlobalRef(local));
+      env->DeleteLocalRef(local);
+
+      // Lower slots are handed out first
+      Handle first = static_cast<Handle>(_segmentCount * _segmentSize);
+      for (std::size_t i = _segmentSize; i > 0; i--)
+         _free.push_back(first + static_cast<Handle>(i - 1));
+      _segmentCount++;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIPooledRef owns a slot of a JNIGlobalRefPool, and releases it on
+ * destruction. Like JNIGlobalRef, it may be moved but not copied.
+ *---------------------------------------------------------------------------*/
+class JNIPooledRef {
+   JNIGlobalRefPool *_pool;
+   JNIGlobalRefPool::Handle _handle;
+
+   JNIPooledRef(const JNIPooledRef &);
+   JNIPooledRef &operator= (const JNIPooledRef &);
+
+public:
+   JNIPooledRef() : _pool(0), _handle(JNIGlobalRefPool::invalid) {}
+   JNIPooledRef(JNIGlobalRefPool &pool, JNIEnv *env, jobject obj) :
+      _pool(&pool), _handle(pool.acquire(env, obj)) {}
+
+   JNIPooledRef(JNIPooledRef &&x) : _pool(x._pool), _handle(x.release()) {
+      x._pool = 0;
+   }
+   JNIPooledRef &operator= (JNIPooledRef &&x) {
+      if (&x != this) {
+         reset();
+         _pool = x._pool;
+         _handle = x.release();
+         x._pool = 0;
+      }
+      return *this;
+   }
+
+   ~JNIPooledRef() { reset(); }
+
+   // Returns a new local reference to the object (0 if no slot is owned)
+   jobject get(JNIEnv *env) const {
+      if (_pool == 0 || _handle == JNIGlobalRefPool::invalid)
+         return 0;
+      return _pool->get(env, _handle);
+   }
+
+   JNIGlobalRefPool::Handle handle() const { return _handle; }
+
+   // Gives up ownership of the slot, and returns it
+   JNIGlobalRefPool::Handle release() {
+      JNIGlobalRefPool::Handle h = _handle;
+      _handle = JNIGlobalRefPool::invalid;
+      return h;
+   }
+
+   void reset() {
+      if (_pool != 0)
+         _pool->release(release());
+   }
+};
+
+#endif /* _JNI_GLOBAL_REF_POOL_H_INCLUDED_ */
@@ -0,0 +1,72 @@
+/*-----------------------------------------------------------------------------
+ * Hashing and equality of JNIGlobalRef by object identity.
+ *
+ * With the definitions below, global references can key unordered
+ * containers:
+ *
+ *    typedef std::unordered_map<JNIGlobalRef<jobject>, Info,
+ *                               std::hash<JNIGlobalRef<jobject> >,
+ *                               JNIIdentityEqual<jobject> > Registry;
+ *
+ *    Registry registry(0, std::hash<JNIGlobalRef<jobject> >(),
+ *                      JNIIdentityEqual<jobject>(env));
+ *    registry.emplace(std::piecewise_construct,
+ *                     std::forward_as_tuple(env, obj), std::make_tuple());
+ *
+ * - std::hash<JNIGlobalRef<T> > uses the identity hash code cached by the
+ *   reference (System.identityHashCode, computed once per reference).
+ * - JNIIdentityEqual<T> compares references by identity: equal handles are
+ *   equal, and references with different (cached) hash codes are not,
+ *   without any JNI call. Otherwise IsSameObject is called through the
+ *   JNIEnv given on construction; a functor constructed without a JNIEnv
+ *   obtains one from the Java VM on each such call. A JNIEnv is only valid
+ *   on its own thread, so a container whose functor holds one must only be
+ *   used on that thread.
+ *
+ * Since JNIGlobalRef cannot be copied, entries are constructed in place.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_IDENTITY_H_INCLUDED_
+#define _JNI_IDENTITY_H_INCLUDED_
+
+#include <cstddef>
+#include <functional>
+
+#include "jni_declarations.h"
+#include "jni_resource.h"
+
+namespace std {
+
+template<class T>
+struct hash<JNIGlobalRef<T> > {
+   std::size_t operator() (const JNIGlobalRef<T> &ref) const {
+      return static_cast<std::size_t>(
+         static_cast<unsigned int>(ref.identityHash()));
+   }
+};
+
+}
+
+template<class T>
+class JNIIdentityEqual {
+   JNIEnv *_env;	// environment of the owning thread (or 0)
+
+public:
+   explicit JNIIdentityEqual(JNIEnv *env = 0) : _env(env) {}
+
+   bool operator() (const JNIGlobalRef<T> &x, const JNIGlobalRef<T> &y) const {
+      if (x.get() == y.get())
+         return true;
+      if (x.get() == 0 || y.get() == 0)
+         return false;
+      if (x.hashed() && y.hashed() && x.identityHash() != y.identityHash())
+         return false;
+      if (_env != 0)
+         return _env->IsSameObject(x.get(), y.get()) != JNI_FALSE;
+      return const_cast<JNIGlobalRef<T> &>(x) == y;
+   }
+};
+
+#endif /* _JNI_IDENTITY_H_INCLUDED_ */
@@ -0,0 +1,411 @@
+/*-----------------------------------------------------------------------------
+ * Opt-in instrumentation of the JNI wrappers.
+ *
+ * When JNI_INSTRUMENTATION is defined (before including any header of this
+ * library), the wrappers record, for every call site, the number of calls
+ * and a latency histogram:
+ * - JNIEnvironment attach and detach
+ * - JNIFieldId/JNIStaticFieldId/JNIFieldAccess Get and Set
+ * - JNIResource acquisition and release
+ * - JNIClass lookups
+ * - method calls made by the library (JNIMirror construction,
+ *   CompletableFuture completion, listener deliveries, identity hashing)
+ *
+ * Applications may instrument their own code in the same way:
+ *
+ *    void process(JNIEnv *env, jobject obj) {
+ *       JNI_INSTRUMENT("process");
+ *       ...
+ *    }
+ *
+ * Each thread records into its own buffer, with no locking and no atomic
+ * read-modify-write operations. JNIInstrumentation::snapshot() merges the
+ * buffers of all threads (including threads that have exited), and
+ * JNIInstrumentation::dump() writes them in a simple text format, one line
+ * per call site:
+ *
+ *    # site location count total_ns mean_ns p50_ns p90_ns p99_ns max_ns
+ *    JNIEnvironment::attach jni_env.h:31 12 48213 4017 3840 6144 7168 7305
+ *
+ * Histograms are log-linear (as in HdrHistogram): values are exact below 8
+ * ns, and bucketed with 8 sub-buckets per power of two above, i.e. with a
+ * relative error below 12.5%.
+ *
+ * Without JNI_INSTRUMENTATION, JNI_INSTRUMENT() expands to nothing, and
+ * this file declares nothing else.
+ *
+ * Instrumentation requires C++11. Up to JNI_INSTRUMENT_MAX_SITES (default
+ * 256) call sites are recorded; further sites are ignored.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_INSTRUMENT_H_INCLUDED_
+#define _JNI_INSTRUMENT_H_INCLUDED_
+
+#ifndef JNI_INSTRUMENTATION
+
+#define JNI_INSTRUMENT(name)
+
+#else /* JNI_INSTRUMENTATION */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef JNI_INSTRUMENT_MAX_SITES
+#define JNI_INSTRUMENT_MAX_SITES 256
+#endif
+
+#define JNI_INSTRUMENT_CONCAT_(a, b) a##b
+#define JNI_INSTRUMENT_CONCAT(a, b) JNI_INSTRUMENT_CONCAT_(a, b)
+
+#define JNI_INSTRUMENT(name)												\
+   static JNICallSite JNI_INSTRUMENT_CONCAT(_jniSite, __LINE__)(			\
+      name, __FILE__, __LINE__);											\
+   JNIInstrumentScope JNI_INSTRUMENT_CONCAT(_jniScope, __LINE__)(			\
+      JNI_INSTRUMENT_CONCAT(_jniSite, __LINE__))
+
+/*-----------------------------------------------------------------------------
+ * JNILatencyHistogram: log-linear bucketing of nanosecond latencies
+ *---------------------------------------------------------------------------*/
+struct JNILatencyHistogram {
+   enum { subBits = 3, subBuckets = 1 << subBits };
+   enum { buckets = (64 - subBits + 1) * subBuckets };
+
+   static std::size_t bucket(std::uint64_t v) {
+      if (v < subBuckets)
+         return static_cast<std::size_t>(v);
+      int e = 63 - __builtin_clzll(v);
+      std::size_t sub = static_cast<std::size_t>(v >> (e - subBits)) &
+         (subBuckets - 1);
+      return (e - subBits + 1) * subBuckets + sub;
+   }
+
+   // Smallest value falling into bucket 'b'
+   static std::uint64_t lowerBound(std::size_t b) {
+      if (b < subBuckets)
+         return b;
+      int e = static_cast<int>(b / subBuckets) + subBits - 1;
+      return static_cast<std::uint64_t>(subBuckets + b % subBuckets) <<
+         (e - subBits);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNICallSite identifies an instrumented location; it is registered once,
+ * on first execution.
+ *---------------------------------------------------------------------------*/
+class JNICallSite {
+   const char *_name;
+   const char *_file;
+   int _line;
+   int _index;		// slot in the per-thread buffers, or -1
+
+public:
+   JNICallSite(const char *name, const char *file, int line);
+
+   const char *name() const { return _name; }
+   const char *file() const { return _file; }
+   int line() const { return _line; }
+   int index() const { return _index; }
+};
+
+/*-----------------------------------------------------------------------------
+ * Merged statistics of one call site
+ *---------------------------------------------------------------------------*/
+struct JNICallSiteStats {
+   std::string name;
+   std::string location;		// file:line
+   std::uint64_t count;
+   std::uint64_t totalNanos;
+   std::uint64_t maxNanos;
+   std::vector<std::uint64_t> histogram;	// JNILatencyHistogram buckets
+
+   // Approximate latency below which fraction 'q' of the calls fall
+   std::uint64_t percentile(double q) const {
+      std::uint64_t rank = static_cast<std::uint64_t>(q * count);
+      std::uint64_t seen = 0;
+      for (std::size_t b = 0; b < histogram.size(); b++) {
+         seen += histogram[b];
+         if (seen > rank)
+            return std::min(JNILatencyHistogram::lowerBound(b), maxNanos);
+      }
+      return maxNanos;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIInstrumentation: registry of call sites and thread buffers
+ *---------------------------------------------------------------------------*/
+class JNIInstrumentation {
+public:
+   static const int maxSites = JNI_INSTRUMENT_MAX_SITES;
+
+   // Counters of one site in one thread. Only the owning thread writes
+   // them; the atomics let snapshot() read them concurrently.
+   struct Counters {
+      std::atomic<std::uint64_t> count;
+      std::atomic<std::uint64_t> total;
+      std::atomic<std::uint64_t> max;
+      std::atomic<std::uint64_t> histogram[JNILatencyHistogram::buckets];
+
+      Counters() : count(0), total(0), max(0) {
+         for (std::size_t b = 0; b < JNILatencyHistogram::buckets; b++)
+            histogram[b].store(0, std::memory_order_relaxed);
+      }
+
+      static void bump(std::atomic<std::uint64_t> &x, std::uint64_t v) {
+         x.store(x.load(std::memory_order_relaxed) + v,
+                 std::memory_order_relaxed);
+      }
+
+      void record(std::uint64_t nanos) {
+         bump(count, 1);
+         bump(total, nanos);
+         if (nanos > max.load(std::memory_order_relaxed))
+            max.store(nanos, std::memory_order_relaxed);
+         bump(histogram[JNILatencyHistogram::bucket(nanos)], 1);
+      }
+   };
+
+   // Per-thread buffer; counters are allocated on first use of a site
+   struct Buffer {
+      std::atomic<Counters *> sites[maxSites];
+
+      Buffer() {
+         for (int i = 0; i < maxSites; i++)
+            sites[i].store(0, std::memory_order_relaxed);
+      }
+      ~Buffer() {
+         for (int i = 0; i < maxSites; i++)
+            delete sites[i].load(std::memory_order_relaxed);
+      }
+
+      Counters &at(int site) {
+         Counters *c = sites[site].load(std::memory_order_relaxed);
+         if (c == 0) {
+            c = new Counters;
+            sites[site].store(c, std::memory_order_release);
+         }
+         return *c;
+      }
+   };
+
+private:
+   // Retires the calling thread's buffer when the thread exits
+   struct ThreadGuard {
+      Buffer *buffer;
+      ThreadGuard() : buffer(0) {}
+      ~ThreadGuard() {
+         if (buffer != 0)
+            instance().retire(buffer);
+         current() = dead();
+      }
+   };
+
+   std::mutex _lock;					// protects the fields below
+   const JNICallSite *_sites[maxSites];
+   std::atomic<int> _siteCount;
+   std::vector<Buffer *> _buffers;	// buffers of live threads
+   Buffer _retired;					// merged buffers of exited threads
+
+public:
+   static JNIInstrumentation &instance() {
+      static JNIInstrumentation *registry = new JNIInstrumentation;	// never destroyed
+      return *registry;
+   }
+
+   // Buffer of the calling thread, or 0 during thread exit
+   static Buffer *local() {
+      Buffer *b = current();
+      if (b == 0) {
+         static thread_local ThreadGuard guard;
+         b = new Buffer;
+         instance().adopt(b);
+         guard.buffer = b;
+         current() = b;
+      }
+      return (b == dead()) ? 0 : b;
+   }
+
+   // Sites sharing a name and location (e.g. in the instantiations of a
+   // template) share their counters
+   int registerSite(const JNICallSite *site) {
+      std::lock_guard<std::mutex> guard(_lock);
+      int index = _siteCount.load(std::memory_order_relaxed);
+      for (int i = 0; i < index; i++)
+         if (_sites[i]->line() == site->line() &&
+             std::strcmp(_sites[i]->name(), site->name()) == 0 &&
+             std::strcmp(_sites[i]->file(), site->file()) == 0)
+            return i;
+      if (index >= maxSites)
+         return -1;
+      _sites[index] = site;
+      _siteCount.store(index + 1, std::memory_order_release);
+      return index;
+   }
+
+   // Statistics of all call sites, merged over all threads, in
+   // registration order
+   static std::vector<JNICallSiteStats> snapshot() {
+      return instance().collect();
+   }
+
+   // Text export (see the format above)
+   static void dump(std::ostream &out) {
+      std::vector<JNICallSiteStats> stats = snapshot();
+      out << "# site location count total_ns mean_ns p50_ns p90_ns p99_ns"
+             " max_ns\n";
+      for (std::size_t i = 0; i < stats.size(); i++) {
+         const JNICallSiteStats &s = stats[i];
+         if (s.count == 0)
+            continue;
+         out << s.name << ' ' << s.location << ' ' << s.count << ' '
+             << s.totalNanos << ' ' << s.totalNanos / s.count << ' '
+             << s.percentile(0.5) << ' ' << s.percentile(0.9) << ' '
+             << s.percentile(0.99) << ' ' << s.maxNanos << '\n';
+      }
+   }
+
+   // Clears the counters of exited threads, and of the calling thread
+   static void reset() {
+      JNIInstrumentation &self = instance();
+      std::lock_guard<std::mutex> guard(self._lock);
+      clear(self._retired);
+      Buffer *b = current();
+      if (b != 0 && b != dead())
+         clear(*b);
+   }
+
+private:
+   JNIInstrumentation() : _siteCount(0) {}
+
+   static Buffer *&current() {
+      static thread_local Buffer *buffer = 0;
+      return buffer;
+   }
+
+   static Buffer *dead() {
+      static Buffer *sentinel = reinterpret_cast<Buffer *>(&sentinel);
+      return sentinel;
+   }
+
+   void adopt(Buffer *b) {
+      std::lock_guard<std::mutex> guard(_lock);
+      _buffers.push_back(b);
+   }
+
+   void retire(Buffer *b) {
+      std::lock_guard<std::mutex> guard(_lock);
+      merge(_retired, *b);
+      _buffers.erase(std::find(_buffers.begin(), _buffers.end(), b));
+      delete b;
+   }
+
+   static void merge(Buffer &into, Buffer &from) {
+      for (int i = 0; i < maxSites; i++) {
+         Counters *c = from.sites[i].load(std::memory_order_acquire);
+         if (c == 0)
+            continue;
+         Counters &t = into.at(i);
+         Counters::bump(t.count, c->count.load(std::memory_order_relaxed));
+         Counters::bump(t.total, c->total.load(std::memory_order_relaxed));
+         std::uint64_t m = c->max.load(std::memory_order_relaxed);
+         if (m > t.max.load(std::memory_order_relaxed))
+            t.max.store(m, std::memory_order_relaxed);
+         for (std::size_t b = 0; b < JNILatencyHistogram::buckets; b++)
+            Counters::bump(t.histogram[b],
+               c->histogram[b].load(std::memory_order_relaxed));
+      }
+   }
+
+   static void clear(Buffer &b) {
+      for (int i = 0; i < maxSites; i++) {
+         Counters *c = b.sites[i].load(std::memory_order_relaxed);
+         if (c == 0)
+            continue;
+         c->count.store(0, std::memory_order_relaxed);
+         c->total.store(0, std::memory_order_relaxed);
+         c->max.store(0, std::memory_order_relaxed);
+         for (std::size_t k = 0; k < JNILatencyHistogram::buckets; k++)
+            c->histogram[k].store(0, std::memory_order_relaxed);
+      }
+   }
+
+   std::vector<JNICallSiteStats> collect() {
+      std::lock_guard<std::mutex> guard(_lock);
+      Buffer total;
+      merge(total, _retired);
+      for (std::size_t i = 0; i < _buffers.size(); i++)
+         merge(total, *_buffers[i]);
+
+      std::vector<JNICallSiteStats> result;
+      int sites = _siteCount.load(std::memory_order_acquire);
+      for (int i = 0; i < sites; i++) {
+         const JNICallSite *site = _sites[i];
+         std::string location = std::string(site->file()) + ':' +
+            std::to_string(site->line());
+         const char *slash = std::strrchr(site->file(), '/');
+         if (slash != 0)
+            location = location.substr(slash + 1 - site->file());
+
+         result.push_back(JNICallSiteStats());
+         JNICallSiteStats &s = result.back();
+         s.name = site->name();
+         s.location = location;
+         s.count = s.totalNanos = s.maxNanos = 0;
+         s.histogram.assign(JNILatencyHistogram::buckets, 0);
+
+         Counters *c = total.sites[i].load(std::memory_order_relaxed);
+         if (c == 0)
+            continue;
+         s.count = c->count.load(std::memory_order_relaxed);
+         s.totalNanos = c->total.load(std::memory_order_relaxed);
+         s.maxNanos = c->max.load(std::memory_order_relaxed);
+         for (std::size_t b = 0; b < JNILatencyHistogram::buckets; b++)
+            s.histogram[b] = c->histogram[b].load(std::memory_order_relaxed);
+      }
+      return result;
+   }
+};
+
+inline JNICallSite::JNICallSite(const char *name, const char *file,
+                                int line) :
+   _name(name), _file(file), _line(line),
+   _index(JNIInstrumentation::instance().registerSite(this)) {}
+
+/*-----------------------------------------------------------------------------
+ * JNIInstrumentScope times the enclosing scope for a call site
+ *---------------------------------------------------------------------------*/
+class JNIInstrumentScope {
+   const JNICallSite &_site;
+   std::chrono::steady_clock::time_point _start;
+
+   JNIInstrumentScope(const JNIInstrumentScope &);
+   JNIInstrumentScope &operator= (const JNIInstrumentScope &);
+
+public:
+   explicit JNIInstrumentScope(const JNICallSite &site) :
+      _site(site), _start(std::chrono::steady_clock::now()) {}
+
+   ~JNIInstrumentScope() {
+      std::uint64_t nanos = static_cast<std::uint64_t>(
+         std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _start).count());
+      if (_site.index() < 0)
+         return;
+      JNIInstrumentation::Buffer *b = JNIInstrumentation::local();
+      if (b != 0)
+         b->at(_site.index()).record(nanos);
+   }
+};
+
+#endif /* JNI_INSTRUMENTATION */
+
+#endif /* _JNI_INSTRUMENT_H_INCLUDED_ */
@@ -0,0 +1,607 @@
+/*-----------------------------------------------------------------------------
+ * Vectorized bulk operations on native arrays.
+ *
+ * JNIKernels provides elementwise and reduction primitives over the
+ * buffers exported by JNIArray, JNICriticalArray and JNIPooledArray (or
+ * any raw buffer):
+ *
+ *    JNICriticalArray<jfloat> samples(env, jsamples);
+ *    jfloat peak = JNIKernels::max(samples);
+ *    JNIKernels::scale(samples, 1.0f / peak);
+ *
+ * - sum(a):               sum of the elements (see JNIKernelTraits for
+ *                         the accumulator type)
+ * - min(a), max(a):       smallest/largest element (the array must not be
+ *                         empty)
+ * - dot(a, b):            inner product of two arrays of the same length
+ * - scale(a, factor):     a[i] *= factor
+ * - clamp(a, lo, hi):     a[i] = min(max(a[i], lo), hi)
+ * - convert(src, dst):    dst[i] = (D) src[i], e.g. 'jint' -> 'jfloat'
+ *
+ * On x86 with GCC or Clang, the kernels are compiled for SSE2, AVX2 and
+ * AVX-512 (using the compilers' vector extensions), and the widest
+ * instruction set supported by the running processor is selected once, at
+ * the first call. Other configurations use the scalar versions. Floating
+ * point reductions are computed lane-wise, so their rounding may differ
+ * from that of a sequential loop.
+ *
+ * The kernels which widen their elements (integral sum() and dot() below
+ * 'jlong', and convert() to a wider type) are the scalar loops, compiled
+ * for each instruction set: the compiler vectorizes them with the
+ * dedicated widening instructions (PSADBW, PMADDWD, PMULDQ, ...), which
+ * vector extensions cannot express, where their generic conversions to
+ * wider lanes are slower than the scalar loop. This takes the compiler's
+ * loop vectorizer (-O3 with GCC, -O2 with Clang).
+ *
+ * The kernels make no JNI calls, and can therefore be applied to arrays
+ * held in a critical region.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_KERNELS_H_INCLUDED_
+#define _JNI_KERNELS_H_INCLUDED_
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "jni_declarations.h"
+#include "jni_resource.h"
+#include "jni_array_pool.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define JNI_KERNELS_X86 1
+#endif
+
+#ifdef JNI_KERNELS_X86
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#define JNI_KERNEL_INLINE inline __attribute__((always_inline))
+#define JNI_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define JNI_KERNEL_INLINE inline
+#endif
+
+/*-----------------------------------------------------------------------------
+ * JNIArrayView is a (pointer, length) pair describing a native buffer.
+ * JNIView() builds one from any of the library's array resources.
+ *---------------------------------------------------------------------------*/
+template<class NativeType>
+struct JNIArrayView {
+   NativeType *_data;
+   std::size_t _size;
+
+   JNIArrayView(NativeType *data, std::size_t size) :
+      _data(data), _size(size) {}
+
+   NativeType *data() const { return _data; }
+   std::size_t size() const { return _size; }
+   NativeType &operator[] (std::size_t i) const { return _data[i]; }
+};
+
+template<class NativeType>
+inline JNIArrayView<NativeType> JNIView(const JNIArrayView<NativeType> &a) {
+   return a;
+}
+
+template<class NativeType>
+inline JNIArrayView<NativeType> JNIView(const JNIArray<NativeType> &a) {
+   return JNIArrayView<NativeType>(a.get(), (a.get() == 0) ? 0 : a.size());
+}
+
+template<class NativeType>
+inline JNIArrayView<NativeType>
+JNIView(const JNICriticalArray<NativeType> &a) {
+   return JNIArrayView<NativeType>(a.get(), a.size());
+}
+
+template<class NativeType>
+inline JNIArrayView<NativeType> JNIView(const JNIPooledArray<NativeType> &a) {
+   return JNIArrayView<NativeType>(a.get(), a.size());
+}
+
+/*-----------------------------------------------------------------------------
+ * JNIKernelTraits<NativeType>::Accumulator is the result type of sum() and
+ * dot(): 'jlong' for integral types, and the type itself for 'jfloat' and
+ * 'jdouble'. Element is used for scalar parameters, so that they do not
+ * take part in template argument deduction (e.g., scale(floats, 2)).
+ *---------------------------------------------------------------------------*/
+template<class NativeType>
+struct JNIKernelTraits {
+   typedef NativeType Element;
+   typedef jlong Accumulator;
+};
+
+template<> struct JNIKernelTraits<jfloat> {
+   typedef jfloat Element;
+   typedef jfloat Accumulator;
+};
+
+template<> struct JNIKernelTraits<jdouble> {
+   typedef jdouble Element;
+   typedef jdouble Accumulator;
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIKernelScalar: reference implementation of the kernels. Its loops are
+ * also inlined into the vector levels, for the widening kernels.
+ *---------------------------------------------------------------------------*/
+template<class T>
+struct JNIKernelScalar {
+   typedef typename JNIKernelTraits<T>::Accumulator Acc;
+
+   static JNI_KERNEL_INLINE Acc sum(const T *p, std::size_t n) {
+      Acc r = 0;
+      for (std::size_t i = 0; i < n; i++)
+         r += p[i];
+      return r;
+   }
+   static JNI_KERNEL_INLINE T min(const T *p, std::size_t n) {
+      T r = p[0];
+      for (std::size_t i = 1; i < n; i++)
+         if (p[i] < r)
+            r = p[i];
+      return r;
+   }
+   static JNI_KERNEL_INLINE T max(const T *p, std::size_t n) {
+      T r = p[0];
+      for (std::size_t i = 1; i < n; i++)
+         if (p[i] > r)
+            r = p[i];
+      return r;
+   }
+   static JNI_KERNEL_INLINE Acc dot(const T *a, const T *b, std::size_t n) {
+      Acc r = 0;
+      for (std::size_t i = 0; i < n; i++)
+         r += static_cast<Acc>(a[i]) * static_cast<Acc>(b[i]);
+      return r;
+   }
+   static JNI_KERNEL_INLINE void scale(T *p, std::size_t n, T factor) {
+      for (std::size_t i = 0; i < n; i++)
+         p[i] = static_cast<T>(p[i] * factor);
+   }
+   static JNI_KERNEL_INLINE void clamp(T *p, std::size_t n, T lo, T hi) {
+      for (std::size_t i = 0; i < n; i++)
+         p[i] = (p[i] < lo) ? lo : (p[i] > hi) ? hi : p[i];
+   }
+   template<class D>
+   static JNI_KERNEL_INLINE void convert(const T *src, D *dst, std::size_t n) {
+      for (std::size_t i = 0; i < n; i++)
+         dst[i] = static_cast<D>(src[i]);
+   }
+};
+
+#ifdef JNI_KERNELS_X86
+
+/*-----------------------------------------------------------------------------
+ * JNIKernelVector<T, Bytes>: the kernels written over vectors of 'Bytes'
+ * bytes. All functions are forcibly inlined into the target-specific
+ * entry points of JNIKernelDispatch below, where they are compiled for
+ * the corresponding instruction set.
+ *---------------------------------------------------------------------------*/
+template<class E, int Bytes>
+struct JNIVectorOf {
+   typedef E type __attribute__((vector_size(Bytes)));
+};
+
+template<class T, int Bytes>
+struct JNIKernelVector {
+   typedef typename JNIKernelTraits<T>::Accumulator Acc;
+   static const std::size_t lanes = Bytes / sizeof(T);
+   typedef typename JNIVectorOf<T, Bytes>::type Vec;
+
+   // Whether sum() and dot() widen the elements to the accumulator
+   typedef std::integral_constant<bool, (sizeof(T) < sizeof(Acc))> Widening;
+
+   static JNI_KERNEL_INLINE void load(Vec &v, const T *p) {
+      std::memcpy(&v, p, sizeof(v));
+   }
+   static JNI_KERNEL_INLINE void store(T *p, const Vec &v) {
+      std::memcpy(p, &v, sizeof(v));
+   }
+   static JNI_KERNEL_INLINE void broadcast(Vec &v, T x) {
+      Vec zero = {};
+      v = zero + x;
+   }
+   template<class V>
+   static JNI_KERNEL_INLINE Acc reduce(const V &v) {
+      Acc r = 0;
+      for (std::size_t k = 0; k < lanes; k++)
+         r += v[k];
+      return r;
+   }
+
+   static JNI_KERNEL_INLINE Acc sum(const T *p, std::size_t n) {
+      return sum(p, n, Widening());
+   }
+   static JNI_KERNEL_INLINE Acc sum(const T *p, std::size_t n,
+                                    std::true_type) {
+      return JNIKernelScalar<T>::sum(p, n);
+   }
+   static JNI_KERNEL_INLINE Acc sum(const T *p, std::size_t n,
+                                    std::false_type) {
+      Vec acc0 = {}, acc1 = {}, v0, v1;
+      std::size_t i = 0;
+      for (; i + 2 * lanes <= n; i += 2 * lanes) {
+         load(v0, p + i);
+         load(v1, p + i + lanes);
+         acc0 += v0;
+         acc1 += v1;
+      }
+      Acc r = reduce(acc0 + acc1);
+      for (; i < n; i++)
+         r += p[i];
+      return r;
+   }
+
+   static JNI_KERNEL_INLINE T min(const T *p, std::size_t n) {
+      if (n < lanes)
+         return JNIKernelScalar<T>::min(p, n);
+      Vec m, v;
+      load(m, p);
+      std::size_t i = lanes;
+      for (; i + lanes <= n; i += lanes) {
+         load(v, p + i);
+         m = (v < m) ? v : m;
+      }
+      T r = m[0];
+      for (std::size_t k = 1; k < lanes; k++)
+         if (m[k] < r)
+            r = m[k];
+      for (; i < n; i++)
+         if (p[i] < r)
+            r = p[i];
+      return r;
+   }
+
+   static JNI_KERNEL_INLINE T max(const T *p, std::size_t n) {
+      if (n < lanes)
+         return JNIKernelScalar<T>::max(p, n);
+      Vec m, v;
+      load(m, p);
+      std::size_t i = lanes;
+      for (; i + lanes <= n; i += lanes) {
+         load(v, p + i);
+         m = (v > m) ? v : m;
+      }
+      T r = m[0];
+      for (std::size_t k = 1; k < lanes; k++)
+         if (m[k] > r)
+            r = m[k];
+      for (; i < n; i++)
+         if (p[i] > r)
+            r = p[i];
+      return r;
+   }
+
+   static JNI_KERNEL_INLINE Acc dot(const T *a, const T *b, std::size_t n) {
+      return dot(a, b, n, Widening());
+   }
+   static JNI_KERNEL_INLINE Acc dot(const T *a, const T *b, std::size_t n,
+                                    std::true_type) {
+      return JNIKernelScalar<T>::dot(a, b, n);
+   }
+   static JNI_KERNEL_INLINE Acc dot(const T *a, const T *b, std::size_t n,
+                                    std::false_type) {
+      Vec acc = {}, va, vb;
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         load(va, a + i);
+         load(vb, b + i);
+         acc += va * vb;
+      }
+      Acc r = reduce(acc);
+      for (; i < n; i++)
+         r += static_cast<Acc>(a[i]) * static_cast<Acc>(b[i]);
+      return r;
+   }
+
+   static JNI_KERNEL_INLINE void scale(T *p, std::size_t n, T factor) {
+      Vec f, v;
+      broadcast(f, factor);
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         load(v, p + i);
+         store(p + i, v * f);
+      }
+      for (; i < n; i++)
+         p[i] = static_cast<T>(p[i] * factor);
+   }
+
+   static JNI_KERNEL_INLINE void clamp(T *p, std::size_t n, T lo, T hi) {
+      Vec l, h, v;
+      broadcast(l, lo);
+      broadcast(h, hi);
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         load(v, p + i);
+         v = (v < l) ? l : v;
+         v = (v > h) ? h : v;
+         store(p + i, v);
+      }
+      for (; i < n; i++)
+         p[i] = (p[i] < lo) ? lo : (p[i] > hi) ? hi : p[i];
+   }
+
+   template<class D>
+   static JNI_KERNEL_INLINE void convert(const T *src, D *dst, std::size_t n) {
+      convert(src, dst, n,
+              std::integral_constant<bool, (sizeof(T) < sizeof(D))>());
+   }
+   template<class D>
+   static JNI_KERNEL_INLINE void convert(const T *src, D *dst, std::size_t n,
+                                         std::true_type) {
+      JNIKernelScalar<T>::template convert<D>(src, dst, n);
+   }
+   template<class D>
+   static JNI_KERNEL_INLINE void convert(const T *src, D *dst, std::size_t n,
+                                         std::false_type) {
+      typedef typename JNIVectorOf<D, lanes * sizeof(D)>::type DVec;
+      Vec v;
+      std::size_t i = 0;
+      for (; i + lanes <= n; i += lanes) {
+         load(v, src + i);
+         DVec d = __builtin_convertvector(v, DVec);
+         std::memcpy(dst + i, &d, sizeof(d));
+      }
+      for (; i < n; i++)
+         dst[i] = static_cast<D>(src[i]);
+   }
+};
+
+#endif /* JNI_KERNELS_X86 */
+
+/*-----------------------------------------------------------------------------
+ * JNIKernelDispatch<Level> holds the entry points compiled for one
+ * instruction set level. The specializations for the vector levels are
+ * defined as a macro block.
+ *---------------------------------------------------------------------------*/
+enum JNIKernelLevel {
+   JNI_KERNELS_SCALAR = 0,
+   JNI_KERNELS_SSE2 = 1,
+   JNI_KERNELS_AVX2 = 2,
+   JNI_KERNELS_AVX512 = 3
+};
+
+template<int Level>
+struct JNIKernelDispatch {
+   template<class T>
+   static typename JNIKernelTraits<T>::Accumulator
+   sum(const T *p, std::size_t n) { return JNIKernelScalar<T>::sum(p, n); }
+   template<class T>
+   static T min(const T *p, std::size_t n) {
+      return JNIKernelScalar<T>::min(p, n);
+   }
+   template<class T>
+   static T max(const T *p, std::size_t n) {
+      return JNIKernelScalar<T>::max(p, n);
+   }
+   template<class T>
+   static typename JNIKernelTraits<T>::Accumulator
+   dot(const T *a, const T *b, std::size_t n) {
+      return JNIKernelScalar<T>::dot(a, b, n);
+   }
+   template<class T>
+   static void scale(T *p, std::size_t n, T factor) {
+      JNIKernelScalar<T>::scale(p, n, factor);
+   }
+   template<class T>
+   static void clamp(T *p, std::size_t n, T lo, T hi) {
+      JNIKernelScalar<T>::clamp(p, n, lo, hi);
+   }
+   template<class T, class D>
+   static void convert(const T *src, D *dst, std::size_t n) {
+      JNIKernelScalar<T>::template convert<D>(src, dst, n);
+   }
+};
+
+#ifdef JNI_KERNELS_X86
+
+#define JNI_KERNEL_LEVEL(Level, Bytes, Isa)								\
+template<>																	\
+struct JNIKernelDispatch<Level> {											\
+   template<class T> JNI_KERNEL_TARGET(Isa)								\
+   static typename JNIKernelTraits<T>::Accumulator							\
+   sum(const T *p, std::size_t n) {										\
+      return JNIKernelVector<T, Bytes>::sum(p, n);						\
+   }																		\
+   template<class T> JNI_KERNEL_TARGET(Isa)								\
+   static T min(const T *p, std::size_t n) {								\
+      return JNIKernelVector<T, Bytes>::min(p, n);						\
+   }																		\
+   template<class T> JNI_KERNEL_TARGET(Isa)								\
+   static T max(const T *p, std::size_t n) {								\
+      return JNIKernelVector<T, Bytes>::max(p, n);						\
+   }																		\
+   template<class T> JNI_KERNEL_TARGET(Isa)								\
+   static typename JNIKernelTraits<T>::Accumulator							\
+   dot(const T *a, const T *b, std::size_t n) {							\
+      return JNIKernelVector<T, Bytes>::dot(a, b, n);						\
+   }																		\
+   template<class T> JNI_KERNEL_TARGET(Isa)								\
+   static void scale(T *p, std::size_t n, T factor) {						\
+      JNIKernelVector<T, Bytes>::scale(p, n, factor);						\
+   }																		\
+   template<class T> JNI_KERNEL_TARGET(Isa)								\
+   static void clamp(T *p, std::size_t n, T lo, T hi) {					\
+      JNIKernelVector<T, Bytes>::clamp(p, n, lo, hi);						\
+   }																		\
+   template<class T, class D> JNI_KERNEL_TARGET(Isa)						\
+   static void convert(const T *src, D *dst, std::size_t n) {				\
+      JNIKernelVector<T, Bytes>::template convert<D>(src, dst, n);		\
+   }																		\
+};
+
+JNI_KERNEL_LEVEL(JNI_KERNELS_SSE2, 16, "sse2")
+JNI_KERNEL_LEVEL(JNI_KERNELS_AVX2, 32, "avx2,fma")
+JNI_KERNEL_LEVEL(JNI_KERNELS_AVX512, 64,
+                 "avx512f,avx512bw,avx512dq,avx512vl,fma")
+
+#endif /* JNI_KERNELS_X86 */
+
+/*-----------------------------------------------------------------------------
+ * JNIKernels: the public entry points.
+ * Every kernel is available for raw buffers (pointer and element count)
+ * and for the array resources of this library (through JNIView()).
+ * level()/setLevel() report and override the selected instruction set
+ * (setLevel() is mostly useful for benchmarking; levels not supported by
+ * the processor must not be selected).
+ *---------------------------------------------------------------------------*/
+class JNIKernels {
+   static std::atomic<int> &selected() {
+      static std::atomic<int> level(detect());
+      return level;
+   }
+
+   static int detect() {
+#ifdef JNI_KERNELS_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f") &&
+          __builtin_cpu_supports("avx512bw") &&
+          __builtin_cpu_supports("avx512dq") &&
+          __builtin_cpu_supports("avx512vl"))
+         return JNI_KERNELS_AVX512;
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+         return JNI_KERNELS_AVX2;
+      if (__builtin_cpu_supports("sse2"))
+         return JNI_KERNELS_SSE2;
+#endif
+      return JNI_KERNELS_SCALAR;
+   }
+
+public:
+   static JNIKernelLevel level() {
+      return static_cast<JNIKernelLevel>(
+         selected().load(std::memory_order_relaxed));
+   }
+   static void setLevel(JNIKernelLevel level) {
+      selected().store(level, std::memory_order_relaxed);
+   }
+   static const char *levelName(JNIKernelLevel level) {
+      static const char *names[] = { "scalar", "sse2", "avx2", "avx512" };
+      return names[level];
+   }
+
+// Expands to a switch over the selected level, calling 'Call' on the
+// corresponding JNIKernelDispatch specialization
+#define JNI_KERNEL_DISPATCH(Call)											\
+   switch (level()) {														\
+   case JNI_KERNELS_AVX512:	return JNIKernelDispatch<JNI_KERNELS_AVX512>::Call;	\
+   case JNI_KERNELS_AVX2:	return JNIKernelDispatch<JNI_KERNELS_AVX2>::Call;	\
+   case JNI_KERNELS_SSE2:	return JNIKernelDispatch<JNI_KERNELS_SSE2>::Call;	\
+   default:					return JNIKernelDispatch<JNI_KERNELS_SCALAR>::Call;	\
+   }
+
+   // Raw buffers
+
+   template<class T>
+   static typename JNIKernelTraits<T>::Accumulator
+   sum(const T *p, std::size_t n) {
+      JNI_KERNEL_DISPATCH(sum(p, n))
+   }
+
+   template<class T>
+   static T min(const T *p, std::size_t n) {
+      if (n == 0)
+         throw JNIException("min() of an empty array");
+      JNI_KERNEL_DISPATCH(min(p, n))
+   }
+
+   template<class T>
+   static T max(const T *p, std::size_t n) {
+      if (n == 0)
+         throw JNIException("max() of an empty array");
+      JNI_KERNEL_DISPATCH(max(p, n))
+   }
+
+   template<class T>
+   static typename JNIKernelTraits<T>::Accumulator
+   dot(const T *a, const T *b, std::size_t n) {
+      JNI_KERNEL_DISPATCH(dot(a, b, n))
+   }
+
+   template<class T>
+   static void scale(T *p, std::size_t n,
+                     typename JNIKernelTraits<T>::Element factor) {
+      JNI_KERNEL_DISPATCH(scale(p, n, factor))
+   }
+
+   template<class T>
+   static void clamp(T *p, std::size_t n,
+                     typename JNIKernelTraits<T>::Element lo,
+                     typename JNIKernelTraits<T>::Element hi) {
+      JNI_KERNEL_DISPATCH(clamp(p, n, lo, hi))
+   }
+
+   template<class T, class D>
+   static void convert(const T *src, D *dst, std::size_t n) {
+      JNI_KERNEL_DISPATCH(convert(src, dst, n))
+   }
+
+   // Array resources (JNIArray, JNICriticalArray, JNIPooledArray,
+   // JNIArrayView)
+
+   template<template<class> class Array, class T>
+   static typename JNIKernelTraits<T>::Accumulator sum(const Array<T> &a) {
+      JNIArrayView<T> v = JNIView(a);
+      return sum(v.data(), v.size());
+   }
+
+   template<template<class> class Array, class T>
+   static T min(const Array<T> &a) {
+      JNIArrayView<T> v = JNIView(a);
+      return min(v.data(), v.size());
+   }
+
+   template<template<class> class Array, class T>
+   static T max(const Array<T> &a) {
+      JNIArrayView<T> v = JNIView(a);
+      return max(v.data(), v.size());
+   }
+
+   template<template<class> class ArrayA, template<class> class ArrayB,
+            class T>
+   static typename JNIKernelTraits<T>::Accumulator
+   dot(const ArrayA<T> &a, const ArrayB<T> &b) {
+      JNIArrayView<T> va = JNIView(a), vb = JNIView(b);
+      if (va.size() != vb.size())
+         throw JNIException("dot() of arrays of different lengths");
+      return dot(va.data(), vb.data(), va.size());
+   }
+
+   template<template<class> class Array, class T>
+   static void scale(const Array<T> &a,
+                     typename JNIKernelTraits<T>::Element factor) {
+      JNIArrayView<T> v = JNIView(a);
+      scale(v.data(), v.size(), factor);
+   }
+
+   template<template<class> class Array, class T>
+   static void clamp(const Array<T> &a,
+                     typename JNIKernelTraits<T>::Element lo,
+                     typename JNIKernelTraits<T>::Element hi) {
+      JNIArrayView<T> v = JNIView(a);
+      clamp(v.data(), v.size(), lo, hi);
+   }
+
+   template<template<class> class ArrayS, template<class> class ArrayD,
+            class S, class D>
+   static void convert(const ArrayS<S> &src, const ArrayD<D> &dst) {
+      JNIArrayView<S> vs = JNIView(src);
+      JNIArrayView<D> vd = JNIView(dst);
+      if (vs.size() != vd.size())
+         throw JNIException("convert() between arrays of different lengths");
+      convert(vs.data(), vd.data(), vs.size());
+   }
+
+#undef JNI_KERNEL_DISPATCH
+};
+
+#ifdef JNI_KERNELS_X86
+#pragma GCC diagnostic pop
+#endif
+
+#endif /* _JNI_KERNELS_H_INCLUDED_ */
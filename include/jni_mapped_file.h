@@ -0,0 +1,328 @@
+/*-----------------------------------------------------------------------------
+ * Memory-mapped files, exposed to Java as direct ByteBuffers.
+ *
+ * Reading a file into Java arrays copies it twice (into the page cache,
+ * then into the heap) and fills the Java heap. JNIMappedFile maps the file
+ * instead, and hands windows of the mapping to Java as direct ByteBuffers
+ * (NewDirectByteBuffer), through which Java reads the page cache itself:
+ *
+ *    JNIEXPORT jobjectArray JNICALL Java_Dataset_open(JNIEnv *env, jclass,
+ *                                                     jstring path) {
+ *       JNIMappedFile file(JNIStringUTFChars(env, path).asString(),
+ *                          JNI_MAP_SEQUENTIAL | JNI_MAP_WILLNEED);
+ *       return file.windows(env, 1 << 30);		// 1 GB ByteBuffers
+ *    }	// the file stays mapped while Java holds its buffers
+ *
+ * A ByteBuffer holds at most 2 GB, hence windows(): the buffers covering
+ * the whole file, each but the last 'windowSize' bytes long. window()
+ * returns a single buffer. Buffers are big-endian, as any ByteBuffer,
+ * until Java sets their order, and read-only unless the file was mapped
+ * writable (a Java write to a read-only mapping would crash the VM).
+ *
+ * The mapping is unmapped once the JNIMappedFile is destroyed and every
+ * buffer it returned has been garbage collected (slices and duplicates
+ * made by Java keep their buffer alive). Buffers are tracked by
+ * JNIMappingCleaner through weak global references, whose collection is
+ * checked as more buffers are tracked, or by JNIMappingCleaner::collect().
+ * Code which maps many files but rarely may call collect() after a garbage
+ * collection, or at JNI_OnUnload.
+ *
+ * Hints (JNIMapHint, combined with '|') are given to madvise() when
+ * mapping, or later for a range through advise():
+ * - JNI_MAP_SEQUENTIAL, JNI_MAP_RANDOM: the access pattern, which tunes
+ *   read-ahead
+ * - JNI_MAP_WILLNEED: starts reading the range ahead of the accesses
+ * - JNI_MAP_HUGEPAGE: backs the range with transparent huge pages, where
+ *   the kernel supports them for files (Linux)
+ * Hints are advisory: hints the system rejects are ignored.
+ *
+ * Requires C++11 and POSIX (mmap).
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_MAPPED_FILE_H_INCLUDED_
+#define _JNI_MAPPED_FILE_H_INCLUDED_
+
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jni_declarations.h"
+#include "jni_resource.h"
+
+enum JNIMapHint {
+   JNI_MAP_NORMAL = 0,
+   JNI_MAP_SEQUENTIAL = 1,
+   JNI_MAP_RANDOM = 2,
+   JNI_MAP_WILLNEED = 4,
+   JNI_MAP_HUGEPAGE = 8
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIMappingCleaner: keeps native owners alive while Java buffers use them
+ *---------------------------------------------------------------------------*/
+class JNIMappingCleaner {
+   static const std::size_t minThreshold = 16;
+
+   struct Entry {
+      std::unique_ptr<JNIWeakGlobalRef<jobject> > buffer;
+      std::shared_ptr<const void> owner;
+   };
+
+   struct State {
+      std::mutex lock;				// protects the members
+      std::vector<Entry> entries;
+      std::size_t threshold;		// number of entries triggering a collect
+
+      State() : threshold(minThreshold) {}
+   };
+
+public:
+   // Keeps 'owner' alive until 'buffer' has been garbage collected
+   static void track(JNIEnv *env, jobject buffer,
+                     const std::shared_ptr<const void> &owner) {
+      Entry entry;
+      entry.buffer.reset(new JNIWeakGlobalRef<jobject>(env, buffer));
+      entry.owner = owner;
+
+      bool full;
+      {
+         std::lock_guard<std::mutex> guard(state().lock);
+         state().entries.push_back(std::move(entry));
+         full = state().entries.size() >= state().threshold;
+      }
+      if (full)
+         collect(env);
+   }
+
+   // Releases the owners of the collected buffers; returns their number
+   static std::size_t collect(JNIEnv *env) {
+      std::vector<Entry> collected;
+      {
+         std::lock_guard<std::mutex> guard(state().lock);
+         std::vector<Entry> &entries = state().entries;
+         std::vector<Entry>::iterator kept = entries.begin();
+         for (std::size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].buffer->expired(env))
+               collected.push_back(std::move(entries[i]));
+            else
+               *kept++ = std::move(entries[i]);
+         }
+         entries.erase(kept, entries.end());
+         state().threshold = 2 * entries.size();
+         if (state().threshold < minThreshold)
+            state().threshold = minThreshold;
+      }
+      // Unmaps outside the lock
+      return collected.size();
+   }
+
+   // Buffers tracked, including those not yet found collected
+   static std::size_t tracked() {
+      std::lock_guard<std::mutex> guard(state().lock);
+      return state().entries.size();
+   }
+
+private:
+   // Never destroyed: the weak references cannot be deleted at exit
+   static State &state() {
+      static State *s = new State;
+      return *s;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIMappedFile
+ *---------------------------------------------------------------------------*/
+class JNIMappedFile {
+   // The mapping, shared with the buffers through JNIMappingCleaner
+   struct Mapping {
+      void *address;
+      std::size_t size;
+
+      Mapping() : address(0), size(0) {}
+      ~Mapping() {
+         if (size != 0)
+            munmap(address, size);
+      }
+   };
+
+   std::shared_ptr<Mapping> _mapping;
+   bool _writable;
+
+   JNIMappedFile(const JNIMappedFile &);
+   JNIMappedFile &operator= (const JNIMappedFile &);
+
+public:
+   explicit JNIMappedFile(const std::string &path,
+                          int hints = JNI_MAP_SEQUENTIAL,
+                          bool writable = false) :
+      _mapping(std::make_shared<Mapping>()), _writable(writable) {
+      int fd = open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+      if (fd < 0)
+         fail("Failed to open ", path);
+
+      struct stat info;
+      if (fstat(fd, &info) != 0) {
+         int error = errno;
+         close(fd);
+         errno = error;
+         fail("Failed to get the size of ", path);
+      }
+      if (static_cast<std::uint64_t>(info.st_size) > SIZE_MAX) {
+         close(fd);
+         throw JNIException("File too large to map: " + path);
+      }
+
+      std::size_t size = static_cast<std::size_t>(info.st_size);
+      if (size != 0) {
+         void *address = mmap(0, size,
+            writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+         if (address == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            fail("Failed to map ", path);
+         }
+         _mapping->address = address;
+         _mapping->size = size;
+      }
+      close(fd);	// the mapping keeps the file open
+
+      advise(hints);
+   }
+
+   const unsigned char *data() const {
+      return static_cast<const unsigned char *>(_mapping->address);
+   }
+   // Writable mappings only
+   unsigned char *data() {
+      return static_cast<unsigned char *>(_mapping->address);
+   }
+   std::size_t size() const { return _mapping->size; }
+   bool writable() const { return _writable; }
+
+   // Gives 'hints' (JNI_MAP_NORMAL resets them) for the bytes
+   // [offset, offset + length); false if any was rejected
+   bool advise(int hints, std::size_t offset = 0,
+               std::size_t length = SIZE_MAX) {
+      if (offset >= size())
+         return true;
+      if (length > size() - offset)
+         length = size() - offset;
+
+      // madvise() takes page-aligned ranges
+      std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+      std::size_t start = offset - offset % page;
+      char *address = static_cast<char *>(_mapping->address) + start;
+      length += offset - start;
+
+      bool accepted = true;
+      if (hints == JNI_MAP_NORMAL)
+         accepted = madvise(address, length, MADV_NORMAL) == 0;
+      if (hints & JNI_MAP_SEQUENTIAL)
+         accepted &= madvise(address, length, MADV_SEQUENTIAL) == 0;
+      if (hints & JNI_MAP_RANDOM)
+         accepted &= madvise(address, length, MADV_RANDOM) == 0;
+      if (hints & JNI_MAP_WILLNEED)
+         accepted &= madvise(address, length, MADV_WILLNEED) == 0;
+      if (hints & JNI_MAP_HUGEPAGE) {
+#ifdef MADV_HUGEPAGE
+         accepted &= madvise(address, length, MADV_HUGEPAGE) == 0;
+#else
+         accepted = false;
+#endif
+      }
+      return accepted;
+   }
+
+   // A direct ByteBuffer over the bytes [offset, offset + length), as a
+   // local reference; 'length' is at most 2 GB - 1
+   jobject window(JNIEnv *env, std::size_t offset, std::size_t length) {
+      if (offset > size() || length > size() - offset)
+         throw JNIException("Window outside of the mapped file");
+      if (length > static_cast<std::size_t>(INT_MAX))
+         throw JNIException("Window larger than a ByteBuffer");
+
+      char *address = static_cast<char *>(_mapping->address) + offset;
+      jobject buffer = env->NewDirectByteBuffer(address,
+                                                static_cast<jlong>(length));
+      if (buffer == 0)
+         throw JNIException("Failed to create a direct ByteBuffer");
+      try {
+         JNIMappingCleaner::track(env, buffer, _mapping);
+      }
+      catch (...) {
+         env->DeleteLocalRef(buffer);
+         throw;
+      }
+      return _writable ? buffer : readOnly(env, buffer);
+   }
+
+   // The windows covering the whole file, as a local reference to a
+   // ByteBuffer[]; 'windowSize' is at most 2 GB - 1
+   jobjectArray windows(JNIEnv *env, std::size_t windowSize) {
+      if (windowSize == 0 || windowSize > static_cast<std::size_t>(INT_MAX))
+         throw JNIException("Invalid window size");
+      std::size_t count = (size() + windowSize - 1) / windowSize;
+      if (count > static_cast<std::size_t>(INT_MAX))
+         throw JNIException("Too many windows");
+
+      jclass byteBuffer = env->FindClass("java/nio/ByteBuffer");
+      if (byteBuffer == 0)
+         throw JNIException("Failed to get a class");
+      jobjectArray result = env->NewObjectArray(static_cast<jsize>(count),
+                                                byteBuffer, 0);
+      env->DeleteLocalRef(byteBuffer);
+      if (result == 0)
+         throw JNIException("Failed to allocate the window array");
+
+      try {
+         for (std::size_t i = 0; i < count; i++) {
+            std::size_t offset = i * windowSize;
+            std::size_t length = size() - offset;
+            if (length > windowSize)
+               length = windowSize;
+            jobject buffer = window(env, offset, length);
+            env->SetObjectArrayElement(result, static_cast<jsize>(i), buffer);
+            env->DeleteLocalRef(buffer);
+         }
+      }
+      catch (...) {
+         env->DeleteLocalRef(result);
+         throw;
+      }
+      return result;
+   }
+
+private:
+   static void fail(const char *what, const std::string &path) {
+      throw JNIException(what + path + ": " + std::strerror(errno));
+   }
+
+   // Replaces 'buffer' by its read-only view
+   static jobject readOnly(JNIEnv *env, jobject buffer) {
+      jclass clazz = env->GetObjectClass(buffer);
+      jmethodID asReadOnlyBuffer = (clazz == 0) ? 0 : env->GetMethodID(clazz,
+         "asReadOnlyBuffer", "()Ljava/nio/ByteBuffer;");
+      env->DeleteLocalRef(clazz);
+      jobject view = (asReadOnlyBuffer == 0) ? 0 :
+         env->CallObjectMethod(buffer, asReadOnlyBuffer);
+      env->DeleteLocalRef(buffer);
+      if (view == 0)
+         throw JNIException("Failed to get a read-only ByteBuffer");
+      return view;
+   }
+};
+
+#endif /* _JNI_MAPPED_FILE_H_INCLUDED_ */
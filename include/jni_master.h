@@ -10,9 +10,39 @@
 #include "jni_resource_base.h"
 #include "jni_resource.h"
 #include "jni_env.h"
+#include "jni_tracked_array.h"
+
+/* Extensions requiring C++11 */
+#if __cplusplus >= 201103L
+#include "jni_object_view.h"
+#include "jni_mirror.h"
+#include "jni_arena.h"
+#include "jni_array_pool.h"
+#include "jni_new_array.h"
+#include "jni_kernels.h"
+#include "jni_parallel.h"
+#include "jni_async.h"
+#include "jni_callback_batcher.h"
+#include "jni_global_ref_pool.h"
+#include "jni_weak_cache.h"
+#include "jni_identity.h"
+#include "jni_instrument.h"
+#include "jni_native_lock.h"
+#include "jni_monitor_stats.h"
+#ifndef _WIN32
+#include "jni_mapped_file.h"
+#endif
+#ifndef __ANDROID__
+#include "jni_vm.h"
+#endif
+#endif
 
 #ifdef __ANDROID__
 #include "jni_android.h"
+#if __cplusplus >= 201103L
+#include "jni_bitmap.h"
+#include "jni_bitmap_batch.h"
+#endif
 #endif
 
 #endif /* _JNI_MASTER_H_INCLUDED_ */
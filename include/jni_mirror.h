@@ -0,0 +1,402 @@
+/*-----------------------------------------------------------------------------
+ * Native mirrors of Java data-transfer classes.
+ *
+ * JNI_MIRROR describes how the members of a C++ struct map onto the fields
+ * of a Java class, and generates the code that copies a whole object
+ * (including nested mirrored objects, strings and arrays) in either
+ * direction:
+ *
+ *    struct Point { jint x; jint y; };
+ *    struct Shape { std::string name; std::vector<Point> points; };
+ *
+ *    JNI_MIRROR(Point, "com/x/Point", (x, jint), (y, jint))
+ *    JNI_MIRROR(Shape, "com/x/Shape", (name, std::string),
+ *                                     (points, std::vector<Point>))
+ *
+ *    Shape s = JNIMirror<Shape>::fromJava(env, jshape);
+ *    jobject copy = JNIMirror<Shape>::toJava(env, s);
+ *
+ * The class reference, the field ids and the default constructor id of
+ * each mirrored class are resolved once (on first use) and shared by every
+ * subsequent conversion, so marshalling an object graph costs one lookup
+ * per class rather than one per instance.
+ *
+ * JNI_MIRROR must be used at global scope, and a nested struct must be
+ * mirrored before the structs that contain it.
+ *
+ * Requires C++11 (variadic macros, thread-safe static initialization).
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_MIRROR_H_INCLUDED_
+#define _JNI_MIRROR_H_INCLUDED_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_class.h"
+#include "jni_field.h"
+#include "jni_instrument.h"
+#include "jni_utils.h"
+#include "jni_resource.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIMirror<Struct> is specialized by JNI_MIRROR for every mirrored struct.
+ *---------------------------------------------------------------------------*/
+template<class Struct>
+struct JNIMirror;
+
+/*-----------------------------------------------------------------------------
+ * JNIMirrorTable holds the pre-resolved identifiers of a mirrored class:
+ * a global reference to the class, its field ids (in declaration order)
+ * and the id of its default constructor (0 if there is none, in which case
+ * objects are created with AllocObject).
+ *---------------------------------------------------------------------------*/
+class JNIMirrorTable {
+   JNIGlobalRef<jclass> _clazz;		// mirrored class
+   jmethodID _ctor;					// default constructor
+   std::vector<jfieldID> _ids;		// field ids
+
+public:
+   JNIMirrorTable(JNIEnv *env, const char *className,
+                  const char *const *names, const string *sigs,
+                  std::size_t count) :
+      _clazz(env, JNIClass(env, className)), _ctor(0), _ids(count) {
+      for (std::size_t i = 0; i < count; i++) {
+         _ids[i] = env->GetFieldID(_clazz.get(), names[i], sigs[i].c_str());
+         if (_ids[i] == 0)
+            throw JNIException(string("Field not found: ") + className +
+                               "." + names[i]);
+      }
+      _ctor = env->GetMethodID(_clazz.get(), "<init>", "()V");
+      if (_ctor == 0)
+         env->ExceptionClear();
+   }
+
+   jclass clazz() const { return _clazz.get(); }
+   jfieldID id(std::size_t i) const { return _ids[i]; }
+
+   // Create a new (uninitialized) instance of the mirrored class
+   jobject newObject(JNIEnv *env) const {
+      JNI_INSTRUMENT("JNIMirror::newObject");
+      jobject obj = (_ctor != 0) ? env->NewObject(clazz(), _ctor)
+                                 : env->AllocObject(clazz());
+      if (obj == 0)
+         throw JNIException("Failed to create a mirrored object");
+      return obj;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIMarshal<T> converts a single C++ member of type T to and from a Java
+ * field. Each specialization provides:
+ * - signature():                 the Java type signature of the field
+ * - Get(JNIEnv *, jobject, jfieldID, T &): read the field into a member
+ * - Set(JNIEnv *, jobject, jfieldID, const T &): write a member to the field
+ * Reference types (strings, arrays, mirrored objects) additionally provide
+ * - Read(JNIEnv *, jobject, T &):  convert a Java value into T
+ * - Write(JNIEnv *, const T &):    convert T into a new local reference
+ * - Class(JNIEnv *):               the class of the Java value, used to
+ *                                  create arrays of such values
+ *
+ * The primary template handles mirrored structs.
+ *---------------------------------------------------------------------------*/
+
+// Field access for reference types, in terms of Read and Write
+template<class T, class Marshal>
+struct JNIReferenceMarshal {
+   static void Get(JNIEnv *env, jobject obj, jfieldID id, T &out) {
+      jobject value = env->GetObjectField(obj, id);
+      Marshal::Read(env, value, out);
+      if (value != 0)
+         env->DeleteLocalRef(value);
+   }
+   static void Set(JNIEnv *env, jobject obj, jfieldID id, const T &in) {
+      jobject value = Marshal::Write(env, in);
+      env->SetObjectField(obj, id, value);
+      env->DeleteLocalRef(value);
+   }
+};
+
+template<class T>
+struct JNIMarshal : JNIReferenceMarshal<T, JNIMarshal<T> > {
+   static string signature() {
+      return string("L") + JNIMirror<T>::className() + ";";
+   }
+   static void Read(JNIEnv *env, jobject value, T &out) {
+      if (value == 0)
+         out = T();
+      else
+         JNIMirror<T>::fromJava(env, value, out);
+   }
+   static jobject Write(JNIEnv *env, const T &in) {
+      return JNIMirror<T>::toJava(env, in);
+   }
+   static jclass Class(JNIEnv *env) {
+      return JNIMirror<T>::table(env).clazz();
+   }
+};
+
+// Strings are converted through (modified) UTF-8
+template<>
+struct JNIMarshal<string> : JNIReferenceMarshal<string, JNIMarshal<string> > {
+   static string signature() { return SIGNATURE_OF(jstring); }
+   static void Read(JNIEnv *env, jobject value, string &out) {
+      JNIStringUTFChars chars(env, static_cast<jstring>(value));
+      out = (chars.get() != 0) ? chars.get() : "";
+      chars.ReleaseResource(env);
+   }
+   static jobject Write(JNIEnv *env, const string &in) {
+      return env->NewStringUTF(in.c_str());
+   }
+   static jclass Class(JNIEnv *env) {
+      static JNIGlobalRef<jclass> clazz(env,
+                                        JNIClass(env, "java/lang/String"));
+      return clazz.get();
+   }
+};
+
+// Arrays of reference types are converted element by element
+template<class T>
+struct JNIMarshal<std::vector<T> > :
+   JNIReferenceMarshal<std::vector<T>, JNIMarshal<std::vector<T> > > {
+   static string signature() { return "[" + JNIMarshal<T>::signature(); }
+   static void Read(JNIEnv *env, jobject value, std::vector<T> &out) {
+      jobjectArray array = static_cast<jobjectArray>(value);
+      jsize len = (array == 0) ? 0 : env->GetArrayLength(array);
+      out.resize(len);
+      for (jsize i = 0; i < len; i++) {
+         jobject element = env->GetObjectArrayElement(array, i);
+         JNIMarshal<T>::Read(env, element, out[i]);
+         if (element != 0)
+            env->DeleteLocalRef(element);
+      }
+   }
+   static jobject Write(JNIEnv *env, const std::vector<T> &in) {
+      jobjectArray array = env->NewObjectArray(
+         static_cast<jsize>(in.size()), JNIMarshal<T>::Class(env), 0);
+      if (array == 0)
+         throw JNIException("Failed to create an array");
+      for (std::size_t i = 0; i < in.size(); i++) {
+         jobject element = JNIMarshal<T>::Write(env, in[i]);
+         env->SetObjectArrayElement(array, static_cast<jsize>(i), element);
+         env->DeleteLocalRef(element);
+      }
+      return array;
+   }
+   static jclass Class(JNIEnv *env) {
+      static JNIGlobalRef<jclass> clazz(env,
+                                        JNIClass(env, signature().c_str()));
+      return clazz.get();
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * Specializations of JNIMarshal for primitive types and arrays of primitive
+ * types are defined as a macro block. Primitive arrays are copied in bulk,
+ * with a single Get/Set<PrimitiveType>ArrayRegion call.
+ *---------------------------------------------------------------------------*/
+
+#define JNI_MIRROR_MARSHAL(Type)                                              \
+template<>                                                                    \
+struct JNIMarshal<NATIVE_TYPE(Type)> {                                        \
+   static string signature() { return SIGNATURE(Type); }                      \
+   static void Get(JNIEnv *env, jobject obj, jfieldID id,                     \
+                   NATIVE_TYPE(Type) &out) {                                  \
+      out = JNIFieldAccess<NATIVE_TYPE(Type)>::Get(env, obj, id);             \
+   }                                                                          \
+   static void Set(JNIEnv *env, jobject obj, jfieldID id,                     \
+                   const NATIVE_TYPE(Type) &in) {                             \
+      JNIFieldAccess<NATIVE_TYPE(Type)>::Set(env, obj, id, in);               \
+   }                                                                          \
+};                                                                            \
+                                                                              \
+template<>                                                                    \
+struct JNIMarshal<std::vector<NATIVE_TYPE(Type)> > :                          \
+   JNIReferenceMarshal<std::vector<NATIVE_TYPE(Type)>,                        \
+                       JNIMarshal<std::vector<NATIVE_TYPE(Type)> > > {        \
+   static string signature() { return ARRAY_SIGNATURE(Type); }                \
+   static void Read(JNIEnv *env, jobject value,                               \
+                    std::vector<NATIVE_TYPE(Type)> &out) {                    \
+      ARRAY_TYPE(Type) array = static_cast<ARRAY_TYPE(Type)>(value);          \
+      jsize len = (array == 0) ? 0 : env->GetArrayLength(array);              \
+      out.resize(len);                                                        \
+      if (len > 0)                                                            \
+         GetArrayRegion(env, array, 0, len, &out[0]);                         \
+   }                                                                          \
+   static jobject Write(JNIEnv *env,                                          \
+                        const std::vector<NATIVE_TYPE(Type)> &in) {           \
+      jsize len = static_cast<jsize>(in.size());                              \
+      ARRAY_TYPE(Type) array = env->New##Type##Array(len);                    \
+      if (array == 0)                                                         \
+         throw JNIException("Failed to create an array");                     \
+      if (len > 0)                                                            \
+         env->Set##Type##ArrayRegion(array, 0, len, &in[0]);                  \
+      return array;                                                           \
+   }                                                                          \
+   static jclass Class(JNIEnv *env) {                                         \
+      static JNIGlobalRef<jclass> clazz(env,                                  \
+                                        JNIClass(env, ARRAY_SIGNATURE(Type)));\
+      return clazz.get();                                                     \
+   }                                                                          \
+};
+
+/*-----------------------------------------------------------------------------
+ * Combo instantiation of JNIMarshal specializations for all primitive types
+ *---------------------------------------------------------------------------*/
+
+INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_MIRROR_MARSHAL)
+
+/*-----------------------------------------------------------------------------
+ * JNIMirrorBase provides the conversion functions common to all mirrored
+ * structs, in terms of the table(), read() and write() functions generated
+ * by JNI_MIRROR:
+ * - fromJava(JNIEnv *, jobject [, Struct &]):   Java object -> struct
+ * - toJava(JNIEnv *, const Struct &):          struct -> new Java object
+ * - toJava(JNIEnv *, const Struct &, jobject): struct -> existing object
+ * - bulk variants for 'jobjectArray' <-> std::vector<Struct>, which
+ *   resolve the table once for the whole array.
+ *---------------------------------------------------------------------------*/
+template<class Struct>
+struct JNIMirrorBase {
+   typedef JNIMirror<Struct> _mirror;
+
+   static void fromJava(JNIEnv *env, jobject obj, Struct &out) {
+      _mirror::read(env, obj, _mirror::table(env), out);
+   }
+   static Struct fromJava(JNIEnv *env, jobject obj) {
+      Struct out;
+      fromJava(env, obj, out);
+      return out;
+   }
+
+   static void toJava(JNIEnv *env, const Struct &in, jobject obj) {
+      _mirror::write(env, obj, _mirror::table(env), in);
+   }
+   static jobject toJava(JNIEnv *env, const Struct &in) {
+      const JNIMirrorTable &table = _mirror::table(env);
+      jobject obj = table.newObject(env);
+      _mirror::write(env, obj, table, in);
+      return obj;
+   }
+
+   static void fromJava(JNIEnv *env, jobjectArray array,
+                        std::vector<Struct> &out) {
+      const JNIMirrorTable &table = _mirror::table(env);
+      jsize len = (array == 0) ? 0 : env->GetArrayLength(array);
+      out.resize(len);
+      for (jsize i = 0; i < len; i++) {
+         jobject obj = env->GetObjectArrayElement(array, i);
+         if (obj == 0) {
+            out[i] = Struct();
+            continue;
+         }
+         _mirror::read(env, obj, table, out[i]);
+         env->DeleteLocalRef(obj);
+      }
+   }
+   static jobjectArray toJava(JNIEnv *env, const std::vector<Struct> &in) {
+      const JNIMirrorTable &table = _mirror::table(env);
+      jobjectArray array = env->NewObjectArray(
+         static_cast<jsize>(in.size()), table.clazz(), 0);
+      if (array == 0)
+         throw JNIException("Failed to create an array");
+      for (std::size_t i = 0; i < in.size(); i++) {
+         jobject obj = table.newObject(env);
+         _mirror::write(env, obj, table, in[i]);
+         env->SetObjectArrayElement(array, static_cast<jsize>(i), obj);
+         env->DeleteLocalRef(obj);
+      }
+      return array;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * Preprocessor machinery for JNI_MIRROR: applying a macro to each
+ * (name, type) pair of the argument list (up to 16 fields).
+ *---------------------------------------------------------------------------*/
+
+#define JNI_MIRROR_CAT(a, b)		JNI_MIRROR_CAT_(a, b)
+#define JNI_MIRROR_CAT_(a, b)		a##b
+#define JNI_MIRROR_STR(x)			JNI_MIRROR_STR_(x)
+#define JNI_MIRROR_STR_(x)			#x
+
+#define JNI_MIRROR_NARGS(...)												\
+   JNI_MIRROR_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9,			\
+					 8, 7, 6, 5, 4, 3, 2, 1)
+#define JNI_MIRROR_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11,	\
+						  _12, _13, _14, _15, _16, N, ...) N
+
+#define JNI_MIRROR_FOR_EACH(M, ...)										\
+   JNI_MIRROR_CAT(JNI_MIRROR_FOR_EACH_, JNI_MIRROR_NARGS(__VA_ARGS__))		\
+      (M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_1(M, x)       M(x)
+#define JNI_MIRROR_FOR_EACH_2(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_1(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_3(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_2(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_4(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_3(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_5(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_4(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_6(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_5(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_7(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_6(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_8(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_7(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_9(M, x, ...)  M(x) JNI_MIRROR_FOR_EACH_8(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_10(M, x, ...) M(x) JNI_MIRROR_FOR_EACH_9(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_11(M, x, ...) M(x) JNI_MIRROR_FOR_EACH_10(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_12(M, x, ...) M(x) JNI_MIRROR_FOR_EACH_11(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_13(M, x, ...) M(x) JNI_MIRROR_FOR_EACH_12(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_14(M, x, ...) M(x) JNI_MIRROR_FOR_EACH_13(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_15(M, x, ...) M(x) JNI_MIRROR_FOR_EACH_14(M, __VA_ARGS__)
+#define JNI_MIRROR_FOR_EACH_16(M, x, ...) M(x) JNI_MIRROR_FOR_EACH_15(M, __VA_ARGS__)
+
+// Per-field blocks; each is applied to a parenthesized (name, type) pair
+#define JNI_MIRROR_FIELD_NAME(pair)		JNI_MIRROR_STR(JNI_MIRROR_NAME_OF pair),
+#define JNI_MIRROR_FIELD_SIGNATURE(pair)	JNI_MIRROR_SIGNATURE_OF pair,
+#define JNI_MIRROR_FIELD_READ(pair)		JNI_MIRROR_READ_FIELD pair
+#define JNI_MIRROR_FIELD_WRITE(pair)		JNI_MIRROR_WRITE_FIELD pair
+
+#define JNI_MIRROR_NAME_OF(name, type)		name
+#define JNI_MIRROR_SIGNATURE_OF(name, type)	JNIMarshal<type>::signature()
+#define JNI_MIRROR_READ_FIELD(name, type)									\
+   JNIMarshal<type>::Get(env, obj, table.id(i++), out.name);
+#define JNI_MIRROR_WRITE_FIELD(name, type)									\
+   JNIMarshal<type>::Set(env, obj, table.id(i++), in.name);
+
+/*-----------------------------------------------------------------------------
+ * JNI_MIRROR(Struct, ClassName, (name, type)...) specializes JNIMirror for
+ * 'Struct', mapping each listed member to the Java field of the same name
+ * in class 'ClassName' (given in the form expected by FindClass).
+ * Supported member types are the primitive types ('jint', etc.),
+ * std::string, other mirrored structs, and std::vector of any of these.
+ *---------------------------------------------------------------------------*/
+
+#define JNI_MIRROR(Struct, ClassName, ...)									\
+template<>																	\
+struct JNIMirror<Struct> : JNIMirrorBase<Struct> {							\
+   static const char *className() { return ClassName; }					\
+																			\
+   static const JNIMirrorTable &table(JNIEnv *env) {						\
+      static const char *const names[] = {								\
+         JNI_MIRROR_FOR_EACH(JNI_MIRROR_FIELD_NAME, __VA_ARGS__)			\
+      };																	\
+      static const string signatures[] = {								\
+         JNI_MIRROR_FOR_EACH(JNI_MIRROR_FIELD_SIGNATURE, __VA_ARGS__)		\
+      };																	\
+      static const JNIMirrorTable mirrorTable(env, ClassName, names,		\
+         signatures, sizeof(names) / sizeof(names[0]));					\
+      return mirrorTable;													\
+   }																		\
+																			\
+   static void read(JNIEnv *env, jobject obj, const JNIMirrorTable &table,	\
+                    Struct &out) {											\
+      std::size_t i = 0;													\
+      JNI_MIRROR_FOR_EACH(JNI_MIRROR_FIELD_READ, __VA_ARGS__)				\
+   }																		\
+																			\
+   static void write(JNIEnv *env, jobject obj,								\
+                     const JNIMirrorTable &table, const Struct &in) {		\
+      std::size_t i = 0;													\
+      JNI_MIRROR_FOR_EACH(JNI_MIRROR_FIELD_WRITE, __VA_ARGS__)			\
+   }																		\
+};
+
+#endif /* _JNI_MIRROR_H_INCLUDED_ */
@@ -0,0 +1,274 @@
+/*-----------------------------------------------------------------------------
+ * Contention statistics of Java monitors entered from native code.
+ *
+ * A JNIMonitorStats collects the statistics of one monitor (or of a group
+ * of monitors, e.g. those of all the instances of a class), which
+ * JNIProfiledMonitor enters and exits like JNIMonitor:
+ *
+ *    static JNIMonitorStats queueStats("Queue");
+ *
+ *    JNIProfiledMonitor lock(env, queue, queueStats);
+ *    while (isEmpty(env, queue))
+ *       lock.wait(env, 100);
+ *
+ * Recorded per JNIMonitorStats:
+ * - acquisitions, and their latency (the time spent entering the monitor):
+ *   total and maximum
+ * - the hold time (from entering to exiting the monitor, excluding the
+ *   time spent in wait()): total and maximum
+ * - calls to wait(), and acquisitions that spun (see below)
+ * Each acquisition reads the clock three times.
+ *
+ * JNIMonitorStats::dump() lists every JNIMonitorStats by decreasing total
+ * latency, i.e. the hot monitors first.
+ *
+ * Spin-then-enter: JNI cannot try to enter a monitor without blocking, but
+ * the JNIProfiledMonitors of one JNIMonitorStats know whether a native
+ * thread holds its monitor. Given a spin limit, a thread which finds the
+ * monitor held spins (JNISpinBackoff, up to about twice 'spinPauses' CPU
+ * relaxations) until the holder exits, before entering. Short native
+ * critical sections then do not park the waiting threads in the Java VM.
+ * Only native holders are seen, so spinning requires one monitor per
+ * JNIMonitorStats, and pays off when the monitor is mostly held by native
+ * code (the Java VM spins on its own before blocking).
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_MONITOR_STATS_H_INCLUDED_
+#define _JNI_MONITOR_STATS_H_INCLUDED_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_resource.h"
+#include "jni_native_lock.h"
+
+/*-----------------------------------------------------------------------------
+ * Statistics of one JNIMonitorStats
+ *---------------------------------------------------------------------------*/
+struct JNIMonitorSnapshot {
+   std::string name;
+   std::uint64_t acquisitions;
+   std::uint64_t spins;				// acquisitions which spun
+   std::uint64_t waits;
+   std::uint64_t latencyNanos;		// total time spent entering
+   std::uint64_t maxLatencyNanos;
+   std::uint64_t holdNanos;			// total time held
+   std::uint64_t maxHoldNanos;
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIMonitorStats
+ *---------------------------------------------------------------------------*/
+class JNIMonitorStats {
+   std::string _name;
+   unsigned _spinPauses;
+   std::atomic<int> _holders;		// native threads holding the monitor
+   std::atomic<std::uint64_t> _acquisitions;
+   std::atomic<std::uint64_t> _spins;
+   std::atomic<std::uint64_t> _waits;
+   std::atomic<std::uint64_t> _latencyNanos;
+   std::atomic<std::uint64_t> _maxLatencyNanos;
+   std::atomic<std::uint64_t> _holdNanos;
+   std::atomic<std::uint64_t> _maxHoldNanos;
+
+   JNIMonitorStats(const JNIMonitorStats &);
+   JNIMonitorStats &operator= (const JNIMonitorStats &);
+
+   friend class JNIProfiledMonitor;
+
+public:
+   // 'spinPauses' 0: no spinning before entering the monitor
+   explicit JNIMonitorStats(const std::string &name,
+                            unsigned spinPauses = 0) :
+      _name(name), _spinPauses(spinPauses), _holders(0) {
+      reset();
+      std::lock_guard<std::mutex> guard(registryLock());
+      registry().push_back(this);
+   }
+
+   ~JNIMonitorStats() {
+      std::lock_guard<std::mutex> guard(registryLock());
+      std::vector<JNIMonitorStats *> &r = registry();
+      r.erase(std::find(r.begin(), r.end(), this));
+   }
+
+   const std::string &name() const { return _name; }
+   unsigned spinPauses() const { return _spinPauses; }
+
+   JNIMonitorSnapshot snapshot() const {
+      JNIMonitorSnapshot s;
+      s.name = _name;
+      s.acquisitions = _acquisitions.load(std::memory_order_relaxed);
+      s.spins = _spins.load(std::memory_order_relaxed);
+      s.waits = _waits.load(std::memory_order_relaxed);
+      s.latencyNanos = _latencyNanos.load(std::memory_order_relaxed);
+      s.maxLatencyNanos = _maxLatencyNanos.load(std::memory_order_relaxed);
+      s.holdNanos = _holdNanos.load(std::memory_order_relaxed);
+      s.maxHoldNanos = _maxHoldNanos.load(std::memory_order_relaxed);
+      return s;
+   }
+
+   void reset() {
+      _acquisitions.store(0, std::memory_order_relaxed);
+      _spins.store(0, std::memory_order_relaxed);
+      _waits.store(0, std::memory_order_relaxed);
+      _latencyNanos.store(0, std::memory_order_relaxed);
+      _maxLatencyNanos.store(0, std::memory_order_relaxed);
+      _holdNanos.store(0, std::memory_order_relaxed);
+      _maxHoldNanos.store(0, std::memory_order_relaxed);
+   }
+
+   // Every JNIMonitorStats, by decreasing total latency
+   static std::vector<JNIMonitorSnapshot> all() {
+      std::vector<JNIMonitorSnapshot> result;
+      {
+         std::lock_guard<std::mutex> guard(registryLock());
+         std::vector<JNIMonitorStats *> &r = registry();
+         for (std::size_t i = 0; i < r.size(); i++)
+            result.push_back(r[i]->snapshot());
+      }
+      std::stable_sort(result.begin(), result.end(), hotter);
+      return result;
+   }
+
+   // Text export, one line per monitor acquired
+   static void dump(std::ostream &out) {
+      std::vector<JNIMonitorSnapshot> stats = all();
+      out << "# monitor acquisitions spins waits mean_latency_ns"
+             " max_latency_ns mean_hold_ns max_hold_ns\n";
+      for (std::size_t i = 0; i < stats.size(); i++) {
+         const JNIMonitorSnapshot &s = stats[i];
+         if (s.acquisitions == 0)
+            continue;
+         out << s.name << ' ' << s.acquisitions << ' ' << s.spins << ' '
+             << s.waits << ' ' << s.latencyNanos / s.acquisitions << ' '
+             << s.maxLatencyNanos << ' ' << s.holdNanos / s.acquisitions
+             << ' ' << s.maxHoldNanos << '\n';
+      }
+   }
+
+private:
+   static bool hotter(const JNIMonitorSnapshot &a,
+                      const JNIMonitorSnapshot &b) {
+      return a.latencyNanos > b.latencyNanos;
+   }
+
+   static std::vector<JNIMonitorStats *> &registry() {
+      static std::vector<JNIMonitorStats *> stats;
+      return stats;
+   }
+   static std::mutex &registryLock() {
+      static std::mutex lock;
+      return lock;
+   }
+
+   // Spins while a native thread holds the monitor; true if it did
+   bool spin() {
+      if (_spinPauses == 0 || _holders.load(std::memory_order_relaxed) == 0)
+         return false;
+      JNISpinBackoff backoff(_spinPauses);
+      while (backoff.spinning() &&
+             _holders.load(std::memory_order_relaxed) != 0)
+         backoff.pause();
+      return true;
+   }
+
+   void entered(std::uint64_t latency, bool spun) {
+      _holders.fetch_add(1, std::memory_order_relaxed);
+      _acquisitions.fetch_add(1, std::memory_order_relaxed);
+      if (spun)
+         _spins.fetch_add(1, std::memory_order_relaxed);
+      _latencyNanos.fetch_add(latency, std::memory_order_relaxed);
+      raise(_maxLatencyNanos, latency);
+   }
+
+   void exited(std::uint64_t held) {
+      _holders.fetch_sub(1, std::memory_order_relaxed);
+      _holdNanos.fetch_add(held, std::memory_order_relaxed);
+      raise(_maxHoldNanos, held);
+   }
+
+   static void raise(std::atomic<std::uint64_t> &max, std::uint64_t value) {
+      std::uint64_t current = max.load(std::memory_order_relaxed);
+      while (value > current && !max.compare_exchange_weak(
+                                   current, value, std::memory_order_relaxed))
+         ;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIProfiledMonitor: JNIMonitor, recording into a JNIMonitorStats
+ *---------------------------------------------------------------------------*/
+class JNIProfiledMonitor {
+   typedef std::chrono::steady_clock _clock;
+
+   JNIMonitorStats &_stats;
+   JNIEnv *_env;					// of the thread holding the monitor
+   _clock::time_point _arrival;		// before spinning and entering
+   bool _spun;
+   JNIMonitor _monitor;
+   _clock::time_point _entry;		// of the current hold
+   std::uint64_t _held;				// nanoseconds held before wait() calls
+
+   JNIProfiledMonitor(const JNIProfiledMonitor &);
+   JNIProfiledMonitor &operator= (const JNIProfiledMonitor &);
+
+public:
+   JNIProfiledMonitor(JNIEnv *env, jobject obj, JNIMonitorStats &stats) :
+      _stats(stats), _env(env), _arrival(_clock::now()), _spun(stats.spin()),
+      _monitor(env, obj), _entry(_clock::now()), _held(0) {
+      _stats.entered(nanoseconds(_arrival, _entry), _spun);
+   }
+
+   // The monitor is exited first: the stats must not show it free while
+   // it is still held, or spinning threads would enter behind the holder
+   ~JNIProfiledMonitor() {
+      _monitor.ReleaseResource(_env);
+      _stats.exited(_held + nanoseconds(_entry, _clock::now()));
+   }
+
+   // As JNIMonitor::wait(); the monitor is not held while waiting
+   void wait(JNIEnv *env, jlong millis = 0) {
+      _stats._waits.fetch_add(1, std::memory_order_relaxed);
+      _held += nanoseconds(_entry, _clock::now());
+      _stats._holders.fetch_sub(1, std::memory_order_relaxed);
+      try {
+         _monitor.wait(env, millis);
+      }
+      catch (JNIException &e) {
+         resume();
+         throw;
+      }
+      resume();
+   }
+
+   void notify(JNIEnv *env) { _monitor.notify(env); }
+   void notifyAll(JNIEnv *env) { _monitor.notifyAll(env); }
+
+   jobject get() { return _monitor.get(); }
+   JNIMonitorStats &stats() { return _stats; }
+
+private:
+   void resume() {
+      _stats._holders.fetch_add(1, std::memory_order_relaxed);
+      _entry = _clock::now();
+   }
+
+   static std::uint64_t nanoseconds(_clock::time_point from,
+                                    _clock::time_point to) {
+      return static_cast<std::uint64_t>(
+         std::chrono::duration_cast<std::chrono::nanoseconds>(
+            to - from).count());
+   }
+};
+
+#endif /* _JNI_MONITOR_STATS_H_INCLUDED_ */
@@ -0,0 +1,328 @@
+/*-----------------------------------------------------------------------------
+ * Native locks, for critical sections over native data.
+ *
+ * JNIMonitor enters the monitor of a Java object: every lock is a JNI call,
+ * and a contended monitor is inflated by the Java VM. This is only needed
+ * when the same object is also locked from Java, i.e. when Java code
+ * synchronizes on it (synchronized blocks or methods, Object.wait and
+ * notify). Data that only native code touches is better protected by a
+ * native lock, which costs one atomic operation when uncontended:
+ *
+ *    static JNINativeMutex registryLock;
+ *
+ *    JNINativeLock<JNINativeMutex> lock(env, registryLock);	// like JNIMonitor
+ *    registry.insert(...);
+ *
+ * The family (all C++11 Lockable types, also usable with std::lock_guard):
+ * - JNISpinLock: test-and-test-and-set, with exponential backoff (pause,
+ *   then yield). For very short sections, taken by few threads.
+ * - JNINativeMutex: spins briefly, then sleeps on a futex. The general
+ *   purpose lock.
+ * - JNINativeRWLock: shared (lock_shared) and exclusive locking, with
+ *   writers preferred over new readers. For data read far more often
+ *   than written.
+ * The RAII guards are JNINativeLock (exclusive) and JNINativeSharedLock.
+ * Their JNIEnv constructors make them drop-in replacements of JNIMonitor;
+ * the JNIEnv is not used.
+ *
+ * A native lock is invisible to the Java VM: a thread waiting for it is
+ * running native code (it does not hold up garbage collection, but thread
+ * dumps show it as RUNNABLE), and Java code cannot take part in the
+ * locking. Keep JNI calls that may block (e.g. calls into Java, or
+ * allocations that trigger a garbage collection) out of JNISpinLock
+ * sections, where the waiting threads spin.
+ *
+ * Futexes are used on Linux (and Android); elsewhere, waiting threads
+ * yield instead. See jni_lock_benchmark.cpp for the costs of JNIMonitor
+ * and of the native locks.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_NATIVE_LOCK_H_INCLUDED_
+#define _JNI_NATIVE_LOCK_H_INCLUDED_
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "jni_declarations.h"
+
+// Relaxes the CPU in spin loops
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define JNI_CPU_RELAX() __builtin_ia32_pause()
+#elif (defined(__GNUC__) || defined(__clang__)) && \
+      (defined(__aarch64__) || defined(__arm__))
+#define JNI_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define JNI_CPU_RELAX() ((void)0)
+#endif
+
+/*-----------------------------------------------------------------------------
+ * JNISpinBackoff: exponential backoff of a spin loop, pausing for 1, 2,
+ * 4 ... 'maxPauses' CPU relaxations, then yielding the processor
+ *---------------------------------------------------------------------------*/
+class JNISpinBackoff {
+   unsigned _pauses;
+   unsigned _maxPauses;
+
+public:
+   explicit JNISpinBackoff(unsigned maxPauses = 64) :
+      _pauses(1), _maxPauses(maxPauses) {}
+
+   void pause() {
+      if (_pauses <= _maxPauses) {
+         for (unsigned i = 0; i < _pauses; i++)
+            JNI_CPU_RELAX();
+         _pauses *= 2;
+      }
+      else
+         std::this_thread::yield();
+   }
+
+   // true while pause() still spins (rather than yields)
+   bool spinning() const { return _pauses <= _maxPauses; }
+
+   void reset() { _pauses = 1; }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIFutex: waiting on a 32-bit word, and waking its waiters
+ *---------------------------------------------------------------------------*/
+struct JNIFutex {
+   // Sleeps while 'word' holds 'expected' (spurious wakeups are possible)
+   static void wait(std::atomic<uint32_t> &word, uint32_t expected) {
+#ifdef __linux__
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+              FUTEX_WAIT_PRIVATE, expected, 0, 0, 0);
+#else
+      if (word.load() == expected)
+         std::this_thread::yield();
+#endif
+   }
+
+   static void wake(std::atomic<uint32_t> &word, int threads) {
+#ifdef __linux__
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+              FUTEX_WAKE_PRIVATE, threads, 0, 0, 0);
+#else
+      (void)word;
+      (void)threads;
+#endif
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNISpinLock
+ *---------------------------------------------------------------------------*/
+class JNISpinLock {
+   std::atomic<bool> _locked;
+
+   JNISpinLock(const JNISpinLock &);
+   JNISpinLock &operator= (const JNISpinLock &);
+
+public:
+   JNISpinLock() : _locked(false) {}
+
+   void lock() {
+      JNISpinBackoff backoff;
+      while (_locked.exchange(true, std::memory_order_acquire)) {
+         // Spins on reads, which keep the cache line shared
+         while (_locked.load(std::memory_order_relaxed))
+            backoff.pause();
+      }
+   }
+
+   bool try_lock() {
+      return !_locked.load(std::memory_order_relaxed) &&
+             !_locked.exchange(true, std::memory_order_acquire);
+   }
+
+   void unlock() {
+      _locked.store(false, std::memory_order_release);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNINativeMutex: a futex mutex (0: unlocked, 1: locked, 2: locked, with
+ * possible waiters), from U. Drepper's "Futexes Are Tricky"
+ *---------------------------------------------------------------------------*/
+class JNINativeMutex {
+   std::atomic<uint32_t> _state;
+
+   JNINativeMutex(const JNINativeMutex &);
+   JNINativeMutex &operator= (const JNINativeMutex &);
+
+public:
+   JNINativeMutex() : _state(0) {}
+
+   void lock() {
+      uint32_t state = 0;
+      if (_state.compare_exchange_strong(state, 1, std::memory_order_acquire))
+         return;
+
+      // Spins while the holder is likely to release the lock soon
+      JNISpinBackoff backoff;
+      while (backoff.spinning() && state == 1) {
+         backoff.pause();
+         state = 0;
+         if (_state.compare_exchange_strong(state, 1,
+                                            std::memory_order_acquire))
+            return;
+      }
+
+      if (state != 2)
+         state = _state.exchange(2, std::memory_order_acquire);
+      while (state != 0) {
+         JNIFutex::wait(_state, 2);
+         state = _state.exchange(2, std::memory_order_acquire);
+      }
+   }
+
+   bool try_lock() {
+      uint32_t state = 0;
+      return _state.compare_exchange_strong(state, 1,
+                                            std::memory_order_acquire);
+   }
+
+   void unlock() {
+      if (_state.fetch_sub(1, std::memory_order_release) != 1) {
+         _state.store(0, std::memory_order_release);
+         JNIFutex::wake(_state, 1);
+      }
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNINativeRWLock: the state holds the number of readers, and the WRITER
+ * and PENDING (a writer is waiting) flags. Waiting threads sleep on
+ * '_epoch', which every release that may unblock them increments.
+ *---------------------------------------------------------------------------*/
+class JNINativeRWLock {
+   static const uint32_t WRITER = 1u << 31;
+   static const uint32_t PENDING = 1u << 30;
+
+   std::atomic<uint32_t> _state;
+   std::atomic<uint32_t> _epoch;
+   std::atomic<uint32_t> _waiters;
+
+   JNINativeRWLock(const JNINativeRWLock &);
+   JNINativeRWLock &operator= (const JNINativeRWLock &);
+
+public:
+   JNINativeRWLock() : _state(0), _epoch(0), _waiters(0) {}
+
+   void lock_shared() {
+      JNISpinBackoff backoff;
+      for (;;) {
+         uint32_t state = _state.load();
+         if ((state & (WRITER | PENDING)) == 0) {
+            if (_state.compare_exchange_weak(state, state + 1))
+               return;
+         }
+         else if (backoff.spinning())
+            backoff.pause();
+         else
+            await(WRITER | PENDING);
+      }
+   }
+
+   bool try_lock_shared() {
+      uint32_t state = _state.load();
+      return (state & (WRITER | PENDING)) == 0 &&
+             _state.compare_exchange_strong(state, state + 1);
+   }
+
+   void unlock_shared() {
+      // The last reader lets a pending writer in
+      if (_state.fetch_sub(1) - 1 == PENDING)
+         wakeAll();
+   }
+
+   void lock() {
+      JNISpinBackoff backoff;
+      for (;;) {
+         uint32_t state = _state.load();
+         if ((state & ~PENDING) == 0) {
+            if (_state.compare_exchange_weak(state, WRITER))
+               return;
+         }
+         else if ((state & PENDING) == 0)
+            _state.compare_exchange_weak(state, state | PENDING);
+         else if (backoff.spinning())
+            backoff.pause();
+         else
+            await(~PENDING);
+      }
+   }
+
+   bool try_lock() {
+      uint32_t state = _state.load();
+      return (state & ~PENDING) == 0 &&
+             _state.compare_exchange_strong(state, WRITER);
+   }
+
+   void unlock() {
+      _state.fetch_and(~WRITER);
+      wakeAll();
+   }
+
+private:
+   // Sleeps until a release, unless none of the 'blocking' bits is set
+   void await(uint32_t blocking) {
+      _waiters.fetch_add(1);
+      uint32_t epoch = _epoch.load();
+      if ((_state.load() & blocking) != 0)
+         JNIFutex::wait(_epoch, epoch);
+      _waiters.fetch_sub(1);
+   }
+
+   void wakeAll() {
+      _epoch.fetch_add(1);
+      if (_waiters.load() != 0)
+         JNIFutex::wake(_epoch, INT_MAX);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNINativeLock and JNINativeSharedLock: exclusive and shared RAII locking
+ *---------------------------------------------------------------------------*/
+template<class Lockable>
+class JNINativeLock {
+   Lockable &_lock;
+
+   JNINativeLock(const JNINativeLock &);
+   JNINativeLock &operator= (const JNINativeLock &);
+
+public:
+   explicit JNINativeLock(Lockable &lock) : _lock(lock) { _lock.lock(); }
+   JNINativeLock(JNIEnv *, Lockable &lock) : _lock(lock) { _lock.lock(); }
+   ~JNINativeLock() { _lock.unlock(); }
+};
+
+template<class SharedLockable>
+class JNINativeSharedLock {
+   SharedLockable &_lock;
+
+   JNINativeSharedLock(const JNINativeSharedLock &);
+   JNINativeSharedLock &operator= (const JNINativeSharedLock &);
+
+public:
+   explicit JNINativeSharedLock(SharedLockable &lock) : _lock(lock) {
+      _lock.lock_shared();
+   }
+   JNINativeSharedLock(JNIEnv *, SharedLockable &lock) : _lock(lock) {
+      _lock.lock_shared();
+   }
+   ~JNINativeSharedLock() { _lock.unlock_shared(); }
+};
+
+#endif /* _JNI_NATIVE_LOCK_H_INCLUDED_ */
@@ -0,0 +1,167 @@
+/*-----------------------------------------------------------------------------
+ * Creation of primitive Java arrays from native data.
+ *
+ * Returning an array to Java takes a New<PrimitiveType>Array call, then
+ * filling it in. JNINewArray does both, for every primitive type, and
+ * fills the array in through one Set<PrimitiveType>ArrayRegion call:
+ *
+ *    JNIEXPORT jintArray JNICALL Java_Foo_primes(JNIEnv *env, jclass) {
+ *       JNICallScope scope;
+ *       JNIArenaVector<jint> primes;
+ *       ...
+ *       return JNINewArray(env, std::move(primes));
+ *    }
+ *
+ * The sources of the elements:
+ * - a native buffer and its length, a C array, or a std::vector of any
+ *   allocator: copied into the array straight from their memory
+ * - a JNIArenaVector, by move: adopted, copied from the arena and freed
+ *   right away (which returns the memory to the arena when it was its most
+ *   recent allocation), so building the result in the arena costs neither
+ *   malloc nor a staging copy
+ * - a generator, called with each index 0 ... len - 1 in order:
+ *
+ *      jdoubleArray squares = JNINewArray<jdouble>(env, len,
+ *         [](jsize i) { return static_cast<jdouble>(i) * i; });
+ *
+ *   Arrays of less than JNI_NEW_ARRAY_CRITICAL_BYTES bytes (64 KB unless
+ *   defined otherwise before including this file) are generated into a
+ *   pooled buffer (JNIBufferPool), then copied by one region call. Larger
+ *   arrays are generated in place, inside a GetPrimitiveArrayCritical
+ *   section, which saves the copy (and the buffer) on a VM which does not
+ *   copy critical arrays. The generator must therefore not make JNI calls,
+ *   nor block.
+ *
+ * The array is returned as a local reference. Failing allocations throw a
+ * JNIException, leaving the OutOfMemoryError pending in Java.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_NEW_ARRAY_H_INCLUDED_
+#define _JNI_NEW_ARRAY_H_INCLUDED_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_arena.h"
+#include "jni_array_pool.h"
+
+#ifndef JNI_NEW_ARRAY_CRITICAL_BYTES
+#define JNI_NEW_ARRAY_CRITICAL_BYTES (64 * 1024)
+#endif
+
+/*-----------------------------------------------------------------------------
+ * JNIArrayFactory<NativeType>: New<PrimitiveType>Array and
+ * Set<PrimitiveType>ArrayRegion for one primitive type
+ *---------------------------------------------------------------------------*/
+template<class NativeType>
+struct JNIArrayFactory {};
+
+#define JNI_ARRAY_FACTORY(Type)												\
+template<> struct JNIArrayFactory<NATIVE_TYPE(Type)> {						\
+   static ARRAY_TYPE(Type) create(JNIEnv *env, jsize len) {					\
+      ARRAY_TYPE(Type) array = env->New##Type##Array(len);					\
+      if (array == 0)														\
+         throw JNIException("Failed to allocate a Java " #Type " array");	\
+      return array;															\
+   }																		\
+   static void fill(JNIEnv *env, ARRAY_TYPE(Type) array, jsize len,			\
+                    const NATIVE_TYPE(Type) *data) {						\
+      env->Set##Type##ArrayRegion(array, 0, len, data);						\
+   }																		\
+};
+
+/*-----------------------------------------------------------------------------
+ * Combo instantiation of JNIArrayFactory for all primitive types
+ *---------------------------------------------------------------------------*/
+
+INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_ARRAY_FACTORY)
+
+/*-----------------------------------------------------------------------------
+ * JNINewArray from native memory
+ *---------------------------------------------------------------------------*/
+template<class T>
+inline typename JNITypeDeclarations<T>::ArrayType
+JNINewArray(JNIEnv *env, const T *data, jsize len) {
+   typename JNITypeDeclarations<T>::ArrayType array =
+      JNIArrayFactory<T>::create(env, len);
+   if (len > 0)
+      JNIArrayFactory<T>::fill(env, array, len, data);
+   return array;
+}
+
+template<class T, std::size_t N>
+inline typename JNITypeDeclarations<T>::ArrayType
+JNINewArray(JNIEnv *env, const T (&values)[N]) {
+   return JNINewArray(env, values, static_cast<jsize>(N));
+}
+
+template<class T, class Allocator>
+inline typename JNITypeDeclarations<T>::ArrayType
+JNINewArray(JNIEnv *env, const std::vector<T, Allocator> &values) {
+   return JNINewArray(env, values.data(), static_cast<jsize>(values.size()));
+}
+
+// Adopts an arena vector: its memory is freed once copied
+template<class T>
+inline typename JNITypeDeclarations<T>::ArrayType
+JNINewArray(JNIEnv *env, JNIArenaVector<T> &&values) {
+   JNIArenaVector<T> adopted(std::move(values));
+   return JNINewArray(env, adopted.data(), static_cast<jsize>(adopted.size()));
+}
+
+/*-----------------------------------------------------------------------------
+ * JNINewArray from a generator: 'generate(i)' returns element i
+ *---------------------------------------------------------------------------*/
+template<class T, class Generator>
+inline typename JNITypeDeclarations<T>::ArrayType
+JNINewArray(JNIEnv *env, jsize len, Generator generate) {
+   typename JNITypeDeclarations<T>::ArrayType array =
+      JNIArrayFactory<T>::create(env, len);
+   std::size_t bytes = static_cast<std::size_t>(len) * sizeof(T);
+   if (len == 0)
+      return array;
+
+   if (bytes < JNI_NEW_ARRAY_CRITICAL_BYTES) {
+      // Generated into a pooled buffer, then copied
+      JNIBufferPool &pool = JNIBufferPool::local();
+      T *buf = 0;
+      try {
+         buf = static_cast<T *>(pool.acquire(bytes));
+         for (jsize i = 0; i < len; i++)
+            buf[i] = generate(i);
+      }
+      catch (...) {
+         if (buf != 0)
+            pool.release(buf);
+         env->DeleteLocalRef(array);
+         throw;
+      }
+      JNIArrayFactory<T>::fill(env, array, len, buf);
+      pool.release(buf);
+   }
+   else {
+      // Generated in place
+      T *elements = static_cast<T *>(env->GetPrimitiveArrayCritical(array, 0));
+      if (elements == 0) {
+         env->DeleteLocalRef(array);
+         throw JNIException("Failed to get a critical array");
+      }
+      try {
+         for (jsize i = 0; i < len; i++)
+            elements[i] = generate(i);
+      }
+      catch (...) {
+         env->ReleasePrimitiveArrayCritical(array, elements, JNI_ABORT);
+         env->DeleteLocalRef(array);
+         throw;
+      }
+      env->ReleasePrimitiveArrayCritical(array, elements, 0);
+   }
+   return array;
+}
+
+#endif /* _JNI_NEW_ARRAY_H_INCLUDED_ */
@@ -0,0 +1,188 @@
+/*-----------------------------------------------------------------------------
+ * This file provides batched access to several fields of one Java object.
+ *
+ * Each JNIField proxy resolves its own field id and constructs its own
+ * JNIEnvironment on every access. When a native method needs a number of
+ * fields of the same object, JNIObjectView loads all of them in a single
+ * pass (one JNIEnv, one tight sequence of Get<PrimitiveType>Field calls)
+ * into a native record, and commit() writes back only the fields that were
+ * changed.
+ *
+ * Requires C++11 (variadic templates).
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_OBJECT_VIEW_H_INCLUDED_
+#define _JNI_OBJECT_VIEW_H_INCLUDED_
+
+#include <cstddef>
+#include <tuple>
+
+#include "jni_declarations.h"
+#include "jni_class.h"
+#include "jni_field.h"
+#include "jni_env.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIIndexList<0, 1, ..., N-1> is a compile-time list of indices, used to
+ * expand per-field operations over a parameter pack.
+ * JNIMakeIndexList<N>::type yields the list for N elements.
+ *---------------------------------------------------------------------------*/
+template<std::size_t... I>
+struct JNIIndexList {};
+
+template<std::size_t N, std::size_t... I>
+struct JNIMakeIndexList : JNIMakeIndexList<N - 1, N - 1, I...> {};
+
+template<std::size_t... I>
+struct JNIMakeIndexList<0, I...> {
+   typedef JNIIndexList<I...> type;
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIObjectLayout holds the field ids of a fixed set of fields of one class.
+ * The template parameters are the JNI types of the fields ('jint', 'jlong',
+ * 'jintArray', 'jstring', etc.); their signatures are taken from the
+ * JNITypeDeclarations lookup table. Field names are given to the
+ * constructor, in the same order.
+ *
+ * The ids are resolved once, at construction. A layout may therefore be
+ * kept (e.g., as a static variable) and shared by every JNIObjectView of
+ * the same class, so that no by-name lookup happens on the per-call path.
+ *---------------------------------------------------------------------------*/
+template<class... Fields>
+class JNIObjectLayout {
+public:
+   static const std::size_t count = sizeof...(Fields);
+
+private:
+   jfieldID _ids[count];	// field ids, in declaration order
+
+public:
+   // Construct a layout given some object from which a class can be
+   // constructed ('jclass', 'jobject' or 'const char *') and field names
+   template<class T, class... Names>
+   JNIObjectLayout(JNIEnv *env, T protoClass, Names... names) {
+      static_assert(sizeof...(Names) == count,
+                    "JNIObjectLayout: one name is required per field");
+      JNIClass clazz(env, protoClass);
+      const char *fieldNames[] = { names... };
+      const char *signatures[] = { SIGNATURE_OF(Fields)... };
+      for (std::size_t i = 0; i < count; i++) {
+         _ids[i] = env->GetFieldID(clazz, fieldNames[i], signatures[i]);
+         if (_ids[i] == 0)
+            throw JNIException(string("Field not found: ") + fieldNames[i]);
+      }
+   }
+
+   jfieldID id(std::size_t i) const { return _ids[i]; }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIObjectView is a native record of the fields described by a
+ * JNIObjectLayout, loaded from a single Java object.
+ *
+ * - The constructor reads every field using the supplied JNIEnv.
+ * - get<I>() returns a (modifiable) reference to the I-th field value.
+ * - commit() writes back the fields whose value differs from the one
+ *   loaded (or last committed), and returns the number of fields written.
+ *   Object fields are compared by reference handle.
+ * - reload() discards local changes and reads all the fields again.
+ *
+ * As with other wrappers in this library, the JNIEnv itself is not kept;
+ * commit() and reload() without an environment parameter obtain one from
+ * the associated JavaVM.
+ *---------------------------------------------------------------------------*/
+template<class... Fields>
+class JNIObjectView {
+   typedef JNIObjectView<Fields...> _self;
+   typedef typename JNIMakeIndexList<sizeof...(Fields)>::type _indices;
+
+public:
+   typedef JNIObjectLayout<Fields...> Layout;
+   typedef std::tuple<Fields...> Values;
+
+private:
+   JavaVM *_vm;			// Associated JVM
+   jobject _obj;		// The Java object that hosts the fields
+   Layout _layout;		// field ids
+   Values _values;		// current (possibly modified) values
+   Values _loaded;		// values as last read from / written to Java
+
+public:
+   // Construct a view given a prebuilt layout and an object
+   JNIObjectView(JNIEnv *env, jobject obj, const Layout &layout) :
+      _obj(obj), _layout(layout) {
+      env->GetJavaVM(&_vm);
+      load(env, _indices());
+   }
+
+   // Construct a view given an object and field names (the ids are
+   // resolved for this view only)
+   template<class... Names>
+   JNIObjectView(JNIEnv *env, jobject obj, Names... names) :
+      _obj(obj), _layout(env, obj, names...) {
+      env->GetJavaVM(&_vm);
+      load(env, _indices());
+   }
+
+   // Field access
+   template<std::size_t I>
+   typename std::tuple_element<I, Values>::type &get() {
+      return std::get<I>(_values);
+   }
+   template<std::size_t I>
+   const typename std::tuple_element<I, Values>::type &get() const {
+      return std::get<I>(_values);
+   }
+
+   Values &values() { return _values; }
+   const Values &values() const { return _values; }
+
+   // Write back the modified fields
+   int commit(JNIEnv *env) {
+      return store(env, _indices());
+   }
+   int commit() {
+      JNIEnvironment env(_vm);
+      return commit(env);
+   }
+
+   // Discard local changes and read all the fields again
+   void reload(JNIEnv *env) {
+      load(env, _indices());
+   }
+   void reload() {
+      JNIEnvironment env(_vm);
+      reload(env);
+   }
+
+private:
+   template<std::size_t... I>
+   void load(JNIEnv *env, JNIIndexList<I...>) {
+      int expand[] = { 0, (std::get<I>(_values) =
+         JNIFieldAccess<Fields>::Get(env, _obj, _layout.id(I)), 0)... };
+      (void)expand;
+      _loaded = _values;
+   }
+
+   template<std::size_t... I>
+   int store(JNIEnv *env, JNIIndexList<I...>) {
+      int written = 0;
+      int expand[] = { 0, (written += storeField<I>(env), 0)... };
+      (void)expand;
+      return written;
+   }
+
+   template<std::size_t I>
+   int storeField(JNIEnv *env) {
+      typedef typename std::tuple_element<I, Values>::type FieldType;
+      if (std::get<I>(_values) == std::get<I>(_loaded))
+         return 0;
+      JNIFieldAccess<FieldType>::Set(env, _obj, _layout.id(I),
+                                     std::get<I>(_values));
+      std::get<I>(_loaded) = std::get<I>(_values);
+      return 1;
+   }
+};
+
+#endif /* _JNI_OBJECT_VIEW_H_INCLUDED_ */
@@ -0,0 +1,422 @@
+/*-----------------------------------------------------------------------------
+ * Parallel processing of native arrays.
+ *
+ * Once an array is pinned or copied into native memory, JNIParallelFor
+ * splits its buffer into chunks and runs a kernel over them on a
+ * JNIThreadPool. The call returns only after every chunk has been
+ * processed (and therefore before the array can be released):
+ *
+ *    static JNIThreadPool *pool;	// created in JNI_OnLoad: new JNIThreadPool(vm)
+ *
+ *    JNICriticalArray<jfloat> samples(env, jsamples);
+ *    JNIParallelFor(*pool, samples, [](jfloat *begin, jfloat *end) {
+ *       for (jfloat *p = begin; p != end; p++)
+ *          *p = std::sqrt(*p);
+ *    });
+ *
+ * - Chunk boundaries fall on cache line boundaries (except for the start of
+ *   the first chunk and the end of the last one), so that no two workers
+ *   write to the same cache line.
+ * - Chunks are first distributed evenly among the workers; a worker which
+ *   runs out of chunks steals from the end of the others' ranges.
+ * - The workers are attached to the Java VM once, when the pool is created,
+ *   and stay attached until it is destroyed. They are attached as daemon
+ *   threads, so that a pool which is never destroyed (e.g. created in
+ *   JNI_OnLoad) does not keep DestroyJavaVM waiting at shutdown. A kernel
+ *   may obtain the worker's JNIEnv through JNIThreadPool::env(), except
+ *   while the array is held in a critical region (JNICriticalArray), where
+ *   JNI calls are forbidden and env() throws a JNIException instead.
+ * - The first exception thrown by a kernel is rethrown by JNIParallelFor,
+ *   once all the workers have stopped.
+ * - Per-worker timings of the run are returned as JNIParallelStats.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_PARALLEL_H_INCLUDED_
+#define _JNI_PARALLEL_H_INCLUDED_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_env.h"
+#include "jni_resource.h"
+#include "jni_kernels.h"
+
+#ifndef JNI_CACHE_LINE_SIZE
+#define JNI_CACHE_LINE_SIZE 64
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Timings of one JNIParallelFor run
+ *---------------------------------------------------------------------------*/
+struct JNIParallelWorkerStats {
+   std::size_t chunks;		// chunks processed (including stolen ones)
+   std::size_t stolen;		// chunks taken from other workers
+   std::size_t elements;	// elements processed
+   long long nanoseconds;	// time from wake-up to running out of work
+};
+
+struct JNIParallelStats {
+   std::vector<JNIParallelWorkerStats> workers;	// indexed by worker
+   std::size_t chunks;		// total number of chunks
+   long long nanoseconds;	// wall time of the run, as seen by the caller
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIChunkRange: a range of chunk indices [begin, end), packed in a single
+ * atomic word. The owner takes chunks from the front, thieves from the back.
+ *---------------------------------------------------------------------------*/
+class JNIChunkRange {
+   std::atomic<std::uint64_t> _range;
+
+public:
+   JNIChunkRange() : _range(0) {}
+
+   void assign(std::uint32_t begin, std::uint32_t end) {
+      _range.store(pack(begin, end), std::memory_order_relaxed);
+   }
+
+   bool popFront(std::size_t &chunk) {
+      std::uint64_t r = _range.load(std::memory_order_relaxed);
+      for (;;) {
+         std::uint32_t b = begin(r), e = end(r);
+         if (b >= e)
+            return false;
+         if (_range.compare_exchange_weak(r, pack(b + 1, e),
+                                          std::memory_order_acq_rel)) {
+            chunk = b;
+            return true;
+         }
+      }
+   }
+
+   bool popBack(std::size_t &chunk) {
+      std::uint64_t r = _range.load(std::memory_order_relaxed);
+      for (;;) {
+         std::uint32_t b = begin(r), e = end(r);
+         if (b >= e)
+            return false;
+         if (_range.compare_exchange_weak(r, pack(b, e - 1),
+                                          std::memory_order_acq_rel)) {
+            chunk = e - 1;
+            return true;
+         }
+      }
+   }
+
+private:
+   static std::uint64_t pack(std::uint32_t b, std::uint32_t e) {
+      return (static_cast<std::uint64_t>(b) << 32) | e;
+   }
+   static std::uint32_t begin(std::uint64_t r) {
+      return static_cast<std::uint32_t>(r >> 32);
+   }
+   static std::uint32_t end(std::uint64_t r) {
+      return static_cast<std::uint32_t>(r);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIThreadPool: a fixed set of worker threads, attached to the Java VM
+ * for their whole lifetime (or not attached at all, if no VM is given).
+ *
+ * run(chunks, f, critical) calls f(chunk) for every chunk index, and
+ * returns when all have completed; 'f' returns the number of elements the
+ * chunk covered (for statistics only). Runs are serialized: concurrent
+ * callers wait for each other. run() must not be called from a worker.
+ *---------------------------------------------------------------------------*/
+class JNIThreadPool {
+public:
+   typedef std::function<std::size_t(std::size_t)> ChunkF;
+
+private:
+   // Per-worker state, on its own cache line
+   struct alignas(JNI_CACHE_LINE_SIZE) Slot {
+      JNIChunkRange range;			// chunks still owned by the worker
+      JNIParallelWorkerStats stats;	// timings of the current run
+   };
+
+   // Per-thread view of the pool, set for worker threads only
+   struct WorkerContext {
+      JNIThreadPool *pool;
+      JNIEnv *env;
+      int index;
+   };
+
+   JavaVM *_vm;
+   std::vector<std::thread> _threads;
+   std::vector<Slot> _slots;
+
+   std::mutex _submit;				// serializes run()
+   std::mutex _lock;				// protects the fields below
+   std::condition_variable _wake;	// signals a new run (or stop)
+   std::condition_variable _done;	// signals the end of a run
+   unsigned long _generation;		// incremented on every run
+   std::size_t _active;			// workers still busy in the current run
+   bool _stop;
+
+   // Current run
+   const ChunkF *_f;
+   bool _critical;
+   std::exception_ptr _error;
+
+   JNIThreadPool(const JNIThreadPool &);
+   JNIThreadPool &operator= (const JNIThreadPool &);
+
+public:
+   // 'threads' == 0 selects the number of hardware threads
+   explicit JNIThreadPool(JavaVM *vm, unsigned threads = 0) : _vm(vm) {
+      start(threads);
+   }
+   explicit JNIThreadPool(JNIEnv *env, unsigned threads = 0) : _vm(0) {
+      env->GetJavaVM(&_vm);
+      start(threads);
+   }
+
+   // Stops and joins the workers, which detach from the VM as they exit
+   ~JNIThreadPool() {
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         _stop = true;
+      }
+      _wake.notify_all();
+      for (std::size_t i = 0; i < _threads.size(); i++)
+         _threads[i].join();
+   }
+
+   std::size_t size() const { return _threads.size(); }
+
+   JNIParallelStats run(std::size_t chunks, const ChunkF &f,
+                        bool critical = false) {
+      if (context() != 0)
+         throw JNIException("JNIThreadPool::run() called from a worker");
+      if (chunks > 0xffffffffu)
+         throw JNIException("JNIThreadPool::run(): too many chunks");
+
+      std::lock_guard<std::mutex> submit(_submit);
+      std::chrono::steady_clock::time_point start =
+         std::chrono::steady_clock::now();
+
+      // Distribute the chunks evenly
+      std::size_t n = _slots.size();
+      for (std::size_t w = 0; w < n; w++) {
+         _slots[w].range.assign(static_cast<std::uint32_t>(chunks * w / n),
+                                static_cast<std::uint32_t>(chunks * (w + 1) / n));
+         JNIParallelWorkerStats zero = { 0, 0, 0, 0 };
+         _slots[w].stats = zero;
+      }
+
+      // Wake the workers, and wait for all of them to run out of work
+      std::unique_lock<std::mutex> lock(_lock);
+      _f = &f;
+      _critical = critical;
+      _error = std::exception_ptr();
+      _active = n;
+      _generation++;
+      _wake.notify_all();
+      _done.wait(lock, [this] { return _active == 0; });
+      _f = 0;
+
+      JNIParallelStats stats;
+      stats.chunks = chunks;
+      for (std::size_t w = 0; w < n; w++)
+         stats.workers.push_back(_slots[w].stats);
+      stats.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now() - start).count();
+
+      if (_error)
+         std::rethrow_exception(_error);
+      return stats;
+   }
+
+   // JNIEnv of the calling worker; throws if the caller is not a worker,
+   // if the pool has no VM, or if the current run holds a critical region
+   static JNIEnv *env() {
+      WorkerContext *ctx = context();
+      if (ctx == 0 || ctx->env == 0)
+         throw JNIException("No JNIEnv: not an attached pool worker");
+      if (ctx->pool->_critical)
+         throw JNIException("JNI call attempted inside a critical region");
+      return ctx->env;
+   }
+
+   // Index of the calling worker, or -1 if the caller is not a worker
+   static int workerIndex() {
+      WorkerContext *ctx = context();
+      return (ctx == 0) ? -1 : ctx->index;
+   }
+
+private:
+   static WorkerContext *&context() {
+      static thread_local WorkerContext *ctx = 0;
+      return ctx;
+   }
+
+   void start(unsigned threads) {
+      if (threads == 0)
+         threads = std::thread::hardware_concurrency();
+      if (threads == 0)
+         threads = 1;
+      _generation = 0;
+      _active = 0;
+      _stop = false;
+      _f = 0;
+      _critical = false;
+      _slots = std::vector<Slot>(threads);
+      for (unsigned i = 0; i < threads; i++)
+         _threads.push_back(std::thread(&JNIThreadPool::main, this, i));
+   }
+
+   void main(int index) {
+      WorkerContext ctx = { this, 0, index };
+      context() = &ctx;
+      if (_vm != 0) {
+         try {
+            JNIEnvironment env(_vm, true);	// detached on exit
+            ctx.env = env;
+            loop(index);
+            return;
+         }
+         catch(JNIException &e) {
+            // Unable to attach: the worker runs without a JNIEnv
+         }
+      }
+      loop(index);
+   }
+
+   void loop(int index) {
+      unsigned long seen = 0;
+      for (;;) {
+         {
+            std::unique_lock<std::mutex> lock(_lock);
+            _wake.wait(lock, [&] { return _stop || _generation != seen; });
+            if (_stop)
+               return;
+            seen = _generation;
+         }
+
+         work(index);
+
+         std::lock_guard<std::mutex> guard(_lock);
+         if (--_active == 0)
+            _done.notify_one();
+      }
+   }
+
+   void work(int index) {
+      JNIParallelWorkerStats &stats = _slots[index].stats;
+      std::chrono::steady_clock::time_point start =
+         std::chrono::steady_clock::now();
+      try {
+         std::size_t chunk;
+         while (_slots[index].range.popFront(chunk)) {
+            stats.elements += (*_f)(chunk);
+            stats.chunks++;
+         }
+         std::size_t n = _slots.size();
+         for (std::size_t k = 1; k < n; k++) {
+            JNIChunkRange &victim = _slots[(index + k) % n].range;
+            while (victim.popBack(chunk)) {
+               stats.elements += (*_f)(chunk);
+               stats.chunks++;
+               stats.stolen++;
+            }
+         }
+      }
+      catch(...) {
+         std::lock_guard<std::mutex> guard(_lock);
+         if (!_error)
+            _error = std::current_exception();
+         // Drain the remaining chunks, so that the run ends promptly
+         std::size_t chunk;
+         for (std::size_t w = 0; w < _slots.size(); w++)
+            while (_slots[w].range.popBack(chunk))
+               ;
+      }
+      stats.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now() - start).count();
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIParallelFor applies kernel(begin, end) to consecutive chunks of a
+ * native buffer on the given pool. 'grain' is the minimal number of
+ * elements per chunk (rounded up to whole cache lines); by default, the
+ * buffer is divided into about eight chunks per worker.
+ *
+ * The array resource overloads accept JNIArray, JNIPooledArray and
+ * JNICriticalArray (through JNIView()); JNICriticalArray runs are marked
+ * critical, so that JNIThreadPool::env() refuses JNI access.
+ *---------------------------------------------------------------------------*/
+template<class NativeType, class Kernel>
+JNIParallelStats JNIParallelFor(JNIThreadPool &pool, NativeType *data,
+                                std::size_t n, Kernel kernel,
+                                std::size_t grain = 0, bool critical = false) {
+   const std::size_t line = JNI_CACHE_LINE_SIZE / sizeof(NativeType);
+   if (grain == 0)
+      grain = n / (pool.size() * 8);
+   grain = (grain + line - 1) / line * line;
+   if (grain == 0)
+      grain = line;
+
+   // Elements before the first cache line boundary join the first chunk
+   std::size_t head = (JNI_CACHE_LINE_SIZE -
+      reinterpret_cast<std::uintptr_t>(data) % JNI_CACHE_LINE_SIZE) %
+      JNI_CACHE_LINE_SIZE / sizeof(NativeType);
+   if (head > n)
+      head = n;
+   std::size_t chunks = (n - head + grain - 1) / grain;
+   if (chunks == 0 && n > 0)
+      chunks = 1;
+
+   JNIThreadPool::ChunkF f = [=](std::size_t c) -> std::size_t {
+      std::size_t begin = (c == 0) ? 0 : head + c * grain;
+      std::size_t end = head + (c + 1) * grain;
+      if (end > n)
+         end = n;
+      kernel(data + begin, data + end);
+      return end - begin;
+   };
+   return pool.run(chunks, f, critical);
+}
+
+template<class NativeType, class Kernel>
+inline JNIParallelStats JNIParallelFor(JNIThreadPool &pool,
+                                       const JNIArrayView<NativeType> &a,
+                                       Kernel kernel, std::size_t grain = 0) {
+   return JNIParallelFor(pool, a.data(), a.size(), kernel, grain);
+}
+
+template<class NativeType, class Kernel>
+inline JNIParallelStats JNIParallelFor(JNIThreadPool &pool,
+                                       JNIArray<NativeType> &a,
+                                       Kernel kernel, std::size_t grain = 0) {
+   return JNIParallelFor(pool, JNIView(a), kernel, grain);
+}
+
+template<class NativeType, class Kernel>
+inline JNIParallelStats JNIParallelFor(JNIThreadPool &pool,
+                                       JNIPooledArray<NativeType> &a,
+                                       Kernel kernel, std::size_t grain = 0) {
+   return JNIParallelFor(pool, JNIView(a), kernel, grain);
+}
+
+template<class NativeType, class Kernel>
+inline JNIParallelStats JNIParallelFor(JNIThreadPool &pool,
+                                       JNICriticalArray<NativeType> &a,
+                                       Kernel kernel, std::size_t grain = 0) {
+   JNIArrayView<NativeType> v = JNIView(a);
+   return JNIParallelFor(pool, v.data(), v.size(), kernel, grain, true);
+}
+
+#endif /* _JNI_PARALLEL_H_INCLUDED_ */
@@ -9,6 +9,10 @@
 using std::string;
 
 #include "jni_declarations.h"
+#include "jni_class.h"
+#include "jni_field.h"
+#include "jni_access_telemetry.h"
+#include "jni_instrument.h"
 #include "jni_resource_base.h"
 
 /*-----------------------------------------------------------------------------
@@ -130,7 +134,7 @@ struct JNIStringCharsSettings {
 	  jboolean *_isCopy;
 	  GetF(jboolean *isCopy = 0) : _isCopy(isCopy) {}
       Resource operator() (JNIEnv *env, JResource jstr) const {
-         return (jstr == 0) ? 0 : env->GetStringChars(jstr, _isCopy);
+         return (jstr == 0) ? 0 : env->GetStringChars(jstr, JNI_ACCESS_IS_COPY(_isCopy));
       }
    };
 
@@ -196,7 +200,8 @@ struct JNIStringUTFCharsSettings {
 	  jboolean *_isCopy;
 	  GetF(jboolean *isCopy = 0) : _isCopy(isCopy) {}
       Resource operator() (JNIEnv *env, JResource jstr) const {
-		 return (jstr == 0) ? 0 : env->GetStringUTFChars(jstr, _isCopy);
+		 return (jstr == 0) ? 0 :
+			env->GetStringUTFChars(jstr, JNI_ACCESS_IS_COPY(_isCopy));
       }
    };
 
@@ -296,7 +301,7 @@ public:
    JNIArray() {}
    JNIArray(JNIEnv *env, ArrayType array) : _super(env, array) {}
    JNIArray(JNIEnv *env, ArrayType array, jboolean *isCopy) :
-      _super(env, array, _settings::GetF(isCopy)) {}
+      _super(env, array, typename _settings::GetF(isCopy)) {}
    
    // The following two constructors access the requested Java
    // resource field by calling GetJResource<jstring>(...), and
@@ -310,8 +315,13 @@ public:
    JNIArray(JNIEnv *env, T arg, const char *name, bool isStatic) :
 	  _super(env, GetJResource<ArrayType>()(env, arg, name, isStatic)) {}
 
+   // Release the array with the given mode (0, JNI_COMMIT or JNI_ABORT)
+   void CustomRelease(JNIEnv *env, int mode = 0) {
+	  this->ReleaseResource(env, typename _settings::ReleaseF(mode));
+   }
    void CustomRelease(int mode = 0) {
-	  ReleaseResource(_settings::ReleaseF(mode));
+	  JNIEnvironment env(this->_vm);
+	  CustomRelease(env, mode);
    }
 
    NativeType &operator[] (int i) { return this->_resource[i]; }
@@ -340,7 +350,8 @@ template<>                                                                    \
 inline NATIVE_TYPE(Type) *                                                    \
 JNIArraySettings<NATIVE_TYPE(Type)>::GetF::operator()                         \
    (JNIEnv *env, ARRAY_TYPE(Type) array) const {                              \
-   return (array == 0) ? 0 : env->Get##Type##ArrayElements(array, _isCopy);   \
+   return (array == 0) ? 0 :                                                  \
+      env->Get##Type##ArrayElements(array, JNI_ACCESS_IS_COPY(_isCopy));      \
 }                                                                             \
                                                                               \
 template<>                                                                    \
@@ -358,6 +369,157 @@ JNIArraySettings<NATIVE_TYPE(Type)>::ReleaseF::operator()                     \
 
 INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_ARRAY_SETTINGS)
 					
+/*-----------------------------------------------------------------------------
+ * Case 3a: Critical access to primitive arrays
+ *
+ * GetPrimitiveArrayCritical is more likely than Get<PrimitiveType>Array
+ * Elements to give direct access to the array, but no JNI calls may be
+ * made (and the thread must not block) until the array is released.
+ * JNICriticalArraySettings implements JNIResourceSettings for such access.
+ * Since JNIArray::size() would call into JNI, JNICriticalArray obtains the
+ * length before entering the critical region; JNICriticalArrayLength is a
+ * base class constructed before the resource for that purpose.
+ *---------------------------------------------------------------------------*/
+
+template<class NativeType>
+struct JNICriticalArraySettings {
+   typedef typename ARRAY_TYPE_OF(NativeType) JResource;
+   typedef NativeType *Resource;
+
+   // Enter the critical region: GetF uses GetPrimitiveArrayCritical
+   struct GetF {
+	  jboolean *_isCopy;
+	  GetF(jboolean *isCopy = 0) : _isCopy(isCopy) {}
+      Resource operator() (JNIEnv *env, JResource array) const {
+		 return (array == 0) ? 0 : static_cast<Resource>(
+			env->GetPrimitiveArrayCritical(array, JNI_ACCESS_IS_COPY(_isCopy)));
+      }
+   };
+
+   // Leave the critical region: ReleaseF uses ReleasePrimitiveArrayCritical
+   struct ReleaseF {
+	  jint _mode;
+	  ReleaseF(jint mode = 0) : _mode(mode) {}
+      void operator() (JNIEnv *env, JResource array,
+					   Resource nativeArray) const {
+		 if (array != 0)
+			env->ReleasePrimitiveArrayCritical(array, nativeArray, _mode);
+      }
+   };
+};
+
+struct JNICriticalArrayLength {
+   jsize _length;	// number of elements
+
+   JNICriticalArrayLength() : _length(0) {}
+   JNICriticalArrayLength(JNIEnv *env, jarray array) :
+	  _length((array == 0) ? 0 : env->GetArrayLength(array)) {}
+};
+
+template<class NativeType>
+class JNICriticalArray : protected JNICriticalArrayLength,
+						 public JNIResource<JNICriticalArraySettings<NativeType> >
+{
+   typedef JNICriticalArraySettings<NativeType> _settings;
+   typedef JNIResource<_settings> _super;
+   typedef typename ARRAY_TYPE_OF(NativeType) ArrayType;
+
+public:
+   JNICriticalArray() {}
+   JNICriticalArray(JNIEnv *env, ArrayType array) :
+	  JNICriticalArrayLength(env, array), _super(env, array) {}
+   JNICriticalArray(JNIEnv *env, ArrayType array, jboolean *isCopy) :
+	  JNICriticalArrayLength(env, array),
+	  _super(env, array, typename _settings::GetF(isCopy)) {}
+
+   void CustomRelease(JNIEnv *env, int mode = 0) {
+	  this->ReleaseResource(env, typename _settings::ReleaseF(mode));
+   }
+   void CustomRelease(int mode = 0) {
+	  JNIEnvironment env(this->_vm);
+	  CustomRelease(env, mode);
+   }
+
+   NativeType &operator[] (int i) { return this->_resource[i]; }
+   const NativeType &operator[] (int i) const { return this->_resource[i]; }
+
+   // The length is obtained before entering the critical region
+   int size() const { return _length; }
+};
+
+/*-----------------------------------------------------------------------------
+ * Access telemetry (see jni_access_telemetry.h): the kinds of access of
+ * the settings above. The sizes are obtained before the acquisition, so
+ * that no JNI call is made in a critical region.
+ *---------------------------------------------------------------------------*/
+
+#ifdef JNI_ACCESS_TELEMETRY
+
+template<class NativeType>
+struct JNIAccessTraits<JNIArraySettings<NativeType> > {
+   enum { kind = JNI_ACCESS_ELEMENTS * JNIAccessTelemetry::elementTypes +
+		  JNIAccessElement<NativeType>::index };
+
+   static std::uint64_t bytes(JNIEnv *env, jarray array) {
+	  return (array == 0) ? 0 : sizeof(NativeType) *
+		 static_cast<std::uint64_t>(env->GetArrayLength(array));
+   }
+
+   // Application-defined ReleaseF functions are assumed to copy back
+   static bool writesBack(
+	  const typename JNIArraySettings<NativeType>::ReleaseF &releaseF) {
+	  return releaseF._mode != JNI_ABORT;
+   }
+   template<class ReleaseF>
+   static bool writesBack(const ReleaseF &) { return true; }
+};
+
+template<class NativeType>
+struct JNIAccessTraits<JNICriticalArraySettings<NativeType> > {
+   enum { kind = JNI_ACCESS_CRITICAL * JNIAccessTelemetry::elementTypes +
+		  JNIAccessElement<NativeType>::index };
+
+   static std::uint64_t bytes(JNIEnv *env, jarray array) {
+	  return JNIAccessTraits<JNIArraySettings<NativeType> >::bytes(env, array);
+   }
+
+   static bool writesBack(
+	  const typename JNICriticalArraySettings<NativeType>::ReleaseF &releaseF) {
+	  return releaseF._mode != JNI_ABORT;
+   }
+   template<class ReleaseF>
+   static bool writesBack(const ReleaseF &) { return true; }
+};
+
+template<>
+struct JNIAccessTraits<JNIStringCharsSettings> {
+   enum { kind = JNI_ACCESS_STRING * JNIAccessTelemetry::elementTypes };
+
+   static std::uint64_t bytes(JNIEnv *env, jstring str) {
+	  return (str == 0) ? 0 : sizeof(jchar) *
+		 static_cast<std::uint64_t>(env->GetStringLength(str));
+   }
+
+   // String characters are never copied back
+   template<class ReleaseF>
+   static bool writesBack(const ReleaseF &) { return false; }
+};
+
+template<>
+struct JNIAccessTraits<JNIStringUTFCharsSettings> {
+   enum { kind = JNI_ACCESS_STRING * JNIAccessTelemetry::elementTypes + 1 };
+
+   static std::uint64_t bytes(JNIEnv *env, jstring str) {
+	  return (str == 0) ? 0 :
+		 static_cast<std::uint64_t>(env->GetStringUTFLength(str));
+   }
+
+   template<class ReleaseF>
+   static bool writesBack(const ReleaseF &) { return false; }
+};
+
+#endif /* JNI_ACCESS_TELEMETRY */
+
 /*-----------------------------------------------------------------------------
  * Case 4: Monitors
  *
@@ -368,6 +530,14 @@ INSTANTIATE_FOR_PRIMITIVE_TYPES(JNI_ARRAY_SETTINGS)
  * serve a parameter to JNIResource template above.
  * Applications should use JNIMonitor, which inherits from 
  * JNIResource<JNIMonitorSettings>.
+ *
+ * JNIMonitor also provides the java.lang.Object methods which require the
+ * monitor: wait(env) (or wait(env, millis), with a timeout), notify(env)
+ * and notifyAll(env). Their method ids are looked up once. A Java
+ * exception thrown by these methods (e.g. InterruptedException) is left
+ * pending, for the Java caller, and reported as a JNIException.
+ * Contention statistics are gathered by JNIProfiledMonitor
+ * (jni_monitor_stats.h).
  *---------------------------------------------------------------------------*/
 
 struct JNIMonitorSettings {
@@ -390,11 +560,58 @@ struct JNIMonitorSettings {
    };
 };
 
+// Method ids of Object.wait(long), notify() and notifyAll(), looked up on
+// the first call
+struct JNIObjectMonitorMethods {
+   jmethodID wait;
+   jmethodID notify;
+   jmethodID notifyAll;
+
+   static const JNIObjectMonitorMethods &get(JNIEnv *env) {
+      static const JNIObjectMonitorMethods methods(env);
+      return methods;
+   }
+
+private:
+   JNIObjectMonitorMethods(JNIEnv *env) {
+      JNIClass object(env, "java/lang/Object");
+      wait = env->GetMethodID(object, "wait", "(J)V");
+      notify = env->GetMethodID(object, "notify", "()V");
+      notifyAll = env->GetMethodID(object, "notifyAll", "()V");
+      if (wait == 0 || notify == 0 || notifyAll == 0)
+         throw JNIException("Failed to get the Object monitor methods");
+   }
+};
+
 class JNIMonitor : public JNIResource<JNIMonitorSettings> {
 public:
    JNIMonitor() {}
    JNIMonitor(JNIEnv *env, jobject obj) :
       JNIResource<JNIMonitorSettings>(env, obj) {}
+
+   // Releases the monitor until notified, interrupted, or (with 'millis'
+   // greater than 0) until the timeout elapses; spurious wakeups occur
+   void wait(JNIEnv *env, jlong millis = 0) {
+      JNI_INSTRUMENT("JNIMonitor::wait");
+      env->CallVoidMethod(_jresource, JNIObjectMonitorMethods::get(env).wait,
+                          millis);
+      if (env->ExceptionCheck())
+         throw JNIException("Exception in Object.wait");
+   }
+
+   void notify(JNIEnv *env) {
+      env->CallVoidMethod(_jresource,
+                          JNIObjectMonitorMethods::get(env).notify);
+      if (env->ExceptionCheck())
+         throw JNIException("Exception in Object.notify");
+   }
+
+   void notifyAll(JNIEnv *env) {
+      env->CallVoidMethod(_jresource,
+                          JNIObjectMonitorMethods::get(env).notifyAll);
+      if (env->ExceptionCheck())
+         throw JNIException("Exception in Object.notifyAll");
+   }
 };
 
 /*----------------------------------------------------------------------------
@@ -406,8 +623,15 @@ public:
  * Applications should use JNIGlobalRef, which inherits from 
  * JNIResource<JNIGlobalRefSettings> and provides equality comparison operator 
  * (for comparing whether two proxies actually refer to the same object).
+ *
+ * JNIGlobalRef also caches the identity hash code of its object
+ * (System.identityHashCode), computed on the first call to identityHash().
+ * The cache is not synchronized: a reference shared between threads should
+ * be hashed before it is published.
  *---------------------------------------------------------------------------*/
 
+inline jint JNIIdentityHashCode(JNIEnv *env, jobject obj);
+
 template <class T>
 struct JNIGlobalRefSettings {
    typedef T JResource;
@@ -422,19 +646,46 @@ struct JNIGlobalRefSettings {
 
    // releasing a global reference: DefaultReleaseF uses DeleteGlobalRef
    struct ReleaseF {
-      void operator() (JNIEnv *env, JResource obj, Resource ref) const {
+      void operator() (JNIEnv *env, JResource, Resource ref) const {
        //std::cout << "Deleting ref: " << ref << std::endl;
 		 env->DeleteGlobalRef(ref);
       }
    };
 };
 
+// A global reference may be deleted on any thread
+template<class T>
+struct JNIReleaseTraits<JNIGlobalRefSettings<T> > {
+   enum { deferrable = 1 };
+};
+
 template<class T>
 class JNIGlobalRef : public JNIResource<JNIGlobalRefSettings<T> > {
+   mutable jint _identityHash;	// cached System.identityHashCode
+   mutable bool _hashed;		// true if '_identityHash' is valid
+
 public:
-   JNIGlobalRef() {}
+   JNIGlobalRef() : _identityHash(0), _hashed(false) {}
    JNIGlobalRef(JNIEnv *env, T obj) :
-      JNIResource<JNIGlobalRefSettings<T> >(env, obj) {}
+      JNIResource<JNIGlobalRefSettings<T> >(env, obj),
+      _identityHash(0), _hashed(false) {}
+
+   // System.identityHashCode of the referenced object (0 for null)
+   jint identityHash(JNIEnv *env) const {
+	  if (!_hashed) {
+		 if (this->_resource != 0)
+			_identityHash = JNIIdentityHashCode(env, this->_resource);
+		 _hashed = true;
+	  }
+	  return _identityHash;
+   }
+   jint identityHash() const {
+	  if (_hashed || this->_resource == 0)
+		 return _identityHash;
+	  JNIEnvironment env(this->_vm);
+	  return identityHash(env);
+   }
+   bool hashed() const { return _hashed; }
 
    // Due to problems with Microsoft Visual C++ 6.0 compiler, the equality
    // comparison operator is implemented as a member function.
@@ -442,12 +693,84 @@ public:
    // friend bool operator== (const JNIGlobalRef &x, const JNIGlobalRef &y)
    // passes compilation with g++, but fails for VC++.
    bool operator== (const JNIGlobalRef<T> &x) {
+	  if (this->_resource == x._resource)
+		 return true;
 	  if (this->_vm != x._vm)
 		 return false;
+	  if (_hashed && x._hashed && _identityHash != x._identityHash)
+		 return false;
 
      JNIEnvironment env(this->_vm);
 	  return (env.Get()->IsSameObject(this->_resource, x._resource) != JNI_FALSE);
    }
 };
 
+// The class and method id are looked up on the first call
+inline jint JNIIdentityHashCode(JNIEnv *env, jobject obj) {
+   static JNIGlobalRef<jclass> system(env, JNIClass(env, "java/lang/System"));
+   static jmethodID identityHashCode = env->GetStaticMethodID(system,
+	  "identityHashCode", "(Ljava/lang/Object;)I");
+   if (identityHashCode == 0)
+	  throw JNIException("Failed to get System.identityHashCode");
+   JNI_INSTRUMENT("System::identityHashCode");
+   return env->CallStaticIntMethod(system, identityHashCode, obj);
+}
+
+/*-----------------------------------------------------------------------------
+ * Case 6: Weak global references
+ *
+ * JNIWeakGlobalRefSettings implements JNIResourceSettings for weak global
+ * references, which do not prevent the referenced object from being
+ * garbage collected. Applications should use JNIWeakGlobalRef, which
+ * provides:
+ * - lock(env): a new local reference to the object, or 0 if the object
+ *   has been collected (the local reference keeps it alive until deleted)
+ * - expired(env): true if the object has been collected
+ *---------------------------------------------------------------------------*/
+
+template <class T>
+struct JNIWeakGlobalRefSettings {
+   typedef T JResource;
+   typedef T Resource;
+
+   // weak reference acquisition: DefaultGetF uses NewWeakGlobalRef
+   struct GetF {
+      Resource operator() (JNIEnv *env, JResource obj) const {
+		 return static_cast<JResource>(env->NewWeakGlobalRef(obj));
+      }
+   };
+
+   // releasing a weak reference: DefaultReleaseF uses DeleteWeakGlobalRef
+   struct ReleaseF {
+      void operator() (JNIEnv *env, JResource, Resource ref) const {
+		 env->DeleteWeakGlobalRef(ref);
+      }
+   };
+};
+
+template<class T>
+struct JNIReleaseTraits<JNIWeakGlobalRefSettings<T> > {
+   enum { deferrable = 1 };
+};
+
+template<class T>
+class JNIWeakGlobalRef : public JNIResource<JNIWeakGlobalRefSettings<T> > {
+public:
+   JNIWeakGlobalRef() {}
+   JNIWeakGlobalRef(JNIEnv *env, T obj) :
+      JNIResource<JNIWeakGlobalRefSettings<T> >(env, obj) {}
+
+   // Promotes the weak reference to a local one; 0 if collected
+   T lock(JNIEnv *env) const {
+	  if (this->_resource == 0)
+		 return 0;
+	  return static_cast<T>(env->NewLocalRef(this->_resource));
+   }
+
+   bool expired(JNIEnv *env) const {
+	  return this->_resource == 0 ||
+		 env->IsSameObject(this->_resource, 0) != JNI_FALSE;
+   }
+};
+
 #endif /* _JNI_RESOURCE_H_INCLUDED_ */
@@ -11,6 +11,9 @@
 
 #include "jni_declarations.h"
 #include "jni_env.h"
+#include "jni_deferred_release.h"
+#include "jni_instrument.h"
+#include "jni_access_telemetry.h"
 
 /*-----------------------------------------------------------------------------
  * JNIResource template: general resource management
@@ -39,6 +42,14 @@
  * - Destructor/ReleaseResource, which use functional objects of the form
  *     void ReleaseF::operator()(JNIEnv *, JResource, Resource)
  * - smart pointer functionality: op=, casting operator, get()/release()
+ *
+ * If the destructor cannot obtain a JNIEnv, the release of a global or
+ * weak global reference is deferred, and any other release is counted as
+ * leaked (C++11 builds; see jni_deferred_release.h).
+ *
+ * With JNI_ACCESS_TELEMETRY defined, acquisitions whose settings specialize
+ * JNIAccessTraits (array elements and string characters) are recorded by
+ * JNIAccessTelemetry: copied or pinned, bytes copied, and hold times.
  *-------------------------------------------------------------------------*/
  
 template<class JNIResourceSettings>
@@ -56,6 +67,9 @@ protected:
    JavaVM *_vm;	   		// Java environment handle
    JResource _jresource;	// Java resource handle
    Resource _resource;		// exported resource handle
+#ifdef JNI_ACCESS_TELEMETRY
+   JNIAccessRecord _access;	// telemetry of the acquisition
+#endif
 
 public:
 
@@ -68,29 +82,37 @@ public:
 
    JNIResource(JNIEnv *env, JResource jresource) :
       _owns(true), _jresource(jresource) {
+      JNI_INSTRUMENT("JNIResource::acquire");
       env->GetJavaVM(&_vm);
-      _resource = DefaultGetF()(env, _jresource);
+      DefaultGetF getF;
+      _resource = acquire(env, getF);
    }
    
    template<class GetF>
    JNIResource(JNIEnv *env, JResource jresource, GetF &getF) :
       _owns(true), _jresource(jresource) {
+      JNI_INSTRUMENT("JNIResource::acquire");
       env->GetJavaVM(&_vm);
-      _resource = getF(env, _jresource);
+      _resource = acquire(env, getF);
    }
    
    template<class GetF>
    JNIResource(JNIEnv *env, JResource jresource, const GetF &getF) :
       _owns(true), _jresource(jresource) {
+      JNI_INSTRUMENT("JNIResource::acquire");
       env->GetJavaVM(&_vm);
-      _resource = getF(env, _jresource);
+      _resource = acquire(env, getF);
    }
 
    // Copy constructor
    JNIResource(const _self &x) :
 	  _vm(x._vm), _owns(x._owns),
 	  _jresource(x._jresource), _resource(x.release())
-   {}
+   {
+#ifdef JNI_ACCESS_TELEMETRY
+	  _access = x._access;
+#endif
+   }
    
    // Assignment operator
    _self &operator= (const _self &x) {
@@ -102,6 +124,9 @@ public:
 		 _owns = x._owns;
 		 _jresource = x._jresource;
 		 _resource = x.release();
+#ifdef JNI_ACCESS_TELEMETRY
+		 _access = x._access;
+#endif
       }
 	  
       return *this;
@@ -109,12 +134,18 @@ public:
 
    // Destructor: calls the default ReleaseResource()
    ~JNIResource() {
+     if (!_owns)
+        return;
      try {
         JNIEnvironment env(_vm);
         ReleaseResource(env); 
      }
      catch(JNIException &e) {
          // Unable to release resources, most likely because the JVM has exited
+#if __cplusplus >= 201103L
+         JNIDeferredRelease::defer<JNIResourceSettings>(_vm, _jresource,
+                                                        release());
+#endif
      }     
    }
 
@@ -124,21 +155,25 @@ public:
    
    void ReleaseResource(JNIEnv *env) {
       if (_owns) {
-		 DefaultReleaseF()(env, _jresource, release());
+		 JNI_INSTRUMENT("JNIResource::release");
+		 DefaultReleaseF releaseF;
+		 dispose(env, releaseF);
 	  }
    }
    
    template<class ReleaseF>
    void ReleaseResource(JNIEnv *env, ReleaseF &releaseF) {
       if (_owns) {
-		 releaseF(env, _jresource, release());
+		 JNI_INSTRUMENT("JNIResource::release");
+		 dispose(env, releaseF);
 	  }
    }
    
    template<class ReleaseF>
    void ReleaseResource(JNIEnv *env, const ReleaseF &releaseF) {
       if (_owns) {
-		 releaseF(env, _jresource, release());
+		 JNI_INSTRUMENT("JNIResource::release");
+		 dispose(env, releaseF);
 	  }
    }
    
@@ -158,6 +193,33 @@ public:
 	  _resource = 0;
 	  return tmp;
    }
+
+private:
+   // Acquisition and release through the functional objects, recorded
+   // when JNI_ACCESS_TELEMETRY is defined
+   template<class GetF>
+   Resource acquire(JNIEnv *env, GetF &getF) {
+#ifdef JNI_ACCESS_TELEMETRY
+	  typedef JNIAccessTraits<JNIResourceSettings> _traits;
+	  if (_traits::kind >= 0)
+		 _access.begin(_traits::kind, _traits::bytes(env, _jresource));
+	  Resource resource = getF(env, _jresource);
+	  if (_traits::kind >= 0)
+		 _access.end(resource != 0);
+	  return resource;
+#else
+	  return getF(env, _jresource);
+#endif
+   }
+
+   template<class ReleaseF>
+   void dispose(JNIEnv *env, ReleaseF &releaseF) {
+#ifdef JNI_ACCESS_TELEMETRY
+	  _access.released(
+		 JNIAccessTraits<JNIResourceSettings>::writesBack(releaseF));
+#endif
+	  releaseF(env, _jresource, release());
+   }
 };
 
 #endif /* _JNI_RESOURCE_BASE_H_INCLUDED_ */
@@ -0,0 +1,277 @@
+/*-----------------------------------------------------------------------------
+ * Native arrays with write tracking.
+ *
+ * JNIArray::operator[] returns a modifiable reference, so when the JVM
+ * hands out a copy, the whole buffer has to be copied back on release even
+ * if only a few elements were modified. JNITrackedArray records the index
+ * ranges that were written (through a proxy reference returned by
+ * operator[], or explicitly through markDirty()), and on release copies
+ * back only those ranges with Set<PrimitiveType>ArrayRegion, then releases
+ * the elements with JNI_ABORT.
+ *
+ * If the JVM pinned the array instead of copying it, the modifications are
+ * already in place and no copying is performed at all.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_TRACKED_ARRAY_H_INCLUDED_
+#define _JNI_TRACKED_ARRAY_H_INCLUDED_
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_utils.h"
+#include "jni_resource.h"
+
+/*-----------------------------------------------------------------------------
+ * JNIDirtyRanges: a set of half-open index ranges [begin, end).
+ * Consecutive marks extending the most recent range are merged as they are
+ * added; the ranges are sorted and coalesced by normalize(). Once more than
+ * 'maxRanges' ranges accumulate, they are collapsed into their bounding
+ * range, to keep the bookkeeping cheaper than the copy it saves.
+ *---------------------------------------------------------------------------*/
+class JNIDirtyRanges {
+public:
+   typedef std::pair<jsize, jsize> Range;
+   enum { maxRanges = 16 };
+
+private:
+   std::vector<Range> _ranges;
+
+public:
+   void mark(jsize begin, jsize end) {
+      if (begin >= end)
+         return;
+      if (!_ranges.empty()) {
+         Range &last = _ranges.back();
+         if (begin >= last.first && begin <= last.second) {
+            if (end > last.second)
+               last.second = end;
+            return;
+         }
+      }
+      _ranges.push_back(Range(begin, end));
+      if (_ranges.size() > maxRanges) {
+         normalize();
+         if (_ranges.size() > maxRanges) {
+            Range bounds(_ranges.front().first, _ranges.back().second);
+            _ranges.assign(1, bounds);
+         }
+      }
+   }
+
+   void normalize() {
+      std::sort(_ranges.begin(), _ranges.end());
+      std::vector<Range> merged;
+      for (std::size_t i = 0; i < _ranges.size(); i++) {
+         if (!merged.empty() && _ranges[i].first <= merged.back().second)
+            merged.back().second =
+               std::max(merged.back().second, _ranges[i].second);
+         else
+            merged.push_back(_ranges[i]);
+      }
+      _ranges.swap(merged);
+   }
+
+   void clear() { _ranges.clear(); }
+   bool empty() const { return _ranges.empty(); }
+   const std::vector<Range> &ranges() const { return _ranges; }
+
+   // Total number of elements covered (after normalize())
+   jsize count() const {
+      jsize n = 0;
+      for (std::size_t i = 0; i < _ranges.size(); i++)
+         n += _ranges[i].second - _ranges[i].first;
+      return n;
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIDirtyRef is the proxy reference returned by JNITrackedArray::
+ * operator[]. Reading through it is free; any assignment marks the element
+ * as modified.
+ *---------------------------------------------------------------------------*/
+template<class NativeType>
+class JNIDirtyRef {
+   NativeType &_element;		// referenced element
+   JNIDirtyRanges &_dirty;		// ranges of the owning array
+   jsize _index;				// index of the element
+
+public:
+   JNIDirtyRef(NativeType &element, JNIDirtyRanges &dirty, jsize index) :
+      _element(element), _dirty(dirty), _index(index) {}
+
+   operator NativeType() const { return _element; }
+
+   JNIDirtyRef &operator= (const NativeType &val) {
+      _element = val;
+      _dirty.mark(_index, _index + 1);
+      return *this;
+   }
+   JNIDirtyRef &operator= (const JNIDirtyRef &x) {
+      return *this = static_cast<NativeType>(x);
+   }
+   JNIDirtyRef &operator+= (const NativeType &val) {
+      return *this = static_cast<NativeType>(_element + val);
+   }
+   JNIDirtyRef &operator-= (const NativeType &val) {
+      return *this = static_cast<NativeType>(_element - val);
+   }
+   JNIDirtyRef &operator*= (const NativeType &val) {
+      return *this = static_cast<NativeType>(_element * val);
+   }
+   JNIDirtyRef &operator/= (const NativeType &val) {
+      return *this = static_cast<NativeType>(_element / val);
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * The write-back functional object for tracked arrays: it copies the dirty
+ * ranges back (if the elements are a copy), then releases the elements with
+ * JNI_ABORT. With 'commit' set, the ranges are copied back but the elements
+ * are not released (the equivalent of JNI_COMMIT).
+ *---------------------------------------------------------------------------*/
+template<class NativeType>
+struct JNITrackedArrayReleaseF {
+   typedef typename ARRAY_TYPE_OF(NativeType) JResource;
+   typedef NativeType *Resource;
+
+   JNIDirtyRanges &_dirty;
+   bool _isCopy;
+   bool _commit;
+
+   JNITrackedArrayReleaseF(JNIDirtyRanges &dirty, bool isCopy,
+                           bool commit = false) :
+      _dirty(dirty), _isCopy(isCopy), _commit(commit) {}
+
+   void operator() (JNIEnv *env, JResource array, Resource elements) const {
+      if (array == 0 || elements == 0)
+         return;
+      if (_isCopy) {
+         _dirty.normalize();
+         const std::vector<JNIDirtyRanges::Range> &r = _dirty.ranges();
+         for (std::size_t i = 0; i < r.size(); i++)
+            SetArrayRegion(env, array, r[i].first, r[i].second - r[i].first,
+                           elements + r[i].first);
+      }
+      _dirty.clear();
+      if (!_commit) {
+         typename JNIArraySettings<NativeType>::ReleaseF releaseF(JNI_ABORT);
+         releaseF(env, array, elements);
+      }
+   }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNITrackedArray offers the interface of JNIArray, except that
+ * operator[] returns a JNIDirtyRef. Code which writes through raw pointers
+ * (see data()) must call markDirty() for the ranges it modifies.
+ *
+ * JNITrackedArrayState is a base class constructed before the resource
+ * itself, so that the 'isCopy' flag reported on acquisition is stored in
+ * an already initialized member.
+ *---------------------------------------------------------------------------*/
+struct JNITrackedArrayState {
+   jboolean _isCopy;			// whether the elements are a copy
+   JNIDirtyRanges _dirty;		// modified ranges
+   jsize _length;				// number of elements
+
+   JNITrackedArrayState() : _isCopy(JNI_FALSE), _length(0) {}
+};
+
+template<class NativeType>
+class JNITrackedArray : protected JNITrackedArrayState,
+                        public JNIResource<JNIArraySettings<NativeType> >
+{
+   typedef JNIArraySettings<NativeType> _settings;
+   typedef JNIResource<_settings> _super;
+   typedef JNITrackedArrayReleaseF<NativeType> _releaseF;
+   typedef typename ARRAY_TYPE_OF(NativeType) ArrayType;
+
+public:
+   JNITrackedArray() {}
+   JNITrackedArray(JNIEnv *env, ArrayType array) :
+      _super(env, array, typename _settings::GetF(&_isCopy)) {
+      init(env, array);
+   }
+   JNITrackedArray(JNIEnv *env, ArrayType array, jboolean *isCopy) :
+      _super(env, array, typename _settings::GetF(&_isCopy)) {
+      init(env, array);
+      if (isCopy != 0)
+         *isCopy = _isCopy;
+   }
+
+   // The following two constructors access the requested Java
+   // resource field by calling GetJResource<ArrayType>(...)
+   template<class T>
+   JNITrackedArray(JNIEnv *env, T arg, const char *name) :
+      _super(env, GetJResource<ArrayType>()(env, arg, name),
+             typename _settings::GetF(&_isCopy)) {
+      init(env, this->_jresource);
+   }
+
+   template<class T>
+   JNITrackedArray(JNIEnv *env, T arg, const char *name, bool isStatic) :
+      _super(env, GetJResource<ArrayType>()(env, arg, name, isStatic),
+             typename _settings::GetF(&_isCopy)) {
+      init(env, this->_jresource);
+   }
+
+   // Destructor: writes back the dirty ranges before the base class
+   // destructor runs (which then has nothing left to release)
+   ~JNITrackedArray() {
+      try {
+         JNIEnvironment env(this->_vm);
+         this->ReleaseResource(env, _releaseF(_dirty, isCopy()));
+      }
+      catch(JNIException &e) {
+         // Unable to obtain a JNIEnv: the base class destructor counts the
+         // release as leaked
+      }
+   }
+
+   // Release the array with the given mode:
+   // 0 writes back the dirty ranges and releases the elements,
+   // JNI_COMMIT writes back the dirty ranges and keeps the elements,
+   // JNI_ABORT releases the elements, discarding all modifications.
+   void CustomRelease(JNIEnv *env, int mode = 0) {
+      if (mode == JNI_COMMIT) {
+         _releaseF commit(_dirty, isCopy(), true);
+         commit(env, this->_jresource, this->_resource);
+      }
+      else {
+         if (mode == JNI_ABORT)
+            _dirty.clear();
+         this->ReleaseResource(env, _releaseF(_dirty, isCopy()));
+      }
+   }
+   void CustomRelease(int mode = 0) {
+      JNIEnvironment env(this->_vm);
+      CustomRelease(env, mode);
+   }
+
+   // Explicit dirty marking, for writes through data()
+   void markDirty(jsize begin, jsize end) { _dirty.mark(begin, end); }
+   void markDirty(jsize i) { _dirty.mark(i, i + 1); }
+   void markAllDirty() { _dirty.mark(0, _length); }
+
+   JNIDirtyRef<NativeType> operator[] (int i) {
+      return JNIDirtyRef<NativeType>(this->_resource[i], _dirty, i);
+   }
+   const NativeType &operator[] (int i) const { return this->_resource[i]; }
+
+   NativeType *data() { return this->_resource; }
+   const NativeType *data() const { return this->_resource; }
+
+   int size() const { return _length; }
+   bool isCopy() const { return _isCopy != JNI_FALSE; }
+   const JNIDirtyRanges &dirtyRanges() const { return _dirty; }
+
+private:
+   void init(JNIEnv *env, ArrayType array) {
+      _length = (array == 0) ? 0 : env->GetArrayLength(array);
+   }
+};
+
+#endif /* _JNI_TRACKED_ARRAY_H_INCLUDED_ */
@@ -0,0 +1,277 @@
+/*-----------------------------------------------------------------------------
+ * Hosting a Java VM in a native process.
+ *
+ * JNIVirtualMachine creates a Java VM with JNI_CreateJavaVM, and destroys
+ * it (DestroyJavaVM) when it goes out of scope. Its options are built
+ * with JNIVirtualMachineOptions:
+ *
+ *    JNIVirtualMachine jvm(JNIVirtualMachineOptions()
+ *       .classPath("service.jar").maxHeap("512m").gc("G1")
+ *       .checkJNI(debug)
+ *       .preload("com/x/Service"));
+ *
+ *    jclass service = jvm.findClass(jvm.env(), "com/x/Service");
+ *
+ * The creating thread is attached to the VM, with env() as its JNIEnv.
+ * Other threads attach as usual, through the JavaVM: JNIEnvironment
+ * env(jvm.vm()), or a JNIThreadPool(jvm.vm()).
+ *
+ * findClass() keeps the classes it resolves as global references, so
+ * that every thread looks a class up at most once. This also spares
+ * threads attached from native code the FindClass caveat: on them,
+ * FindClass only sees the system class loader. Classes given to
+ * preload() are resolved during startup.
+ *
+ * startup() reports the time spent in JNI_CreateJavaVM and in preloading,
+ * so that the VM options can be tuned for startup latency. Options that
+ * usually help are class data sharing (sharedArchive()), a small initial
+ * heap, and the serial collector for small heaps. JNI_CreateJavaVM and
+ * the preloading are also recorded by JNI_INSTRUMENT.
+ *
+ * JNI_CreateJavaVM requires linking with the JDK's libjvm. HotSpot
+ * supports only one VM per process, and cannot create another after
+ * DestroyJavaVM. The JNIVirtualMachine must be destroyed on an attached
+ * thread that is the last non-daemon thread (normally the creating one),
+ * after every object holding references into the VM.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_VM_H_INCLUDED_
+#define _JNI_VM_H_INCLUDED_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_env.h"
+#include "jni_instrument.h"
+
+#ifdef _WIN32
+#define JNI_PATH_SEPARATOR ";"
+#else
+#define JNI_PATH_SEPARATOR ":"
+#endif
+
+/*-----------------------------------------------------------------------------
+ * JNIVirtualMachineOptions: a fluent builder of JavaVMInitArgs
+ *---------------------------------------------------------------------------*/
+class JNIVirtualMachineOptions {
+   jint _version;
+   bool _ignoreUnrecognized;
+   std::vector<std::string> _classPath;
+   std::vector<std::string> _options;
+   std::vector<std::string> _preload;
+
+public:
+   JNIVirtualMachineOptions() :
+      _version(JNI_VERSION_1_8), _ignoreUnrecognized(false) {}
+
+   // Class path entries, in order (-Djava.class.path)
+   JNIVirtualMachineOptions &classPath(const std::string &path) {
+      _classPath.push_back(path);
+      return *this;
+   }
+
+   // -Dname=value
+   JNIVirtualMachineOptions &property(const std::string &name,
+                                      const std::string &value) {
+      return option("-D" + name + "=" + value);
+   }
+
+   JNIVirtualMachineOptions &libraryPath(const std::string &path) {
+      return property("java.library.path", path);
+   }
+
+   // Heap sizes, as given to -Xms/-Xmx (e.g. "512m")
+   JNIVirtualMachineOptions &initialHeap(const std::string &size) {
+      return option("-Xms" + size);
+   }
+   JNIVirtualMachineOptions &maxHeap(const std::string &size) {
+      return option("-Xmx" + size);
+   }
+
+   // Garbage collector, by HotSpot name: "Serial", "Parallel", "G1", "Z"
+   JNIVirtualMachineOptions &gc(const std::string &collector) {
+      return option("-XX:+Use" + collector + "GC");
+   }
+
+   // Extra checks of JNI calls (-Xcheck:jni), e.g. in debug builds
+   JNIVirtualMachineOptions &checkJNI(bool enabled = true) {
+      return enabled ? option("-Xcheck:jni") : *this;
+   }
+
+   // Class data sharing archive (-XX:SharedArchiveFile), used if valid
+   JNIVirtualMachineOptions &sharedArchive(const std::string &file) {
+      option("-Xshare:auto");
+      return option("-XX:SharedArchiveFile=" + file);
+   }
+
+   // Any other option string
+   JNIVirtualMachineOptions &option(const std::string &option) {
+      _options.push_back(option);
+      return *this;
+   }
+
+   // Classes resolved during startup (names as for FindClass)
+   JNIVirtualMachineOptions &preload(const std::string &className) {
+      _preload.push_back(className);
+      return *this;
+   }
+
+   JNIVirtualMachineOptions &version(jint version) {
+      _version = version;
+      return *this;
+   }
+
+   JNIVirtualMachineOptions &ignoreUnrecognized(bool ignore = true) {
+      _ignoreUnrecognized = ignore;
+      return *this;
+   }
+
+   // The option strings, class path first
+   std::vector<std::string> options() const {
+      std::vector<std::string> all;
+      if (!_classPath.empty()) {
+         std::string path = "-Djava.class.path=" + _classPath[0];
+         for (std::size_t i = 1; i < _classPath.size(); i++)
+            path += JNI_PATH_SEPARATOR + _classPath[i];
+         all.push_back(path);
+      }
+      all.insert(all.end(), _options.begin(), _options.end());
+      return all;
+   }
+
+   const std::vector<std::string> &preloaded() const { return _preload; }
+   jint version() const { return _version; }
+   bool ignoreUnrecognized() const { return _ignoreUnrecognized; }
+};
+
+/*-----------------------------------------------------------------------------
+ * JNIVirtualMachine
+ *---------------------------------------------------------------------------*/
+struct JNIVirtualMachineStartup {
+   long long createNanoseconds;	// JNI_CreateJavaVM
+   long long preloadNanoseconds;	// resolving the preloaded classes
+   std::size_t preloadedClasses;
+};
+
+class JNIVirtualMachine {
+   JavaVM *_vm;
+   JNIEnv *_env;						// of the creating thread
+   JNIVirtualMachineStartup _startup;
+   std::mutex _lock;					// protects '_classes'
+   std::map<std::string, jclass> _classes;	// global references
+
+   JNIVirtualMachine(const JNIVirtualMachine &);
+   JNIVirtualMachine &operator= (const JNIVirtualMachine &);
+
+public:
+   explicit JNIVirtualMachine(const JNIVirtualMachineOptions &options) :
+      _vm(0), _env(0) {
+      std::vector<std::string> strings = options.options();
+      std::vector<JavaVMOption> vmOptions(strings.size());
+      for (std::size_t i = 0; i < strings.size(); i++) {
+         vmOptions[i].optionString = const_cast<char *>(strings[i].c_str());
+         vmOptions[i].extraInfo = 0;
+      }
+      JavaVMInitArgs args;
+      args.version = options.version();
+      args.nOptions = static_cast<jint>(vmOptions.size());
+      args.options = vmOptions.empty() ? 0 : &vmOptions[0];
+      args.ignoreUnrecognized =
+         options.ignoreUnrecognized() ? JNI_TRUE : JNI_FALSE;
+
+      std::chrono::steady_clock::time_point start =
+         std::chrono::steady_clock::now();
+      jint result;
+      {
+         JNI_INSTRUMENT("JNI_CreateJavaVM");
+         result = JNI_CreateJavaVM(&_vm, reinterpret_cast<void **>(&_env),
+                                   &args);
+      }
+      if (result != JNI_OK) {
+         std::ostringstream message;
+         message << "Failed to create the Java VM (error " << result << ")";
+         throw JNIException(message.str());
+      }
+      std::chrono::steady_clock::time_point created =
+         std::chrono::steady_clock::now();
+
+      const std::vector<std::string> &preload = options.preloaded();
+      try {
+         JNI_INSTRUMENT("JNIVirtualMachine::preload");
+         for (std::size_t i = 0; i < preload.size(); i++)
+            findClass(_env, preload[i].c_str());
+      }
+      catch(JNIException &e) {
+         destroy();
+         throw;
+      }
+
+      _startup.createNanoseconds = nanoseconds(start, created);
+      _startup.preloadNanoseconds =
+         nanoseconds(created, std::chrono::steady_clock::now());
+      _startup.preloadedClasses = preload.size();
+   }
+
+   // Waits for the other non-daemon threads to end, then destroys the VM
+   ~JNIVirtualMachine() {
+      destroy();
+   }
+
+   JavaVM *vm() const { return _vm; }
+   operator JavaVM *() const { return _vm; }
+
+   // JNIEnv of the creating thread
+   JNIEnv *env() const { return _env; }
+
+   const JNIVirtualMachineStartup &startup() const { return _startup; }
+
+   // The class 'name', resolved once through 'env' (which must belong to
+   // the calling thread); throws if there is no such class
+   jclass findClass(JNIEnv *env, const char *name) {
+      std::lock_guard<std::mutex> guard(_lock);
+      std::map<std::string, jclass>::iterator i = _classes.find(name);
+      if (i != _classes.end())
+         return i->second;
+
+      jclass local = env->FindClass(name);
+      if (local == 0) {
+         env->ExceptionClear();
+         throw JNIException(std::string("Class not found: ") + name);
+      }
+      jclass global = static_cast<jclass>(env->NewGlobalRef(local));
+      env->DeleteLocalRef(local);
+      _classes[name] = global;
+      return global;
+   }
+
+private:
+   static long long nanoseconds(std::chrono::steady_clock::time_point from,
+                                std::chrono::steady_clock::time_point to) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+         to - from).count();
+   }
+
+   void destroy() {
+      if (_vm == 0)
+         return;
+      {
+         JNIEnvironment env(_vm);
+         std::map<std::string, jclass>::iterator i;
+         for (i = _classes.begin(); i != _classes.end(); ++i)
+            env.Get()->DeleteGlobalRef(i->second);
+         _classes.clear();
+      }
+      _vm->DestroyJavaVM();
+      _vm = 0;
+      _env = 0;
+   }
+};
+
+#endif /* _JNI_VM_H_INCLUDED_ */
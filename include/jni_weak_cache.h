@@ -0,0 +1,123 @@
+/*-----------------------------------------------------------------------------
+ * A native cache of Java objects which does not keep them alive.
+ *
+ * JNIWeakCache<K, T> maps keys to objects through JNIWeakGlobalRef, so
+ * that caching an object does not pin it against garbage collection:
+ *
+ *    JNIWeakCache<std::string, jobject> cache;
+ *    cache.put(env, name, obj);
+ *    ...
+ *    jobject obj = cache.get(env, name);	// local reference, or 0
+ *
+ * Entries whose objects have been collected are purged incrementally: every
+ * put() inspects a few buckets of the table (see 'purgeStep'), so that the
+ * cost is spread over the insertions, and get() drops the entry it finds
+ * collected. purge() scans the whole table at once.
+ *
+ * JNIWeakCache is not thread-safe.
+ *
+ * Requires C++11.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_WEAK_CACHE_H_INCLUDED_
+#define _JNI_WEAK_CACHE_H_INCLUDED_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "jni_declarations.h"
+#include "jni_resource.h"
+
+template<class K, class T, class Hash = std::hash<K>,
+         class Equal = std::equal_to<K> >
+class JNIWeakCache {
+   typedef JNIWeakGlobalRef<T> _ref;
+   typedef std::unordered_map<K, std::unique_ptr<_ref>, Hash, Equal> _map;
+
+   _map _entries;
+   std::size_t _purgeStep;	// buckets inspected per put()
+   std::size_t _cursor;		// next bucket to inspect
+   std::size_t _purged;		// entries dropped since construction
+
+public:
+   explicit JNIWeakCache(std::size_t purgeStep = 2) :
+      _purgeStep(purgeStep), _cursor(0), _purged(0) {}
+
+   // Inserts or replaces the entry for 'key'
+   void put(JNIEnv *env, const K &key, T obj) {
+      purgeSome(env);
+      std::unique_ptr<_ref> &entry = _entries[key];
+      if (entry)
+         entry->ReleaseResource(env);
+      entry.reset(new _ref(env, obj));
+   }
+
+   // Returns a new local reference to the cached object, or 0 if there is
+   // no entry or the object has been collected
+   T get(JNIEnv *env, const K &key) {
+      typename _map::iterator p = _entries.find(key);
+      if (p == _entries.end())
+         return 0;
+      T obj = p->second->lock(env);
+      if (obj == 0) {
+         p->second->ReleaseResource(env);
+         _entries.erase(p);
+         _purged++;
+      }
+      return obj;
+   }
+
+   bool erase(JNIEnv *env, const K &key) {
+      typename _map::iterator p = _entries.find(key);
+      if (p == _entries.end())
+         return false;
+      p->second->ReleaseResource(env);
+      _entries.erase(p);
+      return true;
+   }
+
+   // Drops all the entries whose objects have been collected
+   void purge(JNIEnv *env) {
+      for (std::size_t b = 0; b < _entries.bucket_count(); b++)
+         purgeBucket(env, b);
+   }
+
+   void clear(JNIEnv *env) {
+      for (typename _map::iterator p = _entries.begin();
+           p != _entries.end(); p++)
+         p->second->ReleaseResource(env);
+      _entries.clear();
+   }
+
+   // Number of entries, including those not yet found collected
+   std::size_t size() const { return _entries.size(); }
+   std::size_t purged() const { return _purged; }
+
+private:
+   void purgeSome(JNIEnv *env) {
+      std::size_t buckets = _entries.bucket_count();
+      for (std::size_t i = 0; i < _purgeStep && buckets > 0; i++) {
+         _cursor = (_cursor + 1) % buckets;
+         purgeBucket(env, _cursor);
+      }
+   }
+
+   void purgeBucket(JNIEnv *env, std::size_t b) {
+      std::vector<K> dead;
+      for (typename _map::local_iterator p = _entries.begin(b);
+           p != _entries.end(b); p++)
+         if (p->second->expired(env))
+            dead.push_back(p->first);
+      for (std::size_t i = 0; i < dead.size(); i++) {
+         typename _map::iterator p = _entries.find(dead[i]);
+         p->second->ReleaseResource(env);
+         _entries.erase(p);
+         _purged++;
+      }
+   }
+};
+
+#endif /* _JNI_WEAK_CACHE_H_INCLUDED_ */
@@ -0,0 +1,873 @@
+/*-----------------------------------------------------------------------------
+ * Tests of the Bitmap views and kernels (jni_bitmap.h), and of batch
+ * locking and staging buffers (jni_bitmap_batch.h), on the host mock of
+ * <android/bitmap.h> (benchmark/mock).
+ *
+ * The kernels are compared with reference implementations computed here
+ * in double precision, at every instruction set level supported by the
+ * processor, with and without a JNIThreadPool. Integer kernels must match
+ * exactly; those going through floats may differ by one unit.
+ *
+ * Bitmaps locked in batches are backed by Java objects, so that the info
+ * cache can hash them by identity and see them collected.
+ *
+ * See jni_test.h for the options.
+ *---------------------------------------------------------------------------*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <jni.h>
+
+#include "jni_test.h"
+#include "jni_bitmap.h"
+#include "jni_bitmap_batch.h"
+
+typedef JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_8888> RGBA8888View;
+typedef JNIBitmapView<ANDROID_BITMAP_FORMAT_RGB_565> RGB565View;
+typedef JNIBitmapView<ANDROID_BITMAP_FORMAT_A_8> A8View;
+typedef JNIBitmapView<ANDROID_BITMAP_FORMAT_RGBA_F16> F16View;
+
+// Rows are not multiples of the vector lanes
+static const uint32_t width = 333, height = 17;
+
+static std::vector<JNIRGBA8888> randomPixels(std::size_t n,
+                                             unsigned seed = 1) {
+   std::mt19937 random(seed);
+   std::vector<JNIRGBA8888> pixels(n);
+   for (std::size_t i = 0; i < n; i++) {
+      uint32_t v = random();
+      std::memcpy(&pixels[i], &v, sizeof(v));
+   }
+   return pixels;
+}
+
+// A channel value in [0, 255], rounded half up
+static uint8_t round8(double v) {
+   v = std::floor(v + 0.5);
+   return static_cast<uint8_t>((v < 0.0) ? 0.0 : (v > 255.0) ? 255.0 : v);
+}
+
+// Largest difference between the channels of two images
+static int maxDiff(const std::vector<JNIRGBA8888> &a,
+                   const std::vector<JNIRGBA8888> &b) {
+   int diff = 0;
+   for (std::size_t i = 0; i < a.size() && i < b.size(); i++) {
+      const uint8_t *p = &a[i].r, *q = &b[i].r;
+      for (int c = 0; c < 4; c++)
+         diff = std::max(diff, std::abs(int(p[c]) - int(q[c])));
+   }
+   return (a.size() == b.size()) ? diff : 256;
+}
+
+// Calls f() at every supported instruction set level, then restores it
+static void forEachLevel(JNITest &test, const std::function<void()> &f) {
+   JNIKernelLevel supported = JNIKernels::level();
+   for (int level = JNI_KERNELS_SCALAR; level <= supported; level++) {
+      JNIKernels::setLevel(static_cast<JNIKernelLevel>(level));
+      int failures = test.failures();
+      f();
+      if (test.failures() != failures)
+         printf("  at level %s\n",
+                JNIKernels::levelName(static_cast<JNIKernelLevel>(level)));
+   }
+   JNIKernels::setLevel(supported);
+}
+
+/*-----------------------------------------------------------------------------
+ * Views
+ *---------------------------------------------------------------------------*/
+JNI_TEST(BitmapView_LockedBitmap) {
+   JNIMockBitmap bitmap(5, 3, ANDROID_BITMAP_FORMAT_RGBA_8888, 12);
+   {
+      JNIAndroidBitmap pixels(test.env(), bitmap.object());
+      JNI_EXPECT_EQ(bitmap.locks, 1);
+      RGBA8888View view(pixels);
+      JNI_EXPECT_EQ(view.width(), 5u);
+      JNI_EXPECT_EQ(view.height(), 3u);
+      JNI_EXPECT_EQ(view.stride(), 32u);
+      JNI_EXPECT(view.data() == bitmap.pixels());
+
+      unsigned char *raw = static_cast<unsigned char *>(bitmap.pixels());
+      JNI_EXPECT(static_cast<void *>(view.row(2)) == raw + 64);
+      JNIRGBA8888 red = { 255, 0, 0, 255 };
+      view(4, 1) = red;
+      JNI_EXPECT_EQ(raw[32 + 16], 255);
+      JNI_EXPECT_EQ(raw[32 + 19], 255);
+
+      bool thrown = false;
+      try {
+         RGB565View wrong(pixels);
+      }
+      catch (JNIException &) {
+         thrown = true;
+      }
+      JNI_EXPECT(thrown);
+   }
+   JNI_EXPECT_EQ(bitmap.locks, 0);
+}
+
+JNI_TEST(BitmapView_Layout) {
+   std::vector<uint16_t> buffer(40);
+   RGB565View view(&buffer[0], 7, 4, 20);
+   view(6, 3) = 0xf800;
+   JNI_EXPECT_EQ(buffer[36], 0xf800);
+
+   // A stride shorter than a row is only accepted for a single row
+   bool thrown = false;
+   try {
+      RGB565View shortRows(&buffer[0], 7, 2, 13);
+   }
+   catch (JNIException &) {
+      thrown = true;
+   }
+   JNI_EXPECT(thrown);
+   RGB565View oneRow(&buffer[0], 7, 1, 0);
+   JNI_EXPECT_EQ(oneRow.row(0), &buffer[0]);
+}
+
+/*-----------------------------------------------------------------------------
+ * Half floats
+ *---------------------------------------------------------------------------*/
+JNI_TEST(Half_RoundTrip) {
+   int mismatches = 0;
+   for (uint32_t h = 0; h < 0x10000; h++) {
+      float f = JNIHalf::toFloat(static_cast<uint16_t>(h));
+      uint16_t back = JNIHalf::fromFloat(f);
+      bool nan = (h & 0x7c00) == 0x7c00 && (h & 0x3ff) != 0;
+      if (nan ? !(std::isnan(f) && (back & 0x7c00) == 0x7c00 &&
+                  (back & 0x3ff) != 0)
+              : back != h)
+         mismatches++;
+   }
+   JNI_EXPECT_EQ(mismatches, 0);
+
+   JNI_EXPECT_EQ(JNIHalf::toFloat(0x3c00), 1.0f);
+   JNI_EXPECT_EQ(JNIHalf::toFloat(0xc000), -2.0f);
+   JNI_EXPECT_EQ(JNIHalf::toFloat(0x7bff), 65504.0f);
+   JNI_EXPECT_EQ(JNIHalf::toFloat(0x0001), std::ldexp(1.0f, -24));
+   JNI_EXPECT(std::isinf(JNIHalf::toFloat(0x7c00)));
+}
+
+JNI_TEST(Half_Rounding) {
+   // Ties go to even, in the normal and in the subnormal range
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(1.0f + std::ldexp(1.0f, -11)), 0x3c00);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(1.0f + 3 * std::ldexp(1.0f, -11)),
+                 0x3c02);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(std::ldexp(1.0f, -25)), 0x0000);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(3 * std::ldexp(1.0f, -25)), 0x0002);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(-std::ldexp(1.0f, -24)), 0x8001);
+
+   // Overflow, infinities and NaN
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(65504.0f), 0x7bff);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(65519.0f), 0x7bff);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(65520.0f), 0x7c00);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(-1e10f), 0xfc00);
+   JNI_EXPECT_EQ(JNIHalf::fromFloat(std::nanf("")) & 0x7e00, 0x7e00);
+
+   // Any float goes to a nearest half
+   std::mt19937 random(2);
+   std::uniform_real_distribution<float> values(-65000.0f, 65000.0f);
+   int farther = 0;
+   for (int i = 0; i < 100000; i++) {
+      float f = values(random);
+      if (i % 2)
+         f = std::ldexp(f, -20);
+      uint16_t h = JNIHalf::fromFloat(f);
+      double d = std::fabs(double(JNIHalf::toFloat(h)) - f);
+      for (int step = -1; step <= 1; step += 2) {
+         uint16_t n = static_cast<uint16_t>(h + step);
+         if ((n & 0x7c00) != 0x7c00 && (n ^ h) < 0x8000 &&
+             std::fabs(double(JNIHalf::toFloat(n)) - f) < d)
+            farther++;
+      }
+   }
+   JNI_EXPECT_EQ(farther, 0);
+}
+
+/*-----------------------------------------------------------------------------
+ * Conversions
+ *---------------------------------------------------------------------------*/
+JNI_TEST(Convert_RGB565) {
+   std::vector<JNIRGBA8888> rgba = randomPixels(width * height);
+   std::vector<uint16_t> packed(rgba.size()), all(0x10000);
+   std::vector<uint16_t> expected(rgba.size());
+   for (std::size_t i = 0; i < rgba.size(); i++)
+      expected[i] = static_cast<uint16_t>(
+         round8(rgba[i].r * 31.0 / 255.0) << 11 |
+         round8(rgba[i].g * 63.0 / 255.0) << 5 |
+         round8(rgba[i].b * 31.0 / 255.0));
+   for (uint32_t v = 0; v < all.size(); v++)
+      all[v] = static_cast<uint16_t>(v);
+   std::vector<JNIRGBA8888> unpacked(all.size()), reference(all.size());
+   for (uint32_t v = 0; v < all.size(); v++) {
+      JNIRGBA8888 p = { round8((v >> 11) * 255.0 / 31.0),
+                        round8(((v >> 5) & 0x3f) * 255.0 / 63.0),
+                        round8((v & 0x1f) * 255.0 / 31.0), 255 };
+      reference[v] = p;
+   }
+   RGBA8888View rgbaView(&rgba[0], width, height, width * 4);
+   RGB565View packedView(&packed[0], width, height, width * 2);
+   JNIThreadPool pool(test.vm(), 3);
+
+   forEachLevel(test, [&] {
+      std::fill(packed.begin(), packed.end(), 0);
+      JNIBitmapKernels::convert(rgbaView, packedView, &pool, 1);
+      JNI_EXPECT(packed == expected);
+
+      // Every RGB_565 value, and back
+      JNIBitmapKernels::convert(RGB565View(&all[0], 256, 256, 512),
+                                RGBA8888View(&unpacked[0], 256, 256, 1024));
+      JNI_EXPECT_EQ(maxDiff(unpacked, reference), 0);
+      std::vector<uint16_t> repacked(all.size());
+      JNIBitmapKernels::convert(RGBA8888View(&unpacked[0], 256, 256, 1024),
+                                RGB565View(&repacked[0], 256, 256, 512));
+      JNI_EXPECT(repacked == all);
+   });
+}
+
+JNI_TEST(Convert_Alpha8) {
+   std::vector<JNIRGBA8888> rgba = randomPixels(width * height);
+   std::vector<uint8_t> alpha(rgba.size());
+   std::vector<JNIRGBA8888> back(rgba.size()), expected(rgba.size());
+   for (std::size_t i = 0; i < rgba.size(); i++) {
+      JNIRGBA8888 p = { 0, 0, 0, rgba[i].a };
+      expected[i] = p;
+   }
+
+   RGBA8888View rgbaView(&rgba[0], width, height, width * 4);
+   RGBA8888View backView(&back[0], width, height, width * 4);
+   A8View alphaView(&alpha[0], width, height, width);
+
+   forEachLevel(test, [&] {
+      JNIBitmapKernels::convert(rgbaView, alphaView);
+      bool same = true;
+      for (std::size_t i = 0; i < alpha.size(); i++)
+         same = same && alpha[i] == rgba[i].a;
+      JNI_EXPECT(same);
+      JNIBitmapKernels::convert(alphaView, backView);
+      JNI_EXPECT_EQ(maxDiff(back, expected), 0);
+   });
+}
+
+JNI_TEST(Convert_F16) {
+   std::vector<JNIRGBA8888> rgba = randomPixels(width * height);
+   std::vector<JNIRGBA8888> back(rgba.size());
+   std::vector<JNIRGBAF16> halves(rgba.size());
+   JNIBitmapKernels::convert(RGBA8888View(&rgba[0], width, height, width * 4),
+                             F16View(&halves[0], width, height, width * 8));
+   bool close = true;
+   for (std::size_t i = 0; i < rgba.size(); i++)
+      close = close &&
+         std::fabs(JNIHalf::toFloat(halves[i].g) - rgba[i].g / 255.0) < 1e-3;
+   JNI_EXPECT(close);
+
+   // Back to the same bytes
+   JNIBitmapKernels::convert(F16View(&halves[0], width, height, width * 8),
+                             RGBA8888View(&back[0], width, height, width * 4));
+   JNI_EXPECT_EQ(maxDiff(back, rgba), 0);
+
+   // Extended ranges are clamped when encoding bytes
+   JNIRGBAF16 wide = { JNIHalf::fromFloat(-0.5f), JNIHalf::fromFloat(2.0f),
+                       JNIHalf::fromFloat(0.5f), JNIHalf::fromFloat(1.0f) };
+   JNIRGBA8888 clamped;
+   JNIBitmapKernels::convert(F16View(&wide, 1, 1, 8),
+                             RGBA8888View(&clamped, 1, 1, 4));
+   JNI_EXPECT_EQ(clamped.r, 0);
+   JNI_EXPECT_EQ(clamped.g, 255);
+   JNI_EXPECT_EQ(clamped.b, 128);
+   JNI_EXPECT_EQ(clamped.a, 255);
+
+   // RGB_565 through floats: absent alpha decodes as 1
+   uint16_t white = 0xffff;
+   JNIBitmapKernels::convert(RGB565View(&white, 1, 1, 2),
+                             F16View(&wide, 1, 1, 8));
+   JNI_EXPECT_EQ(wide.r, 0x3c00);
+   JNI_EXPECT_EQ(wide.a, 0x3c00);
+}
+
+JNI_TEST(Convert_DifferentSizes) {
+   std::vector<JNIRGBA8888> a(16), b(16);
+   bool thrown = false;
+   try {
+      JNIBitmapKernels::convert(RGBA8888View(&a[0], 4, 4, 16),
+                                RGBA8888View(&b[0], 8, 2, 32));
+   }
+   catch (JNIException &) {
+      thrown = true;
+   }
+   JNI_EXPECT(thrown);
+}
+
+/*-----------------------------------------------------------------------------
+ * Premultiplication
+ *---------------------------------------------------------------------------*/
+JNI_TEST(Premultiply_RGBA8888) {
+   std::vector<JNIRGBA8888> rgba = randomPixels(width * height), actual;
+   std::vector<JNIRGBA8888> expected(rgba.size());
+   for (std::size_t i = 0; i < rgba.size(); i++) {
+      double a = rgba[i].a;
+      JNIRGBA8888 p = { round8(rgba[i].r * a / 255.0),
+                        round8(rgba[i].g * a / 255.0),
+                        round8(rgba[i].b * a / 255.0), rgba[i].a };
+      expected[i] = p;
+   }
+   JNIThreadPool pool(test.vm(), 3);
+
+   forEachLevel(test, [&] {
+      actual = rgba;
+      JNIBitmapKernels::premultiply(
+         RGBA8888View(&actual[0], width, height, width * 4));
+      JNI_EXPECT_EQ(maxDiff(actual, expected), 0);
+      actual = rgba;
+      JNIBitmapKernels::premultiply(
+         RGBA8888View(&actual[0], width, height, width * 4), &pool, 1);
+      JNI_EXPECT_EQ(maxDiff(actual, expected), 0);
+   });
+}
+
+JNI_TEST(Unpremultiply_RGBA8888) {
+   std::vector<JNIRGBA8888> rgba = randomPixels(width * height);
+   std::vector<JNIRGBA8888> expected(rgba.size());
+   for (std::size_t i = 0; i < rgba.size(); i++) {
+      double a = rgba[i].a;
+      JNIRGBA8888 p = rgba[i];
+      if (a == 0.0)
+         p.r = p.g = p.b = 0;
+      else {
+         p.r = round8(rgba[i].r * 255.0 / a);
+         p.g = round8(rgba[i].g * 255.0 / a);
+         p.b = round8(rgba[i].b * 255.0 / a);
+      }
+      expected[i] = p;
+   }
+   std::vector<JNIRGBA8888> actual = rgba;
+   JNIBitmapKernels::unpremultiply(
+      RGBA8888View(&actual[0], width, height, width * 4));
+   JNI_EXPECT_EQ(maxDiff(actual, expected), 0);
+
+   // Round trips: exact for opaque pixels, within one unit above alpha 128
+   std::vector<JNIRGBA8888> opaque = randomPixels(width * height, 3);
+   std::vector<JNIRGBA8888> translucent = opaque;
+   for (std::size_t i = 0; i < opaque.size(); i++) {
+      opaque[i].a = 255;
+      translucent[i].a |= 0x80;
+   }
+   JNIThreadPool pool(test.vm(), 3);
+   forEachLevel(test, [&] {
+      actual = opaque;
+      RGBA8888View view(&actual[0], width, height, width * 4);
+      JNIBitmapKernels::premultiply(view, &pool);
+      JNIBitmapKernels::unpremultiply(view, &pool);
+      JNI_EXPECT_EQ(maxDiff(actual, opaque), 0);
+
+      actual = translucent;
+      JNIBitmapKernels::premultiply(view);
+      JNIBitmapKernels::unpremultiply(view);
+      JNI_EXPECT(maxDiff(actual, translucent) <= 1);
+   });
+}
+
+JNI_TEST(Premultiply_F16) {
+   const uint16_t half = 0x3800, quarter = 0x3400;	// 0.5 and 0.25
+   std::vector<JNIRGBAF16> pixels(width * height);
+   std::mt19937 random(4);
+   for (std::size_t i = 0; i < pixels.size(); i++) {
+      JNIRGBAF16 p = { static_cast<uint16_t>(random() % 0x3c00),
+                       static_cast<uint16_t>(random() % 0x3c00),
+                       static_cast<uint16_t>(random() % 0x3c00),
+                       static_cast<uint16_t>(random() % 0x3c01) };
+      pixels[i] = p;
+   }
+   pixels[0].r = half;
+   pixels[0].a = half;
+   pixels[1].a = 0;
+
+   std::vector<JNIRGBAF16> actual = pixels;
+   F16View view(&actual[0], width, height, width * 8);
+   JNIBitmapKernels::premultiply(view);
+   JNI_EXPECT_EQ(actual[0].r, quarter);
+   JNI_EXPECT_EQ(actual[0].a, half);
+   JNI_EXPECT_EQ(actual[1].g, 0);
+   int mismatches = 0;
+   for (std::size_t i = 0; i < pixels.size(); i++) {
+      float a = JNIHalf::toFloat(pixels[i].a);
+      if (actual[i].b != JNIHalf::fromFloat(JNIHalf::toFloat(pixels[i].b) * a))
+         mismatches++;
+   }
+   JNI_EXPECT_EQ(mismatches, 0);
+
+   JNIBitmapKernels::unpremultiply(view);
+   JNI_EXPECT_EQ(actual[0].r, half);
+   JNI_EXPECT_EQ(actual[1].r, 0);
+   int farther = 0;
+   for (std::size_t i = 2; i < pixels.size(); i++) {
+      float a = JNIHalf::toFloat(pixels[i].a);
+      float b = JNIHalf::toFloat(pixels[i].b);
+      if (a >= 0.5f && std::fabs(JNIHalf::toFloat(actual[i].b) - b) > 2e-3f)
+         farther++;
+   }
+   JNI_EXPECT_EQ(farther, 0);
+}
+
+/*-----------------------------------------------------------------------------
+ * Blur and resize, against direct sums over the source pixels
+ *---------------------------------------------------------------------------*/
+static std::vector<JNIRGBA8888> referenceBlur(
+   const std::vector<JNIRGBA8888> &src, long w, long h, long r) {
+   std::vector<JNIRGBA8888> dst(src.size());
+   for (long y = 0; y < h; y++)
+      for (long x = 0; x < w; x++) {
+         double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+         for (long dy = -r; dy <= r; dy++)
+            for (long dx = -r; dx <= r; dx++) {
+               long sx = std::min(std::max(x + dx, 0L), w - 1);
+               long sy = std::min(std::max(y + dy, 0L), h - 1);
+               const uint8_t *p = &src[sy * w + sx].r;
+               for (int c = 0; c < 4; c++)
+                  sum[c] += p[c];
+            }
+         uint8_t *q = &dst[y * w + x].r;
+         for (int c = 0; c < 4; c++)
+            q[c] = round8(sum[c] / ((2 * r + 1) * (2 * r + 1)));
+      }
+   return dst;
+}
+
+JNI_TEST(Blur_RGBA8888) {
+   const uint32_t w = 37, h = 23;
+   std::vector<JNIRGBA8888> src = randomPixels(w * h, 5), dst(w * h);
+   JNIThreadPool pool(test.vm(), 3);
+
+   JNIBitmapKernels::blur(RGBA8888View(&src[0], w, h, w * 4),
+                          RGBA8888View(&dst[0], w, h, w * 4), 0);
+   JNI_EXPECT_EQ(maxDiff(dst, src), 0);
+
+   const unsigned radii[] = { 1, 3, 30 };
+   for (int i = 0; i < 3; i++) {
+      std::vector<JNIRGBA8888> expected = referenceBlur(src, w, h, radii[i]);
+      JNIBitmapKernels::blur(RGBA8888View(&src[0], w, h, w * 4),
+                             RGBA8888View(&dst[0], w, h, w * 4), radii[i]);
+      JNI_EXPECT(maxDiff(dst, expected) <= 1);
+      JNIBitmapKernels::blur(RGBA8888View(&src[0], w, h, w * 4),
+                             RGBA8888View(&dst[0], w, h, w * 4), radii[i],
+                             &pool, 2);
+      JNI_EXPECT(maxDiff(dst, expected) <= 1);
+   }
+
+   // In place
+   std::vector<JNIRGBA8888> expected = referenceBlur(src, w, h, 2);
+   RGBA8888View view(&src[0], w, h, w * 4);
+   JNIBitmapKernels::blur(view, view, 2, &pool);
+   JNI_EXPECT(maxDiff(src, expected) <= 1);
+}
+
+JNI_TEST(Blur_A8) {
+   // A single opaque pixel spreads evenly over its 3x3 neighbourhood
+   std::vector<uint8_t> alpha(25, 0);
+   alpha[12] = 255;
+   A8View view(&alpha[0], 5, 5, 5);
+   JNIBitmapKernels::blur(view, view, 1);
+   for (int y = 0; y < 5; y++)
+      for (int x = 0; x < 5; x++) {
+         bool inside = (x >= 1 && x <= 3 && y >= 1 && y <= 3);
+         JNI_EXPECT_EQ(int(alpha[y * 5 + x]), inside ? 28 : 0);
+      }
+}
+
+static std::vector<JNIRGBA8888> referenceBilinear(
+   const std::vector<JNIRGBA8888> &src, uint32_t sw, uint32_t sh,
+   uint32_t dw, uint32_t dh) {
+   std::vector<JNIRGBA8888> dst(std::size_t(dw) * dh);
+   for (uint32_t y = 0; y < dh; y++)
+      for (uint32_t x = 0; x < dw; x++) {
+         double fx = std::max((x + 0.5) * sw / dw - 0.5, 0.0);
+         double fy = std::max((y + 0.5) * sh / dh - 0.5, 0.0);
+         uint32_t x0 = std::min(uint32_t(fx), sw - 1);
+         uint32_t y0 = std::min(uint32_t(fy), sh - 1);
+         uint32_t x1 = std::min(x0 + 1, sw - 1), y1 = std::min(y0 + 1, sh - 1);
+         double wx = (x0 == x1) ? 0.0 : fx - x0;
+         double wy = (y0 == y1) ? 0.0 : fy - y0;
+         const uint8_t *p00 = &src[y0 * sw + x0].r, *p01 = &src[y0 * sw + x1].r;
+         const uint8_t *p10 = &src[y1 * sw + x0].r, *p11 = &src[y1 * sw + x1].r;
+         uint8_t *q = &dst[y * dw + x].r;
+         for (int c = 0; c < 4; c++) {
+            double top = p00[c] + (p01[c] - p00[c]) * wx;
+            double bottom = p10[c] + (p11[c] - p10[c]) * wx;
+            q[c] = round8(top + (bottom - top) * wy);
+         }
+      }
+   return dst;
+}
+
+JNI_TEST(Resize_Nearest) {
+   const uint32_t sw = 41, sh = 29;
+   std::vector<JNIRGBA8888> src = randomPixels(sw * sh, 6);
+   const uint32_t sizes[][2] = { { 41, 29 }, { 20, 14 }, { 100, 3 } };
+   JNIThreadPool pool(test.vm(), 3);
+   for (int s = 0; s < 3; s++) {
+      uint32_t dw = sizes[s][0], dh = sizes[s][1];
+      std::vector<JNIRGBA8888> dst(dw * dh), expected(dw * dh);
+      for (uint32_t y = 0; y < dh; y++)
+         for (uint32_t x = 0; x < dw; x++)
+            expected[y * dw + x] =
+               src[uint32_t(std::floor((y + 0.5) * sh / dh)) * sw +
+                   uint32_t(std::floor((x + 0.5) * sw / dw))];
+      JNIBitmapKernels::resize(RGBA8888View(&src[0], sw, sh, sw * 4),
+                               RGBA8888View(&dst[0], dw, dh, dw * 4),
+                               JNI_BITMAP_NEAREST, &pool, 1);
+      JNI_EXPECT_EQ(maxDiff(dst, expected), 0);
+   }
+}
+
+JNI_TEST(Resize_Bilinear) {
+   const uint32_t sw = 41, sh = 29;
+   std::vector<JNIRGBA8888> src = randomPixels(sw * sh, 7);
+   const uint32_t sizes[][2] = { { 41, 29 }, { 20, 14 }, { 97, 61 }, { 1, 1 } };
+   JNIThreadPool pool(test.vm(), 3);
+   for (int s = 0; s < 4; s++) {
+      uint32_t dw = sizes[s][0], dh = sizes[s][1];
+      std::vector<JNIRGBA8888> dst(dw * dh);
+      std::vector<JNIRGBA8888> expected =
+         referenceBilinear(src, sw, sh, dw, dh);
+      JNIBitmapKernels::resize(RGBA8888View(&src[0], sw, sh, sw * 4),
+                               RGBA8888View(&dst[0], dw, dh, dw * 4),
+                               JNI_BITMAP_BILINEAR, (s % 2) ? &pool : 0);
+      JNI_EXPECT(maxDiff(dst, expected) <= 1);
+      if (dw == sw && dh == sh)
+         JNI_EXPECT_EQ(maxDiff(dst, src), 0);
+   }
+
+   bool thrown = false;
+   try {
+      RGBA8888View view(&src[0], sw, sh, sw * 4);
+      JNIBitmapKernels::resize(view, view);
+   }
+   catch (JNIException &) {
+      thrown = true;
+   }
+   JNI_EXPECT(thrown);
+}
+
+/*-----------------------------------------------------------------------------
+ * Batches
+ *---------------------------------------------------------------------------*/
+typedef std::vector<std::unique_ptr<JNIMockBitmap> > Bitmaps;
+
+static Bitmaps newBitmaps(JNIEnv *env, int n) {
+   Bitmaps bitmaps;
+   for (int i = 0; i < n; i++)
+      bitmaps.push_back(std::unique_ptr<JNIMockBitmap>(new JNIMockBitmap(env,
+         8 + i, 4, ANDROID_BITMAP_FORMAT_RGBA_8888)));
+   return bitmaps;
+}
+
+// A Bitmap[] of the objects backing 'bitmaps', in the order of 'order'
+static jobjectArray newBitmapArray(JNIEnv *env, const Bitmaps &bitmaps,
+                                   const std::vector<int> &order) {
+   JNIClass objectClass(env, "java/lang/Object");
+   jobjectArray array = env->NewObjectArray(
+      static_cast<jsize>(order.size()), objectClass, 0);
+   for (std::size_t i = 0; i < order.size(); i++)
+      env->SetObjectArrayElement(array, static_cast<jsize>(i),
+                                 bitmaps[order[i]]->object());
+   return array;
+}
+
+JNI_TEST(BitmapBatch_UnlocksInReverse) {
+   JNIEnv *env = test.env();
+   Bitmaps bitmaps = newBitmaps(env, 4);
+   jobjectArray array = newBitmapArray(env, bitmaps, { 0, 1, 2, 3 });
+   {
+      JNIBitmapBatch batch(env, array);
+      JNI_ASSERT(batch.size() == 4);
+      for (int i = 0; i < 4; i++) {
+         JNI_EXPECT_EQ(bitmaps[i]->locks, 1);
+         JNI_EXPECT(batch.pixels(i) == bitmaps[i]->pixels());
+         JNI_EXPECT_EQ(batch.info(i).width, uint32_t(8 + i));
+      }
+      RGBA8888View view = batch.view<ANDROID_BITMAP_FORMAT_RGBA_8888>(2);
+      JNI_EXPECT_EQ(view.width(), 10u);
+   }
+   for (int i = 0; i < 4; i++)
+      JNI_EXPECT_EQ(bitmaps[i]->locks, 0);
+   for (int i = 0; i < 3; i++)
+      JNI_EXPECT(bitmaps[i]->unlockOrder > bitmaps[i + 1]->unlockOrder);
+
+   // Locked one at a time, and unlocked explicitly
+   JNIBitmapBatch batch(env);
+   JNI_EXPECT_EQ(batch.lock(bitmaps[3]->object()), 0u);
+   JNI_EXPECT_EQ(batch.lock(bitmaps[1]->object()), 1u);
+   JNI_EXPECT_EQ(batch.lock(bitmaps[2]->object()), 2u);
+   batch.unlock();
+   JNI_EXPECT_EQ(batch.size(), 0u);
+   JNI_EXPECT(bitmaps[2]->unlockOrder < bitmaps[1]->unlockOrder);
+   JNI_EXPECT(bitmaps[1]->unlockOrder < bitmaps[3]->unlockOrder);
+   JNI_EXPECT_EQ(bitmaps[3]->locks, 0);
+}
+
+JNI_TEST(BitmapBatch_UnlocksOnException) {
+   JNIEnv *env = test.env();
+   Bitmaps bitmaps = newBitmaps(env, 4);
+
+   // The third element is no Bitmap: the first two are unlocked, in
+   // reverse order, and the last is never locked
+   jobjectArray array = newBitmapArray(env, bitmaps, { 0, 1, 2, 3 });
+   JNIClass objectClass(env, "java/lang/Object");
+   jobject notBitmap = env->NewObject(objectClass,
+      env->GetMethodID(objectClass, "<init>", "()V"));
+   env->SetObjectArrayElement(array, 2, notBitmap);
+   bool thrown = false;
+   try {
+      JNIBitmapBatch batch(env, array);
+   }
+   catch (JNIException &) {
+      thrown = true;
+   }
+   JNI_EXPECT(thrown);
+   JNI_EXPECT_EQ(bitmaps[0]->locks, 0);
+   JNI_EXPECT_EQ(bitmaps[1]->locks, 0);
+   JNI_EXPECT(bitmaps[0]->unlockOrder > bitmaps[1]->unlockOrder);
+   JNI_EXPECT_EQ(bitmaps[3]->lockCalls, 0);
+
+   // A Bitmap that fails to lock leaves the others in the batch
+   {
+      JNIBitmapBatch batch(env);
+      batch.lock(bitmaps[0]->object());
+      thrown = false;
+      try {
+         batch.lock(notBitmap);
+      }
+      catch (JNIException &) {
+         thrown = true;
+      }
+      JNI_EXPECT(thrown);
+      JNI_EXPECT_EQ(batch.size(), 1u);
+      JNI_EXPECT_EQ(bitmaps[0]->locks, 1);
+
+      thrown = false;
+      try {
+         batch.view<ANDROID_BITMAP_FORMAT_RGB_565>(0);
+      }
+      catch (JNIException &) {
+         thrown = true;
+      }
+      JNI_EXPECT(thrown);
+   }
+   JNI_EXPECT_EQ(bitmaps[0]->locks, 0);
+
+   // An exception thrown while the batch is in use
+   thrown = false;
+   try {
+      JNIBitmapBatch batch(env);
+      for (int i = 0; i < 4; i++)
+         batch.lock(bitmaps[i]->object());
+      throw std::runtime_error("frame dropped");
+   }
+   catch (std::runtime_error &) {
+      thrown = true;
+   }
+   JNI_EXPECT(thrown);
+   for (int i = 0; i < 4; i++)
+      JNI_EXPECT_EQ(bitmaps[i]->locks, 0);
+   for (int i = 0; i < 3; i++)
+      JNI_EXPECT(bitmaps[i]->unlockOrder > bitmaps[i + 1]->unlockOrder);
+}
+
+/*-----------------------------------------------------------------------------
+ * Info cache
+ *---------------------------------------------------------------------------*/
+JNI_TEST(BitmapInfoCache_HitsAndMisses) {
+   JNIEnv *env = test.env();
+   Bitmaps bitmaps = newBitmaps(env, 3);
+   jobjectArray frame = newBitmapArray(env, bitmaps, { 0, 1, 2 });
+   jobjectArray reordered = newBitmapArray(env, bitmaps, { 2, 0, 1 });
+   JNIBitmapInfoCache cache;
+
+   // First frame: every Bitmap is queried
+   {
+      JNIBitmapBatch batch(env, frame, &cache);
+      JNI_EXPECT_EQ(batch.info(1).width, 9u);
+   }
+   JNI_EXPECT_EQ(cache.misses(), 3u);
+   JNI_EXPECT_EQ(cache.hits(), 0u);
+   JNI_EXPECT_EQ(cache.size(), 3u);
+
+   // Same Bitmaps at the same positions, then at other positions
+   {
+      JNIBitmapBatch batch(env, frame, &cache);
+   }
+   {
+      JNIBitmapBatch batch(env, reordered, &cache);
+      JNI_EXPECT_EQ(batch.info(0).width, 10u);
+      JNI_EXPECT_EQ(batch.info(1).width, 8u);
+   }
+   JNI_EXPECT_EQ(cache.misses(), 3u);
+   JNI_EXPECT_EQ(cache.hits(), 6u);
+   for (int i = 0; i < 3; i++) {
+      JNI_EXPECT_EQ(bitmaps[i]->infoCalls, 1);
+      JNI_EXPECT_EQ(bitmaps[i]->locks, 0);
+   }
+
+   // Another reference to a cached Bitmap
+   AndroidBitmapInfo info;
+   JNIGlobalRef<jobject> other(env, bitmaps[2]->object());
+   JNI_EXPECT_EQ(cache.get(env, other.get(), info, 7),
+                 int(ANDROID_BITMAP_RESULT_SUCCESS));
+   JNI_EXPECT_EQ(info.width, 10u);
+   JNI_EXPECT_EQ(cache.hits(), 7u);
+
+   // Invalidated, then queried again
+   cache.invalidate(env, bitmaps[1]->object());
+   JNI_EXPECT_EQ(cache.size(), 2u);
+   {
+      JNIBitmapBatch batch(env, frame, &cache);
+   }
+   JNI_EXPECT_EQ(cache.misses(), 4u);
+   JNI_EXPECT_EQ(bitmaps[1]->infoCalls, 2);
+   JNI_EXPECT_EQ(bitmaps[0]->infoCalls, 1);
+
+   // Failures are not cached
+   JNIClass objectClass(env, "java/lang/Object");
+   jobject notBitmap = env->NewObject(objectClass,
+      env->GetMethodID(objectClass, "<init>", "()V"));
+   JNI_EXPECT_EQ(cache.get(env, notBitmap, info),
+                 int(ANDROID_BITMAP_RESULT_BAD_PARAMETER));
+   JNI_EXPECT_EQ(cache.size(), 3u);
+
+   cache.clear(env);
+   JNI_EXPECT_EQ(cache.size(), 0u);
+}
+
+// Runs System.gc() until 'ref' is cleared (a few times at most)
+static bool collect(JNIEnv *env, const JNIWeakGlobalRef<jobject> &ref) {
+   JNIClass systemClass(env, "java/lang/System");
+   jmethodID gc = env->GetStaticMethodID(systemClass, "gc", "()V");
+   for (int i = 0; i < 10 && !ref.expired(env); i++)
+      env->CallStaticVoidMethod(systemClass, gc);
+   return ref.expired(env);
+}
+
+JNI_TEST(BitmapInfoCache_PurgesCollected) {
+   JNIEnv *env = test.env();
+   JNIBitmapInfoCache cache;
+   Bitmaps bitmaps = newBitmaps(env, 3);
+   AndroidBitmapInfo info;
+   for (int i = 0; i < 3; i++)
+      cache.get(env, bitmaps[i]->object(), info, i);
+   JNI_EXPECT_EQ(cache.size(), 3u);
+
+   // Nothing collected yet
+   JNI_EXPECT_EQ(cache.purge(env), 0u);
+   JNI_EXPECT_EQ(cache.size(), 3u);
+
+   JNIWeakGlobalRef<jobject> dropped(env, bitmaps[1]->object());
+   bitmaps[1].reset();
+   JNI_ASSERT(collect(env, dropped));
+   JNI_EXPECT_EQ(cache.purge(env), 1u);
+   JNI_EXPECT_EQ(cache.size(), 2u);
+   cache.get(env, bitmaps[0]->object(), info, 0);
+   cache.get(env, bitmaps[2]->object(), info, 2);
+   JNI_EXPECT_EQ(cache.misses(), 3u);
+   JNI_EXPECT_EQ(cache.hits(), 2u);
+
+   // A miss purges a full cache of collected Bitmaps
+   JNIBitmapInfoCache full;
+   const int many = JNIBitmapInfoCache::minPurgeAt;
+   Bitmaps frame = newBitmaps(env, many);
+   for (int i = 0; i < many; i++)
+      full.get(env, frame[i]->object(), info);
+   JNI_EXPECT_EQ(full.size(), std::size_t(many));
+   JNIWeakGlobalRef<jobject> last(env, frame.back()->object());
+   frame.clear();
+   JNI_ASSERT(collect(env, last));
+   full.get(env, bitmaps[0]->object(), info);
+   JNI_EXPECT_EQ(full.size(), 1u);
+}
+
+/*-----------------------------------------------------------------------------
+ * Staging buffers
+ *---------------------------------------------------------------------------*/
+JNI_TEST(BitmapBufferPool_Recycles) {
+   JNIMockBitmap bitmap(30, 20, ANDROID_BITMAP_FORMAT_RGBA_8888, 8);
+   const AndroidBitmapInfo &info = bitmap.info();
+   JNIBitmapBufferPool pool;
+   void *data;
+   {
+      JNIBitmapBuffer buffer = pool.acquire(info);
+      data = buffer.data();
+      JNI_EXPECT_EQ(buffer.size(), std::size_t(128 * 20));
+      JNI_EXPECT_EQ(reinterpret_cast<std::uintptr_t>(data) %
+                    JNI_CACHE_LINE_SIZE, 0u);
+      RGBA8888View view = buffer.view<ANDROID_BITMAP_FORMAT_RGBA_8888>();
+      JNI_EXPECT_EQ(view.stride(), 128u);
+      JNI_EXPECT_EQ(pool.misses(), 1u);
+      JNI_EXPECT_EQ(pool.idleBytes(), 0u);
+   }
+   JNI_EXPECT_EQ(pool.idleBytes(), std::size_t(128 * 20));
+
+   // The same block again, then a new one while it is in use
+   {
+      JNIBitmapBuffer buffer = pool.acquire(info);
+      JNI_EXPECT(buffer.data() == data);
+      JNI_EXPECT_EQ(pool.hits(), 1u);
+      JNIBitmapBuffer second = pool.acquire(info);
+      JNI_EXPECT(second.data() != data);
+      JNI_EXPECT_EQ(pool.misses(), 2u);
+
+      // Moved buffers go back once
+      JNIBitmapBuffer moved(std::move(second));
+      JNI_EXPECT_EQ(second.size(), 0u);
+      second.release();
+      JNI_EXPECT_EQ(pool.idleBytes(), 0u);
+   }
+   JNI_EXPECT_EQ(pool.idleBytes(), std::size_t(2 * 128 * 20));
+
+   // Idle blocks are kept by exact size
+   {
+      JNIBitmapBuffer packed =
+         pool.acquire(30, 20, ANDROID_BITMAP_FORMAT_RGB_565);
+      JNI_EXPECT_EQ(packed.info().stride, 60u);
+      JNI_EXPECT_EQ(pool.misses(), 3u);
+      bool thrown = false;
+      try {
+         packed.view<ANDROID_BITMAP_FORMAT_RGBA_8888>();
+      }
+      catch (JNIException &) {
+         thrown = true;
+      }
+      JNI_EXPECT(thrown);
+   }
+
+   pool.trim();
+   JNI_EXPECT_EQ(pool.idleBytes(), 0u);
+
+   // Beyond 'maxIdleBytes', released buffers are freed
+   JNIBitmapBufferPool small(128 * 20);
+   {
+      JNIBitmapBuffer a = small.acquire(info), b = small.acquire(info);
+   }
+   JNI_EXPECT_EQ(small.idleBytes(), std::size_t(128 * 20));
+   {
+      JNIBitmapBuffer a = small.acquire(info), b = small.acquire(info);
+      JNI_EXPECT_EQ(small.hits(), 1u);
+      JNI_EXPECT_EQ(small.misses(), 3u);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   try {
+      JNITestVM vm(argc, argv);
+      return JNITestMain(vm.jvm(), argc, argv);
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
@@ -0,0 +1,206 @@
+/*-----------------------------------------------------------------------------
+ * Tests of the library's resources, against an embedded Java VM.
+ *
+ * See jni_test.h for the options.
+ *---------------------------------------------------------------------------*/
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <jni.h>
+
+#include "jni_test.h"
+
+// A new java.lang.Object, as a local reference
+static jobject newObject(JNIEnv *env) {
+   JNIClass objectClass(env, "java/lang/Object");
+   return env->NewObject(objectClass,
+      env->GetMethodID(objectClass, "<init>", "()V"));
+}
+
+/*-----------------------------------------------------------------------------
+ * Java VM and environments
+ *---------------------------------------------------------------------------*/
+JNI_TEST(VirtualMachine_FindClass) {
+   JNIEnv *env = test.env();
+   jclass string = test.jvm().findClass(env, "java/lang/String");
+   JNI_ASSERT(string != 0);
+   JNI_EXPECT_EQ(test.jvm().findClass(env, "java/lang/String"), string);
+
+   bool thrown = false;
+   try {
+      test.jvm().findClass(env, "no/such/Class");
+   }
+   catch (JNIException &) {
+      thrown = true;
+   }
+   JNI_EXPECT(thrown);
+   JNI_EXPECT(!env->ExceptionCheck());
+}
+
+JNI_TEST(Environment_AttachesThreads) {
+   JavaVM *vm = test.vm();
+   bool attached = false, found = false;
+   std::thread thread([&] {
+      JNIEnvironment env(vm);
+      attached = (env.Get() != 0);
+      jclass clazz = env.Get()->FindClass("java/lang/Object");
+      found = (clazz != 0);
+      env.Get()->DeleteLocalRef(clazz);
+   });
+   thread.join();
+   JNI_EXPECT(attached);
+   JNI_EXPECT(found);
+}
+
+/*-----------------------------------------------------------------------------
+ * Global references
+ *---------------------------------------------------------------------------*/
+JNI_TEST(GlobalRef_Identity) {
+   JNIEnv *env = test.env();
+   jobject a = newObject(env);
+   jobject b = newObject(env);
+   JNIGlobalRef<jobject> ra(env, a), ra2(env, a), rb(env, b);
+
+   JNI_EXPECT(ra.get() != ra2.get());
+   JNI_EXPECT(ra == ra2);
+   JNI_EXPECT(!(ra == rb));
+
+   JNI_EXPECT(!ra.hashed());
+   JNI_EXPECT_EQ(ra.identityHash(env), JNIIdentityHashCode(env, a));
+   JNI_EXPECT(ra.hashed());
+   JNI_EXPECT_EQ(ra2.identityHash(env), ra.identityHash(env));
+}
+
+JNI_TEST(IdentityEqual_Registry) {
+   typedef std::unordered_map<JNIGlobalRef<jobject>, int,
+                              std::hash<JNIGlobalRef<jobject> >,
+                              JNIIdentityEqual<jobject> > Registry;
+   JNIEnv *env = test.env();
+   Registry registry(0, std::hash<JNIGlobalRef<jobject> >(),
+                     JNIIdentityEqual<jobject>(env));
+   std::vector<jobject> objects;
+   for (int i = 0; i < 8; i++) {
+      objects.push_back(newObject(env));
+      registry.emplace(std::piecewise_construct,
+                       std::forward_as_tuple(env, objects.back()),
+                       std::forward_as_tuple(i));
+   }
+   JNI_EXPECT_EQ(registry.size(), 8u);
+
+   // Looked up through distinct references to the same objects
+   for (int i = 0; i < 8; i++) {
+      JNIGlobalRef<jobject> probe(env, objects[i]);
+      Registry::const_iterator p = registry.find(probe);
+      JNI_ASSERT(p != registry.end());
+      JNI_EXPECT_EQ(p->second, i);
+   }
+   JNIGlobalRef<jobject> other(env, newObject(env));
+   JNI_EXPECT(registry.find(other) == registry.end());
+}
+
+JNI_TEST(GlobalRefPool_Slots) {
+   JNIEnv *env = test.env();
+   JNIGlobalRefPool pool(env, 4);
+   std::vector<jobject> objects;
+   std::vector<JNIGlobalRefPool::Handle> handles;
+   for (int i = 0; i < 10; i++) {
+      objects.push_back(newObject(env));
+      handles.push_back(pool.acquire(env, objects.back()));
+   }
+   JNI_EXPECT_EQ(pool.live(), 10u);
+   JNI_EXPECT_EQ(pool.segments(), 3u);
+   for (int i = 0; i < 10; i++) {
+      jobject obj = pool.get(env, handles[i]);
+      JNI_EXPECT(env->IsSameObject(obj, objects[i]));
+      env->DeleteLocalRef(obj);
+   }
+
+   for (int i = 0; i < 10; i++)
+      pool.release(handles[i]);
+   JNI_EXPECT_EQ(pool.live(), 0u);
+   JNI_EXPECT_EQ(pool.highWater(), 10u);
+   pool.flush(env);
+   JNI_EXPECT_EQ(pool.pending(), 0u);
+
+   // Invalid handles, as held by moved-from references
+   JNI_EXPECT(pool.get(env, JNIGlobalRefPool::invalid) == 0);
+   pool.set(env, JNIGlobalRefPool::invalid, objects[0]);
+   JNIPooledRef ref(pool, env, objects[0]);
+   JNIPooledRef moved(std::move(ref));
+   JNI_EXPECT(ref.get(env) == 0);
+   jobject obj = moved.get(env);
+   JNI_EXPECT(env->IsSameObject(obj, objects[0]));
+}
+
+/*-----------------------------------------------------------------------------
+ * Strings and arrays
+ *---------------------------------------------------------------------------*/
+JNI_TEST(StringUTFChars_Contents) {
+   JNIEnv *env = test.env();
+   jstring s = env->NewStringUTF("hello, JNI");
+   JNIStringUTFChars chars(env, s);
+   JNI_EXPECT_EQ(chars.asString(), std::string("hello, JNI"));
+   JNI_EXPECT_EQ(chars.length(), 10);
+   JNI_EXPECT_EQ(chars[7], 'J');
+}
+
+JNI_TEST(Array_WritesBack) {
+   JNIEnv *env = test.env();
+   jintArray array = env->NewIntArray(4);
+   JNI_ASSERT(array != 0);
+   {
+      JNIArray<jint> elements(env, array);
+      JNI_ASSERT(elements.size() == 4);
+      for (int i = 0; i < 4; i++)
+         elements[i] = i * i;
+   }
+   jint values[4];
+   env->GetIntArrayRegion(array, 0, 4, values);
+   for (int i = 0; i < 4; i++)
+      JNI_EXPECT_EQ(values[i], i * i);
+}
+
+JNI_TEST(NewArray_Sources) {
+   JNIEnv *env = test.env();
+   std::vector<jdouble> values;
+   for (int i = 0; i < 5; i++)
+      values.push_back(i + 0.5);
+   jdoubleArray doubles = JNINewArray(env, values);
+   JNI_ASSERT(doubles != 0);
+   JNI_EXPECT_EQ(env->GetArrayLength(doubles), 5);
+   jdouble copied[5];
+   env->GetDoubleArrayRegion(doubles, 0, 5, copied);
+   for (int i = 0; i < 5; i++)
+      JNI_EXPECT_EQ(copied[i], values[i]);
+
+   // Generated in a pooled buffer, then in place
+   const jsize sizes[] = { 100, 100000 };
+   for (int s = 0; s < 2; s++) {
+      jsize len = sizes[s];
+      jintArray ints = JNINewArray<jint>(env, len,
+         [](jsize i) { return static_cast<jint>(3 * i); });
+      JNI_ASSERT(ints != 0);
+      JNI_EXPECT_EQ(env->GetArrayLength(ints), len);
+      jint last;
+      env->GetIntArrayRegion(ints, len - 1, 1, &last);
+      JNI_EXPECT_EQ(last, 3 * (len - 1));
+      env->DeleteLocalRef(ints);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   try {
+      JNITestVM vm(argc, argv);
+      return JNITestMain(vm.jvm(), argc, argv);
+   }
+   catch (JNIException &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+   }
+}
@@ -0,0 +1,233 @@
+/*-----------------------------------------------------------------------------
+ * A small test driver with an embedded Java VM.
+ *
+ * Tests are written and registered in the style of Google Test:
+ *
+ *    JNI_TEST(GlobalRef_SameObject) {
+ *       JNIEnv *env = test.env();
+ *       ...
+ *       JNI_ASSERT(array != 0);		// on failure, ends the test
+ *       JNI_EXPECT(a == b);			// on failure, goes on
+ *       JNI_EXPECT_EQ(env->GetArrayLength(array), 4);
+ *    }
+ *
+ * and run by JNITestMain() once the Java VM exists:
+ *
+ *    int main(int argc, char *argv[]) {
+ *       JNITestVM vm(argc, argv);
+ *       return JNITestMain(vm.jvm(), argc, argv);
+ *    }
+ *
+ * Tests run in registration order, on the thread which created the Java
+ * VM, each in its own local frame; test.env() is that thread's JNIEnv and
+ * test.jvm() the JNIVirtualMachine (jni_vm.h). A test fails if a check
+ * fails, if it throws, or if it returns with a Java exception pending
+ * (which is then described and cleared). JNITestMain() returns 0 if every
+ * selected test passed, so that the executable can be registered with
+ * add_test.
+ *
+ * Options:
+ *    --test_filter=<regex>	run matching tests only
+ *    -J<option>			a Java VM option (e.g. -J-Xmx256m)
+ * The Java VM checks JNI calls (-Xcheck:jni).
+ *
+ * Requires C++11, and the JDK's libjvm at link time.
+ *---------------------------------------------------------------------------*/
+
+#ifndef _JNI_TEST_H_INCLUDED_
+#define _JNI_TEST_H_INCLUDED_
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <jni.h>
+
+#include "jni_master.h"
+
+class JNITest;
+typedef void (*JNITestFunction)(JNITest &);
+
+/*-----------------------------------------------------------------------------
+ * JNITestCase: a registered test
+ *---------------------------------------------------------------------------*/
+class JNITestCase {
+   std::string _name;
+   JNITestFunction _function;
+
+public:
+   JNITestCase(const char *name, JNITestFunction function) :
+      _name(name), _function(function) {}
+
+   const std::string &name() const { return _name; }
+   JNITestFunction function() const { return _function; }
+
+   static std::vector<JNITestCase *> &registry() {
+      static std::vector<JNITestCase *> tests;
+      return tests;
+   }
+
+   static JNITestCase *add(const char *name, JNITestFunction function) {
+      registry().push_back(new JNITestCase(name, function));
+      return registry().back();
+   }
+};
+
+#define JNI_TEST_CONCAT_(a, b) a##b
+#define JNI_TEST_CONCAT(a, b) JNI_TEST_CONCAT_(a, b)
+
+#define JNI_TEST(name)													\
+   static void name(JNITest &test);										\
+   static JNITestCase *JNI_TEST_CONCAT(_jniTest, __LINE__) =			\
+      JNITestCase::add(#name, name);										\
+   static void name(JNITest &test)
+
+/*-----------------------------------------------------------------------------
+ * JNITest: the state of the running test
+ *---------------------------------------------------------------------------*/
+class JNITest {
+   JNIVirtualMachine &_jvm;
+   int _failures;
+
+public:
+   explicit JNITest(JNIVirtualMachine &jvm) : _jvm(jvm), _failures(0) {}
+
+   JNIEnv *env() const { return _jvm.env(); }
+   JavaVM *vm() const { return _jvm.vm(); }
+   JNIVirtualMachine &jvm() const { return _jvm; }
+   int failures() const { return _failures; }
+
+   void fail(const char *file, int line, const std::string &what) {
+      printf("%s:%d: Failure\n  %s\n", file, line, what.c_str());
+      _failures++;
+   }
+
+   bool check(bool passed, const char *file, int line, const char *what) {
+      if (!passed)
+         fail(file, line, std::string("Expected: ") + what);
+      return passed;
+   }
+
+   template<class A, class B>
+   bool checkEqual(const A &a, const B &b, const char *file, int line,
+                   const char *aText, const char *bText) {
+      if (a == b)
+         return true;
+      std::ostringstream what;
+      what << "Expected: " << aText << " == " << bText << "\n  Actual: "
+           << show(a) << " vs " << show(b);
+      fail(file, line, what.str());
+      return false;
+   }
+
+private:
+   // Prints character types as numbers
+   template<class T>
+   static const T &show(const T &x) { return x; }
+   static int show(signed char x) { return x; }
+   static int show(unsigned char x) { return x; }
+   static int show(char x) { return x; }
+};
+
+#define JNI_EXPECT(condition)											\
+   test.check((condition), __FILE__, __LINE__, #condition)
+
+#define JNI_EXPECT_EQ(a, b)												\
+   test.checkEqual((a), (b), __FILE__, __LINE__, #a, #b)
+
+#define JNI_ASSERT(condition)											\
+   do {																	\
+      if (!JNI_EXPECT(condition))										\
+         return;															\
+   } while (0)
+
+/*-----------------------------------------------------------------------------
+ * JNITestVM: the embedded Java VM
+ *---------------------------------------------------------------------------*/
+class JNITestVM {
+   JNIVirtualMachine _jvm;
+
+   static JNIVirtualMachineOptions options(int argc, char *argv[]) {
+      JNIVirtualMachineOptions options;
+      options.checkJNI();
+      for (int i = 1; i < argc; i++)
+         if (strncmp(argv[i], "-J", 2) == 0)
+            options.option(argv[i] + 2);
+      return options;
+   }
+
+public:
+   JNITestVM(int argc, char *argv[]) : _jvm(options(argc, argv)) {}
+
+   JavaVM *vm() const { return _jvm.vm(); }
+   JNIEnv *env() const { return _jvm.env(); }
+   JNIVirtualMachine &jvm() { return _jvm; }
+};
+
+/*-----------------------------------------------------------------------------
+ * Running
+ *---------------------------------------------------------------------------*/
+
+// Runs one test; returns its number of failures
+inline int JNITestRun(JNIVirtualMachine &jvm, const JNITestCase &tc) {
+   JNIEnv *env = jvm.env();
+   JNITest test(jvm);
+   printf("[ RUN      ] %s\n", tc.name().c_str());
+   fflush(stdout);
+   if (env->PushLocalFrame(64) != 0) {
+      env->ExceptionClear();
+      test.fail(__FILE__, __LINE__, "No local frame for the test");
+   }
+   else {
+      try {
+         tc.function()(test);
+      }
+      catch (std::exception &e) {
+         test.fail(__FILE__, __LINE__, std::string("Threw: ") + e.what());
+      }
+      catch (...) {
+         test.fail(__FILE__, __LINE__, "Threw an unknown exception");
+      }
+      if (env->ExceptionCheck()) {
+         env->ExceptionDescribe();
+         env->ExceptionClear();
+         test.fail(__FILE__, __LINE__, "Returned with a Java exception");
+      }
+      env->PopLocalFrame(0);
+   }
+   printf("%s %s\n", test.failures() ? "[  FAILED  ]" : "[       OK ]",
+          tc.name().c_str());
+   fflush(stdout);
+   return test.failures();
+}
+
+// Runs the registered tests selected by the command line
+inline int JNITestMain(JNIVirtualMachine &jvm, int argc, char *argv[]) {
+   std::string filter = ".";
+   for (int i = 1; i < argc; i++)
+      if (strncmp(argv[i], "--test_filter=", 14) == 0)
+         filter = argv[i] + 14;
+   std::regex selected(filter);
+
+   std::vector<std::string> failed;
+   std::size_t run = 0;
+   std::vector<JNITestCase *> &tests = JNITestCase::registry();
+   for (std::size_t t = 0; t < tests.size(); t++) {
+      if (!std::regex_search(tests[t]->name(), selected))
+         continue;
+      run++;
+      if (JNITestRun(jvm, *tests[t]) != 0)
+         failed.push_back(tests[t]->name());
+   }
+
+   printf("%zu tests, %zu failed\n", run, failed.size());
+   for (std::size_t i = 0; i < failed.size(); i++)
+      printf("[  FAILED  ] %s\n", failed[i].c_str());
+   return failed.empty() ? 0 : 1;
+}
+
+#endif /* _JNI_TEST_H_INCLUDED_ */